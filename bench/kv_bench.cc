@@ -0,0 +1,338 @@
+/* Copyright 2020-present VidarDB Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Microbenchmark of the transport between the backends and a kv worker. The
+ * producer processes send requests of an entity size to one consumer process
+ * through the real message queue, either waiting for a response of the same
+ * size (roundtrip, like a get) or not (oneway, like a load). The entities
+ * above LARGEENTITYSIZE of a roundtrip go out of line. The cost of setting up
+ * the shared memory of a cursor is measured as well. Run it with -h for the
+ * options.
+ */
+
+#include <getopt.h>
+#include <sys/wait.h>
+#include <fcntl.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+using namespace std;
+
+#include "ipc/kv_mq.h"
+#include "ipc/kv_posix.h"
+#include "ipc/kv_stats.h"
+#include "server/kv_storage.h"
+#include "server/kv_worker.h"
+
+extern "C" {
+#include "postgres.h"
+}
+
+
+#define BENCHNAME    "Bench"
+#define BENCHSHMNAME "/KVBenchCursor"
+#define PAGESIZE     4096
+
+
+struct BenchOptions {
+    int            producers = 4;
+    uint64         messages = 100000;     /* per producer */
+    vector<uint64> sizes = {16, 256, 4096, 32768, 262144};
+    int            cursors = 10000;       /* shared memory setups */
+    bool           json = false;
+};
+
+struct BenchResult {
+    string mode;
+    string channel;
+    uint64 size;
+    int    producers;
+    uint64 messages;
+    double rate;                          /* per second */
+    double p50;                           /* microseconds */
+    double p99;
+};
+
+
+static void PrintResult(const BenchOptions& options, const BenchResult& r) {
+    if (options.json) {
+        printf("{\"bench\": \"ipc\", \"mode\": \"%s\", \"channel\": \"%s\", "
+               "\"size\": %lu, \"producers\": %d, \"messages\": %lu, "
+               "\"rate\": %.0f, \"p50_us\": %.2f, \"p99_us\": %.2f}\n",
+               r.mode.c_str(), r.channel.c_str(), r.size, r.producers,
+               r.messages, r.rate, r.p50, r.p99);
+    } else {
+        printf("%-10s %-10s %8lu %10d %10lu %12.0f %10.2f %10.2f\n",
+               r.mode.c_str(), r.channel.c_str(), r.size, r.producers,
+               r.messages, r.rate, r.p50, r.p99);
+    }
+    fflush(stdout);
+}
+
+static void Percentiles(uint64* latencies, uint64 count, BenchResult* result) {
+    sort(latencies, latencies + count);
+    result->p50 = latencies[count / 2] / 1000.0;
+    result->p99 = latencies[min(count - 1, count * 99 / 100)] / 1000.0;
+}
+
+/*
+ * A producer owns its slice of the latencies, which the parent reads after it
+ * exits, and announces the end by a terminate request.
+ */
+static void RunProducer(KVRelationId rid, uint64 size, bool roundtrip,
+                        uint64 messages, uint64* latencies) {
+    KVMessageQueue* queue = new KVMessageQueue(rid, BENCHNAME, false);
+    char* buf = static_cast<char*>(malloc(max<uint64>(size, 1)));
+    memset(buf, 'k', size);
+
+    for (uint64 i = 0; i < messages; i++) {
+        KVMessage sendmsg = SimpleMessage(KVOpGet, rid, InvalidOid);
+        sendmsg.ety = buf;
+        sendmsg.hdr.etySize = size;
+        sendmsg.writeFunc = CommonWriteEntity;
+
+        uint64 start = KVNow();
+        if (roundtrip) {
+            KVMessage recvmsg;
+            recvmsg.ety = buf;
+            recvmsg.readFunc = CommonReadEntity;
+            queue->SendWithResponse(sendmsg, recvmsg);
+        } else {
+            sendmsg.hdr.op = KVOpLoad;
+            queue->Send(sendmsg);
+        }
+        latencies[i] = KVNow() - start;
+    }
+
+    queue->Send(SimpleMessage(KVOpTerminate, rid, InvalidOid));
+    free(buf);
+    delete queue;
+}
+
+/* the consumer is served by the parent, as a kv worker with no threads */
+static void RunConsumer(KVMessageQueue* queue, uint64 size, int producers) {
+    char* buf = static_cast<char*>(malloc(max<uint64>(size, 1)));
+
+    while (producers > 0) {
+        KVMessage msg;
+        queue->Recv(msg, MSGHEADER);
+
+        switch (msg.hdr.op) {
+            case KVOpGet:
+            case KVOpLoad: {
+                /* a large entity is read in place as the worker does */
+                if (msg.hdr.largeSize > 0) {
+                    queue->LargeEntity(msg);
+                    queue->Recv(msg, MSGDISCARD);
+                } else {
+                    msg.ety = buf;
+                    msg.readFunc = CommonReadEntity;
+                    queue->Recv(msg, MSGENTITY);
+                }
+                if (msg.hdr.op == KVOpLoad) {
+                    break;
+                }
+
+                KVMessage sendmsg = SuccessMessage(msg.hdr.rpsId);
+                sendmsg.ety = buf;
+                sendmsg.hdr.etySize = size;
+                sendmsg.writeFunc = CommonWriteEntity;
+                queue->Send(sendmsg);
+                break;
+            }
+            case KVOpTerminate:
+                producers--;
+                queue->Recv(msg, MSGDISCARD);
+                break;
+            default:
+                queue->Recv(msg, MSGDISCARD);
+                break;
+        }
+    }
+
+    free(buf);
+}
+
+static BenchResult RunQueue(const BenchOptions& options, uint64 size,
+                            bool roundtrip) {
+    KVRelationId rid = getpid();
+    uint64 total = options.messages * options.producers;
+    uint64 latencySize = sizeof(uint64) * total;
+    uint64* latencies = static_cast<uint64*>(
+        Mmap(nullptr, latencySize, PROT_READ | PROT_WRITE,
+             MAP_SHARED | MAP_ANONYMOUS, -1, 0, __func__));
+
+    /* created before the producers are forked, so that they can connect */
+    KVMessageQueue* queue = new KVMessageQueue(rid, BENCHNAME, true);
+
+    uint64 start = KVNow();
+    vector<pid_t> pids;
+    for (int i = 0; i < options.producers; i++) {
+        pid_t pid = fork();
+        if (pid == 0) {
+            RunProducer(rid, size, roundtrip, options.messages,
+                        latencies + i * options.messages);
+            _exit(0);
+        }
+        pids.push_back(pid);
+    }
+
+    RunConsumer(queue, size, options.producers);
+    for (pid_t pid : pids) {
+        waitpid(pid, nullptr, 0);
+    }
+    uint64 elapsed = KVNow() - start;
+
+    BenchResult result;
+    result.mode = roundtrip ? "roundtrip" : "oneway";
+    result.channel = KVUseLockFreeChannel ? "lockfree" : "circular";
+    result.size = size;
+    result.producers = options.producers;
+    result.messages = total;
+    result.rate = total * 1e9 / elapsed;
+    Percentiles(latencies, total, &result);
+
+    delete queue;
+    Munmap(latencies, latencySize, __func__);
+    return result;
+}
+
+/*
+ * The shared memory of a cursor as ReadBatch sets it up: created and sized by
+ * the worker, attached by the backend, touched page by page, then released.
+ */
+static BenchResult RunCursorSetup(const BenchOptions& options) {
+    uint64 size = READBATCHSIZE * READBATCHSLOTS;
+    vector<uint64> latencies(options.cursors);
+
+    uint64 begin = KVNow();
+    for (int i = 0; i < options.cursors; i++) {
+        uint64 start = KVNow();
+
+        int fd = ShmOpen(BENCHSHMNAME, O_CREAT | O_RDWR, 0777, __func__);
+        Ftruncate(fd, size, __func__);
+        char* worker = static_cast<char*>(Mmap(nullptr, size,
+            PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0, __func__));
+        Fclose(fd, __func__);
+
+        fd = ShmOpen(BENCHSHMNAME, O_RDWR, 0777, __func__);
+        char* backend = static_cast<char*>(Mmap(nullptr, size,
+            PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0, __func__));
+        Fclose(fd, __func__);
+
+        for (uint64 offset = 0; offset < size; offset += PAGESIZE) {
+            worker[offset] = 1;
+        }
+        volatile char sum = 0;
+        for (uint64 offset = 0; offset < size; offset += PAGESIZE) {
+            sum += backend[offset];
+        }
+
+        Munmap(backend, size, __func__);
+        Munmap(worker, size, __func__);
+        ShmUnlink(BENCHSHMNAME, __func__);
+        latencies[i] = KVNow() - start;
+    }
+    uint64 elapsed = KVNow() - begin;
+
+    BenchResult result;
+    result.mode = "cursor";
+    result.channel = "shm";
+    result.size = size;
+    result.producers = 1;
+    result.messages = options.cursors;
+    result.rate = options.cursors * 1e9 / elapsed;
+    Percentiles(latencies.data(), latencies.size(), &result);
+    return result;
+}
+
+static void Usage(const char* program) {
+    fprintf(stderr,
+            "Usage: %s [options]\n"
+            "  -p N      producer processes (default 4)\n"
+            "  -n N      messages per producer (default 100000)\n"
+            "  -s LIST   comma separated entity sizes (default "
+            "16,256,4096,32768,262144)\n"
+            "  -r N      response channels (default 8)\n"
+            "  -l        lock-free request channel\n"
+            "  -c N      cursor shared memory setups, 0 to skip "
+            "(default 10000)\n"
+            "  -j        JSON lines instead of a table\n",
+            program);
+}
+
+int main(int argc, char** argv) {
+    BenchOptions options;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "p:n:s:r:lc:jh")) != -1) {
+        switch (opt) {
+            case 'p':
+                options.producers = max(1, atoi(optarg));
+                break;
+            case 'n':
+                options.messages = max(1L, atol(optarg));
+                break;
+            case 's': {
+                options.sizes.clear();
+                char* saved = nullptr;
+                for (char* token = strtok_r(optarg, ",", &saved); token;
+                     token = strtok_r(nullptr, ",", &saved)) {
+                    options.sizes.push_back(strtoull(token, nullptr, 10));
+                }
+                break;
+            }
+            case 'r':
+                KVResponseChannels = max(1, atoi(optarg));
+                break;
+            case 'l':
+                KVUseLockFreeChannel = true;
+                break;
+            case 'c':
+                options.cursors = atoi(optarg);
+                break;
+            case 'j':
+                options.json = true;
+                break;
+            default:
+                Usage(argv[0]);
+                return opt == 'h' ? 0 : 1;
+        }
+    }
+
+    if (!options.json) {
+        printf("%-10s %-10s %8s %10s %10s %12s %10s %10s\n", "mode", "channel",
+               "size", "producers", "messages", "msgs/sec", "p50(us)",
+               "p99(us)");
+    }
+
+    for (uint64 size : options.sizes) {
+        PrintResult(options, RunQueue(options, size, true));
+
+        /* a oneway message has no large channel, see KVMessageQueue::Send */
+        if (size > MSGMAXENTITY) {
+            fprintf(stderr, "skip oneway size %lu, too large for a channel\n",
+                    size);
+            continue;
+        }
+        PrintResult(options, RunQueue(options, size, false));
+    }
+
+    if (options.cursors > 0) {
+        PrintResult(options, RunCursorSetup(options));
+    }
+    return 0;
+}
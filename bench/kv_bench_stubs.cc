@@ -0,0 +1,65 @@
+/* Copyright 2020-present VidarDB Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Stand-ins of the backend symbols the ipc objects refer to, so that the
+ * microbenchmark links with the frontend libraries only. Errors are printed
+ * to stderr and end the process, warnings (e.g. unlinking a channel not
+ * created yet) are dropped.
+ */
+
+#include <cstdarg>
+
+#include "kv_api.h"
+
+
+/* GUC variables, set by the options of the microbenchmark */
+int  KVResponseChannels = 8;
+bool KVUseLockFreeChannel = false;
+
+static int reportLevel = 0;
+
+bool errstart(int elevel, const char* filename, int lineno,
+              const char* funcname, const char* domain) {
+    reportLevel = elevel;
+    return elevel >= ERROR;
+}
+
+void errfinish(int dummy, ...) {
+    fputc('\n', stderr);
+    if (reportLevel >= ERROR) {
+        exit(1);
+    }
+}
+
+int errmsg(const char* fmt, ...) {
+    va_list args;
+    va_start(args, fmt);
+    vfprintf(stderr, fmt, args);
+    va_end(args);
+    return 0;
+}
+
+int errhint(const char* fmt, ...) {
+    return 0;
+}
+
+int errcode(int sqlerrcode) {
+    return 0;
+}
+
+void* palloc0(Size size) {
+    return calloc(1, size);
+}
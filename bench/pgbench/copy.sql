@@ -0,0 +1 @@
+COPY kv_bench_copy FROM :copyfile;
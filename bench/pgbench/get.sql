@@ -0,0 +1,2 @@
+\set id random(1, :rows)
+SELECT val FROM kv_bench WHERE id = :id;
@@ -0,0 +1,2 @@
+\set id random(1, 1000000000000)
+INSERT INTO kv_bench_insert VALUES (:id, md5(:id::text));
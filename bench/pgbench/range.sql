@@ -0,0 +1,2 @@
+\set start random(1, :rows - 100)
+SELECT sum(length(val)) FROM kv_bench WHERE id BETWEEN :start AND :start + 99;
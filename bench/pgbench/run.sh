@@ -0,0 +1,66 @@
+#!/usr/bin/env bash
+#
+# Runs the pgbench scripts of this directory against kv tables and prints a
+# JSON line per script, comparable across runs:
+#
+#   {"bench": "pgbench", "test": "get", "clients": 8, "transactions": ...,
+#    "tps": ..., "latency_ms": ..., "p50_ms": ..., "p99_ms": ...}
+#
+# The database must exist and kv_fdw must be in shared_preload_libraries.
+# Settings are taken from the environment, libpq variables (PGHOST, PGPORT,
+# PGUSER) are passed through.
+
+set -euo pipefail
+
+DIR="$(cd "$(dirname "$0")" && pwd)"
+PGBENCH="${PGBENCH:-pgbench}"
+PSQL="${PSQL:-psql}"
+DB="${BENCH_DB:-kvbench}"
+CLIENTS="${BENCH_CLIENTS:-8}"
+THREADS="${BENCH_THREADS:-$CLIENTS}"
+DURATION="${BENCH_DURATION:-30}"
+ROWS="${BENCH_ROWS:-1000000}"
+COPYROWS="${BENCH_COPY_ROWS:-100000}"
+COPYFILE="${BENCH_COPY_FILE:-/tmp/kv_bench_copy.csv}"  # written by the server
+TESTS="${BENCH_TESTS:-get insert range scan copy}"
+
+LOGDIR="$(mktemp -d)"
+trap 'rm -rf "$LOGDIR"' EXIT
+
+"$PSQL" -q -X -v ON_ERROR_STOP=1 -v rows="$ROWS" -v copyrows="$COPYROWS" \
+        -v copyfile="$COPYFILE" -d "$DB" -f "$DIR/setup.sql" >/dev/null
+
+for test in $TESTS; do
+    # a copy loads the whole file, so it runs a few times from one client
+    if [ "$test" = "copy" ]; then
+        args=(-c 1 -j 1 -t "${BENCH_COPY_RUNS:-5}")
+    else
+        args=(-c "$CLIENTS" -j "$THREADS" -T "$DURATION")
+    fi
+
+    rm -f "$LOGDIR"/*
+    output="$(cd "$LOGDIR" && "$PGBENCH" -n -M simple "${args[@]}" \
+              --log --log-prefix="$test" -D rows="$ROWS" \
+              -D copyfile="'$COPYFILE'" -f "$DIR/$test.sql" "$DB")"
+
+    # the last tps line excludes the connections established
+    tps="$(echo "$output" | awk '/^tps = / { tps = $3 } END { print tps }')"
+    latency="$(echo "$output" | awk '/^latency average = / { print $4 }')"
+    transactions="$(echo "$output" |
+                    awk '/^number of transactions actually processed:/ {
+                             split($NF, n, "/"); print n[1] }')"
+
+    # the third field of the transaction logs is the latency in microseconds
+    read -r p50 p99 < <(cat "$LOGDIR"/"$test".* | awk '{ print $3 }' |
+                        sort -n | awk '{ l[NR] = $1 } END {
+                            if (NR == 0) { print "0 0"; exit }
+                            i50 = int(NR * 0.50); if (i50 < 1) i50 = 1
+                            i99 = int(NR * 0.99); if (i99 < 1) i99 = 1
+                            printf "%.3f %.3f\n", l[i50] / 1000, l[i99] / 1000 }')
+
+    printf '{"bench": "pgbench", "test": "%s", "clients": %s, ' \
+           "$test" "$( [ "$test" = "copy" ] && echo 1 || echo "$CLIENTS" )"
+    printf '"transactions": %s, "tps": %s, "latency_ms": %s, ' \
+           "${transactions:-0}" "${tps:-0}" "${latency:-0}"
+    printf '"p50_ms": %s, "p99_ms": %s}\n' "$p50" "$p99"
+done
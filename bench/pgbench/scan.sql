@@ -0,0 +1 @@
+SELECT sum(length(val)) FROM kv_bench;
@@ -0,0 +1,17 @@
+--
+-- Tables of the pgbench scripts, the variables are set by run.sh
+--
+
+CREATE EXTENSION IF NOT EXISTS kv_fdw;
+CREATE SERVER IF NOT EXISTS kv_bench_server FOREIGN DATA WRAPPER kv_fdw;
+
+DROP FOREIGN TABLE IF EXISTS kv_bench, kv_bench_insert, kv_bench_copy;
+CREATE FOREIGN TABLE kv_bench(id INTEGER, val TEXT) SERVER kv_bench_server;
+CREATE FOREIGN TABLE kv_bench_insert(id BIGINT, val TEXT) SERVER kv_bench_server;
+CREATE FOREIGN TABLE kv_bench_copy(id INTEGER, val TEXT) SERVER kv_bench_server;
+
+INSERT INTO kv_bench SELECT i, md5(i::text) FROM generate_series(1, :rows) i;
+ANALYZE kv_bench;
+
+COPY (SELECT i, md5(i::text) FROM generate_series(1, :copyrows) i)
+TO :'copyfile';
@@ -0,0 +1,32 @@
+CREATE FUNCTION kv_fdw_stats(
+    OUT worker oid,
+    OUT database oid,
+    OUT operation text,
+    OUT calls bigint,
+    OUT queue_wait double precision,
+    OUT service_time double precision,
+    OUT lease_wait double precision,
+    OUT input_wait double precision,
+    OUT bytes_in bigint,
+    OUT bytes_out bigint,
+    OUT latency bigint[])
+RETURNS SETOF record
+AS 'MODULE_PATHNAME'
+LANGUAGE C STRICT VOLATILE;
+
+CREATE VIEW kv_fdw_stats AS SELECT * FROM kv_fdw_stats();
+
+CREATE FUNCTION kv_fdw_engine_stats(
+    OUT worker oid,
+    OUT database oid,
+    OUT cache_hits bigint,
+    OUT cache_misses bigint,
+    OUT cache_hit_ratio double precision,
+    OUT stall_time double precision,
+    OUT compaction_read_bytes bigint,
+    OUT compaction_write_bytes bigint)
+RETURNS SETOF record
+AS 'MODULE_PATHNAME'
+LANGUAGE C STRICT VOLATILE;
+
+CREATE VIEW kv_fdw_engine_stats AS SELECT * FROM kv_fdw_engine_stats();
@@ -0,0 +1,47 @@
+--
+-- Test the aggregates computed by the kv worker
+--
+
+\c kvtest
+
+CREATE FOREIGN TABLE item(id INTEGER, qty SMALLINT, total INTEGER,
+                          price FLOAT8, name TEXT) SERVER kv_server;
+
+-- empty table --
+SELECT count(*), min(id), max(id), sum(total), avg(price) FROM item;
+
+INSERT INTO item SELECT i, i % 7, i * 3, i / 8.0, 'n' || i
+FROM generate_series(-100, 1000) i;
+INSERT INTO item VALUES (2000, NULL, NULL, NULL, NULL);
+
+EXPLAIN (VERBOSE, COSTS OFF) SELECT count(*) FROM item;
+SELECT count(*) FROM item;
+SELECT count(id), count(qty), count(name) FROM item;
+SELECT min(id), max(id) FROM item;
+SELECT sum(qty), sum(total), sum(price) FROM item;
+SELECT avg(qty), avg(total), avg(price) FROM item;
+
+-- compare with the aggregates computed by PostgreSQL --
+SELECT count(*), min(id), max(id), sum(total), avg(total), avg(price)
+FROM (SELECT * FROM item OFFSET 0) t;
+
+-- not pushed down --
+EXPLAIN (COSTS OFF) SELECT count(*) FROM item WHERE id > 10;
+SELECT count(*) FROM item WHERE id > 10;
+EXPLAIN (COSTS OFF) SELECT qty, count(*) FROM item GROUP BY qty;
+EXPLAIN (COSTS OFF) SELECT count(DISTINCT qty) FROM item;
+EXPLAIN (COSTS OFF) SELECT min(name), max(total) FROM item;
+SELECT min(name), max(total) FROM item;
+
+-- estimated count --
+ALTER FOREIGN TABLE item OPTIONS (ADD estimatecount 'true');
+SELECT count(*) > 0 FROM item;
+SELECT count(*), sum(qty) FROM item;
+
+DROP FOREIGN TABLE item;
+
+-- text keys of C collation --
+CREATE FOREIGN TABLE item(id TEXT COLLATE "C", val TEXT) SERVER kv_server;
+INSERT INTO item VALUES ('b', '1'), ('ab', '2'), ('c', '3'), ('a', '4');
+SELECT min(id), max(id), count(*) FROM item;
+DROP FOREIGN TABLE item;
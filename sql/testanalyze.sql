@@ -0,0 +1,26 @@
+--
+-- Test analyze, the sample gives the planner the statistics of the columns
+--
+
+\c kvtest
+
+CREATE FOREIGN TABLE item(id INTEGER, kind INTEGER, val TEXT) SERVER kv_server;
+INSERT INTO item SELECT i, i % 10, 'v' || i FROM generate_series(1, 50000) i;
+
+ANALYZE item;
+SELECT relpages > 0, reltuples FROM pg_class WHERE relname = 'item';
+SELECT attname, n_distinct, correlation FROM pg_stats
+WHERE tablename = 'item' ORDER BY attname;
+
+EXPLAIN SELECT * FROM item WHERE kind = 3;
+EXPLAIN SELECT * FROM item WHERE id < 100;
+
+-- a table smaller than the sample is read completely --
+CREATE FOREIGN TABLE small(id INTEGER, val TEXT) SERVER kv_server;
+INSERT INTO small VALUES (1, 'a'), (2, 'b'), (3, NULL);
+ANALYZE VERBOSE small;
+SELECT reltuples FROM pg_class WHERE relname = 'small';
+SELECT attname, null_frac FROM pg_stats WHERE tablename = 'small' ORDER BY attname;
+
+DROP FOREIGN TABLE small;
+DROP FOREIGN TABLE item;
@@ -0,0 +1,22 @@
+--
+-- Test batched insert, rows are sent to kv worker in multiple batches
+--
+
+\c kvtest
+
+CREATE FOREIGN TABLE item(id INTEGER, val TEXT) SERVER kv_server;
+
+-- rows span many batches --
+INSERT INTO item SELECT i, repeat('v', i % 100) FROM generate_series(1, 100000) i;
+SELECT count(*) FROM item;
+SELECT * FROM item WHERE id=99999;
+
+-- the later row of the same key wins within one batch --
+INSERT INTO item VALUES (1, 'first'), (1, 'second');
+SELECT * FROM item WHERE id=1;
+
+-- a row larger than a batch is sent alone --
+INSERT INTO item VALUES (0, repeat('x', 40000));
+SELECT id, length(val) FROM item WHERE id=0;
+
+DROP FOREIGN TABLE item;
@@ -0,0 +1,30 @@
+--
+-- Test the bulk load of copy command, rows are ingested as sorted string tables
+--
+
+\c kvtest
+
+-- unsorted input, the later row of the same key wins --
+CREATE FOREIGN TABLE bulk(id INTEGER, val TEXT) SERVER kv_server OPTIONS (bulkload 'true');
+COPY (SELECT i % 50000, 'v' || i FROM generate_series(100000, 1, -1) i) TO '/tmp/bulk.csv' WITH (FORMAT CSV);
+COPY bulk FROM '/tmp/bulk.csv' WITH CSV;
+SELECT count(*) FROM bulk;
+SELECT * FROM bulk WHERE id=1;
+SELECT * FROM bulk LIMIT 3;
+
+-- ingested files overlay the existing rows --
+INSERT INTO bulk VALUES (-1, 'insert');
+COPY bulk FROM '/tmp/bulk.csv' WITH CSV;
+SELECT count(*) FROM bulk;
+DROP FOREIGN TABLE bulk;
+
+-- sorted input --
+CREATE FOREIGN TABLE sortedbulk(id INTEGER, val TEXT) SERVER kv_server OPTIONS (bulkload 'true', sorted 'true');
+COPY (SELECT i, 'v' || i FROM generate_series(1, 100000) i) TO '/tmp/sortedbulk.csv' WITH (FORMAT CSV);
+COPY sortedbulk FROM '/tmp/sortedbulk.csv' WITH CSV;
+SELECT count(*) FROM sortedbulk;
+SELECT * FROM sortedbulk WHERE id=99999;
+
+-- unsorted input is rejected --
+COPY sortedbulk FROM '/tmp/bulk.csv' WITH CSV;
+DROP FOREIGN TABLE sortedbulk;
@@ -233,3 +233,43 @@ INSERT INTO item VALUES((90,100), 'test5');
 SELECT * FROM item;
 DROP FOREIGN TABLE item;
 DROP TYPE comtype;
+
+-- negative bigint --
+CREATE FOREIGN TABLE item(id BIGINT, name TEXT) SERVER kv_server;
+INSERT INTO item VALUES(9876543210, 'test1');
+INSERT INTO item VALUES(-5876543210, 'test2');
+INSERT INTO item VALUES(0, 'test3');
+INSERT INTO item VALUES(-1, 'test4');
+INSERT INTO item VALUES(1, 'test5');
+SELECT * FROM item;
+DROP FOREIGN TABLE item;
+
+-- double precision with special values --
+CREATE FOREIGN TABLE item(id DOUBLE PRECISION, name TEXT) SERVER kv_server;
+INSERT INTO item VALUES('NaN', 'test1');
+INSERT INTO item VALUES('-Infinity', 'test2');
+INSERT INTO item VALUES(-0.5, 'test3');
+INSERT INTO item VALUES('Infinity', 'test4');
+INSERT INTO item VALUES(0.5, 'test5');
+SELECT * FROM item;
+DROP FOREIGN TABLE item;
+
+-- date --
+CREATE FOREIGN TABLE item(id DATE, name TEXT) SERVER kv_server;
+INSERT INTO item VALUES('2020-01-01', 'test1');
+INSERT INTO item VALUES('1999-12-31', 'test2');
+INSERT INTO item VALUES('2020-01-02', 'test3');
+INSERT INTO item VALUES('1970-01-01', 'test4');
+INSERT INTO item VALUES('1960-06-15', 'test5');
+SELECT * FROM item;
+DROP FOREIGN TABLE item;
+
+-- text of C collation --
+CREATE FOREIGN TABLE item(id TEXT COLLATE "C", name TEXT) SERVER kv_server;
+INSERT INTO item VALUES('b', 'test1');
+INSERT INTO item VALUES('B', 'test2');
+INSERT INTO item VALUES('ab', 'test3');
+INSERT INTO item VALUES('a', 'test4');
+INSERT INTO item VALUES(repeat('a', 200), 'test5');
+SELECT * FROM item;
+DROP FOREIGN TABLE item;
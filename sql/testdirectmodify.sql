@@ -0,0 +1,36 @@
+--
+-- Test deletes served by the kv worker alone
+--
+
+\c kvtest
+
+CREATE FOREIGN TABLE item(id INTEGER, val TEXT) SERVER kv_server;
+INSERT INTO item SELECT i, 'v' || i FROM generate_series(1, 1000) i;
+
+-- a key range is pushed down --
+EXPLAIN (COSTS OFF) DELETE FROM item WHERE id BETWEEN 100 AND 199;
+DELETE FROM item WHERE id BETWEEN 100 AND 199;
+SELECT count(*) FROM item WHERE id BETWEEN 90 AND 210;
+
+-- so is a single key, the count is the keys found --
+DELETE FROM item WHERE id = 500;
+DELETE FROM item WHERE id = 500;
+DELETE FROM item WHERE id >= 990 AND id < 995;
+SELECT id FROM item WHERE id >= 985 ORDER BY id;
+
+-- a null matches no key --
+DELETE FROM item WHERE id <= NULL;
+SELECT count(*) FROM item;
+
+-- a strict lower bound, other columns and returning fall back --
+EXPLAIN (COSTS OFF) DELETE FROM item WHERE id > 900;
+DELETE FROM item WHERE id > 900 AND id < 905;
+DELETE FROM item WHERE val = 'v1';
+DELETE FROM item WHERE id = 2 RETURNING *;
+SELECT count(*) FROM item;
+
+-- the whole table --
+DELETE FROM item;
+SELECT count(*) FROM item;
+
+DROP FOREIGN TABLE item;
@@ -0,0 +1,30 @@
+--
+-- Test the options tuning the storage engine
+--
+
+\c kvtest
+
+CREATE FOREIGN TABLE tuned(id INTEGER, name TEXT) SERVER kv_server
+OPTIONS (bloombits '10', blocksize '16kB', writebuffersize '8MB',
+         compression 'none,none,lz4,lz4,zstd', backgroundjobs '4');
+
+INSERT INTO tuned SELECT i, 'n' || i FROM generate_series(1, 1000) i;
+SELECT * FROM tuned WHERE id = 500;
+SELECT count(*) FROM tuned;
+
+-- the options are validated by ALTER as well --
+ALTER FOREIGN TABLE tuned OPTIONS (SET bloombits '100');
+ALTER FOREIGN TABLE tuned OPTIONS (SET bloombits '16');
+SELECT * FROM tuned WHERE id = 42;
+
+-- invalid values --
+CREATE FOREIGN TABLE bad(id INTEGER) SERVER kv_server
+OPTIONS (bloombits 'ten');
+CREATE FOREIGN TABLE bad(id INTEGER) SERVER kv_server
+OPTIONS (blocksize '1');
+CREATE FOREIGN TABLE bad(id INTEGER) SERVER kv_server
+OPTIONS (compression 'brotli');
+CREATE FOREIGN TABLE bad(id INTEGER) SERVER kv_server
+OPTIONS (compression 'none,none,none,none,none,none,none,none');
+
+DROP FOREIGN TABLE tuned;
@@ -0,0 +1,28 @@
+--
+-- Test joins on the key, a nested loop looks up the key of each outer row
+--
+
+\c kvtest
+
+CREATE FOREIGN TABLE customer(id INTEGER, name TEXT) SERVER kv_server;
+INSERT INTO customer SELECT i, 'c' || i FROM generate_series(1, 10000) i;
+
+CREATE TABLE orders(id INTEGER, cust_id INTEGER);
+INSERT INTO orders VALUES (1, 10), (2, 20), (3, 20), (4, 20000), (5, NULL);
+ANALYZE orders;
+
+EXPLAIN (COSTS OFF)
+SELECT o.id, c.name FROM orders o JOIN customer c ON c.id = o.cust_id;
+SELECT o.id, c.name FROM orders o JOIN customer c ON c.id = o.cust_id
+ORDER BY o.id;
+SELECT o.id, c.name FROM orders o LEFT JOIN customer c ON c.id = o.cust_id
+ORDER BY o.id;
+
+-- rescan of a scan without key lookup --
+SELECT count(*) FROM orders o, LATERAL
+(SELECT * FROM customer c WHERE c.id < 3 OFFSET 0) c;
+SELECT count(*) FROM orders o, LATERAL
+(SELECT * FROM customer c WHERE c.id IN (1, 2, 3) OFFSET 0) c;
+
+DROP TABLE orders;
+DROP FOREIGN TABLE customer;
@@ -0,0 +1,28 @@
+--
+-- Test records larger than a batch of a cursor, each is sent alone in the
+-- response of its batch
+--
+
+\c kvtest
+
+CREATE FOREIGN TABLE item(id INTEGER, val TEXT) SERVER kv_server;
+INSERT INTO item SELECT i, 'v' || i FROM generate_series(1, 10) i;
+INSERT INTO item VALUES(5, repeat('x', 200 * 1024));
+INSERT INTO item VALUES(11, repeat('y', 300 * 1024));
+
+-- full scan goes past the large records --
+SELECT id, length(val) FROM item;
+SELECT count(*), sum(length(val)) FROM item WHERE val IS NOT NULL;
+
+-- range scans, forward and reverse --
+SELECT id, length(val) FROM item WHERE id BETWEEN 4 AND 7;
+SELECT id, length(val) FROM item WHERE id >= 4 ORDER BY id DESC;
+
+-- key IN-list --
+SELECT id, length(val) FROM item WHERE id IN (4, 5, 6, 11);
+
+-- sample of ANALYZE --
+ANALYZE item;
+SELECT reltuples FROM pg_class WHERE relname = 'item';
+
+DROP FOREIGN TABLE item;
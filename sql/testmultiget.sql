@@ -0,0 +1,33 @@
+--
+-- Test key IN-list pushdown, all the keys are looked up by one multi get
+--
+
+\c kvtest
+
+CREATE FOREIGN TABLE item(id INTEGER, val TEXT) SERVER kv_server;
+INSERT INTO item SELECT i, 'v' || i FROM generate_series(1, 1000) i;
+
+SELECT * FROM item WHERE id IN (3, 1, 2);
+SELECT * FROM item WHERE id IN (5, 5, 5000, NULL);
+SELECT * FROM item WHERE id = ANY (ARRAY[998, 999, 1000, 1001]);
+SELECT * FROM item WHERE id = ANY (ARRAY[NULL]::INTEGER[]);
+SELECT * FROM item WHERE id IN (1, 2, 3) AND val <> 'v2';
+
+-- external parameters --
+PREPARE multiget(INTEGER[]) AS SELECT * FROM item WHERE id = ANY ($1);
+EXECUTE multiget(ARRAY[7, 8, 9]);
+DEALLOCATE multiget;
+
+-- more keys than a batch holds --
+PREPARE multicount(INTEGER[]) AS
+SELECT count(*), sum(id) FROM item WHERE id = ANY ($1);
+EXECUTE multicount((SELECT array_agg(i) FROM generate_series(-10000, 10000) i));
+DEALLOCATE multicount;
+
+DROP FOREIGN TABLE item;
+
+-- text keys of C collation --
+CREATE FOREIGN TABLE item(id TEXT COLLATE "C", val TEXT) SERVER kv_server;
+INSERT INTO item VALUES ('a', '1'), ('ab', '2'), ('b', '3');
+SELECT * FROM item WHERE id IN ('b', 'a', 'c');
+DROP FOREIGN TABLE item;
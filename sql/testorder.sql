@@ -0,0 +1,38 @@
+--
+-- Test the key order, ORDER BY and merge joins on the key need no sort
+--
+
+\c kvtest
+
+CREATE FOREIGN TABLE item(id INTEGER, val TEXT) SERVER kv_server;
+INSERT INTO item SELECT i, 'v' || i FROM generate_series(-500, 500) i;
+
+EXPLAIN (COSTS OFF) SELECT * FROM item ORDER BY id;
+EXPLAIN (COSTS OFF) SELECT * FROM item ORDER BY id DESC LIMIT 3;
+
+SELECT * FROM item ORDER BY id LIMIT 3;
+SELECT * FROM item ORDER BY id DESC LIMIT 3;
+SELECT * FROM item WHERE id > 495 ORDER BY id DESC;
+SELECT * FROM item WHERE id >= -3 AND id < 0 ORDER BY id DESC;
+SELECT * FROM item WHERE id BETWEEN -500 AND -498 ORDER BY id DESC;
+SELECT * FROM item WHERE id IN (7, 3, 5) ORDER BY id DESC;
+SELECT * FROM item WHERE id < -1000 ORDER BY id DESC;
+
+-- merge join on the key --
+SET enable_hashjoin TO off;
+SET enable_nestloop TO off;
+CREATE FOREIGN TABLE other(id INTEGER, val TEXT) SERVER kv_server;
+INSERT INTO other SELECT i, 'o' || i FROM generate_series(498, 600) i;
+EXPLAIN (COSTS OFF) SELECT * FROM item i JOIN other o ON i.id = o.id;
+SELECT * FROM item i JOIN other o ON i.id = o.id;
+RESET enable_hashjoin;
+RESET enable_nestloop;
+
+DROP FOREIGN TABLE other;
+DROP FOREIGN TABLE item;
+
+-- text keys of C collation --
+CREATE FOREIGN TABLE item(id TEXT COLLATE "C", val TEXT) SERVER kv_server;
+INSERT INTO item VALUES ('a', '1'), ('ab', '2'), ('b', '3'), ('ba', '4');
+SELECT * FROM item ORDER BY id DESC;
+DROP FOREIGN TABLE item;
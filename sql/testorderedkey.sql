@@ -0,0 +1,62 @@
+--
+-- Test the order-preserving key encoding, keys are compared bytewise
+--
+
+\c kvtest
+
+-- signed integer --
+CREATE FOREIGN TABLE item(id INTEGER, name TEXT) SERVER kv_server OPTIONS (keyencoding 'ordered');
+INSERT INTO item VALUES(987654321, 'test1');
+INSERT INTO item VALUES(-587654321, 'test2');
+INSERT INTO item VALUES(0, 'test3');
+INSERT INTO item VALUES(-1, 'test4');
+INSERT INTO item VALUES(1, 'test5');
+SELECT * FROM item;
+SELECT * FROM item WHERE id=-1;
+UPDATE item SET name='updated' WHERE id=0;
+DELETE FROM item WHERE id=1;
+SELECT * FROM item;
+DROP FOREIGN TABLE item;
+
+-- double precision with special values --
+CREATE FOREIGN TABLE item(id DOUBLE PRECISION, name TEXT) SERVER kv_server OPTIONS (keyencoding 'ordered');
+INSERT INTO item VALUES('NaN', 'test1');
+INSERT INTO item VALUES('-Infinity', 'test2');
+INSERT INTO item VALUES(-0.5, 'test3');
+INSERT INTO item VALUES('Infinity', 'test4');
+INSERT INTO item VALUES(0.5, 'test5');
+SELECT * FROM item;
+DROP FOREIGN TABLE item;
+
+-- bytea with zero bytes and prefixes --
+CREATE FOREIGN TABLE item(id BYTEA, name TEXT) SERVER kv_server OPTIONS (keyencoding 'ordered');
+INSERT INTO item VALUES('\x6100', 'test1');
+INSERT INTO item VALUES('\x61', 'test2');
+INSERT INTO item VALUES('\x6162', 'test3');
+INSERT INTO item VALUES('\x00', 'test4');
+INSERT INTO item VALUES('\x', 'test5');
+SELECT * FROM item;
+SELECT * FROM item WHERE id='\x6100';
+DROP FOREIGN TABLE item;
+
+-- text of C collation --
+CREATE FOREIGN TABLE item(id TEXT COLLATE "C", name TEXT) SERVER kv_server OPTIONS (keyencoding 'ordered');
+\copy item FROM STDIN WITH CSV
+b,test1
+B,test2
+ab,test3
+a,test4
+\.
+SELECT * FROM item;
+DROP FOREIGN TABLE item;
+
+-- unsupported key type --
+CREATE FOREIGN TABLE item(id NUMERIC, name TEXT) SERVER kv_server OPTIONS (keyencoding 'ordered');
+
+
+-- the encoding is fixed per table --
+CREATE FOREIGN TABLE item(id INTEGER, name TEXT) SERVER kv_server OPTIONS (keyencoding 'ordered');
+ALTER FOREIGN TABLE item OPTIONS (SET keyencoding 'native');
+ALTER FOREIGN TABLE item OPTIONS (DROP keyencoding);
+ALTER SERVER kv_server OPTIONS (ADD keyencoding 'ordered');
+DROP FOREIGN TABLE item;
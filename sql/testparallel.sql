@@ -0,0 +1,31 @@
+--
+-- Test parallel scan, the participants read the chunks of the key range
+--
+
+\c kvtest
+
+CREATE FOREIGN TABLE item(id INTEGER, val INTEGER) SERVER kv_server;
+INSERT INTO item SELECT i, i % 100 FROM generate_series(1, 200000) i;
+ANALYZE item;
+
+SET parallel_setup_cost TO 0;
+SET parallel_tuple_cost TO 0;
+SET min_parallel_table_scan_size TO 0;
+SET max_parallel_workers_per_gather TO 4;
+
+EXPLAIN (COSTS OFF) SELECT count(*), sum(val) FROM item;
+SELECT count(*), sum(val) FROM item;
+SELECT count(*), sum(val) FROM item WHERE id > 1000 AND id <= 150000;
+SELECT count(*) FROM item WHERE val = 7;
+
+-- no worker launched, the leader reads all the chunks --
+SET max_parallel_workers TO 0;
+SELECT count(*) FROM item WHERE id < 100;
+RESET max_parallel_workers;
+
+RESET parallel_setup_cost;
+RESET parallel_tuple_cost;
+RESET min_parallel_table_scan_size;
+RESET max_parallel_workers_per_gather;
+
+DROP FOREIGN TABLE item;
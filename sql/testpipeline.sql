@@ -0,0 +1,51 @@
+--
+-- Test pipelined writes and the durability options of a table
+--
+
+\c kvtest
+
+SET kv_fdw.pipelined_writes = on;
+
+CREATE FOREIGN TABLE item(id INTEGER, val TEXT) SERVER kv_server;
+
+-- batches are not waited for until the end of the statement --
+INSERT INTO item SELECT i, repeat('v', i % 100) FROM generate_series(1, 100000) i;
+SELECT count(*) FROM item;
+
+-- updated rows are batched as well --
+UPDATE item SET val = 'updated' WHERE id <= 50000;
+SELECT count(*) FROM item WHERE val = 'updated';
+
+-- deleted keys too, the rows are still returned --
+DELETE FROM item WHERE id > 99990 RETURNING id;
+DELETE FROM item WHERE id > 50000;
+SELECT count(*) FROM item;
+
+-- a row larger than the request channel is waited for --
+INSERT INTO item VALUES (0, repeat('x', 100000));
+SELECT id, length(val) FROM item WHERE id=0;
+
+DROP FOREIGN TABLE item;
+
+RESET kv_fdw.pipelined_writes;
+
+-- a rebuildable table skips the log, a durable one syncs it --
+CREATE FOREIGN TABLE scratch(id INTEGER, val TEXT) SERVER kv_server
+    OPTIONS (disablewal 'true');
+INSERT INTO scratch SELECT i, 'v' FROM generate_series(1, 1000) i;
+SELECT count(*) FROM scratch;
+DROP FOREIGN TABLE scratch;
+
+CREATE FOREIGN TABLE durable(id INTEGER, val TEXT) SERVER kv_server
+    OPTIONS (sync 'true');
+INSERT INTO durable VALUES (1, 'one');
+SELECT * FROM durable;
+DROP FOREIGN TABLE durable;
+
+-- the options are Boolean and exclusive --
+CREATE FOREIGN TABLE invalid(id INTEGER) SERVER kv_server
+    OPTIONS (sync 'maybe');
+CREATE FOREIGN TABLE invalid(id INTEGER) SERVER kv_server
+    OPTIONS (sync 'true', disablewal 'true');
+SELECT * FROM invalid;
+DROP FOREIGN TABLE invalid;
@@ -0,0 +1,44 @@
+--
+-- Test the point lookups cached by a backend
+--
+
+\c kvtest
+
+SET kv_fdw.point_cache_size = '1MB';
+
+CREATE FOREIGN TABLE config(id INTEGER, val TEXT) SERVER kv_server;
+INSERT INTO config SELECT i, 'v' || i FROM generate_series(1, 100) i;
+
+-- the second lookup is served by the cache --
+SELECT * FROM config WHERE id = 1;
+SELECT * FROM config WHERE id = 1;
+SELECT * FROM config WHERE id = 1000;
+SELECT * FROM config WHERE id = 1000;
+
+-- the writes expire the cached values --
+UPDATE config SET val = 'updated' WHERE id = 1;
+SELECT * FROM config WHERE id = 1;
+INSERT INTO config VALUES (1000, 'inserted');
+SELECT * FROM config WHERE id = 1000;
+DELETE FROM config WHERE id = 1;
+SELECT * FROM config WHERE id = 1;
+DELETE FROM config WHERE id BETWEEN 900 AND 1100;
+SELECT * FROM config WHERE id = 1000;
+
+-- so do the pipelined ones --
+SET kv_fdw.pipelined_writes = on;
+SELECT * FROM config WHERE id = 2;
+UPDATE config SET val = 'pipelined' WHERE id = 2;
+SELECT * FROM config WHERE id = 2;
+RESET kv_fdw.pipelined_writes;
+
+-- a value larger than the cache is not cached --
+SET kv_fdw.point_cache_size = '64kB';
+INSERT INTO config VALUES (3000, repeat('x', 100000));
+SELECT id, length(val) FROM config WHERE id = 3000;
+SELECT id, length(val) FROM config WHERE id = 3000;
+
+RESET kv_fdw.point_cache_size;
+SELECT * FROM config WHERE id = 2;
+
+DROP FOREIGN TABLE config;
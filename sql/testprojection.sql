@@ -0,0 +1,41 @@
+--
+-- Test the row-store scan decodes only the referenced attributes
+--
+
+\c kvtest
+
+CREATE FOREIGN TABLE wide(id INTEGER, a TEXT, b INTEGER, c TEXT, d FLOAT8,
+                          e TEXT) SERVER kv_server;
+INSERT INTO wide SELECT i, repeat('a', i), i * 2, NULL, i / 4.0, 'e' || i
+FROM generate_series(1, 200) i;
+
+SELECT id FROM wide WHERE id <= 3;
+SELECT id, b FROM wide WHERE id <= 3;
+SELECT count(*) FROM wide;
+SELECT sum(b), max(d) FROM wide;
+SELECT id, e FROM wide WHERE length(a) = 150;
+SELECT id, c IS NULL FROM wide WHERE b = 10;
+SELECT w FROM wide w WHERE id = 2;
+SELECT * FROM wide WHERE id = 3;
+
+-- update keeps the attributes not referenced --
+UPDATE wide SET b = 0 WHERE id = 4;
+SELECT * FROM wide WHERE id = 4;
+UPDATE wide SET e = 'updated' WHERE d > 49;
+SELECT * FROM wide WHERE id >= 199;
+
+-- parameterized and parallel scans --
+CREATE FOREIGN TABLE narrow(id INTEGER, wid INTEGER) SERVER kv_server;
+INSERT INTO narrow VALUES (1, 5), (2, 6);
+SELECT n.id, w.e FROM narrow n JOIN wide w ON w.id = n.wid;
+DROP FOREIGN TABLE narrow;
+
+SET parallel_setup_cost TO 0;
+SET parallel_tuple_cost TO 0;
+SET min_parallel_table_scan_size TO 0;
+SELECT sum(b), count(e) FROM wide;
+RESET parallel_setup_cost;
+RESET parallel_tuple_cost;
+RESET min_parallel_table_scan_size;
+
+DROP FOREIGN TABLE wide;
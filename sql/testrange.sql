@@ -0,0 +1,35 @@
+--
+-- Test key range pushdown, the scan seeks to the lower bound and stops at the
+-- upper bound of the key
+--
+
+\c kvtest
+
+CREATE FOREIGN TABLE item(id INTEGER, val TEXT) SERVER kv_server;
+INSERT INTO item SELECT i, 'v' || i FROM generate_series(-1000, 1000) i;
+
+SELECT * FROM item WHERE id > 995;
+SELECT * FROM item WHERE id >= 995 AND id < 998;
+SELECT * FROM item WHERE id BETWEEN -3 AND 2;
+SELECT * FROM item WHERE 997 < id;
+SELECT count(*) FROM item WHERE id <= -990;
+SELECT count(*) FROM item WHERE id < 10 AND id < 5 AND id <= 5;
+SELECT count(*) FROM item WHERE id > 10 AND id < 5;
+
+-- cross-type operators of the key's btree family --
+SELECT * FROM item WHERE id > 998::BIGINT;
+SELECT * FROM item WHERE id < -998::SMALLINT;
+
+-- external parameters --
+PREPARE range(INTEGER, INTEGER) AS SELECT * FROM item WHERE id >= $1 AND id <= $2;
+EXECUTE range(10, 12);
+DEALLOCATE range;
+
+DROP FOREIGN TABLE item;
+
+-- text keys of C collation --
+CREATE FOREIGN TABLE item(id TEXT COLLATE "C", val TEXT) SERVER kv_server;
+INSERT INTO item VALUES ('a', '1'), ('ab', '2'), ('b', '3'), ('ba', '4'), ('c', '5');
+SELECT * FROM item WHERE id >= 'ab' AND id < 'ba';
+SELECT * FROM item WHERE id > 'b';
+DROP FOREIGN TABLE item;
@@ -0,0 +1,20 @@
+--
+-- Test the statistics of the kv workers
+--
+
+\c kvtest
+
+CREATE FOREIGN TABLE counted(id INTEGER, name TEXT) SERVER kv_server;
+
+INSERT INTO counted SELECT i, 'n' || i FROM generate_series(1, 1000) i;
+SELECT * FROM counted WHERE id = 500;
+SELECT count(*) FROM counted;
+
+SELECT operation, calls > 0 AS called, bytes_in > 0 AS sent,
+       array_length(latency, 1) AS buckets
+FROM kv_fdw_stats WHERE worker = 'counted'::regclass ORDER BY operation;
+
+SELECT cache_hits + cache_misses >= 0 AS looked_up, stall_time >= 0 AS stalled
+FROM kv_fdw_engine_stats WHERE worker = 'counted'::regclass;
+
+DROP FOREIGN TABLE counted;
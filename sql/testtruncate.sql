@@ -0,0 +1,46 @@
+--
+-- Test truncating kv tables in their kv workers
+--
+
+\c kvtest
+
+CREATE FOREIGN TABLE item(id INTEGER, val TEXT) SERVER kv_server;
+INSERT INTO item SELECT i, 'v' || i FROM generate_series(1, 100000) i;
+SELECT count(*) FROM item;
+
+TRUNCATE item;
+SELECT count(*) FROM item;
+
+-- the table is usable afterwards --
+INSERT INTO item VALUES (1, 'one'), (2, 'two');
+SELECT * FROM item;
+
+-- an empty table, and twice in a row --
+TRUNCATE item;
+TRUNCATE item;
+SELECT count(*) FROM item;
+
+-- together with a regular table --
+INSERT INTO item VALUES (1, 'one');
+CREATE TABLE regular(id INTEGER);
+INSERT INTO regular VALUES (1);
+TRUNCATE item, regular;
+SELECT count(*) FROM item;
+SELECT count(*) FROM regular;
+DROP TABLE regular;
+
+-- the point cache of the backend is expired --
+SET kv_fdw.point_cache_size = '1MB';
+INSERT INTO item VALUES (1, 'one');
+SELECT * FROM item WHERE id = 1;
+TRUNCATE item;
+SELECT * FROM item WHERE id = 1;
+RESET kv_fdw.point_cache_size;
+
+-- a delete without conditions is pushed down as well --
+INSERT INTO item SELECT i, 'v' FROM generate_series(1, 1000) i;
+EXPLAIN (COSTS OFF) DELETE FROM item;
+DELETE FROM item;
+SELECT count(*) FROM item;
+
+DROP FOREIGN TABLE item;
@@ -13,6 +13,8 @@
  * limitations under the License.
  */
 
+#include <list>
+#include <string>
 #include <unordered_map>
 using namespace std;
 
@@ -31,6 +33,27 @@ extern "C" {
 static KVManagerClient* manager = nullptr;
 static unordered_map<KVWorkerId, KVWorkerClient*> workers;
 
+/*
+ * Point lookups cached by this backend, see kv_fdw.point_cache_size. A value
+ * is valid while the write sequence of its relation, read before the lookup,
+ * is unchanged, and no write of this backend to the relation was sent since,
+ * which the worker might not have applied yet.
+ */
+struct KVCacheEntry {
+    string id;       /* relation and key */
+    string val;
+    bool   found;
+    uint64 seq;      /* published by the worker */
+    uint64 epoch;    /* of the writes of this backend to the relation */
+};
+
+static list<KVCacheEntry> cacheEntries;  /* the most recently used first */
+static unordered_map<string, list<KVCacheEntry>::iterator> cacheIndex;
+static unordered_map<KVRelationId, uint64> cacheEpochs;
+static uint64 cacheBytes = 0;
+
+#define CACHEENTRYOVERHEAD 128  /* list and index nodes */
+
 /*
  * Implementation for kv client
  */
@@ -39,7 +62,9 @@ static void InitKVManagerClient() {
     manager = new KVManagerClient();
 }
 
-static KVWorkerClient* GetKVWorkerClient(KVWorkerId workerId) {
+/* the tables of a database share its worker with the shared storage */
+static KVWorkerClient* GetKVWorkerClient(KVRelationId rid) {
+    KVWorkerId workerId = KVSharedStorage ? MyDatabaseId : rid;
     auto it = workers.find(workerId);
     if (it != workers.end()) {
         return it->second;
@@ -65,6 +90,83 @@ static KVWorkerClient* GetKVWorkerClient(KVWorkerId workerId) {
     return nullptr;
 }
 
+static uint64 CacheEntrySize(const KVCacheEntry& entry) {
+    return 2 * entry.id.size() + entry.val.size() + CACHEENTRYOVERHEAD;
+}
+
+static void EvictCache(uint64 capacity) {
+    while (cacheBytes > capacity) {
+        KVCacheEntry& entry = cacheEntries.back();
+        cacheBytes -= CacheEntrySize(entry);
+        cacheIndex.erase(entry.id);
+        cacheEntries.pop_back();
+    }
+}
+
+/* the writes sent by this backend expire the cached values of the relation */
+static void InvalidateCache(KVRelationId rid) {
+    if (!cacheEntries.empty()) {
+        cacheEpochs[rid]++;
+    }
+}
+
+static bool CachedGet(KVWorkerClient* worker, KVRelationId rid, GetArgs* args) {
+    uint64 capacity = static_cast<uint64>(KVPointCacheSize) * 1024;
+    EvictCache(capacity);
+
+    uint64 seq;
+    if (capacity == 0 || !worker->WriteSeq(rid, &seq)) {
+        return worker->Get(rid, args);
+    }
+
+    string id(reinterpret_cast<char*>(&rid), sizeof(rid));
+    id.append(args->key, args->keyLen);
+    auto epoch = cacheEpochs.find(rid);
+    uint64 writes = epoch == cacheEpochs.end() ? 0 : epoch->second;
+
+    auto it = cacheIndex.find(id);
+    if (it != cacheIndex.end()) {
+        KVCacheEntry& entry = *it->second;
+        if (entry.seq == seq && entry.epoch == writes) {
+            cacheEntries.splice(cacheEntries.begin(), cacheEntries, it->second);
+            *(args->valLen) = entry.val.size();
+            *(args->val) = static_cast<char*>(palloc0(entry.val.size()));
+            memcpy(*(args->val), entry.val.data(), entry.val.size());
+            return entry.found;
+        }
+
+        cacheBytes -= CacheEntrySize(entry);
+        cacheEntries.erase(it->second);
+        cacheIndex.erase(it);
+    }
+
+    bool found = worker->Get(rid, args);
+
+    KVCacheEntry entry;
+    entry.id = move(id);
+    entry.val.assign(*(args->val), *(args->valLen));
+    entry.found = found;
+    entry.seq = seq;
+    entry.epoch = writes;
+    uint64 size = CacheEntrySize(entry);
+    if (size > capacity) {
+        return found;
+    }
+
+    cacheEntries.push_front(move(entry));
+    cacheIndex[cacheEntries.front().id] = cacheEntries.begin();
+    cacheBytes += size;
+    EvictCache(capacity);
+    return found;
+}
+
+static void ClearCache() {
+    cacheEntries.clear();
+    cacheIndex.clear();
+    cacheEpochs.clear();
+    cacheBytes = 0;
+}
+
 void KVOpenRequest(KVRelationId rid, OpenArgs* args) {
     KVWorkerClient* worker = GetKVWorkerClient(rid);
     worker->Open(rid, args);
@@ -82,29 +184,85 @@ uint64 KVCountRequest(KVRelationId rid) {
 
 bool KVPutRequest(KVRelationId rid, PutArgs* args) {
     KVWorkerClient* worker = GetKVWorkerClient(rid);
+    InvalidateCache(rid);
     return worker->Put(rid, args);
 }
 
+bool KVPutBatchRequest(KVRelationId rid, PutBatchArgs* args) {
+    KVWorkerClient* worker = GetKVWorkerClient(rid);
+    InvalidateCache(rid);
+    return worker->PutBatch(rid, args);
+}
+
 bool KVGetRequest(KVRelationId rid, GetArgs* args) {
     KVWorkerClient* worker = GetKVWorkerClient(rid);
-    return worker->Get(rid, args);
+    return CachedGet(worker, rid, args);
 }
 
 bool KVDeleteRequest(KVRelationId rid, DeleteArgs* args) {
     KVWorkerClient* worker = GetKVWorkerClient(rid);
+    InvalidateCache(rid);
     return worker->Delete(rid, args);
 }
 
+bool KVDeleteBatchRequest(KVRelationId rid, DeleteBatchArgs* args) {
+    KVWorkerClient* worker = GetKVWorkerClient(rid);
+    InvalidateCache(rid);
+    return worker->DeleteBatch(rid, args);
+}
+
+bool KVDeleteRangeRequest(KVRelationId rid, DeleteRangeArgs* args) {
+    KVWorkerClient* worker = GetKVWorkerClient(rid);
+    InvalidateCache(rid);
+    return worker->DeleteRange(rid, args);
+}
+
+bool KVTruncateRequest(KVRelationId rid) {
+    KVWorkerClient* worker = GetKVWorkerClient(rid);
+    InvalidateCache(rid);
+    return worker->Truncate(rid);
+}
+
 void KVLoadRequest(KVRelationId rid, PutArgs* args) {
     KVWorkerClient* worker = GetKVWorkerClient(rid);
+    InvalidateCache(rid);
     worker->Load(rid, args);
 }
 
+/*
+ * Returns the writes which failed since the last sync, of those not waited
+ * for: pipelined batches and loads. Without waiting they are forgotten.
+ */
+uint64 KVSyncRequest(KVRelationId rid, bool wait) {
+    KVWorkerClient* worker = GetKVWorkerClient(rid);
+    return worker->Sync(rid, wait);
+}
+
 bool KVReadBatchRequest(KVRelationId rid, ReadBatchArgs* args) {
     KVWorkerClient* worker = GetKVWorkerClient(rid);
     return worker->ReadBatch(rid, args);
 }
 
+bool KVMultiGetRequest(KVRelationId rid, MultiGetArgs* args) {
+    KVWorkerClient* worker = GetKVWorkerClient(rid);
+    return worker->MultiGet(rid, args);
+}
+
+bool KVSampleRequest(KVRelationId rid, SampleArgs* args) {
+    KVWorkerClient* worker = GetKVWorkerClient(rid);
+    return worker->Sample(rid, args);
+}
+
+void KVSplitRequest(KVRelationId rid, SplitArgs* args) {
+    KVWorkerClient* worker = GetKVWorkerClient(rid);
+    worker->Split(rid, args);
+}
+
+bool KVAggregateRequest(KVRelationId rid, AggregateArgs* args) {
+    KVWorkerClient* worker = GetKVWorkerClient(rid);
+    return worker->Aggregate(rid, args);
+}
+
 void KVCloseCursorRequest(KVRelationId rid, CloseCursorArgs* args) {
     KVWorkerClient* worker = GetKVWorkerClient(rid);
     worker->CloseCursor(rid, args);
@@ -120,6 +278,18 @@ void KVClearRangeQueryRequest(KVRelationId rid, RangeQueryArgs* args) {
     KVWorkerClient* worker = GetKVWorkerClient(rid);
     worker->ClearRangeQuery(rid, args);
 }
+#else
+bool KVIngestRequest(KVRelationId rid, IngestArgs* args) {
+    KVWorkerClient* worker = GetKVWorkerClient(rid);
+    InvalidateCache(rid);
+    return worker->Ingest(rid, args);
+}
+
+bool KVDropRequest(KVRelationId rid, DropArgs* args) {
+    KVWorkerClient* worker = GetKVWorkerClient(rid);
+    InvalidateCache(rid);
+    return worker->Drop(rid, args);
+}
 #endif
 
 void KVTerminateRequest(KVRelationId rid, KVDatabaseId dbId) {
@@ -129,4 +299,9 @@ void KVTerminateRequest(KVRelationId rid, KVDatabaseId dbId) {
 
     manager->Terminate(rid, dbId);
     workers.erase(rid);
+    /* a worker launched again might publish its writes in another slot */
+    ClearCache();
+    if (KVSharedStorage && rid == KVAllRelationId) {
+        workers.erase(dbId);
+    }
 }
@@ -15,6 +15,8 @@
 
 #include "kv_channel.h"
 #include <fcntl.h>
+#include <sys/stat.h>
+#include <climits>
 
 extern "C" {
 #include "postgres.h"
@@ -218,6 +220,226 @@ void KVCircularChannel::Stop() {
     SemPost(&data_->empty, __func__);
 }
 
+/*
+ * Implementation for kv lock-free channel
+ */
+
+#define LOCKFREESPINS 1000  /* spins before sleeping on the futex */
+#define LOCKFREEWAKE  (MSGBUFSIZE / 8)  /* space released to wake producers */
+
+/* record size including the commit word, kept aligned to the commit word */
+static inline uint64 LockFreeRecordSize(const KVMessage& msg) {
+    uint64 size = sizeof(uint64) + sizeof(msg.hdr) + msg.hdr.etySize;
+    return (size + sizeof(uint64) - 1) & ~(sizeof(uint64) - 1);
+}
+
+KVLockFreeChannel::KVLockFreeChannel(KVRelationId rid, const char* tag,
+                                     bool create) {
+    create_ = create;
+    running_ = true;
+    getPos_ = getOffset_ = getSize_ = wakePos_ = 0;
+    snprintf(name_, MAXPATHLENGTH, "%s%s%u", MSGPATHPREFIX, tag, rid);
+
+    if (!create_) { /* connect to the channel */
+        int fd = ShmOpen(name_, O_RDWR, 0777, __func__);
+        data_ = (KVLockFreeChannelData*) Mmap(NULL, sizeof(*data_),
+            PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0, __func__);
+        Fclose(fd, __func__);
+        return;
+    }
+
+    /* create the channel, ftruncate guarantees zeroed commit words */
+    ShmUnlink(name_, __func__);
+    int fd = ShmOpen(name_, O_CREAT | O_RDWR, 0777, __func__);
+    Ftruncate(fd, sizeof(*data_), __func__);
+    data_ = (KVLockFreeChannelData*) Mmap(NULL, sizeof(*data_),
+        PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0, __func__);
+    Fclose(fd, __func__);
+
+    data_->head.store(0);
+    data_->tail.store(0);
+    data_->putSeq.store(0);
+    data_->consumerWaiting.store(0);
+    data_->getSeq.store(0);
+    data_->producerWaiting.store(0);
+}
+
+KVLockFreeChannel::~KVLockFreeChannel() {
+    Munmap((void*) data_, sizeof(*data_), __func__);
+    if (create_) {
+        ShmUnlink(name_, __func__);
+    }
+}
+
+atomic<uint64>* KVLockFreeChannel::CommitWord(uint64 pos) {
+    return reinterpret_cast<atomic<uint64>*>(data_->buf + pos % MSGBUFSIZE);
+}
+
+void KVLockFreeChannel::Input(const KVMessage& msg) {
+    uint64 size = LockFreeRecordSize(msg);
+    if (size > MSGBUFSIZE) {
+        ereport(ERROR, errmsg("kv message of %lu bytes is too large", size));
+    }
+
+    uint64 pos = data_->head.fetch_add(size);
+
+    /* wait until the consumer has released enough space for the record */
+    for (int spin = 0; spin < LOCKFREESPINS; spin++) {
+        if (pos + size - data_->tail.load(memory_order_acquire) <= MSGBUFSIZE) {
+            break;
+        }
+    }
+    while (pos + size - data_->tail.load(memory_order_acquire) > MSGBUFSIZE) {
+        uint32 seq = data_->getSeq.load();
+        data_->producerWaiting.fetch_add(1);
+        if (pos + size - data_->tail.load() > MSGBUFSIZE) {
+            FutexWait(reinterpret_cast<volatile uint32_t*>(&data_->getSeq), seq,
+                      __func__);
+        }
+        data_->producerWaiting.fetch_sub(1);
+    }
+
+    uint64 offset = (pos + sizeof(uint64)) % MSGBUFSIZE;
+    Push(&offset, (char*) &(msg.hdr), sizeof(msg.hdr));
+    if (msg.writeFunc) {
+        (*msg.writeFunc) (this, &offset, msg.ety, msg.hdr.etySize);
+    }
+
+    /* publish the record, then wake up the consumer if it sleeps */
+    CommitWord(pos)->store(size, memory_order_release);
+    data_->putSeq.fetch_add(1);
+    if (data_->consumerWaiting.load() > 0) {
+        FutexWake(reinterpret_cast<volatile uint32_t*>(&data_->putSeq), 1,
+                  __func__);
+    }
+}
+
+void KVLockFreeChannel::Output(KVMessage& msg, int flag) {
+    if (flag & MSGDISCARD) {
+        Release();
+        return;
+    }
+
+    if (flag & MSGHEADER) {
+        uint64 pos = data_->tail.load(memory_order_relaxed);
+        atomic<uint64>* commit = CommitWord(pos);
+
+        for (int spin = 0; spin < LOCKFREESPINS; spin++) {
+            if (commit->load(memory_order_acquire) != 0) {
+                break;
+            }
+        }
+        while (commit->load(memory_order_acquire) == 0) {
+            if (!running_) {
+                return;
+            }
+
+            /* blocked producers might hold the record, let them go first */
+            WakeProducers();
+
+            uint32 seq = data_->putSeq.load();
+            data_->consumerWaiting.store(1);
+            if (commit->load() == 0 && running_) {
+                FutexWait(reinterpret_cast<volatile uint32_t*>(&data_->putSeq),
+                          seq, __func__);
+            }
+            data_->consumerWaiting.store(0);
+        }
+
+        getPos_ = pos;
+        getSize_ = commit->load(memory_order_relaxed);
+        getOffset_ = (pos + sizeof(uint64)) % MSGBUFSIZE;
+        Pop(&getOffset_, (char*) &(msg.hdr), sizeof(msg.hdr));
+    }
+
+    if (flag & MSGENTITY) {
+        if (msg.readFunc) {
+            (*msg.readFunc) (this, &getOffset_, msg.ety, msg.hdr.etySize);
+        }
+        /* the whole record is consumed even if the entity is not read */
+        Release();
+    }
+}
+
+/*
+ * Zero the record so that stale bytes are never taken as a commit word in the
+ * next round, then hand the space back to the producers.
+ */
+void KVLockFreeChannel::Release() {
+    if (getSize_ == 0) {
+        return;
+    }
+
+    uint64 start = getPos_ % MSGBUFSIZE;
+    uint64 delta = MSGBUFSIZE - start;
+    if (getSize_ > delta) {
+        memset(data_->buf + start, 0, delta);
+        memset(data_->buf, 0, getSize_ - delta);
+    } else {
+        memset(data_->buf + start, 0, getSize_);
+    }
+
+    data_->tail.store(getPos_ + getSize_, memory_order_release);
+    getSize_ = 0;
+
+    /* wake up producers in bulk to avoid a thundering herd per message */
+    if (data_->tail.load(memory_order_relaxed) - wakePos_ >= LOCKFREEWAKE) {
+        WakeProducers();
+    }
+}
+
+void KVLockFreeChannel::WakeProducers() {
+    wakePos_ = data_->tail.load(memory_order_relaxed);
+    data_->getSeq.fetch_add(1);
+    if (data_->producerWaiting.load() > 0) {
+        FutexWake(reinterpret_cast<volatile uint32_t*>(&data_->getSeq), INT_MAX,
+                  __func__);
+    }
+}
+
+void KVLockFreeChannel::Push(uint64* offset, char* str, uint64 size) {
+    if (size == 0) {
+        return;
+    }
+
+    char* putPos = data_->buf + *offset;
+    uint64 delta = MSGBUFSIZE - *offset;
+
+    if (size > delta) { /* circular write into the channel */
+        memcpy(putPos, str, delta);
+        memcpy(data_->buf, str + delta, size - delta);
+        *offset = size - delta;
+    } else {
+        memcpy(putPos, str, size);
+        *offset = (*offset + size) % MSGBUFSIZE;
+    }
+}
+
+void KVLockFreeChannel::Pop(uint64* offset, char* str, uint64 size) {
+    if (size == 0) {
+        return;
+    }
+
+    char* getPos = data_->buf + *offset;
+    uint64 delta = MSGBUFSIZE - *offset;
+
+    if (size > delta) { /* circular read out from the channel */
+        memcpy(str, getPos, delta);
+        memcpy(str + delta, data_->buf, size - delta);
+        *offset = size - delta;
+    } else {
+        memcpy(str, getPos, size);
+        *offset = (*offset + size) % MSGBUFSIZE;
+    }
+}
+
+void KVLockFreeChannel::Stop() {
+    running_ = false;
+    /* try to wakeup the consumer */
+    data_->putSeq.fetch_add(1);
+    FutexWake(reinterpret_cast<volatile uint32_t*>(&data_->putSeq), 1, __func__);
+}
+
 /*
  * Implementation for kv simple channel
  */
@@ -314,11 +536,156 @@ void KVSimpleChannel::Unlease() {
 }
 
 
+/*
+ * Implementation for kv large channel
+ */
+
+KVLargeChannel::KVLargeChannel(KVRelationId rid, const char* tag, bool create) {
+    create_ = create;
+    capacity_ = 0;
+    data_ = nullptr;
+    snprintf(name_, MAXPATHLENGTH, "%s%s%u", MSGPATHPREFIX, tag, rid);
+}
+
+/* the other side may have created the file even if it is not mapped here */
+KVLargeChannel::~KVLargeChannel() {
+    if (capacity_ > 0) {
+        Munmap(data_, capacity_, __func__);
+    }
+    if (create_) {
+        shm_unlink(name_);
+    }
+}
+
+/*
+ * The worker maps the channel to send a response on a thread of the pool,
+ * where ereport(ERROR) cannot unwind, so a failure returns nullptr with errno
+ * set and leaves the old mapping in place.
+ */
+char* KVLargeChannel::TryMap(uint64 size) {
+    /* the file never shrinks below LARGEMINSIZE */
+    if (size <= capacity_ && size <= LARGEMINSIZE) {
+        return data_;
+    }
+
+    int fd = shm_open(name_, O_CREAT | O_RDWR, 0777);
+    if (fd == -1) {
+        return nullptr;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) == -1) {
+        int err = errno;
+        close(fd);
+        errno = err;
+        return nullptr;
+    }
+    uint64 capacity = st.st_size;
+    if (capacity < size) {
+        capacity = capacity < LARGEMINSIZE ? LARGEMINSIZE : capacity;
+        while (capacity < size) {
+            capacity *= 2;
+        }
+        if (ftruncate(fd, capacity) == -1) {
+            int err = errno;
+            close(fd);
+            errno = err;
+            return nullptr;
+        }
+    }
+
+    if (capacity == capacity_) {
+        close(fd);
+        return data_;
+    }
+    void* data = mmap(NULL, capacity, PROT_READ | PROT_WRITE, MAP_SHARED, fd,
+                      0);
+    int err = errno;
+    close(fd);
+    if (data == MAP_FAILED) {
+        errno = err;
+        return nullptr;
+    }
+
+    if (capacity_ > 0) {
+        munmap(data_, capacity_);
+    }
+    data_ = static_cast<char*>(data);
+    capacity_ = capacity;
+    return data_;
+}
+
+char* KVLargeChannel::Map(uint64 size) {
+    char* data = TryMap(size);
+    if (data == nullptr) {
+        pg_fprintf(stderr, "%s\n", pg_strerror(errno));
+        ereport(ERROR, errmsg("%s failed for %lu bytes", __func__, size));
+    }
+    return data;
+}
+
+/*
+ * Called by the backend which leased the channel after it got the response,
+ * when the worker does not touch the entity anymore. The pages above
+ * LARGEMINSIZE are freed, and the mapping is taken again by the next Map.
+ */
+void KVLargeChannel::Shrink() {
+    if (capacity_ <= LARGESHRINKSIZE) {
+        return;
+    }
+
+    int fd = ShmOpen(name_, O_RDWR, 0777, __func__);
+    Ftruncate(fd, LARGEMINSIZE, __func__);
+    Fclose(fd, __func__);
+
+    Munmap(data_, capacity_, __func__);
+    data_ = nullptr;
+    capacity_ = 0;
+}
+
+/* the entity is written to the mapping taken by Map or TryMap before */
+void KVLargeChannel::Input(const KVMessage& msg) {
+    uint64 offset = 0; /* from start position */
+
+    if (msg.writeFunc) {
+        (*msg.writeFunc) (this, &offset, msg.ety, msg.hdr.etySize);
+    }
+}
+
+void KVLargeChannel::Output(KVMessage& msg, int flag) {
+    uint64 offset = 0; /* from start position */
+
+    if ((flag & MSGENTITY) && msg.readFunc) {
+        Map(msg.hdr.etySize);
+        (*msg.readFunc) (this, &offset, msg.ety, msg.hdr.etySize);
+    }
+}
+
+void KVLargeChannel::Push(uint64* offset, char* str, uint64 size) {
+    if (size == 0) {
+        return;
+    }
+
+    memcpy(data_ + *offset, str, size);
+    *offset += size;
+}
+
+void KVLargeChannel::Pop(uint64* offset, char* str, uint64 size) {
+    if (size == 0) {
+        return;
+    }
+
+    memcpy(str, data_ + *offset, size);
+    *offset += size;
+}
+
+
 /*
  * Implementation for kv ctrl channel
  */
 
-KVCtrlChannel::KVCtrlChannel(KVRelationId rid, const char* tag, bool create) {
+KVCtrlChannel::KVCtrlChannel(KVRelationId rid, const char* tag, bool create,
+                             uint32 responses) {
     create_ = create;
     snprintf(name_, MAXPATHLENGTH, "%s%s%u", MSGPATHPREFIX, tag, rid);
 
@@ -340,6 +707,7 @@ KVCtrlChannel::KVCtrlChannel(KVRelationId rid, const char* tag, bool create) {
 
     SemInit(&data_->workerReady, 1, 0, __func__);
     SemInit(&data_->workerDesty, 1, 0, __func__);
+    SemInit(&data_->responseFree, 1, responses, __func__);
 }
 
 KVCtrlChannel::~KVCtrlChannel() {
@@ -350,6 +718,7 @@ KVCtrlChannel::~KVCtrlChannel() {
 
     SemDestroy(&data_->workerReady, __func__);
     SemDestroy(&data_->workerDesty, __func__);
+    SemDestroy(&data_->responseFree, __func__);
     Munmap((void*) data_, sizeof(*data_), __func__);
     ShmUnlink(name_, __func__);
 }
@@ -362,6 +731,11 @@ void KVCtrlChannel::Wait(KVCtrlType type) {
         case WorkerDesty:
             SemWait(&data_->workerDesty, __func__);
             break;
+        case ResponseFree:
+            while (SemWait(&data_->responseFree, __func__) == -1) {
+                /* interrupted by signal, keep waiting */
+            }
+            break;
     }
 }
 
@@ -373,5 +747,8 @@ void KVCtrlChannel::Notify(KVCtrlType type) {
         case WorkerDesty:
             SemPost(&data_->workerDesty, __func__);
             break;
+        case ResponseFree:
+            SemPost(&data_->responseFree, __func__);
+            break;
     }
 }
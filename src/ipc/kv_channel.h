@@ -17,6 +17,9 @@
 #define KV_CHANNEL_H_
 
 
+#include <atomic>
+using namespace std;
+
 #include "kv_message.h"
 #include "kv_posix.h"
 
@@ -26,6 +29,13 @@
 #define MSGENTITY     02     /* read msg entity */
 #define MSGDISCARD    04     /* discard msg */
 #define MSGBUFSIZE    65536  /* msg buf size */
+#define CACHELINESIZE 64     /* avoid false sharing of hot positions */
+#define LARGEENTITYSIZE (MSGBUFSIZE / 8)  /* larger entities go out of line */
+#define LARGEMINSIZE  1048576  /* initial size of a large channel */
+#define LARGESHRINKSIZE 67108864  /* a larger one shrinks once unleased */
+
+/* the largest entity of a message which has no large channel */
+#define MSGMAXENTITY  (MSGBUFSIZE - sizeof(KVMessageHeader) - CACHELINESIZE)
 
 
 /*
@@ -97,6 +107,52 @@ class KVCircularChannel : public KVChannel {
     volatile KVCircularChannelData* data_;
 };
 
+/*
+ * A kv lock-free channel is an alternative request channel to the above
+ * <KVCircularChannel> (multiple producers and a single consumer as well).
+ *
+ * Producers reserve ring space with a fetch-add on the head, then write the
+ * message after an 8-byte commit word and finally publish the commit word with
+ * the record size. The consumer releases a record by zeroing it and advancing
+ * the tail. Both sides only sleep on a futex when the ring is empty or full.
+ */
+
+struct KVLockFreeChannelData {
+    alignas(CACHELINESIZE) atomic<uint64> head; /* bytes reserved by producers */
+    alignas(CACHELINESIZE) atomic<uint64> tail; /* bytes released by consumer */
+    alignas(CACHELINESIZE) atomic<uint32> putSeq; /* bumped on every commit */
+    atomic<uint32> consumerWaiting;
+    alignas(CACHELINESIZE) atomic<uint32> getSeq; /* bumped on every release */
+    atomic<uint32> producerWaiting;
+    alignas(CACHELINESIZE) char buf[MSGBUFSIZE];
+};
+
+class KVLockFreeChannel : public KVChannel {
+  public:
+    KVLockFreeChannel(KVRelationId rid, const char* tag, bool create);
+    ~KVLockFreeChannel();
+
+    void Input(const KVMessage& msg);
+    void Output(KVMessage& msg, int flag);
+    void Push(uint64* offset, char* str, uint64 size);
+    void Pop(uint64* offset, char* str, uint64 size);
+    void Stop();
+
+  private:
+    atomic<uint64>* CommitWord(uint64 pos);
+    void Release();
+    void WakeProducers();
+
+    char name_[MAXPATHLENGTH];
+    bool create_; /* instruct whether to create */
+    bool running_; /* only used in output message */
+    uint64 getPos_; /* start of the record being output */
+    uint64 getOffset_; /* read offset inside the record being output */
+    uint64 getSize_; /* size of the record being output */
+    uint64 wakePos_; /* tail when producers were woken up last time */
+    KVLockFreeChannelData* data_;
+};
+
 /*
  * A kv simple channel is primarily used as the response channel to send kv
  * messages in the following <KVMessageQueue> definition.
@@ -107,7 +163,7 @@ struct KVSimpleChannelData {
     uint64 getPos;           /* the position consumer can get data */
     sem_t  mutex;            /* whether the channel has been occupied */
     sem_t  ready;            /* tell whether response is ready */
-    char   buf[MSGBUFSIZE];  /* assume ~64K for a tuple is enough */
+    char   buf[MSGBUFSIZE];  /* larger entities go to <KVLargeChannel> */
 };
 
 class KVSimpleChannel : public KVChannel {
@@ -129,6 +185,42 @@ class KVSimpleChannel : public KVChannel {
     volatile KVSimpleChannelData* data_;
 };
 
+/*
+ * A kv large channel carries the entities above LARGEENTITYSIZE of the
+ * requests and the responses of a response channel, whose header still goes
+ * through the ring. It is owned by whom leased the response channel, so it is
+ * not synchronized, and the entity of a request is overwritten by the one of
+ * its response.
+ *
+ * The shared memory is created by the first side which needs it and grown by
+ * powers of two, the size of the file is the capacity. The data which is
+ * already mapped keeps its place when the file grows. Once the backend gets
+ * the response, a file above LARGESHRINKSIZE is cut back to LARGEMINSIZE, so
+ * a side checks the size of the file for an entity above LARGEMINSIZE, and
+ * maps it again when its mapping differs.
+ */
+
+class KVLargeChannel : public KVChannel {
+  public:
+    KVLargeChannel(KVRelationId rid, const char* tag, bool create);
+    ~KVLargeChannel();
+
+    void  Input(const KVMessage& msg);
+    void  Output(KVMessage& msg, int flag);
+    void  Push(uint64* offset, char* str, uint64 size);
+    void  Pop(uint64* offset, char* str, uint64 size);
+    void  Stop() {}
+    char* Map(uint64 size);  /* an entity of the size can be read in place */
+    char* TryMap(uint64 size);  /* Map without ereport, nullptr if it fails */
+    void  Shrink();          /* the exchange on the channel is over */
+
+  private:
+    char name_[MAXPATHLENGTH];
+    bool create_; /* instruct whether to unlink */
+    uint64 capacity_; /* of the mapping, 0 if not mapped yet */
+    char* data_;
+};
+
 /*
  * A kv control channel which defines some semaphores to coordinate kv manager
  * and kv worker processes.
@@ -140,16 +232,19 @@ class KVSimpleChannel : public KVChannel {
 enum KVCtrlType {
     WorkerReady = 0,
     WorkerDesty,
+    ResponseFree,
 };
 
 struct KVCtrlData {
-    sem_t workerReady; /* tell whether kv worker is ready */
-    sem_t workerDesty; /* tell whether kv worker is destroyed */
+    sem_t workerReady;  /* tell whether kv worker is ready */
+    sem_t workerDesty;  /* tell whether kv worker is destroyed */
+    sem_t responseFree; /* count of response channels not leased */
 };
 
 class KVCtrlChannel {
   public:
-    KVCtrlChannel(KVRelationId rid, const char* tag, bool create);
+    KVCtrlChannel(KVRelationId rid, const char* tag, bool create,
+                  uint32 responses);
     ~KVCtrlChannel();
 
     void Wait(KVCtrlType type);
@@ -36,6 +36,7 @@ KVMessage SimpleMessage(KVOperation op, KVRelationId rid, KVDatabaseId dbId) {
     msg.hdr.op = op;
     msg.hdr.relId = rid;
     msg.hdr.dbId = dbId;
+    msg.hdr.pid = getpid();
     return msg;
 }
 
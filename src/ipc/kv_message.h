@@ -26,16 +26,29 @@ enum KVOperation {
     KVOpClose,
     KVOpCount,
     KVOpPut,
+    KVOpPutBatch,
     KVOpGet,
     KVOpDel,
+    KVOpDelBatch,
+    KVOpDelRange,
+    KVOpTruncate,
     KVOpLoad,
+    KVOpSync,
     KVOpReadBatch,
+    KVOpMultiGet,
+    KVOpSample,
+    KVOpSplit,
+    KVOpAggregate,
     KVOpDelCursor,
     #ifdef VIDARDB
     KVOpRangeQuery,
     KVOpClearRangeQuery,
+    #else
+    KVOpIngest,
+    KVOpDrop,
     #endif
     KVOpLaunch,
+    KVOpReady,
     KVOpTerminate,
 };
 
@@ -51,8 +64,11 @@ struct KVMessageHeader {
     KVDatabaseId    dbId    = InvalidOid;
     KVRelationId    relId   = InvalidOid;
     KVMessageStatus status  = KVStatusDummy;
+    pid_t           pid     = 0; /* sender process pid */
     uint32          rpsId = 0;   /* response channel id */
     uint64          etySize = 0; /* message entity size */
+    uint64          sendTime = 0; /* monotonic nanoseconds, see KVStatsServed */
+    uint64          largeSize = 0; /* entity size if out of line, see Send */
 };
 
 
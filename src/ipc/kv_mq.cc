@@ -23,6 +23,7 @@ extern "C" {
 #define MSGREQCHANNELNAME "Request"
 #define MSGRESCHANNELNAME "Response"
 #define MSGCRLCHANNELNAME "Ctrl"
+#define MSGLRGCHANNELNAME "Large"
 
 
 KVMessageQueue::KVMessageQueue(KVRelationId rid, const char* name,
@@ -31,25 +32,52 @@ KVMessageQueue::KVMessageQueue(KVRelationId rid, const char* name,
 
     char tmp[MAXPATHLENGTH];
     snprintf(tmp, MAXPATHLENGTH, "%s%s", name, MSGCRLCHANNELNAME);
-    ctrl_ = new KVCtrlChannel(rid, tmp, isServer);
+    responseCount_ = KVResponseChannels;
+    ctrl_ = new KVCtrlChannel(rid, tmp, isServer, responseCount_);
 
     snprintf(tmp, MAXPATHLENGTH, "%s%s", name, MSGREQCHANNELNAME);
-    request_ = new KVCircularChannel(rid, tmp, isServer);
+    if (KVUseLockFreeChannel) {
+        request_ = new KVLockFreeChannel(rid, tmp, isServer);
+    } else {
+        request_ = new KVCircularChannel(rid, tmp, isServer);
+    }
 
-    for (uint32 i = 0; i < MSGRESQUEUELENGTH; i++) {
+    response_ = new KVSimpleChannel*[responseCount_];
+    for (uint32 i = 0; i < responseCount_; i++) {
         snprintf(tmp, MAXPATHLENGTH, "%s%s%d", name, MSGRESCHANNELNAME, i);
         response_[i] = new KVSimpleChannel(rid, tmp, isServer);
     }
+
+    large_ = new KVLargeChannel*[responseCount_];
+    for (uint32 i = 0; i < responseCount_; i++) {
+        snprintf(tmp, MAXPATHLENGTH, "%s%s%d", name, MSGLRGCHANNELNAME, i);
+        large_[i] = new KVLargeChannel(rid, tmp, isServer);
+    }
 }
 
 KVMessageQueue::~KVMessageQueue() {
-    for (uint32 i = 0; i < MSGRESQUEUELENGTH; i++) {
+    for (uint32 i = 0; i < responseCount_; i++) {
+        delete large_[i];
         delete response_[i];
     }
+    delete[] large_;
+    delete[] response_;
     delete request_;
     delete ctrl_;
 }
 
+bool KVMessageQueue::IsLargeEntity(const KVMessageHeader& hdr) {
+    return hdr.etySize > LARGEENTITYSIZE && hdr.rpsId > 0 &&
+           hdr.rpsId <= responseCount_;
+}
+
+/*
+ * An entity above LARGEENTITYSIZE is written to the large channel of the
+ * response channel, and the header, which carries its size in largeSize, goes
+ * through the channel alone. So that a large entity neither stalls the other
+ * backends on the request channel nor overflows the response channel. A
+ * message which has no response channel must fit into the channel.
+ */
 void KVMessageQueue::Send(const KVMessage& msg) {
     KVChannel* channel = nullptr;
 
@@ -59,14 +87,68 @@ void KVMessageQueue::Send(const KVMessage& msg) {
             return;
         }
 
+        if (msg.hdr.rpsId > responseCount_) {
+            ereport(WARNING, errmsg("invalid response channel"));
+            return;
+        }
+
         channel = response_[msg.hdr.rpsId - 1];
+        KVStatsResponded(stats_, msg.hdr.etySize);
     } else {
         channel = request_;
     }
 
-    channel->Input(msg);
+    KVMessage sendmsg = msg;
+    char cause[KVERRORSIZE];  /* entity of the failure sent instead */
+    if (IsLargeEntity(msg.hdr)) {
+        KVLargeChannel* large = large_[msg.hdr.rpsId - 1];
+
+        /*
+         * The worker sends on a thread of the pool, which cannot raise the
+         * error, so it answers a failure instead and its backend raises it.
+         */
+        if (isServer_ && large->TryMap(msg.hdr.etySize) == nullptr) {
+            snprintf(cause, KVERRORSIZE, "could not map %lu bytes of the "
+                     "response: %m", msg.hdr.etySize);
+            sendmsg = FailureMessage(msg.hdr.rpsId);
+            sendmsg.ety = cause;
+            sendmsg.hdr.etySize = strlen(cause) + 1;
+            sendmsg.writeFunc = CommonWriteEntity;
+        } else {
+            if (!isServer_) {
+                large->Map(msg.hdr.etySize);
+            }
+            large->Input(msg);
+            sendmsg.hdr.largeSize = msg.hdr.etySize;
+            sendmsg.hdr.etySize = 0;
+            sendmsg.writeFunc = nullptr;
+        }
+    } else if (msg.hdr.etySize > MSGMAXENTITY) {
+        ereport(ERROR, errmsg("kv message of %lu bytes is too large",
+                              msg.hdr.etySize),
+                       errhint("only a message with a response can exceed "
+                               "the channel"));
+    }
+
+    if (isServer_ || stats_ == nullptr) {
+        channel->Input(sendmsg);
+        return;
+    }
+
+    /* stamp the request, so that the worker knows how long it was queued */
+    uint64 start = KVNow();
+    sendmsg.hdr.sendTime = start;
+    channel->Input(sendmsg);
+
+    KVStatsSent(stats_, msg.hdr, leaseWait_, KVNow() - start);
+    leaseWait_ = 0;
 }
 
+/*
+ * The entity of a large message is read from the large channel, after the
+ * header which restores its size. A header received before leaves the record
+ * in the channel until the entity is received or discarded.
+ */
 void KVMessageQueue::Recv(KVMessage& msg, int flag) {
     KVChannel* channel = nullptr;
 
@@ -81,21 +163,59 @@ void KVMessageQueue::Recv(KVMessage& msg, int flag) {
         channel = response_[msg.hdr.rpsId - 1];
     }
 
+    if (!(flag & MSGHEADER) && msg.hdr.largeSize > 0) {
+        if (flag & MSGENTITY) {
+            large_[msg.hdr.rpsId - 1]->Output(msg, MSGENTITY);
+        }
+        channel->Output(msg, MSGDISCARD);
+        return;
+    }
+
     channel->Output(msg, flag);
+    if ((flag & MSGHEADER) && msg.hdr.largeSize > 0) {
+        msg.hdr.etySize = msg.hdr.largeSize;
+        if (flag & MSGENTITY) {
+            large_[msg.hdr.rpsId - 1]->Output(msg, MSGENTITY);
+        }
+    }
+}
+
+/*
+ * The entity of a large message in place, after its header is received. It is
+ * valid until a response is sent on its response channel.
+ */
+char* KVMessageQueue::LargeEntity(const KVMessage& msg) {
+    return large_[msg.hdr.rpsId - 1]->Map(msg.hdr.largeSize);
 }
 
+/*
+ * Block until a response channel is free instead of spinning, the counting
+ * semaphore guarantees that at least one channel can be leased afterwards.
+ * Start the probe from a pid based position to spread the backends. The wait
+ * is counted to the request sent next on the channel.
+ */
 uint32 KVMessageQueue::LeaseResponseChannel() {
+    uint64 waitStart = stats_ == nullptr ? 0 : KVNow();
+    ctrl_->Wait(ResponseFree);
+    if (stats_ != nullptr) {
+        leaseWait_ += KVNow() - waitStart;
+    }
+
+    uint32 start = getpid() % responseCount_;
     while (true) {
-        for (uint32 i = 0; i < MSGRESQUEUELENGTH; i++) {
-            if (response_[i]->Lease()) {
-                return i + 1;
+        for (uint32 i = 0; i < responseCount_; i++) {
+            uint32 index = (start + i) % responseCount_;
+            if (response_[index]->Lease()) {
+                return index + 1;
             }
         }
     }
 }
 
 void KVMessageQueue::UnleaseResponseChannel(uint32 index) {
+    large_[index-1]->Shrink();
     response_[index-1]->Unlease();
+    ctrl_->Notify(ResponseFree);
 }
 
 void KVMessageQueue::SendWithResponse(KVMessage& sendmsg, KVMessage& recvmsg) {
@@ -120,7 +240,7 @@ void KVMessageQueue::Notify(KVCtrlType type) {
 void KVMessageQueue::Stop() {
     request_->Stop();
 
-    for (uint32 i = 0; i < MSGRESQUEUELENGTH; i++) {
+    for (uint32 i = 0; i < responseCount_; i++) {
         response_[i]->Stop();
     }
 }
@@ -18,16 +18,17 @@
 
 
 #include "kv_channel.h"
+#include "kv_stats.h"
 
 
-#define MSGRESQUEUELENGTH 2
-
 
 /*
  * A kv message queue which exchanges messages between different processes as a
- * media. Currently it contains four channels: a circular channel (from client
- * to server), two simple channels (from server to client), and a control
- * channel as a coordinator.
+ * media. Currently it contains a circular channel (from client to server),
+ * a pool of simple channels (from server to client) sized by GUC, and a
+ * control channel as a coordinator. The circular channel can be replaced by a
+ * lock-free channel via GUC. The entities too large for the channels go
+ * through the large channel of the leased response channel.
  * Both client and server will use this message queue, so meaning of send and
  * recv will depend on who calls it.
  */
@@ -45,12 +46,20 @@ class KVMessageQueue {
     void   Wait(KVCtrlType type);
     void   Notify(KVCtrlType type);
     void   Stop();  /* stop to recv kv msg */
+    void   SetStats(KVWorkerStats* stats) { stats_ = stats; };
+    char*  LargeEntity(const KVMessage& msg);
 
   private:
+    bool   IsLargeEntity(const KVMessageHeader& hdr);
+
     KVCtrlChannel* ctrl_;
-    KVCircularChannel* request_;
-    KVSimpleChannel* response_[MSGRESQUEUELENGTH];
+    KVChannel* request_;  /* circular or lock-free channel */
+    KVSimpleChannel** response_;
+    KVLargeChannel** large_;  /* one per response channel */
+    uint32 responseCount_;  /* fixed at creation, same for server and client */
     volatile bool isServer_;
+    KVWorkerStats* stats_ = nullptr;
+    uint64 leaseWait_ = 0;  /* of the lease before the next request */
 };
 
 #endif  /* KV_MQ_H_ */
@@ -14,6 +14,11 @@
  */
 
 #include "kv_posix.h"
+#include <sys/stat.h>
+#ifdef __linux__
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#endif
 
 extern "C" {
 #include "postgres.h"
@@ -60,6 +65,15 @@ void Ftruncate(int fd, off_t length, const char* func) {
     }
 }
 
+off_t Fsize(int fd, const char* func) {
+    struct stat st;
+    if (fstat(fd, &st) == -1) {
+        pg_fprintf(stderr, "%s\n", pg_strerror(errno));
+        ereport(ERROR, errmsg("%s %s failed", func, __func__));
+    }
+    return st.st_size;
+}
+
 void Fclose(int fd, const char* func) {
     if (close(fd) == -1) {
         pg_fprintf(stderr, "%s\n", pg_strerror(errno));
@@ -108,3 +122,29 @@ int SemTryWait(volatile sem_t* sem, const char* func) {
     }
     return ret;
 }
+
+int FutexWait(volatile uint32_t* addr, uint32_t val, const char* func) {
+    #ifdef __linux__
+    if (syscall(SYS_futex, addr, FUTEX_WAIT, val, NULL, NULL, 0) == -1) {
+        if (errno == EINTR || errno == EAGAIN) {
+            return -1;
+        }
+        pg_fprintf(stderr, "%s\n", pg_strerror(errno));
+        ereport(ERROR, errmsg("%s %s failed", func, __func__));
+    }
+    #else
+    if (*addr == val) {
+        usleep(50);
+    }
+    #endif
+    return 0;
+}
+
+void FutexWake(volatile uint32_t* addr, int count, const char* func) {
+    #ifdef __linux__
+    if (syscall(SYS_futex, addr, FUTEX_WAKE, count, NULL, NULL, 0) == -1) {
+        pg_fprintf(stderr, "%s\n", pg_strerror(errno));
+        ereport(ERROR, errmsg("%s %s failed", func, __func__));
+    }
+    #endif
+}
@@ -19,6 +19,7 @@
 #include <sys/mman.h>
 #include <unistd.h>
 #include <semaphore.h>
+#include <stdint.h>
 
 
 /*
@@ -37,8 +38,9 @@ extern void  Munmap(void* addr, size_t len, const char* func);
 /*
  * File OPs
  */
-extern void Ftruncate(int fd, off_t length, const char* func);
-extern void Fclose(int fd, const char* func);
+extern void  Ftruncate(int fd, off_t length, const char* func);
+extern off_t Fsize(int fd, const char* func);
+extern void  Fclose(int fd, const char* func);
 
 /*
  * Semaphore
@@ -50,4 +52,10 @@ extern void SemPost(volatile sem_t* sem, const char* func);
 extern int  SemWait(volatile sem_t* sem, const char* func);
 extern int  SemTryWait(volatile sem_t* sem, const char* func);
 
+/*
+ * Futex (process shared), falls back to polling on other platforms
+ */
+extern int  FutexWait(volatile uint32_t* addr, uint32_t val, const char* func);
+extern void FutexWake(volatile uint32_t* addr, int count, const char* func);
+
 #endif  /* KV_POSIX_H_ */
@@ -0,0 +1,320 @@
+/* Copyright 2020-present VidarDB Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "kv_stats.h"
+#include "kv_posix.h"
+#include <ctime>
+
+extern "C" {
+#include "postgres.h"
+}
+
+
+/*
+ * The slots are mapped by the postmaster while the library is preloaded, so
+ * every kv worker and backend forked afterwards shares them without a name.
+ * They survive the restarts of the workers, and a restarted worker takes its
+ * slot back with the counters.
+ */
+static KVWorkerStats* slots = nullptr;
+
+/* the operation served by this thread, which the responses are counted to */
+static thread_local KVOperation serving = KVOpDummy;
+
+static const char* OperationNames[KVOPERATIONS] = {
+    "dummy",
+    "open",
+    "close",
+    "count",
+    "put",
+    "putbatch",
+    "get",
+    "delete",
+    "deletebatch",
+    "deleterange",
+    "truncate",
+    "load",
+    "sync",
+    "readbatch",
+    "multiget",
+    "sample",
+    "split",
+    "aggregate",
+    "closecursor",
+    #ifdef VIDARDB
+    "rangequery",
+    "clearrangequery",
+    #else
+    "ingest",
+    "drop",
+    #endif
+    "launch",
+    "ready",
+    "terminate",
+};
+
+
+uint64 KVNow() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<uint64>(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+void InitKVStats() {
+    uint64 size = sizeof(KVWorkerStats) * KVSTATSLOTS;
+    slots = static_cast<KVWorkerStats*>(Mmap(nullptr, size,
+                                             PROT_READ | PROT_WRITE,
+                                             MAP_SHARED | MAP_ANONYMOUS, -1, 0,
+                                             __func__));
+    /* anonymous memory is zeroed, hence the slots are free */
+}
+
+static void ResetKVStats(KVWorkerStats* stats) {
+    for (int i = 0; i < KVOPERATIONS; i++) {
+        KVOpStats& op = stats->ops[i];
+        op.calls = 0;
+        op.queueWait = 0;
+        op.serviceTime = 0;
+        op.leaseWait = 0;
+        op.inputWait = 0;
+        op.bytesIn = 0;
+        op.bytesOut = 0;
+        for (int j = 0; j < KVSTATSBUCKETS; j++) {
+            op.latency[j] = 0;
+        }
+    }
+    for (int i = 0; i < KVEngineTickers; i++) {
+        stats->engine[i] = 0;
+    }
+
+    /* bumped instead, the values cached under the previous owner expire */
+    for (int i = 0; i < KVWRITESEQS; i++) {
+        stats->writeSeqs[i].fetch_add(1, memory_order_release);
+    }
+}
+
+/*
+ * Take the slot of the worker back, or a free one, or the one of a stopped
+ * worker, whose counters are reset then. Return nullptr if the library is not
+ * preloaded or all the slots are taken, then the worker runs without them.
+ */
+KVWorkerStats* AttachKVStats(KVWorkerId workerId, KVDatabaseId dbId) {
+    if (slots == nullptr) {
+        return nullptr;
+    }
+
+    KVWorkerStats* stats = FindKVStats(workerId);
+    if (stats != nullptr) {
+        stats->running = true;
+    }
+
+    for (int i = 0; stats == nullptr && i < KVSTATSLOTS; i++) {
+        KVWorkerId expected = InvalidOid;
+        if (slots[i].workerId.compare_exchange_strong(expected, workerId)) {
+            stats = &slots[i];
+            stats->running = true;
+            ResetKVStats(stats);
+        }
+    }
+
+    for (int i = 0; stats == nullptr && i < KVSTATSLOTS; i++) {
+        bool expected = false;
+        if (slots[i].running.compare_exchange_strong(expected, true)) {
+            stats = &slots[i];
+            stats->workerId = workerId;
+            ResetKVStats(stats);
+        }
+    }
+
+    if (stats != nullptr) {
+        stats->dbId = dbId;
+    }
+    return stats;
+}
+
+/*
+ * The counters are kept until the slot is taken by another worker, so that
+ * the statistics of a stopped worker can still be read.
+ */
+void DetachKVStats(KVWorkerStats* stats) {
+    if (stats != nullptr) {
+        stats->running = false;
+    }
+}
+
+KVWorkerStats* FindKVStats(KVWorkerId workerId) {
+    if (slots == nullptr) {
+        return nullptr;
+    }
+
+    for (int i = 0; i < KVSTATSLOTS; i++) {
+        if (slots[i].workerId == workerId) {
+            return &slots[i];
+        }
+    }
+    return nullptr;
+}
+
+static int LatencyBucket(uint64 nanos) {
+    uint64 micros = nanos / 1000;
+    int bucket = micros == 0 ? 0 : 64 - __builtin_clzll(micros);
+    return bucket < KVSTATSBUCKETS ? bucket : KVSTATSBUCKETS - 1;
+}
+
+void KVStatsServing(KVOperation op) {
+    serving = op;
+}
+
+/*
+ * Count a request whose service started at the given time. The queue wait is
+ * known only if the backend stamped the request, both sides read the same
+ * monotonic clock.
+ */
+void KVStatsServed(KVWorkerStats* stats, const KVMessageHeader& hdr,
+                   uint64 start) {
+    if (stats == nullptr || hdr.op <= KVOpDummy || hdr.op >= KVOPERATIONS) {
+        return;
+    }
+
+    uint64 service = KVNow() - start;
+    KVOpStats& op = stats->ops[hdr.op];
+    op.calls.fetch_add(1, memory_order_relaxed);
+    if (hdr.sendTime > 0 && hdr.sendTime < start) {
+        op.queueWait.fetch_add(start - hdr.sendTime, memory_order_relaxed);
+    }
+    op.serviceTime.fetch_add(service, memory_order_relaxed);
+    op.bytesIn.fetch_add(hdr.etySize, memory_order_relaxed);
+    op.latency[LatencyBucket(service)].fetch_add(1, memory_order_relaxed);
+    serving = KVOpDummy;
+}
+
+void KVStatsResponded(KVWorkerStats* stats, uint64 bytes) {
+    if (stats == nullptr || serving == KVOpDummy) {
+        return;
+    }
+
+    stats->ops[serving].bytesOut.fetch_add(bytes, memory_order_relaxed);
+}
+
+/*
+ * Publish a write of the relation, after it is applied and before it is
+ * answered. A value cached by a backend stays valid while the sequence read
+ * before its lookup is unchanged.
+ */
+void KVStatsWritten(KVWorkerStats* stats, KVRelationId relId) {
+    if (stats == nullptr) {
+        return;
+    }
+
+    stats->writeSeqs[relId % KVWRITESEQS].fetch_add(1, memory_order_release);
+}
+
+void KVStatsSent(KVWorkerStats* stats, const KVMessageHeader& hdr,
+                 uint64 leaseWait, uint64 inputWait) {
+    if (stats == nullptr || hdr.op <= KVOpDummy || hdr.op >= KVOPERATIONS) {
+        return;
+    }
+
+    KVOpStats& op = stats->ops[hdr.op];
+    op.leaseWait.fetch_add(leaseWait, memory_order_relaxed);
+    op.inputWait.fetch_add(inputWait, memory_order_relaxed);
+}
+
+
+/*
+ * The write sequence of the relation, false if the writes of the worker are
+ * not published there, when it has no slot or the slot is taken by another.
+ */
+bool KVWriteSeq(KVWorkerStats* stats, KVWorkerId workerId, KVRelationId relId,
+                uint64* seq) {
+    if (stats == nullptr) {
+        return false;
+    }
+
+    /* the owner is checked afterwards, a new owner bumps the sequences */
+    *seq = stats->writeSeqs[relId % KVWRITESEQS].load(memory_order_acquire);
+    return stats->workerId == workerId;
+}
+
+/*
+ * C API of the statistics, see kv_fdw_stats()
+ */
+
+uint32 KVReadOpStats(KVOpStatsEntry** entries) {
+    *entries = static_cast<KVOpStatsEntry*>(
+        palloc0(sizeof(KVOpStatsEntry) * KVSTATSLOTS * KVOPERATIONS));
+    if (slots == nullptr) {
+        return 0;
+    }
+
+    uint32 count = 0;
+    for (int i = 0; i < KVSTATSLOTS; i++) {
+        KVWorkerStats* stats = &slots[i];
+        KVWorkerId workerId = stats->workerId;
+        if (workerId == InvalidOid) {
+            continue;
+        }
+
+        for (int j = KVOpDummy + 1; j < KVOPERATIONS; j++) {
+            KVOpStats& op = stats->ops[j];
+            if (op.calls == 0) {
+                continue;
+            }
+
+            KVOpStatsEntry* entry = &(*entries)[count++];
+            entry->workerId = workerId;
+            entry->dbId = stats->dbId;
+            entry->operation = OperationNames[j];
+            entry->calls = op.calls;
+            entry->queueWait = op.queueWait;
+            entry->serviceTime = op.serviceTime;
+            entry->leaseWait = op.leaseWait;
+            entry->inputWait = op.inputWait;
+            entry->bytesIn = op.bytesIn;
+            entry->bytesOut = op.bytesOut;
+            for (int k = 0; k < KVSTATSBUCKETS; k++) {
+                entry->latency[k] = op.latency[k];
+            }
+        }
+    }
+
+    return count;
+}
+
+uint32 KVReadEngineStats(KVEngineStatsEntry** entries) {
+    *entries = static_cast<KVEngineStatsEntry*>(
+        palloc0(sizeof(KVEngineStatsEntry) * KVSTATSLOTS));
+    if (slots == nullptr) {
+        return 0;
+    }
+
+    uint32 count = 0;
+    for (int i = 0; i < KVSTATSLOTS; i++) {
+        KVWorkerStats* stats = &slots[i];
+        KVWorkerId workerId = stats->workerId;
+        if (workerId == InvalidOid) {
+            continue;
+        }
+
+        KVEngineStatsEntry* entry = &(*entries)[count++];
+        entry->workerId = workerId;
+        entry->dbId = stats->dbId;
+        for (int j = 0; j < KVEngineTickers; j++) {
+            entry->tickers[j] = stats->engine[j];
+        }
+    }
+
+    return count;
+}
@@ -0,0 +1,81 @@
+/* Copyright 2020-present VidarDB Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef KV_STATS_H_
+#define KV_STATS_H_
+
+
+#include <atomic>
+using namespace std;
+
+#include "kv_message.h"
+
+
+#define KVOPERATIONS (KVOpTerminate + 1)
+#define KVWRITESEQS  64  /* write sequences of a worker, by relation */
+
+
+/*
+ * Counters of an operation, times are in nanoseconds. The wait for a free
+ * response channel and for room in the request channel are seen by the
+ * backends, the queue wait and the service time by the worker. The histogram
+ * counts the service times by the power of two of their microseconds.
+ */
+struct KVOpStats {
+    atomic<uint64> calls;
+    atomic<uint64> queueWait;    /* from sent by the backend to served */
+    atomic<uint64> serviceTime;
+    atomic<uint64> leaseWait;
+    atomic<uint64> inputWait;
+    atomic<uint64> bytesIn;      /* request entities */
+    atomic<uint64> bytesOut;     /* response entities and batches */
+    atomic<uint64> latency[KVSTATSBUCKETS];
+};
+
+/*
+ * A slot of the statistics owned by a kv worker while it runs, and kept after
+ * it stops until another worker needs the slot. The backends talking to the
+ * worker find it by the worker id. The write sequences only grow, the point
+ * cache of a backend compares them, see KVStatsWritten.
+ */
+struct KVWorkerStats {
+    atomic<KVWorkerId> workerId;  /* InvalidOid if the slot is free */
+    atomic<KVDatabaseId> dbId;
+    atomic<bool> running;
+    KVOpStats ops[KVOPERATIONS];
+    atomic<uint64> engine[KVEngineTickers];  /* copied from the engine */
+    atomic<uint64> writeSeqs[KVWRITESEQS];
+};
+
+extern uint64         KVNow();
+extern void           InitKVStats();
+extern KVWorkerStats* AttachKVStats(KVWorkerId workerId, KVDatabaseId dbId);
+extern void           DetachKVStats(KVWorkerStats* stats);
+extern KVWorkerStats* FindKVStats(KVWorkerId workerId);
+
+/* the worker side, served by the calling thread */
+extern void KVStatsServing(KVOperation op);
+extern void KVStatsServed(KVWorkerStats* stats, const KVMessageHeader& hdr,
+                          uint64 start);
+extern void KVStatsResponded(KVWorkerStats* stats, uint64 bytes);
+extern void KVStatsWritten(KVWorkerStats* stats, KVRelationId relId);
+
+/* the backend side */
+extern void KVStatsSent(KVWorkerStats* stats, const KVMessageHeader& hdr,
+                        uint64 leaseWait, uint64 inputWait);
+extern bool KVWriteSeq(KVWorkerStats* stats, KVWorkerId workerId,
+                       KVRelationId relId, uint64* seq);
+
+#endif  /* KV_STATS_H_ */
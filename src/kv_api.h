@@ -33,6 +33,7 @@ extern "C" {
 
 
 #define KVAllRelationId InvalidOid
+#define PUTBATCHSIZE    32768  /* flush threshold of the write batches */
 
 typedef Oid             KVDatabaseId;
 typedef Oid             KVRelationId;
@@ -42,13 +43,44 @@ typedef uint64          KVOpId;
 
 typedef struct ComparatorOpts {
     Oid   cmpFuncOid;
+    Oid   attrTypeOid;  /* picks a native comparator, see NewDataTypeComparator */
     Oid   attrCollOid;
     bool  attrByVal;
     int16 attrLength;
+    bool  orderedKey;  /* keys are memcmp-able, use the bytewise comparator */
 } ComparatorOpts;
 
+#define KVMAXLEVELS     7      /* levels of the storage engine by default */
+
+typedef enum KVCompression {
+    KVCompressionDefault = 0,  /* the engine's default of the level */
+    KVCompressionNone,
+    KVCompressionSnappy,
+    KVCompressionLZ4,
+    KVCompressionZSTD,
+    KVCompressionZlib,
+} KVCompression;
+
+/* tuning of the storage engine from the table and server options, 0: default */
+typedef struct EngineOpts {
+    int32 bloomBits;           /* bits per key of the bloom filter */
+    int32 blockSize;           /* bytes */
+    int32 writeBufferSize;     /* bytes */
+    int32 backgroundJobs;      /* flushes and compactions in parallel */
+    int32 compressionLevels;   /* levels given in compression */
+    int8  compression[KVMAXLEVELS];
+} EngineOpts;
+
+/* durability of the writes into a table, from the table and server options */
+typedef struct WriteOpts {
+    bool sync;        /* sync the log before a write is acknowledged */
+    bool disableWAL;  /* no log, for tables which can be rebuilt */
+} WriteOpts;
+
 typedef struct OpenArgs {
     ComparatorOpts opts;
+    EngineOpts     engine;
+    WriteOpts      write;
     #ifdef VIDARDB
     bool           useColumn;
     int            attrCount;
@@ -63,11 +95,28 @@ typedef struct PutArgs {
     char*  val;
 } PutArgs;
 
+/*
+ * Rows are packed as [uint64 keyLen][key][uint64 valLen][val], the same
+ * layout returned by ReadBatch.
+ */
+typedef struct PutBatchArgs {
+    uint64 bufLen;
+    char*  buf;
+    bool   pipelined;  /* not waiting for the worker, see KVSyncRequest */
+} PutBatchArgs;
+
 typedef struct DeleteArgs {
     uint64 keyLen;
     char*  key;
 } DeleteArgs;
 
+/* keys are packed as [uint64 keyLen][key] */
+typedef struct DeleteBatchArgs {
+    uint64 bufLen;
+    char*  buf;
+    bool   pipelined;  /* not waiting for the worker, see KVSyncRequest */
+} DeleteBatchArgs;
+
 typedef struct GetArgs {
     uint64  keyLen;
     char*   key;
@@ -75,17 +124,98 @@ typedef struct GetArgs {
     char**  val;
 } GetArgs;
 
+/* serialized key bounds of a scan, an empty bound is unbounded */
+typedef struct ScanBounds {
+    uint64     startLen;
+    uint64     limitLen;
+    char*      start;           /* inclusive */
+    char*      limit;
+    bool       limitInclusive;
+    bool       reverse;         /* from the limit down to the start */
+} ScanBounds;
+
+/* all the keys within the bounds are deleted by the worker, see DelRange */
+typedef struct DeleteRangeArgs {
+    ScanBounds* bounds;
+    uint64*     count;          /* keys deleted */
+} DeleteRangeArgs;
+
 typedef struct ReadBatchArgs {
-    KVOpId     opid;
-    char**     buf;
-    uint64*    bufLen;
+    KVOpId      opid;
+    char**      buf;
+    uint64*     bufLen;
+    ScanBounds* bounds;         /* only for the first batch, otherwise NULL */
 } ReadBatchArgs;
 
+/*
+ * Keys are packed as [uint64 keyLen][key], the found records come back the
+ * same way as ReadBatch, and the rest batches are read by ReadBatch too.
+ */
+typedef struct MultiGetArgs {
+    KVOpId      opid;
+    char**      buf;
+    uint64*     bufLen;
+    uint64      keysLen;
+    char*       keys;
+} MultiGetArgs;
+
+/* records sampled by the worker, read in the same way as MultiGet */
+typedef struct SampleArgs {
+    KVOpId      opid;
+    char**      buf;
+    uint64*     bufLen;
+    uint64      sampleSize;
+    uint64      rowCount;    /* rows of the table, set by the response */
+} SampleArgs;
+
+/* keys splitting the bounds into pieces, packed as [uint64 keyLen][key] */
+typedef struct SplitArgs {
+    uint32      maxSplits;
+    ScanBounds* bounds;
+    char**      buf;            /* palloc'd */
+    uint64*     bufLen;
+} SplitArgs;
+
+/* aggregates computed by the worker, see AggregateRecords */
+typedef enum KVAggregateKind {
+    KVAggCount = 0,         /* count(*) */
+    KVAggCountAttr,         /* count(attribute) */
+    KVAggMinKey,
+    KVAggMaxKey,
+    KVAggSumInt16,
+    KVAggSumInt32,
+    KVAggSumFloat64,
+} KVAggregateKind;
+
+typedef struct KVAggregate {
+    int32  kind;
+    int32  index;           /* of the attribute in the value, 0 for the second */
+} KVAggregate;
+
+/*
+ * Results of the aggregates in order, for the rows or the non-null values,
+ * followed by the min and max keys as [uint64 keyLen][key] in order too.
+ */
+typedef struct KVAggregateResult {
+    uint64 count;
+    int64  intSum;
+    double floatSum;
+} KVAggregateResult;
+
+typedef struct AggregateArgs {
+    bool         estimate;  /* count(*) from the estimate of the engine */
+    uint32       aggCount;
+    KVAggregate* aggs;
+    char**       buf;       /* palloc'd */
+    uint64*      bufLen;
+} AggregateArgs;
+
 typedef struct CloseCursorArgs {
     KVOpId     opid;
-    void*      buf;
 } CloseCursorArgs;
 
+#define KVERRORSIZE     256    /* status of a failed request */
+
 #ifdef VIDARDB
 typedef struct RangeQueryOpts {
     uint64      startLen;
@@ -103,23 +233,116 @@ typedef struct RangeQueryArgs {
     uint64*         bufLen;
     RangeQueryOpts* opts;
 } RangeQueryArgs;
+
+/*
+ * A batch of a range query is columnar, the keys and then the value columns
+ * queried in the attribute order:
+ *
+ *   [uint64 rows][uint64 columns]
+ *   keys:   [uint64 offsets[rows + 1]][data]
+ *   column: [null bitmap][uint64 offsets[rows + 1]][data]
+ *
+ * The value of a row spans offsets[row] to offsets[row + 1] of the data of
+ * its column, and a set bit of the bitmap is a null. Every part starts at a
+ * multiple of 8 bytes from the batch.
+ */
+#define COLUMNBATCHALIGN(len)  (((len) + 7) & ~((uint64) 7))
+#define COLUMNBITMAPSIZE(rows) COLUMNBATCHALIGN(((rows) + 7) / 8)
+#else
+/* sorted string table built by the backend, moved into the db on ingestion */
+typedef struct IngestArgs {
+    char* path;
+    char  error[KVERRORSIZE];  /* status of the engine if it fails */
+} IngestArgs;
+
+/* instance of the database whose column family of the table is dropped */
+typedef struct DropArgs {
+    char* path;
+} DropArgs;
 #endif
 
 
+/* statistics of the kv workers, see kv_fdw_stats() */
+
+#define KVSTATSLOTS     128    /* kv workers with statistics at the same time */
+#define KVSTATSBUCKETS  24     /* powers of two of microseconds, up to seconds */
+
+typedef enum KVEngineTicker {
+    KVEngineCacheHits = 0,
+    KVEngineCacheMisses,
+    KVEngineStallMicros,
+    KVEngineCompactReadBytes,
+    KVEngineCompactWriteBytes,
+    KVEngineTickers,
+} KVEngineTicker;
+
+/* times are in nanoseconds, see KVOpStats */
+typedef struct KVOpStatsEntry {
+    KVWorkerId   workerId;
+    KVDatabaseId dbId;
+    const char*  operation;
+    uint64       calls;
+    uint64       queueWait;
+    uint64       serviceTime;
+    uint64       leaseWait;
+    uint64       inputWait;
+    uint64       bytesIn;
+    uint64       bytesOut;
+    uint64       latency[KVSTATSBUCKETS];
+} KVOpStatsEntry;
+
+typedef struct KVEngineStatsEntry {
+    KVWorkerId   workerId;
+    KVDatabaseId dbId;
+    uint64       tickers[KVEngineTickers];
+} KVEngineStatsEntry;
+
+/* the returned entries are palloc'd, only the called operations are returned */
+extern uint32 KVReadOpStats(KVOpStatsEntry** entries);
+extern uint32 KVReadEngineStats(KVEngineStatsEntry** entries);
+
+
+/* GUC variables */
+
+extern int  KVWorkerThreads;
+extern int  KVResponseChannels;
+extern bool KVUseLockFreeChannel;
+extern int  KVIdleWorkers;
+extern bool KVSharedStorage;
+extern int  KVBlockCacheSize;
+extern bool KVDebugTrace;
+extern bool KVPipelinedWrites;
+extern int  KVPointCacheSize;
+
+/* the debug prints of the callbacks, see kv_fdw.debug_trace */
+#define KV_TRACE(...) do { if (KVDebugTrace) printf(__VA_ARGS__); } while (0)
+
 /* Communication API between kv client and kv worker */
 
 extern void   KVOpenRequest(KVRelationId rid, OpenArgs* args);
 extern void   KVCloseRequest(KVRelationId rid);
 extern uint64 KVCountRequest(KVRelationId rid);
 extern bool   KVPutRequest(KVRelationId rid, PutArgs* args);
+extern bool   KVPutBatchRequest(KVRelationId rid, PutBatchArgs* args);
 extern bool   KVGetRequest(KVRelationId rid, GetArgs* args);
 extern bool   KVDeleteRequest(KVRelationId rid, DeleteArgs* args);
+extern bool   KVDeleteBatchRequest(KVRelationId rid, DeleteBatchArgs* args);
+extern bool   KVDeleteRangeRequest(KVRelationId rid, DeleteRangeArgs* args);
+extern bool   KVTruncateRequest(KVRelationId rid);
 extern void   KVLoadRequest(KVRelationId rid, PutArgs* args);
+extern uint64 KVSyncRequest(KVRelationId rid, bool wait);
 extern bool   KVReadBatchRequest(KVRelationId rid, ReadBatchArgs* args);
+extern bool   KVMultiGetRequest(KVRelationId rid, MultiGetArgs* args);
+extern bool   KVSampleRequest(KVRelationId rid, SampleArgs* args);
+extern void   KVSplitRequest(KVRelationId rid, SplitArgs* args);
+extern bool   KVAggregateRequest(KVRelationId rid, AggregateArgs* args);
 extern void   KVCloseCursorRequest(KVRelationId rid, CloseCursorArgs* args);
 #ifdef VIDARDB
 extern bool   KVRangeQueryRequest(KVRelationId rid, RangeQueryArgs* args);
 extern void   KVClearRangeQueryRequest(KVRelationId rid, RangeQueryArgs* args);
+#else
+extern bool   KVIngestRequest(KVRelationId rid, IngestArgs* args);
+extern bool   KVDropRequest(KVRelationId rid, DropArgs* args);
 #endif
 extern void   KVTerminateRequest(KVRelationId rid, KVDatabaseId dbId);
 
@@ -16,6 +16,8 @@
 #include "kv_fdw.h"
 #include "kv_api.h"
 
+#include <math.h>
+
 #include "foreign/fdwapi.h"
 #include "optimizer/pathnode.h"
 #include "optimizer/planmain.h"
@@ -26,11 +28,30 @@
 #include "access/tuptoaster.h"
 #include "catalog/pg_operator.h"
 #include "utils/syscache.h"
+#include "utils/lsyscache.h"
+#include "utils/typcache.h"
 #include "access/table.h"
-#ifdef VIDARDB
-#include "parser/parsetree.h"
+#include "access/stratnum.h"
+#include "nodes/nodeFuncs.h"
+#include "parser/parse_coerce.h"
+#include "executor/executor.h"
+#include "commands/explain.h"
+#include "utils/array.h"
 #include "optimizer/optimizer.h"
-#endif
+#include "optimizer/paths.h"
+#include "optimizer/plancat.h"
+#include "optimizer/cost.h"
+#include "access/parallel.h"
+#include "port/atomics.h"
+#include "access/htup_details.h"
+#include "parser/parsetree.h"
+#include "optimizer/tlist.h"
+#include "catalog/pg_aggregate.h"
+#include "catalog/pg_namespace.h"
+#include "catalog/pg_type.h"
+#include "utils/builtins.h"
+#include "access/reloptions.h"
+#include "commands/defrem.h"
 
 
 PG_MODULE_MAGIC;
@@ -56,6 +77,11 @@ typedef struct TablePlanState {
  */
 typedef struct TableReadState {
     bool isKeyBased;
+    bool isMultiKey;   /* key = ANY (array), served by one multi get */
+    StringInfo keys;   /* keys of the multi get, packed as [len][key] */
+    ExprState* keyExpr;  /* value of the key-based qual */
+    ScanBounds* bounds;  /* key range of a batch scan */
+    bool reverse;        /* return rows in the descending key order */
     uint64 operationId;
     bool done;
     StringInfo key;
@@ -63,15 +89,70 @@ typedef struct TableReadState {
     size_t bufLen; /* shared mem length, no next batch if it is 0 */
     char* next;    /* pointer to the next data entry for IterateForeignScan */
     bool hasNext;  /* whether a next batch from RangeQuery or ReadBatch*/
+    bool orderedKey; /* order-preserving key encoding */
+    KVTupleCodec* codec;
 
     #ifdef VIDARDB
     bool useColumn;
     List* targetAttrs;    /* attributes in select, where, group */
+    size_t batchCapacity;
+
+    /* the columnar batch of a range query, see kv_api.h */
+    uint64 batchRows;
+    uint64 batchRow;      /* next row to return */
+    bool batchKey;        /* is the key among the target attributes? */
+    uint64* keyOffsets;
+    char* keyData;
+    int valueCount;       /* value columns of a batch */
+    AttrNumber* valueAttrs;
+    uint8** columnNulls;
+    uint64** columnOffsets;
+    char** columnData;
     #endif
 
+    /* a parallel scan reads the chunks claimed from ParallelScanState */
+    bool parallel;
+    struct ParallelScanState* parallelState;
+    ScanBounds* qualBounds;  /* bounds of the quals, split into the chunks */
+    ScanBounds chunkBounds;
+    bool chunkStarted;       /* has the claimed chunk sent its first request? */
+    bool chunkClaimed;       /* the whole range is read without shared state */
+    char* splits;            /* split keys of the leader, for the shared state */
+    uint64 splitsLen;
+
     bool execExplainOnly;
 } TableReadState;
 
+/*
+ * Shared by the participants of a parallel scan, the bounds are split into
+ * chunks at the split keys, and each participant claims the next chunk once
+ * it finishes the previous one.
+ */
+typedef struct ParallelScanState {
+    pg_atomic_uint32 next;      /* next chunk to claim */
+    uint32           chunks;
+    uint64           splitsLen;
+    char             splits[FLEXIBLE_ARRAY_MEMBER]; /* [uint64 keyLen][key] */
+} ParallelScanState;
+
+/*
+ * The aggregate state is for aggregates computed by the kv worker, a scan of
+ * no relation which returns a single row of the aggregates.
+ *
+ * It is set up in BeginForeignScan when the plan has no scan relation.
+ */
+typedef struct TableAggregateState {
+    Oid relationId;
+    uint32 aggCount;
+    KVAggregate* aggs;
+    bool* averages;       /* avg is the sum divided by the count */
+    bool estimate;        /* count(*) from the estimate of the engine */
+    KVTupleCodec* codec;  /* decodes the min and max keys */
+    bool done;
+
+    bool execExplainOnly;
+} TableAggregateState;
+
 /*
  * The modify state is for maintaining state of modify operations.
  *
@@ -81,22 +162,61 @@ typedef struct TableReadState {
  */
 typedef struct TableWriteState {
     CmdType operation;
+    StringInfo batch;       /* rows or deleted keys not sent to kv worker yet */
+    bool    pipelined;      /* batches not waited for, see SyncWrites */
+    bool    orderedKey;     /* order-preserving key encoding */
+    KVTupleCodec* codec;
     #ifdef VIDARDB
     bool    useColumn;
     List*   targetAttrs;    /* attributes in select, where, group */
     #endif
 } TableWriteState;
 
+/*
+ * The direct modify state is for a delete whose quals are all key bounds,
+ * which the kv worker serves alone without returning the rows.
+ *
+ * It is set up in BeginDirectModify and stashed in node->fdw_state and
+ * subsequently used in IterateDirectModify and EndDirectModify.
+ */
+typedef struct TableDirectModifyState {
+    ScanBounds* bounds;
+    bool empty;           /* a null value in the quals, nothing to delete */
+    bool done;
+
+    bool execExplainOnly;
+} TableDirectModifyState;
+
+/* bounds of the key collected from the range quals of a scan */
+typedef struct KeyRangeQual {
+    bool  hasLower;
+    bool  hasUpper;
+    bool  upperInclusive;
+    bool  empty;    /* a null value, no key matches */
+    Datum lower;    /* always inclusive, the qual filters the equal key of > */
+    Datum upper;
+} KeyRangeQual;
+
+/* to sort the keys of a multi get in the order of the key type */
+typedef struct KeySortContext {
+    FmgrInfo* cmp;
+    Oid       collation;
+    bool      reverse;
+} KeySortContext;
+
 /*
  * in backend process scope
  */
 
 static uint64 operationId = 0;  /* a SQL might cause multiple scans */
 
+/* chunks of a parallel scan per participant */
+#define PARALLELCHUNKS 4
+
 
 static void GetForeignRelSize(PlannerInfo* root, RelOptInfo* baserel,
                               Oid foreignTableId) {
-    printf("\n-----------------%s----------------------\n", __func__);
+    KV_TRACE("\n-----------------%s----------------------\n", __func__);
     /*
      * Obtain relation size estimates for a foreign table. This is called at
      * the beginning of planning for a query that scans a foreign table. root
@@ -116,18 +236,7 @@ static void GetForeignRelSize(PlannerInfo* root, RelOptInfo* baserel,
 
     ereport(DEBUG1, errmsg("entering function %s", __func__));
 
-    /*
-     * min & max will call GetForeignRelSize & GetForeignPaths multiple times,
-     * we should open & close db multiple times.
-     */
-    OpenArgs args;
-
-    Relation relation = table_open(foreignTableId, AccessShareLock);
-    SetRelationComparatorOpts(relation, &args.opts);
-    table_close(relation, AccessShareLock);
-
     KVFdwOptions* fdwOptions = KVGetOptions(foreignTableId);
-    args.path = fdwOptions->filename;
 
     #ifdef VIDARDB
     TablePlanState* planState = palloc0(sizeof(TablePlanState));
@@ -155,7 +264,7 @@ static void GetForeignRelSize(PlannerInfo* root, RelOptInfo* baserel,
         pull_varattnos((Node*) restrictInfo->clause, baserel->relid, &attrs);
     }
 
-    printf("\n");
+    KV_TRACE("\n");
     planState->targetAttrs = NIL;
     int col = -1;
     while ((col = bms_next_member(attrs, col)) >= 0) {
@@ -165,9 +274,9 @@ static void GetForeignRelSize(PlannerInfo* root, RelOptInfo* baserel,
             ereport(ERROR, errmsg("InvalidAttrNumber in %s", __func__));
         }
         planState->targetAttrs = lappend_int(planState->targetAttrs, attr);
-        printf(" %d ", attr);
+        KV_TRACE(" %d ", attr);
     }
-    printf("\n");
+    KV_TRACE("\n");
 
     /* count(*), no attributes show up, so we have to manually add key column */
     if (planState->targetAttrs == NIL) {
@@ -175,20 +284,279 @@ static void GetForeignRelSize(PlannerInfo* root, RelOptInfo* baserel,
     }
 
     baserel->fdw_private = planState;
+    #endif
 
-    args.useColumn = planState->fdwOptions->useColumn;
-    args.attrCount = planState->attrCount;
+    /*
+     * ANALYZE keeps the size in pg_class, which get_relation_info copies. Only
+     * a table never analyzed asks the worker for the estimated count.
+     */
+    if (baserel->pages == 0 && baserel->tuples == 0) {
+        /*
+         * min & max will call GetForeignRelSize & GetForeignPaths multiple
+         * times, we should open & close db multiple times.
+         */
+        OpenArgs args;
+
+        Relation relation = table_open(foreignTableId, AccessShareLock);
+        SetRelationComparatorOpts(relation, &args.opts);
+        table_close(relation, AccessShareLock);
+
+        args.path = fdwOptions->filename;
+        args.engine = fdwOptions->engine;
+        args.write = fdwOptions->write;
+        #ifdef VIDARDB
+        args.useColumn = planState->fdwOptions->useColumn;
+        args.attrCount = planState->attrCount;
+        #endif
+
+        KVOpenRequest(foreignTableId, &args);
+        baserel->tuples = KVCountRequest(foreignTableId);
+        KVCloseRequest(foreignTableId);
+    }
+
+    Selectivity selectivity = clauselist_selectivity(root,
+                                                     baserel->baserestrictinfo,
+                                                     0, JOIN_INNER, NULL);
+    baserel->rows = clamp_row_est(baserel->tuples * selectivity);
+}
+
+/*
+ * Whether key = value can be looked up: the operator is the equality of the
+ * key's btree family and the value can be implicitly coerced to the key type.
+ */
+static bool IsKeyEquality(Oid opno, Oid inputCollation, Oid keyType,
+                          Oid keyCollation, Oid valueType) {
+    if (!OidIsValid(opno) || inputCollation != keyCollation) {
+        return false;
+    }
+
+    TypeCacheEntry* typeEntry = lookup_type_cache(keyType,
+                                                  TYPECACHE_BTREE_OPFAMILY);
+    if (!OidIsValid(typeEntry->btree_opf) ||
+        get_op_opfamily_strategy(opno, typeEntry->btree_opf) !=
+        BTEqualStrategyNumber) {
+        return false;
+    }
+
+    return valueType == keyType ||
+           can_coerce_type(1, &valueType, &keyType, COERCION_IMPLICIT);
+}
+
+static bool IsKeyVar(Node* node, Index relid) {
+    if (node && IsA(node, RelabelType)) {
+        node = (Node*) ((RelabelType*) node)->arg;
+    }
+
+    return node && IsA(node, Var) && ((Var*) node)->varno == relid &&
+           ((Var*) node)->varattno == 1 && ((Var*) node)->varlevelsup == 0;
+}
+
+static bool KeyMemberMatches(PlannerInfo* root, RelOptInfo* baserel,
+                             EquivalenceClass* ec, EquivalenceMember* em,
+                             void* arg) {
+    return IsKeyVar((Node*) em->em_expr, baserel->relid);
+}
+
+/*
+ * Whether the join clause is key = outer expression, which GetKeyBasedQual
+ * serves with a Get when the outer side is passed in as a param.
+ */
+static bool IsKeyJoinClause(PlannerInfo* root, RestrictInfo* restrictInfo,
+                            RelOptInfo* baserel) {
+    Node* clause = (Node*) restrictInfo->clause;
+    if (!IsA(clause, OpExpr) || list_length(((OpExpr*) clause)->args) != 2) {
+        return false;
+    }
+
+    OpExpr* op = (OpExpr*) clause;
+    Node* left = list_nth(op->args, 0);
+    Node* right = list_nth(op->args, 1);
+    Relids outer = restrictInfo->right_relids;
+    Oid opno = op->opno;
+    if (!IsKeyVar(left, baserel->relid)) {
+        Node* temp = left;
+        left = right;
+        right = temp;
+        outer = restrictInfo->left_relids;
+        opno = get_commutator(opno);
+    }
+
+    if (!IsKeyVar(left, baserel->relid) ||
+        bms_is_member(baserel->relid, outer) ||
+        contain_volatile_functions(right) ||
+        !join_clause_is_movable_to(restrictInfo, baserel)) {
+        return false;
+    }
+
+    Oid keyType, keyCollation;
+    int32 keyTypmod;
+    get_atttypetypmodcoll(planner_rt_fetch(baserel->relid, root)->relid, 1,
+                          &keyType, &keyTypmod, &keyCollation);
+    return IsKeyEquality(opno, op->inputcollid, keyType, keyCollation,
+                         exprType(right));
+}
+
+/*
+ * Add a path per outer rel which the key can be joined to by an equality,
+ * so that a nested loop looks up the key of each outer row instead of
+ * scanning the whole table.
+ */
+static void AddKeyParamPaths(PlannerInfo* root, RelOptInfo* baserel) {
+    List* clauses =
+        generate_implied_equalities_for_column(root, baserel, KeyMemberMatches,
+                                               NULL,
+                                               baserel->lateral_referencers);
+
+    ListCell* lc;
+    foreach (lc, baserel->joininfo) {
+        clauses = lappend(clauses, lfirst(lc));
+    }
+
+    List* outers = NIL;
+    foreach (lc, clauses) {
+        RestrictInfo* restrictInfo = lfirst_node(RestrictInfo, lc);
+        if (!IsKeyJoinClause(root, restrictInfo, baserel)) {
+            continue;
+        }
+
+        Relids outer = bms_union(restrictInfo->clause_relids,
+                                 baserel->lateral_relids);
+        outer = bms_del_member(outer, baserel->relid);
+        if (bms_is_empty(outer)) {
+            continue;
+        }
+
+        ListCell* cell;
+        bool found = false;
+        foreach (cell, outers) {
+            if (bms_equal(outer, (Relids) lfirst(cell))) {
+                found = true;
+                break;
+            }
+        }
+        if (found) {
+            continue;
+        }
+        outers = lappend(outers, outer);
+
+        /* the key is unique, one round trip per outer row */
+        get_baserel_parampathinfo(root, baserel, outer);
+        Cost startupCost = 0;
+        Cost totalCost = startupCost + 1;
+        add_path(baserel,
+                 (Path *) create_foreignscan_path(root, baserel,
+                                                  NULL,  /* default pathtarget */
+                                                  1,     /* rows */
+                                                  startupCost, totalCost,
+                                                  NIL,   /* no pathkeys */
+                                                  outer,
+                                                  NULL,  /* no extra plan */
+                                                  NIL)); /* no fdw_private data */
+    }
+}
+
+/*
+ * Add the paths returning the rows in the key order, forward and backward,
+ * if the order is useful, e.g. to ORDER BY or a merge join. The storage
+ * keeps the keys in the order of the key's default btree opclass.
+ */
+static void AddKeyOrderPaths(PlannerInfo* root, RelOptInfo* baserel,
+                             Oid foreignTableId, Cost startupCost,
+                             Cost totalCost) {
+    #ifdef VIDARDB
+    /* the column store does not promise the order of a range query */
+    TablePlanState* planState = baserel->fdw_private;
+    if (planState->fdwOptions->useColumn) {
+        return;
+    }
     #endif
 
-    KVOpenRequest(foreignTableId, &args);
-    /* TODO: better estimation */
-    baserel->rows = KVCountRequest(foreignTableId);
-    KVCloseRequest(foreignTableId);
+    Oid keyType, keyCollation;
+    int32 keyTypmod;
+    get_atttypetypmodcoll(foreignTableId, 1, &keyType, &keyTypmod,
+                          &keyCollation);
+    TypeCacheEntry* typeEntry = lookup_type_cache(keyType,
+        TYPECACHE_LT_OPR | TYPECACHE_GT_OPR);
+    Expr* key = (Expr*) makeVar(baserel->relid, 1, keyType, keyTypmod,
+                                keyCollation, 0);
+
+    for (int reverse = 0; reverse <= 1; reverse++) {
+        Oid opno = reverse ? typeEntry->gt_opr : typeEntry->lt_opr;
+        if (!OidIsValid(opno)) {
+            continue;
+        }
+
+        /* only the existing orders, those nobody asks for are not built */
+        List* pathkeys = build_expression_pathkey(root, key, NULL, opno,
+                                                  baserel->relids, false);
+        if (pathkeys == NIL) {
+            continue;
+        }
+
+        add_path(baserel,
+                 (Path *) create_foreignscan_path(root, baserel,
+                                                  NULL,  /* default pathtarget */
+                                                  baserel->rows, startupCost,
+                                                  totalCost,
+                                                  pathkeys,
+                                                  NULL,  /* no outer rel either */
+                                                  NULL,  /* no extra plan */
+                                                  list_make1(makeInteger(reverse))));
+    }
+}
+
+/*
+ * Add a partial path for a parallel scan, where the participants read the
+ * chunks of the key range. The number of workers follows the size in
+ * pg_class, so a table is scanned in parallel only after ANALYZE.
+ */
+static void AddParallelPath(PlannerInfo* root, RelOptInfo* baserel,
+                            Cost startupCost, Cost totalCost) {
+    #ifdef VIDARDB
+    /* the plan state in fdw_private cannot be passed to parallel workers */
+    return;
+    #else
+    if (!baserel->consider_parallel) {
+        return;
+    }
+
+    int workers = compute_parallel_worker(baserel, baserel->pages, -1,
+                                          max_parallel_workers_per_gather);
+    if (workers <= 0) {
+        return;
+    }
+
+    /* the same as the share of the leader in get_parallel_divisor */
+    double divisor = workers;
+    if (parallel_leader_participation) {
+        double leader = 1.0 - (0.3 * workers);
+        if (leader > 0) {
+            divisor += leader;
+        }
+    }
+
+    ForeignPath* path = create_foreignscan_path(root, baserel,
+                                                NULL,  /* default pathtarget */
+                                                clamp_row_est(baserel->rows /
+                                                              divisor),
+                                                startupCost,
+                                                startupCost +
+                                                (totalCost - startupCost) /
+                                                divisor,
+                                                NIL,   /* no pathkeys */
+                                                NULL,  /* no outer rel either */
+                                                NULL,  /* no extra plan */
+                                                list_make1(makeInteger(false)));
+    path->path.parallel_aware = true;
+    path->path.parallel_safe = true;
+    path->path.parallel_workers = workers;
+    add_partial_path(baserel, (Path*) path);
+    #endif
 }
 
 static void GetForeignPaths(PlannerInfo* root, RelOptInfo* baserel,
                             Oid foreignTableId) {
-    printf("\n-----------------%s----------------------\n", __func__);
+    KV_TRACE("\n-----------------%s----------------------\n", __func__);
     /*
      * Create possible access paths for a scan on a foreign table. This is
      * called during query planning. The parameters are the same as for
@@ -206,10 +574,11 @@ static void GetForeignPaths(PlannerInfo* root, RelOptInfo* baserel,
 
     ereport(DEBUG1, errmsg("entering function %s", __func__));
 
+    /* the quals are checked by the executor, so every row is read */
     Cost startupCost = 0;
-    Cost totalCost = startupCost + baserel->rows;
+    Cost totalCost = startupCost + baserel->tuples;
 
-    /* Create a ForeignPath node and add it as only possible path */
+    /* Create a ForeignPath node without order */
     add_path(baserel,
              (Path *) create_foreignscan_path(root, baserel,
                                               NULL,  /* default pathtarget */
@@ -219,13 +588,255 @@ static void GetForeignPaths(PlannerInfo* root, RelOptInfo* baserel,
                                               NULL,  /* no outer rel either */
                                               NULL,  /* no extra plan */
                                               NIL)); /* no fdw_private data */
+
+    AddKeyOrderPaths(root, baserel, foreignTableId, startupCost, totalCost);
+    AddKeyParamPaths(root, baserel);
+    AddParallelPath(root, baserel, startupCost, totalCost);
+}
+
+/*
+ * Translate an aggregate into one computed by the kv worker, which only knows
+ * the keys and the fixed-length attributes in the row format. min and max
+ * must follow the order of the key, namely the comparator of the table.
+ */
+static bool GetPushedAggregate(RelOptInfo* inputRel, Expr* expr,
+                               KVAggregate* agg, bool* average) {
+    if (!IsA(expr, Aggref)) {
+        return false;
+    }
+
+    Aggref* aggref = (Aggref*) expr;
+    if (aggref->aggdistinct != NIL || aggref->aggorder != NIL ||
+        aggref->aggfilter != NULL || aggref->aggvariadic ||
+        aggref->aggkind != AGGKIND_NORMAL || aggref->agglevelsup != 0 ||
+        aggref->aggsplit != AGGSPLIT_SIMPLE ||
+        get_func_namespace(aggref->aggfnoid) != PG_CATALOG_NAMESPACE) {
+        return false;
+    }
+
+    char* name = get_func_name(aggref->aggfnoid);
+    *average = false;
+    agg->index = 0;
+    if (aggref->aggstar) {
+        agg->kind = KVAggCount;
+        return strcmp(name, "count") == 0;
+    }
+    if (list_length(aggref->args) != 1) {
+        return false;
+    }
+
+    Var* var = (Var*) linitial_node(TargetEntry, aggref->args)->expr;
+    if (!IsA(var, Var) || var->varno != inputRel->relid ||
+        var->varlevelsup != 0 || var->varattno <= InvalidAttrNumber) {
+        return false;
+    }
+
+    /* no null key, count(key) is count(*) */
+    if (strcmp(name, "count") == 0) {
+        agg->kind = var->varattno == 1 ? KVAggCount : KVAggCountAttr;
+        agg->index = var->varattno - 2;
+        return true;
+    }
+
+    if (var->varattno == 1) {
+        bool isMin = strcmp(name, "min") == 0;
+        if (!isMin && strcmp(name, "max") != 0) {
+            return false;
+        }
+
+        HeapTuple aggTuple = SearchSysCache1(AGGFNOID,
+                                             ObjectIdGetDatum(aggref->aggfnoid));
+        if (!HeapTupleIsValid(aggTuple)) {
+            return false;
+        }
+        Oid sortOp = ((Form_pg_aggregate) GETSTRUCT(aggTuple))->aggsortop;
+        ReleaseSysCache(aggTuple);
+
+        TypeCacheEntry* typeEntry = lookup_type_cache(var->vartype,
+            TYPECACHE_LT_OPR | TYPECACHE_GT_OPR);
+        if (sortOp != (isMin ? typeEntry->lt_opr : typeEntry->gt_opr) ||
+            aggref->inputcollid != var->varcollid) {
+            return false;
+        }
+
+        agg->kind = isMin ? KVAggMinKey : KVAggMaxKey;
+        return true;
+    }
+
+    *average = strcmp(name, "avg") == 0;
+    if (!*average && strcmp(name, "sum") != 0) {
+        return false;
+    }
+
+    /* the results are those of the aggregates over integers and doubles */
+    agg->index = var->varattno - 2;
+    switch (var->vartype) {
+        case INT2OID:
+            agg->kind = KVAggSumInt16;
+            return aggref->aggtype == (*average ? NUMERICOID : INT8OID);
+        case INT4OID:
+            agg->kind = KVAggSumInt32;
+            return aggref->aggtype == (*average ? NUMERICOID : INT8OID);
+        case FLOAT8OID:
+            agg->kind = KVAggSumFloat64;
+            return aggref->aggtype == FLOAT8OID;
+        default:
+            return false;
+    }
+}
+
+static void GetForeignUpperPaths(PlannerInfo* root, UpperRelationKind stage,
+                                 RelOptInfo* inputRel, RelOptInfo* outputRel,
+                                 void* extra) {
+    KV_TRACE("\n-----------------%s----------------------\n", __func__);
+    /*
+     * Create possible access paths for scanning an upper relation, such as
+     * the aggregation of a foreign table, and add them to outputRel via
+     * add_path. The whole aggregate is pushed down into the kv worker, when
+     * there is neither grouping nor qual, so that no row is sent back.
+     */
+
+    ereport(DEBUG1, errmsg("entering function %s", __func__));
+
+    if (stage != UPPERREL_GROUP_AGG || outputRel->fdw_private != NIL ||
+        inputRel->reloptkind != RELOPT_BASEREL ||
+        inputRel->baserestrictinfo != NIL) {
+        return;
+    }
+
+    /*
+     * An inheritance parent is an append of its children, so the aggregate of
+     * the parent's own rows is not the answer. Its size was not estimated by
+     * GetForeignRelSize either.
+     */
+    if (inputRel->fdw_private == NULL ||
+        planner_rt_fetch(inputRel->relid, root)->inh) {
+        return;
+    }
+
+    Query* parse = root->parse;
+    GroupPathExtraData* groupExtra = (GroupPathExtraData*) extra;
+    if (parse->groupClause != NIL || parse->groupingSets != NIL ||
+        parse->havingQual != NULL || parse->hasTargetSRFs ||
+        groupExtra->patype != PARTITIONWISE_AGGREGATE_NONE) {
+        return;
+    }
+
+    Oid foreignTableId = planner_rt_fetch(inputRel->relid, root)->relid;
+    KVFdwOptions* fdwOptions = KVGetOptions(foreignTableId);
+    #ifdef VIDARDB
+    /* the values of the column store are not in the row format */
+    if (fdwOptions->useColumn) {
+        return;
+    }
+    #endif
+
+    PathTarget* target = root->upper_targets[UPPERREL_GROUP_AGG];
+    List* kinds = NIL;
+    List* indexes = NIL;
+    List* averages = NIL;
+    bool scan = false;
+    ListCell* lc = NULL;
+    foreach (lc, target->exprs) {
+        KVAggregate agg;
+        bool average;
+        if (!GetPushedAggregate(inputRel, lfirst(lc), &agg, &average)) {
+            return;
+        }
+
+        kinds = lappend_int(kinds, agg.kind);
+        indexes = lappend_int(indexes, agg.index);
+        averages = lappend_int(averages, average);
+        if (agg.kind != KVAggMinKey && agg.kind != KVAggMaxKey &&
+            !(agg.kind == KVAggCount && fdwOptions->estimateCount)) {
+            scan = true;
+        }
+    }
+    if (kinds == NIL) {
+        return;
+    }
+
+    /* a pass of the worker is cheaper than any scan sending the rows */
+    Cost totalCost = scan ?
+        Max(inputRel->tuples, inputRel->rows) * cpu_operator_cost : 1;
+    List* fdwPrivate = list_make4(makeInteger(foreignTableId), kinds, indexes,
+                                  averages);
+
+    add_path(outputRel,
+             (Path*) create_foreign_upper_path(root, outputRel, target,
+                                               1, totalCost, totalCost,
+                                               NIL,   /* no pathkeys */
+                                               NULL,  /* no extra plan */
+                                               fdwPrivate));
+    outputRel->fdw_private = fdwPrivate;
+}
+
+/*
+ * The aggregates are the scan tuple of a plan without scan relation, which the
+ * target list refers to.
+ */
+static ForeignScan* GetAggregatePlan(PlannerInfo* root, RelOptInfo* upperRel,
+                                     ForeignPath* bestPath, List* targetList) {
+    List* fdwPrivate = bestPath->fdw_private;
+    Oid foreignTableId = intVal(linitial(fdwPrivate));
+
+    OpenArgs args;
+    Relation relation = table_open(foreignTableId, AccessShareLock);
+    SetRelationComparatorOpts(relation, &args.opts);
+    #ifdef VIDARDB
+    args.useColumn = false;
+    args.attrCount = RelationGetDescr(relation)->natts;
+    #endif
+    table_close(relation, AccessShareLock);
+
+    KVFdwOptions* fdwOptions = KVGetOptions(foreignTableId);
+    args.path = fdwOptions->filename;
+    args.engine = fdwOptions->engine;
+    args.write = fdwOptions->write;
+    KVOpenRequest(foreignTableId, &args);
+
+    List* scanTargetList = add_to_flat_tlist(NIL,
+                                             bestPath->path.pathtarget->exprs);
+    return make_foreignscan(targetList, NIL, 0, /* no scan relation */
+                            NIL, fdwPrivate, scanTargetList,
+                            NIL, /* no remote quals */ NULL);
+}
+
+/*
+ * The attributes a row-store scan has to decode: those in the output and in
+ * the quals, which include the join clauses of a parameterized path. A
+ * whole-row reference needs them all. It is an integer list so that it can be
+ * copied into parallel workers with the plan.
+ */
+static List* GetNeededAttrs(RelOptInfo* baserel, List* scanClauses) {
+    Bitmapset* attrs = NULL;
+    pull_varattnos((Node*) baserel->reltarget->exprs, baserel->relid, &attrs);
+    pull_varattnos((Node*) scanClauses, baserel->relid, &attrs);
+
+    List* neededAttrs = NIL;
+    if (bms_is_member(0 - FirstLowInvalidHeapAttributeNumber, attrs)) {
+        for (AttrNumber attr = 1; attr <= baserel->max_attr; attr++) {
+            neededAttrs = lappend_int(neededAttrs, attr);
+        }
+        return neededAttrs;
+    }
+
+    int col = -1;
+    while ((col = bms_next_member(attrs, col)) >= 0) {
+        /* bit numbers are offset by FirstLowInvalidHeapAttributeNumber */
+        AttrNumber attr = col + FirstLowInvalidHeapAttributeNumber;
+        if (attr > InvalidAttrNumber) {
+            neededAttrs = lappend_int(neededAttrs, attr);
+        }
+    }
+    return neededAttrs;
 }
 
 static ForeignScan* GetForeignPlan(PlannerInfo* root, RelOptInfo* baserel,
                                    Oid foreignTableId, ForeignPath* bestPath,
                                    List* targetList, List* scanClauses,
                                    Plan* outerPlan) {
-    printf("\n-----------------%s----------------------\n", __func__);
+    KV_TRACE("\n-----------------%s----------------------\n", __func__);
     /*
      * Create a ForeignScan plan node from the selected foreign access path.
      * This is called at the end of query planning. The parameters are as for
@@ -240,6 +851,10 @@ static ForeignScan* GetForeignPlan(PlannerInfo* root, RelOptInfo* baserel,
 
     ereport(DEBUG1, errmsg("entering function %s", __func__));
 
+    if (IS_UPPER_REL(baserel)) {
+        return GetAggregatePlan(root, baserel, bestPath, targetList);
+    }
+
     /*
      * We have no native ability to evaluate restriction clauses, so we just
      * put all the scan_clauses into the plan node's qual list for the
@@ -258,6 +873,8 @@ static ForeignScan* GetForeignPlan(PlannerInfo* root, RelOptInfo* baserel,
 
     KVFdwOptions* fdwOptions = KVGetOptions(foreignTableId);
     args.path = fdwOptions->filename;
+    args.engine = fdwOptions->engine;
+    args.write = fdwOptions->write;
 
     /* To accommodate min & max, we open file here */
     #ifdef VIDARDB
@@ -268,18 +885,36 @@ static ForeignScan* GetForeignPlan(PlannerInfo* root, RelOptInfo* baserel,
 
     KVOpenRequest(foreignTableId, &args);
 
+    /* the key order paths tell whether to scan backward */
+    Node* reverse = (Node*) makeInteger(bestPath->fdw_private != NIL &&
+                                        intVal(linitial(bestPath->fdw_private)));
+    Node* neededAttrs = (Node*) GetNeededAttrs(baserel, scanClauses);
+
     /* Create the ForeignScan node */
     return make_foreignscan(targetList, scanClauses, baserel->relid,
                             NIL, /* no expressions to evaluate */
                             #ifdef VIDARDB
-                            list_make1(planState),
+                            list_make3(planState, neededAttrs, reverse),
                             #else
-                            NIL,
+                            list_make2(neededAttrs, reverse),
                             #endif
                             NIL, /* no custom tlist */
                             NIL, /* no remote quals */ NULL);
 }
 
+static void SerializeKey(TupleDesc tupleDescriptor, Datum datum,
+                         bool orderedKey, StringInfo key) {
+    if (orderedKey) {
+        SerializeOrderedKey(tupleDescriptor, datum, key);
+    } else {
+        SerializeAttribute(tupleDescriptor, 0, datum, key);
+    }
+}
+
+/*
+ * Find key = value, where the value might be a param of a nested loop, so it
+ * is evaluated by EvalKeyBasedQual on each (re)scan instead of here.
+ */
 static void GetKeyBasedQual(Node* node, ForeignScanState* scanState,
                             TableReadState* readState) {
     if (!node || !IsA(node, OpExpr)) {
@@ -291,66 +926,533 @@ static void GetKeyBasedQual(Node* node, ForeignScanState* scanState,
         return;
     }
 
+    /* make it key = value */
+    Index relid = ((Scan*) scanState->ss.ps.plan)->scanrelid;
     Node* left = list_nth(op->args, 0);
-    if (!IsA(left, Var)) {
-        return;
+    Node* right = list_nth(op->args, 1);
+    Oid opno = op->opno;
+    if (!IsKeyVar(left, relid)) {
+        Node* temp = left;
+        left = right;
+        right = temp;
+        opno = get_commutator(opno);
     }
 
-    Node* right = list_nth(op->args, 1);
-    if (!IsA(right, Const) && !IsA(right, Param)) {
+    if (!IsKeyVar(left, relid) || contain_var_clause(right) ||
+        contain_volatile_functions(right)) {
         return;
     }
 
-    Index varattno = ((Var*) left)->varattno;
-    if (varattno != 1) {
+    Relation relation = scanState->ss.ss_currentRelation;
+    Form_pg_attribute attr = TupleDescAttr(RelationGetDescr(relation), 0);
+    if (!IsKeyEquality(opno, op->inputcollid, attr->atttypid,
+                       attr->attcollation, exprType(right))) {
         return;
     }
 
-    /* get the name of the operator according to PG_OPERATOR OID */
-    HeapTuple opertup = SearchSysCache1(OPEROID, ObjectIdGetDatum(op->opno));
-    if (!HeapTupleIsValid(opertup)) {
-        ereport(ERROR, errmsg("cache lookup failed for operator %u", op->opno));
+    /* a cross-type operator of the family, e.g. int8 key = int4 value */
+    Oid valueType = exprType(right);
+    if (valueType != attr->atttypid) {
+        right = coerce_to_target_type(NULL, right, valueType, attr->atttypid,
+                                      attr->atttypmod, COERCION_IMPLICIT,
+                                      COERCE_IMPLICIT_CAST, -1);
+        if (right == NULL) {
+            return;
+        }
     }
-    Form_pg_operator operform = (Form_pg_operator) GETSTRUCT(opertup);
-    char* oprname = NameStr(operform->oprname);
-    /* TODO: support more operators */
-    if (strncmp(oprname, "=", NAMEDATALEN)) {
-        ReleaseSysCache(opertup);
-        return;
+
+    readState->isKeyBased = true;
+    readState->key = makeStringInfo();
+    readState->keyExpr = ExecInitExpr((Expr*) right, &scanState->ss.ps);
+}
+
+/* serialize the key of a key-based scan, false if the value is null */
+static bool EvalKeyBasedQual(ForeignScanState* scanState,
+                             TableReadState* readState) {
+    bool isNull = false;
+    Datum datum = ExecEvalExpr(readState->keyExpr,
+                               scanState->ss.ps.ps_ExprContext, &isNull);
+    if (isNull) {
+        return false;
     }
-    ReleaseSysCache(opertup);
 
-    Datum datum;
+    resetStringInfo(readState->key);
+    SerializeKey(scanState->ss.ss_currentRelation->rd_att, datum,
+                 readState->orderedKey, readState->key);
+    return true;
+}
 
-    if (IsA(right, Const)) {
-        Const* constNode = (Const*) right;
-        datum = constNode->constvalue;
-    } else {
-        Param* paramNode = (Param*) right;
-        ParamListInfo paramListInfo = scanState->ss.ps.state->es_param_list_info;
-        datum = paramListInfo->params[paramNode->paramid-1].value;
+/* whether the value is known at the beginning of the scan */
+static bool IsScanConstant(Node* node) {
+    if (IsA(node, Const)) {
+        return true;
     }
 
-    /*
-     * We can push down this qual if:
-     * - The operatory is =
-     * - The qual is on the key column
-     */
-    readState->isKeyBased = true;
-    readState->key = makeStringInfo();
-    Relation relation = scanState->ss.ss_currentRelation;
-    TupleDesc tupleDescriptor = relation->rd_att;
+    /* outer params are not ready until rescan */
+    if (IsA(node, Param)) {
+        return ((Param*) node)->paramkind == PARAM_EXTERN;
+    }
 
-    SerializeAttribute(tupleDescriptor, varattno-1, datum, readState->key);
+    if (IsA(node, ArrayExpr)) {
+        ListCell* lc;
+        foreach (lc, ((ArrayExpr*) node)->elements) {
+            if (!IsScanConstant((Node*) lfirst(lc))) {
+                return false;
+            }
+        }
+        return true;
+    }
 
-    return;
+    return false;
 }
 
-static void BeginForeignScan(ForeignScanState* scanState, int executorFlags) {
-    printf("\n-----------------%s----------------------\n", __func__);
-    /*
-     * Begin executing a foreign scan. This is called during executor startup.
-     * It should perform any initialization needed before the scan can start,
+static int CompareKeyDatum(const void* a, const void* b, void* arg) {
+    KeySortContext* context = (KeySortContext*) arg;
+    int ret = DatumGetInt32(FunctionCall2Coll(context->cmp, context->collation,
+                                              *(const Datum*) a,
+                                              *(const Datum*) b));
+    return context->reverse ? -ret : ret;
+}
+
+/*
+ * Collect the keys of key = ANY (array), e.g. key IN (...), which are sorted
+ * and deduplicated so that a key is returned only once. Like the range quals,
+ * only the equality of the key's btree family and collation applies.
+ */
+static void GetKeyArrayQual(Node* node, ForeignScanState* scanState,
+                            TableReadState* readState) {
+    if (!node || !IsA(node, ScalarArrayOpExpr)) {
+        return;
+    }
+
+    ScalarArrayOpExpr* op = (ScalarArrayOpExpr*) node;
+    if (!op->useOr || list_length(op->args) != 2) {
+        return;
+    }
+
+    Node* left = list_nth(op->args, 0);
+    Node* right = list_nth(op->args, 1);
+    if (!IsA(left, Var) || ((Var*) left)->varattno != 1 ||
+        !IsScanConstant(right)) {
+        return;
+    }
+
+    Relation relation = scanState->ss.ss_currentRelation;
+    TupleDesc tupleDescriptor = RelationGetDescr(relation);
+    Form_pg_attribute attr = TupleDescAttr(tupleDescriptor, 0);
+    if (op->inputcollid != attr->attcollation ||
+        get_element_type(exprType(right)) != attr->atttypid) {
+        return;
+    }
+
+    TypeCacheEntry* typeEntry = lookup_type_cache(attr->atttypid,
+        TYPECACHE_BTREE_OPFAMILY | TYPECACHE_CMP_PROC_FINFO);
+    if (!OidIsValid(typeEntry->btree_opf) || !OidIsValid(typeEntry->cmp_proc) ||
+        get_op_opfamily_strategy(op->opno, typeEntry->btree_opf) !=
+        BTEqualStrategyNumber) {
+        return;
+    }
+
+    ExprState* exprState = ExecInitExpr((Expr*) right, &scanState->ss.ps);
+    bool isNull = false;
+    Datum array = ExecEvalExpr(exprState, scanState->ss.ps.ps_ExprContext,
+                               &isNull);
+    if (isNull) {
+        return;
+    }
+
+    int16 typeLen;
+    bool  typeByVal;
+    char  typeAlign;
+    get_typlenbyvalalign(attr->atttypid, &typeLen, &typeByVal, &typeAlign);
+
+    Datum* elements;
+    bool*  nulls;
+    int    count;
+    deconstruct_array(DatumGetArrayTypeP(array), attr->atttypid, typeLen,
+                      typeByVal, typeAlign, &elements, &nulls, &count);
+
+    /* a null never equals to the key */
+    int valid = 0;
+    for (int i = 0; i < count; i++) {
+        if (!nulls[i]) {
+            elements[valid++] = elements[i];
+        }
+    }
+
+    KeySortContext context;
+    context.cmp = &typeEntry->cmp_proc_finfo;
+    context.collation = attr->attcollation;
+    context.reverse = readState->reverse;
+    qsort_arg(elements, valid, sizeof(Datum), CompareKeyDatum, &context);
+
+    StringInfo keys = makeStringInfo();
+    StringInfo key = makeStringInfo();
+    for (int i = 0; i < valid; i++) {
+        if (i > 0 && CompareKeyDatum(&elements[i - 1], &elements[i],
+                                     &context) == 0) {
+            continue;
+        }
+
+        resetStringInfo(key);
+        SerializeKey(tupleDescriptor, elements[i], readState->orderedKey, key);
+
+        uint64 keyLen = key->len;
+        appendBinaryStringInfo(keys, (char*) &keyLen, sizeof(keyLen));
+        appendBinaryStringInfo(keys, key->data, key->len);
+    }
+
+    pfree(key->data);
+    pfree(key);
+    pfree(elements);
+    pfree(nulls);
+
+    readState->isMultiKey = true;
+    readState->keys = keys;
+}
+
+/*
+ * Narrow the key range with a qual of =, <, <=, > or >= on the key column.
+ * Only the operators of the key's btree family and the key's collation apply,
+ * so the bounds follow the same order as the storage. The qual itself is
+ * still checked by the executor, except for a direct delete.
+ */
+static void GetKeyRangeQual(Node* node, ForeignScanState* scanState,
+                            KeyRangeQual* range) {
+    if (!node || !IsA(node, OpExpr)) {
+        return;
+    }
+
+    OpExpr* op = (OpExpr*) node;
+    if (list_length(op->args) != 2) {
+        return;
+    }
+
+    /* make it key op value */
+    Node* left = list_nth(op->args, 0);
+    Node* right = list_nth(op->args, 1);
+    Oid opno = op->opno;
+    if (!IsA(left, Var)) {
+        Node* temp = left;
+        left = right;
+        right = temp;
+        opno = get_commutator(opno);
+    }
+
+    if (!IsA(left, Var) || ((Var*) left)->varattno != 1 || !OidIsValid(opno)) {
+        return;
+    }
+
+    if (!IsScanConstant(right)) {
+        return;
+    }
+
+    Relation relation = scanState->ss.ss_currentRelation;
+    Form_pg_attribute attr = TupleDescAttr(RelationGetDescr(relation), 0);
+    if (op->inputcollid != attr->attcollation) {
+        return;
+    }
+
+    TypeCacheEntry* typeEntry = lookup_type_cache(attr->atttypid,
+        TYPECACHE_BTREE_OPFAMILY | TYPECACHE_CMP_PROC_FINFO);
+    if (!OidIsValid(typeEntry->btree_opf) || !OidIsValid(typeEntry->cmp_proc)) {
+        return;
+    }
+
+    int strategy = get_op_opfamily_strategy(opno, typeEntry->btree_opf);
+    if (strategy == 0) {
+        return;
+    }
+
+    /* a cross-type operator of the family, e.g. int8 key > int4 value */
+    Oid valueType = exprType(right);
+    if (valueType != attr->atttypid) {
+        right = coerce_to_target_type(NULL, right, valueType, attr->atttypid,
+                                      attr->atttypmod, COERCION_IMPLICIT,
+                                      COERCE_IMPLICIT_CAST, -1);
+        if (right == NULL) {
+            return;
+        }
+    }
+
+    ExprState* exprState = ExecInitExpr((Expr*) right, &scanState->ss.ps);
+    bool isNull = false;
+    Datum datum = ExecEvalExpr(exprState, scanState->ss.ps.ps_ExprContext,
+                               &isNull);
+    if (isNull) {
+        range->empty = true;
+        return;
+    }
+
+    /* an equality is both an inclusive lower and an inclusive upper bound */
+    FmgrInfo* cmp = &typeEntry->cmp_proc_finfo;
+    if (strategy == BTGreaterStrategyNumber ||
+        strategy == BTGreaterEqualStrategyNumber ||
+        strategy == BTEqualStrategyNumber) {
+        if (!range->hasLower ||
+            DatumGetInt32(FunctionCall2Coll(cmp, attr->attcollation, datum,
+                                            range->lower)) > 0) {
+            range->lower = datum;
+            range->hasLower = true;
+        }
+    }
+
+    if (strategy == BTLessStrategyNumber ||
+        strategy == BTLessEqualStrategyNumber ||
+        strategy == BTEqualStrategyNumber) {
+        bool inclusive = (strategy != BTLessStrategyNumber);
+        int ret = range->hasUpper ?
+            DatumGetInt32(FunctionCall2Coll(cmp, attr->attcollation, datum,
+                                            range->upper)) : -1;
+        if (ret < 0 || (ret == 0 && !inclusive)) {
+            range->upper = datum;
+            range->hasUpper = true;
+            range->upperInclusive = inclusive;
+        }
+    }
+}
+
+/* serialize the key bounds of the range for the storage */
+static ScanBounds* SerializeScanBounds(TupleDesc tupleDescriptor,
+                                       KeyRangeQual* range, bool orderedKey) {
+    ScanBounds* bounds = palloc0(sizeof(ScanBounds));
+
+    if (range->hasLower) {
+        StringInfo start = makeStringInfo();
+        SerializeKey(tupleDescriptor, range->lower, orderedKey, start);
+        bounds->start = start->data;
+        bounds->startLen = start->len;
+    }
+
+    if (range->hasUpper) {
+        StringInfo limit = makeStringInfo();
+        SerializeKey(tupleDescriptor, range->upper, orderedKey, limit);
+        bounds->limit = limit->data;
+        bounds->limitLen = limit->len;
+        bounds->limitInclusive = range->upperInclusive;
+    }
+
+    return bounds;
+}
+
+/* key bounds of the range quals of a scan */
+static ScanBounds* GetScanBounds(ForeignScanState* scanState,
+                                 TableReadState* readState) {
+    KeyRangeQual range;
+    memset(&range, 0, sizeof(range));
+
+    ListCell* lc;
+    foreach (lc, scanState->ss.ps.plan->qual) {
+        GetKeyRangeQual((Node*) lfirst(lc), scanState, &range);
+    }
+
+    ScanBounds* bounds =
+        SerializeScanBounds(scanState->ss.ss_currentRelation->rd_att, &range,
+                            readState->orderedKey);
+    if (range.hasLower || range.hasUpper) {
+        KV_TRACE("\nkey_range_qual\n");
+    }
+    bounds->reverse = readState->reverse;
+    return bounds;
+}
+
+#ifdef VIDARDB
+/* point the columns of the scan into the batch just returned by RangeQuery */
+static void ParseColumnBatch(TableReadState* readState) {
+    readState->batchRow = 0;
+    readState->batchRows = 0;
+    if (readState->bufLen == 0) {
+        return;
+    }
+
+    char* current = readState->buf;
+    uint64 rows, columns;
+    memcpy(&rows, current, sizeof(rows));
+    current += sizeof(rows);
+    memcpy(&columns, current, sizeof(columns));
+    current += sizeof(columns);
+    if (columns != (uint64) readState->valueCount) {
+        ereport(ERROR, errmsg("range query returned " UINT64_FORMAT
+                              " columns, expected %d", columns,
+                              readState->valueCount));
+    }
+
+    readState->batchRows = rows;
+    readState->keyOffsets = (uint64*) current;
+    readState->keyData = current + (rows + 1) * sizeof(uint64);
+    current = readState->keyData + COLUMNBATCHALIGN(readState->keyOffsets[rows]);
+
+    for (int i = 0; i < readState->valueCount; i++) {
+        readState->columnNulls[i] = (uint8*) current;
+        readState->columnOffsets[i] = (uint64*) (current +
+                                                 COLUMNBITMAPSIZE(rows));
+        readState->columnData[i] = (char*) (readState->columnOffsets[i] +
+                                            rows + 1);
+        current = readState->columnData[i] +
+                  COLUMNBATCHALIGN(readState->columnOffsets[i][rows]);
+    }
+}
+#endif
+
+/*
+ * Send the first request of a scan, the key of a key-based scan is looked up
+ * by IterateForeignScan since it might depend on the params of a rescan.
+ */
+static void StartScan(Oid relationId, TableReadState* readState) {
+    readState->done = false;
+    if (readState->isKeyBased) {
+        return;
+    }
+
+    readState->operationId = ++operationId;
+
+    if (readState->isMultiKey) {
+        /* no key to look up, e.g. key IN (NULL) */
+        if (readState->keys->len == 0) {
+            readState->hasNext = false;
+            readState->bufLen = 0;
+        } else {
+            MultiGetArgs args;
+            args.opid = readState->operationId;
+            args.buf = &readState->buf;
+            args.bufLen = &readState->bufLen;
+            args.keysLen = readState->keys->len;
+            args.keys = readState->keys->data;
+            readState->hasNext = KVMultiGetRequest(relationId, &args);
+        }
+        readState->next = readState->buf;
+        return;
+    }
+
+    ScanBounds* bounds = readState->bounds;
+
+    #ifdef VIDARDB
+    if (readState->useColumn) {
+
+        /* the limit of range query is inclusive, the qual filters it */
+        RangeQueryOpts options;
+        options.batchCapacity = readState->batchCapacity;
+        options.startLen = bounds->startLen;
+        options.start = bounds->start;
+        options.limitLen = bounds->limitLen;
+        options.limit = bounds->limit;
+        options.attrCount = list_length(readState->targetAttrs);
+        options.attrs = palloc0(options.attrCount * sizeof(*options.attrs));
+
+        KV_TRACE("\n");
+        int i = 0;
+        ListCell* targetCell = NULL;
+        foreach (targetCell, readState->targetAttrs) {
+            AttrNumber attr = lfirst_int(targetCell);
+            *(options.attrs + i) = attr - 1;
+            KV_TRACE(" %d ", *(options.attrs + i));
+            ++i;
+        }
+        KV_TRACE("\n");
+
+        RangeQueryArgs args;
+        args.opid = readState->operationId;
+        args.opts = &options;
+        args.buf = &readState->buf;
+        args.bufLen = &readState->bufLen;
+        readState->hasNext = KVRangeQueryRequest(relationId, &args);
+        pfree(options.attrs);
+        ParseColumnBatch(readState);
+    } else {
+        ReadBatchArgs args;
+        args.buf = &readState->buf;
+        args.bufLen = &readState->bufLen;
+        args.opid = readState->operationId;
+        args.bounds = bounds;
+        readState->hasNext = KVReadBatchRequest(relationId, &args);
+    }
+    #else
+    ReadBatchArgs args;
+    args.buf = &readState->buf;
+    args.bufLen = &readState->bufLen;
+    args.opid = readState->operationId;
+    args.bounds = bounds;
+    readState->hasNext = KVReadBatchRequest(relationId, &args);
+    #endif
+
+    readState->next = readState->buf;
+}
+
+/* release the worker side resources of a scan */
+static void EndScan(Oid relationId, TableReadState* readState) {
+    if (readState->isKeyBased) {
+        return;
+    }
+
+    #ifdef VIDARDB
+    if (readState->useColumn && !readState->isMultiKey) {
+        /*
+         * The shared memory of the range query is kept for the whole
+         * scan, release it together with the worker side resources.
+         */
+        RangeQueryArgs args;
+        args.opid = readState->operationId;
+        args.buf = &readState->buf;
+        args.bufLen = &readState->bufLen;
+        KVClearRangeQueryRequest(relationId, &args);
+    } else {
+        CloseCursorArgs args;
+        args.opid = readState->operationId;
+        KVCloseCursorRequest(relationId, &args);
+    }
+    #else
+    CloseCursorArgs args;
+    args.opid = readState->operationId;
+    KVCloseCursorRequest(relationId, &args);
+    #endif
+}
+
+/* a plan of pushed down aggregates has no scan relation */
+static bool IsAggregateScan(ForeignScanState* scanState) {
+    return ((Scan*) scanState->ss.ps.plan)->scanrelid == 0;
+}
+
+static void BeginAggregateScan(ForeignScanState* scanState, int executorFlags) {
+    List* fdwPrivate = ((ForeignScan*) scanState->ss.ps.plan)->fdw_private;
+    TableAggregateState* aggState = palloc0(sizeof(TableAggregateState));
+    aggState->relationId = intVal(linitial(fdwPrivate));
+    aggState->done = false;
+    aggState->execExplainOnly = false;
+
+    List* kinds = lsecond(fdwPrivate);
+    List* indexes = lthird(fdwPrivate);
+    List* averages = lfourth(fdwPrivate);
+    aggState->aggCount = list_length(kinds);
+    aggState->aggs = palloc(aggState->aggCount * sizeof(KVAggregate));
+    aggState->averages = palloc(aggState->aggCount * sizeof(bool));
+    for (uint32 i = 0; i < aggState->aggCount; i++) {
+        aggState->aggs[i].kind = list_nth_int(kinds, i);
+        aggState->aggs[i].index = list_nth_int(indexes, i);
+        aggState->averages[i] = list_nth_int(averages, i);
+    }
+
+    scanState->fdw_state = (void*) aggState;
+    if (executorFlags & EXEC_FLAG_EXPLAIN_ONLY) {
+        aggState->execExplainOnly = true;
+        return;
+    }
+
+    /* the table is locked by the executor already */
+    KVFdwOptions* fdwOptions = KVGetOptions(aggState->relationId);
+    aggState->estimate = fdwOptions->estimateCount;
+    Relation relation = table_open(aggState->relationId, NoLock);
+    aggState->codec =
+        BuildTupleCodec(CreateTupleDescCopy(RelationGetDescr(relation)),
+                        fdwOptions->orderedKey);
+    TrimTupleCodec(aggState->codec, NIL);
+    table_close(relation, NoLock);
+}
+
+static void BeginForeignScan(ForeignScanState* scanState, int executorFlags) {
+    KV_TRACE("\n-----------------%s----------------------\n", __func__);
+    /*
+     * Begin executing a foreign scan. This is called during executor startup.
+     * It should perform any initialization needed before the scan can start,
      * but not start executing the actual scan (that should be done upon the
      * first call to IterateForeignScan). The ForeignScanState node has
      * already been created, but its fdw_state field is still NULL.
@@ -369,23 +1471,54 @@ static void BeginForeignScan(ForeignScanState* scanState, int executorFlags) {
 
     ereport(DEBUG1, errmsg("entering function %s", __func__));
 
+    if (IsAggregateScan(scanState)) {
+        BeginAggregateScan(scanState, executorFlags);
+        return;
+    }
+
     TableReadState* readState = palloc0(sizeof(TableReadState));
     readState->execExplainOnly = false;
     readState->isKeyBased = false;
+    readState->isMultiKey = false;
+    readState->keys = NULL;
+    readState->keyExpr = NULL;
+    readState->bounds = NULL;
     readState->operationId = 0;
     readState->done = false;
     readState->key = NULL;
     readState->buf = NULL;
     readState->bufLen = 0;
 
-    #ifdef VIDARDB
     ForeignScan* foreignScan = (ForeignScan*) scanState->ss.ps.plan;
     List* fdwPrivateList = (List*) foreignScan->fdw_private;
+    readState->reverse = intVal(llast(fdwPrivateList));
+
+    #ifdef VIDARDB
     TablePlanState* planState = (TablePlanState*) linitial(fdwPrivateList);
     readState->useColumn = planState->fdwOptions->useColumn;
     readState->targetAttrs = planState->targetAttrs;
+    readState->batchCapacity = planState->fdwOptions->batchCapacity;
+
+    /* the value columns of a batch are in the ascending attribute order */
+    if (readState->useColumn) {
+        int count = list_length(readState->targetAttrs);
+        readState->valueAttrs = palloc0(count * sizeof(AttrNumber));
+        readState->columnNulls = palloc0(count * sizeof(uint8*));
+        readState->columnOffsets = palloc0(count * sizeof(uint64*));
+        readState->columnData = palloc0(count * sizeof(char*));
+        readState->valueCount = 0;
+        readState->batchKey = false;
 
-    size_t batchCapacity = planState->fdwOptions->batchCapacity;
+        ListCell* targetCell = NULL;
+        foreach (targetCell, readState->targetAttrs) {
+            AttrNumber attr = lfirst_int(targetCell);
+            if (attr == 1) {
+                readState->batchKey = true;
+            } else {
+                readState->valueAttrs[readState->valueCount++] = attr;
+            }
+        }
+    }
 
     if (planState->toUpdateDelete == false) {
         pfree(planState);
@@ -400,65 +1533,66 @@ static void BeginForeignScan(ForeignScanState* scanState, int executorFlags) {
         return;
     }
 
+    Relation relation = scanState->ss.ss_currentRelation;
+    Oid relationId = RelationGetRelid(relation);
+    KVFdwOptions* fdwOptions = KVGetOptions(relationId);
+    readState->orderedKey = fdwOptions->orderedKey;
+    readState->codec = BuildTupleCodec(RelationGetDescr(relation),
+                                       readState->orderedKey);
+
+    /* the needed attributes are second to last in fdw_private */
+    TrimTupleCodec(readState->codec,
+                   list_nth(fdwPrivateList, list_length(fdwPrivateList) - 2));
+
+    /*
+     * The leader opened the table in GetForeignPlan, a parallel worker opens
+     * it again since every participant closes it in EndForeignScan.
+     */
+    if (IsParallelWorker()) {
+        OpenArgs args;
+        SetRelationComparatorOpts(relation, &args.opts);
+        args.path = fdwOptions->filename;
+        args.engine = fdwOptions->engine;
+        args.write = fdwOptions->write;
+        #ifdef VIDARDB
+        args.useColumn = fdwOptions->useColumn;
+        args.attrCount = RelationGetNumberOfAttributes(relation);
+        #endif
+        KVOpenRequest(relationId, &args);
+    }
+
+    /* the participants of a parallel scan share the range, not the keys */
+    readState->parallel = scanState->ss.ps.plan->parallel_aware;
+    if (readState->parallel) {
+        readState->qualBounds = GetScanBounds(scanState, readState);
+        return;
+    }
+
     ListCell* lc;
     foreach (lc, scanState->ss.ps.plan->qual) {
         Expr* state = lfirst(lc);
         GetKeyBasedQual((Node*) state, scanState, readState);
         if (readState->isKeyBased) {
-            printf("\nkey_based_qual\n");
+            KV_TRACE("\nkey_based_qual\n");
             break;
         }
     }
 
-    Oid relationId = RelationGetRelid(scanState->ss.ss_currentRelation);
-
     if (!readState->isKeyBased) {
-        #ifdef VIDARDB
-        if (readState->useColumn) {
-
-            RangeQueryOpts options;
-            options.batchCapacity = batchCapacity;
-            options.startLen = 0;
-            options.limitLen = 0;
-            options.attrCount = list_length(readState->targetAttrs);
-            options.attrs = palloc0(options.attrCount * sizeof(*options.attrs));
-
-            printf("\n");
-            int i = 0;
-            ListCell* targetCell = NULL;
-            foreach (targetCell, readState->targetAttrs) {
-                AttrNumber attr = lfirst_int(targetCell);
-                *(options.attrs + i) = attr - 1;
-                printf(" %d ", *(options.attrs + i));
-                ++i;
+        foreach (lc, scanState->ss.ps.plan->qual) {
+            GetKeyArrayQual((Node*) lfirst(lc), scanState, readState);
+            if (readState->isMultiKey) {
+                KV_TRACE("\nkey_array_qual\n");
+                break;
             }
-            printf("\n");
-
-            RangeQueryArgs args;
-            args.opid = ++operationId;
-            args.opts = &options;
-            args.buf = &readState->buf;
-            args.bufLen = &readState->bufLen;
-            readState->hasNext = KVRangeQueryRequest(relationId, &args);
-            pfree(options.attrs);
-        } else {
-            ReadBatchArgs args;
-            args.buf = &readState->buf;
-            args.bufLen = &readState->bufLen;
-            args.opid = ++operationId;
-            readState->hasNext = KVReadBatchRequest(relationId, &args);
         }
-        #else
-        ReadBatchArgs args;
-        args.buf = &readState->buf;
-        args.bufLen = &readState->bufLen;
-        args.opid = ++operationId;
-        readState->hasNext = KVReadBatchRequest(relationId, &args);
-        #endif
+    }
 
-        readState->next = readState->buf;
-        readState->operationId = operationId;
+    if (!readState->isKeyBased && !readState->isMultiKey) {
+        readState->bounds = GetScanBounds(scanState, readState);
     }
+
+    StartScan(relationId, readState);
 }
 
 #ifdef VIDARDB
@@ -469,7 +1603,8 @@ static void BeginForeignScan(ForeignScanState* scanState, int executorFlags) {
  */
 static void DeserializeColumnTuple(char* key, size_t kLen, char* val,
                                    size_t vLen, TupleTableSlot* tupleSlot,
-                                   List* targetList, bool fullTuple) {
+                                   List* targetList, bool fullTuple,
+                                   bool orderedKey) {
     Datum* values = tupleSlot->tts_values;
     bool* nulls = tupleSlot->tts_isnull;
 
@@ -481,58 +1616,84 @@ static void DeserializeColumnTuple(char* key, size_t kLen, char* val,
     /* nulls tells the above layer whether corresponding attribute is carried */
     memset(nulls, true, count * sizeof(bool));
 
-    int targetListLen = list_length(targetList);
-    int targetAttrsLen = fullTuple ? count : targetListLen;
-    AttrNumber* attrs = (AttrNumber*) palloc0(targetAttrsLen * sizeof(*attrs));
+    int targetAttrsLen = fullTuple ? count : list_length(targetList);
+    ListCell* targetCell = list_head(targetList);
 
-    if (fullTuple) {
-        for (int index = 0; index < targetAttrsLen; ++index) {
-            *(attrs + index) = index + 1;
-        }
-    } else {
-        int i = 0;
-        ListCell* targetCell = NULL;
-        foreach (targetCell, targetList) {
-            AttrNumber attr = lfirst_int(targetCell);
-            *(attrs + i) = attr;
-            ++i;
+    for (int index = 0, offset = 0; index < targetAttrsLen; index++) {
+        AttrNumber attr = index;
+        if (!fullTuple) {
+            attr = lfirst_int(targetCell) - 1;
+            targetCell = lnext(targetCell);
         }
-    }
 
-//    printf("\n");
-//    for (int index = 0; index < targetAttrsLen; ++index) {
-//        printf(" %d ", *(attrs + index));
-//    }
-//    printf("\n");
-
-    for (int index = 0, offset = 0; index < targetAttrsLen; index++) {
-        AttrNumber attr = *(attrs + index);
-        attr--;
+        if (attr == 0 && orderedKey) {
+            values[0] = DeserializeOrderedKey(tupleDescriptor, key, kLen);
+            nulls[0] = false;
+            continue;
+        }
         offset = DeserializeAttribute(tupleDescriptor, attr, offset, key, val,
                                       val + vLen, values, nulls);
     }
-
-    pfree(attrs);
 }
-#endif
 
-static void DeserializeTuple(char* key, size_t kLen, char* val, size_t vLen,
-                             TupleTableSlot* tupleSlot) {
+/*
+ * Fill the slot with the next row of the columnar batches of a range query,
+ * a value is read in place from its column and a set bit is a null. An empty
+ * batch of only deleted keys is skipped for the next one.
+ */
+static bool GetNextFromColumnBatch(Oid relationId, TableReadState* readState,
+                                   TupleTableSlot* tupleSlot) {
+    while (readState->batchRow >= readState->batchRows) {
+        if (!readState->hasNext) {
+            return false;
+        }
+
+        RangeQueryArgs args;
+        args.opid = readState->operationId;
+        args.opts = NULL;
+        args.buf = &readState->buf;
+        args.bufLen = &readState->bufLen;
+        readState->hasNext = KVRangeQueryRequest(relationId, &args);
+        ParseColumnBatch(readState);
+    }
+
     Datum* values = tupleSlot->tts_values;
     bool* nulls = tupleSlot->tts_isnull;
-
     TupleDesc tupleDescriptor = tupleSlot->tts_tupleDescriptor;
-    int count = tupleDescriptor->natts;
+    memset(values, 0, tupleDescriptor->natts * sizeof(Datum));
+    memset(nulls, true, tupleDescriptor->natts * sizeof(bool));
+
+    uint64 row = readState->batchRow++;
+    if (readState->batchKey) {
+        char* key = readState->keyData + readState->keyOffsets[row];
+        size_t kLen = readState->keyOffsets[row + 1] -
+                      readState->keyOffsets[row];
+        if (readState->orderedKey) {
+            values[0] = DeserializeOrderedKey(tupleDescriptor, key, kLen);
+            nulls[0] = false;
+        } else {
+            DeserializeAttribute(tupleDescriptor, 0, 0, key, NULL, NULL,
+                                 values, nulls);
+        }
+    }
 
-    /* initialize all values for this row to null */
-    memset(values, 0, count * sizeof(Datum));
-    memset(nulls, false, count * sizeof(bool));
+    for (int i = 0; i < readState->valueCount; i++) {
+        if (readState->columnNulls[i][row / 8] & (1 << (row % 8))) {
+            continue;
+        }
 
-    for (int index = 0, offset = 0; index < count; index++) {
-        offset = DeserializeAttribute(tupleDescriptor, index, offset, key, val,
-                                      val + vLen, values, nulls);
+        AttrNumber attr = readState->valueAttrs[i] - 1;
+        Form_pg_attribute attributeForm = TupleDescAttr(tupleDescriptor, attr);
+        char* current = readState->columnData[i] +
+                        readState->columnOffsets[i][row];
+        values[attr] = fetch_att(current, attributeForm->attbyval,
+                                 attributeForm->attlen);
+        nulls[attr] = false;
     }
+
+    return true;
 }
+#endif
 
 static bool GetNextFromBatch(Oid relationId, TableReadState* readState,
                              char** key, size_t* keyLen, char** val,
@@ -541,32 +1702,20 @@ static bool GetNextFromBatch(Oid relationId, TableReadState* readState,
     if (readState->next < readState->buf + readState->bufLen) {
         found = true;
     } else if (readState->hasNext) {
-        #ifdef VIDARDB
-        if (readState->useColumn) {
-            RangeQueryArgs args;
-            args.opid = readState->operationId;
-            args.opts = NULL;
-            args.buf = &readState->buf;
-            args.bufLen = &readState->bufLen;
-            readState->hasNext = KVRangeQueryRequest(relationId, &args);
-        } else {
-            ReadBatchArgs args;
-            args.buf = &readState->buf;
-            args.bufLen = &readState->bufLen;
-            args.opid = readState->operationId;
-            readState->hasNext = KVReadBatchRequest(relationId, &args);
-        }
-        #else
         ReadBatchArgs args;
         args.buf = &readState->buf;
         args.bufLen = &readState->bufLen;
         args.opid = readState->operationId;
+        args.bounds = NULL;
         readState->hasNext = KVReadBatchRequest(relationId, &args);
-        #endif
 
         readState->next  = readState->buf;
         if (readState->bufLen > 0) {
             found = true;
+        } else if (readState->hasNext) {
+            /* ending here would silently drop the rest of the scan */
+            ereport(ERROR, errmsg("kv worker returned an empty batch of foreign "
+                                  "table %u before its end", relationId));
         }
     }
 
@@ -582,7 +1731,166 @@ static bool GetNextFromBatch(Oid relationId, TableReadState* readState,
         readState->next += *valLen;
     }
 
-    return found;
+    return found;
+}
+
+/*
+ * Claim the next chunk of a parallel scan and set its bounds, the first chunk
+ * starts at the lower bound of the quals and the last one ends at the upper.
+ * Without the shared state, e.g. no worker is launched, the whole range is
+ * the only chunk.
+ */
+static bool ClaimChunk(TableReadState* readState) {
+    ParallelScanState* parallelState = readState->parallelState;
+    ScanBounds* chunk = &readState->chunkBounds;
+    ScanBounds* bounds = readState->qualBounds;
+
+    if (parallelState == NULL) {
+        if (readState->chunkClaimed) {
+            return false;
+        }
+        readState->chunkClaimed = true;
+        *chunk = *bounds;
+        return true;
+    }
+
+    uint32 index = pg_atomic_fetch_add_u32(&parallelState->next, 1);
+    if (index >= parallelState->chunks) {
+        return false;
+    }
+
+    /* chunk i is from split key i - 1 to split key i */
+    *chunk = *bounds;
+    char* current = parallelState->splits;
+    for (uint32 i = 0; i <= index && i + 1 < parallelState->chunks; i++) {
+        uint64 keyLen;
+        memcpy(&keyLen, current, sizeof(keyLen));
+        current += sizeof(keyLen);
+
+        if (i + 1 == index) {
+            chunk->start = current;
+            chunk->startLen = keyLen;
+        } else if (i == index) {
+            chunk->limit = current;
+            chunk->limitLen = keyLen;
+            chunk->limitInclusive = false;
+        }
+        current += keyLen;
+    }
+    return true;
+}
+
+/*
+ * The next row of a batch scan, the columnar batches of a range query fill
+ * the slot themselves, the others return the row to decode.
+ */
+static bool GetNextFromScan(Oid relationId, TableReadState* readState,
+                            TupleTableSlot* tupleSlot, char** key,
+                            size_t* keyLen, char** val, size_t* valLen) {
+    #ifdef VIDARDB
+    if (readState->useColumn && !readState->isMultiKey) {
+        return GetNextFromColumnBatch(relationId, readState, tupleSlot);
+    }
+    #endif
+    return GetNextFromBatch(relationId, readState, key, keyLen, val, valLen);
+}
+
+static bool GetNextFromChunk(Oid relationId, TableReadState* readState,
+                             TupleTableSlot* tupleSlot, char** key,
+                             size_t* keyLen, char** val, size_t* valLen) {
+    while (true) {
+        if (readState->chunkStarted) {
+            if (GetNextFromScan(relationId, readState, tupleSlot, key, keyLen,
+                                val, valLen)) {
+                return true;
+            }
+            EndScan(relationId, readState);
+            readState->chunkStarted = false;
+        }
+
+        if (!ClaimChunk(readState)) {
+            return false;
+        }
+        readState->bounds = &readState->chunkBounds;
+        StartScan(relationId, readState);
+        readState->chunkStarted = true;
+    }
+}
+
+/*
+ * The single row of the aggregates, whose by-reference keys point into the
+ * reply, which lives in the short-lived memory context as the row does.
+ */
+static TupleTableSlot* IterateAggregateScan(ForeignScanState* scanState) {
+    TupleTableSlot* tupleSlot = scanState->ss.ss_ScanTupleSlot;
+    ExecClearTuple(tupleSlot);
+
+    TableAggregateState* aggState = (TableAggregateState*) scanState->fdw_state;
+    if (aggState->done) {
+        return tupleSlot;
+    }
+    aggState->done = true;
+
+    char* buf = NULL;
+    uint64 bufLen = 0;
+    AggregateArgs args;
+    args.estimate = aggState->estimate;
+    args.aggCount = aggState->aggCount;
+    args.aggs = aggState->aggs;
+    args.buf = &buf;
+    args.bufLen = &bufLen;
+    if (!KVAggregateRequest(aggState->relationId, &args)) {
+        ereport(ERROR, errmsg("could not aggregate foreign table %u",
+                              aggState->relationId));
+    }
+
+    KVTupleCodec* codec = aggState->codec;
+    Datum* keyValues = palloc(codec->count * sizeof(Datum));
+    bool* keyNulls = palloc(codec->count * sizeof(bool));
+    KVAggregateResult* results = (KVAggregateResult*) buf;
+    char* keys = buf + aggState->aggCount * sizeof(KVAggregateResult);
+
+    Datum* values = tupleSlot->tts_values;
+    bool* nulls = tupleSlot->tts_isnull;
+    for (uint32 i = 0; i < aggState->aggCount; i++) {
+        KVAggregateResult* result = &results[i];
+        int32 kind = aggState->aggs[i].kind;
+
+        /* count is never null, the others are on no input */
+        nulls[i] = (kind != KVAggCount && kind != KVAggCountAttr &&
+                    result->count == 0);
+        values[i] = (Datum) 0;
+
+        if (kind == KVAggCount || kind == KVAggCountAttr) {
+            values[i] = Int64GetDatum(result->count);
+        } else if (kind == KVAggMinKey || kind == KVAggMaxKey) {
+            uint64 keyLen;
+            memcpy(&keyLen, keys, sizeof(keyLen));
+            keys += sizeof(keyLen);
+            if (keyLen > 0) {
+                DecodeTuple(codec, keys, keyLen, NULL, 0, keyValues, keyNulls);
+                values[i] = keyValues[0];
+                keys += keyLen;
+            }
+        } else if (nulls[i]) {
+            continue;
+        } else if (kind == KVAggSumFloat64) {
+            values[i] = Float8GetDatum(aggState->averages[i] ?
+                result->floatSum / result->count : result->floatSum);
+        } else if (aggState->averages[i]) {
+            /* the same as int8_avg */
+            Datum sum = DirectFunctionCall1(int8_numeric,
+                                            Int64GetDatum(result->intSum));
+            Datum count = DirectFunctionCall1(int8_numeric,
+                                              Int64GetDatum(result->count));
+            values[i] = DirectFunctionCall2(numeric_div, sum, count);
+        } else {
+            values[i] = Int64GetDatum(result->intSum);
+        }
+    }
+
+    ExecStoreVirtualTuple(tupleSlot);
+    return tupleSlot;
 }
 
 static TupleTableSlot* IterateForeignScan(ForeignScanState* scanState) {
@@ -613,6 +1921,10 @@ static TupleTableSlot* IterateForeignScan(ForeignScanState* scanState) {
 
     ereport(DEBUG1, errmsg("entering function %s", __func__));
 
+    if (IsAggregateScan(scanState)) {
+        return IterateAggregateScan(scanState);
+    }
+
     TupleTableSlot* tupleSlot = scanState->ss.ss_ScanTupleSlot;
     ExecClearTuple(tupleSlot);
 
@@ -622,7 +1934,7 @@ static TupleTableSlot* IterateForeignScan(ForeignScanState* scanState) {
     Oid relationId = RelationGetRelid(scanState->ss.ss_currentRelation);
     bool found = false;
     if (readState->isKeyBased) {
-        if (!readState->done) {
+        if (!readState->done && EvalKeyBasedQual(scanState, readState)) {
             k = readState->key->data;
             kLen = readState->key->len;
 
@@ -636,20 +1948,29 @@ static TupleTableSlot* IterateForeignScan(ForeignScanState* scanState) {
             readState->done = true;
         }
     } else {
-        found = GetNextFromBatch(relationId, readState, &k, &kLen, &v, &vLen);
+        found = readState->parallel ?
+            GetNextFromChunk(relationId, readState, tupleSlot, &k, &kLen, &v,
+                             &vLen) :
+            GetNextFromScan(relationId, readState, tupleSlot, &k, &kLen, &v,
+                            &vLen);
     }
 
     if (found) {
         #ifdef VIDARDB
         if (readState->useColumn) {
-            DeserializeColumnTuple(k, kLen, v, vLen, tupleSlot,
-                                   readState->targetAttrs,
-                                   readState->isKeyBased);
+            /* a range query has filled the slot, a lookup is a full tuple */
+            if (readState->isKeyBased || readState->isMultiKey) {
+                DeserializeColumnTuple(k, kLen, v, vLen, tupleSlot,
+                                       readState->targetAttrs, true,
+                                       readState->orderedKey);
+            }
         } else {
-            DeserializeTuple(k, kLen, v, vLen, tupleSlot);
+            DecodeTuple(readState->codec, k, kLen, v, vLen,
+                        tupleSlot->tts_values, tupleSlot->tts_isnull);
         }
         #else
-        DeserializeTuple(k, kLen, v, vLen, tupleSlot);
+        DecodeTuple(readState->codec, k, kLen, v, vLen, tupleSlot->tts_values,
+                    tupleSlot->tts_isnull);
         #endif
 
         ExecStoreVirtualTuple(tupleSlot);
@@ -659,7 +1980,7 @@ static TupleTableSlot* IterateForeignScan(ForeignScanState* scanState) {
 }
 
 static void ReScanForeignScan(ForeignScanState* scanState) {
-    printf("\n-----------------%s----------------------\n", __func__);
+    KV_TRACE("\n-----------------%s----------------------\n", __func__);
     /*
      * Restart the scan from the beginning. Note that any parameters the scan
      * depends on may have changed value, so the new scan does not necessarily
@@ -667,10 +1988,35 @@ static void ReScanForeignScan(ForeignScanState* scanState) {
      */
 
     ereport(DEBUG1, errmsg("entering function %s", __func__));
+
+    if (IsAggregateScan(scanState)) {
+        ((TableAggregateState*) scanState->fdw_state)->done = false;
+        return;
+    }
+
+    TableReadState* readState = (TableReadState*) scanState->fdw_state;
+    if (readState->execExplainOnly) {
+        return;
+    }
+
+    /* a key-based scan evaluates its key again with the new params */
+    Oid relationId = RelationGetRelid(scanState->ss.ss_currentRelation);
+    if (readState->parallel) {
+        /* the shared state is reset by ReInitializeDSMForeignScan */
+        if (readState->chunkStarted) {
+            EndScan(relationId, readState);
+            readState->chunkStarted = false;
+        }
+        readState->chunkClaimed = false;
+        return;
+    }
+
+    EndScan(relationId, readState);
+    StartScan(relationId, readState);
 }
 
 static void EndForeignScan(ForeignScanState* scanState) {
-    printf("\n-----------------%s----------------------\n", __func__);
+    KV_TRACE("\n-----------------%s----------------------\n", __func__);
     /*
      * End the scan and release resources. It is normally not important to
      * release palloc'd memory, but for example open files and connections to
@@ -679,6 +2025,16 @@ static void EndForeignScan(ForeignScanState* scanState) {
 
     ereport(DEBUG1, errmsg("entering function %s", __func__));
 
+    if (IsAggregateScan(scanState)) {
+        TableAggregateState* aggState =
+            (TableAggregateState*) scanState->fdw_state;
+        if (!aggState->execExplainOnly) {
+            KVCloseRequest(aggState->relationId);
+        }
+        pfree(aggState);
+        return;
+    }
+
     TableReadState* readState = (TableReadState*) scanState->fdw_state;
     Assert(readState);
 
@@ -688,30 +2044,8 @@ static void EndForeignScan(ForeignScanState* scanState) {
     }
 
     Oid relationId = RelationGetRelid(scanState->ss.ss_currentRelation);
-    if (!readState->isKeyBased) {
-        #ifdef VIDARDB
-        if (readState->useColumn) {
-            /*
-             * unmap for this backend process should already be done in
-             * IterateForeignScan. Now release resource of worker process.
-             */
-            RangeQueryArgs args;
-            args.opid = readState->operationId;
-            args.buf = &readState->buf;
-            args.bufLen = &readState->bufLen;
-            KVClearRangeQueryRequest(relationId, &args);
-        } else {
-            CloseCursorArgs args;
-            args.opid = readState->operationId;
-            args.buf = readState->buf;
-            KVCloseCursorRequest(relationId, &args);
-        }
-        #else
-        CloseCursorArgs args;
-        args.opid = readState->operationId;
-        args.buf = readState->buf;
-        KVCloseCursorRequest(relationId, &args);
-        #endif
+    if (!readState->parallel || readState->chunkStarted) {
+        EndScan(relationId, readState);
     }
 
     KVCloseRequest(relationId);
@@ -720,7 +2054,7 @@ static void EndForeignScan(ForeignScanState* scanState) {
 
 static void AddForeignUpdateTargets(Query* parsetree, RangeTblEntry* tableEntry,
                                     Relation targetRelation) {
-    printf("\n-----------------%s----------------------\n", __func__);
+    KV_TRACE("\n-----------------%s----------------------\n", __func__);
     /*
      * UPDATE and DELETE operations are performed against rows previously
      * fetched by the table-scanning functions. The FDW may need extra
@@ -771,7 +2105,7 @@ static void AddForeignUpdateTargets(Query* parsetree, RangeTblEntry* tableEntry,
 
 static List* PlanForeignModify(PlannerInfo* root, ModifyTable* plan,
                                Index resultRelation, int subplanIndex) {
-    printf("\n-----------------%s----------------------\n", __func__);
+    KV_TRACE("\n-----------------%s----------------------\n", __func__);
     /*
      * Perform any additional planning actions needed for an insert, update,
      * or delete on a foreign table. This function generates the FDW-private
@@ -851,7 +2185,7 @@ static List* PlanForeignModify(PlannerInfo* root, ModifyTable* plan,
 static void BeginForeignModify(ModifyTableState* modifyTableState,
                                ResultRelInfo* resultRelInfo, List* fdwPrivate,
                                int subplanIndex, int executorFlags) {
-    printf("\n-----------------%s----------------------\n", __func__);
+    KV_TRACE("\n-----------------%s----------------------\n", __func__);
     /*
      * Begin executing a foreign table modification operation. This routine is
      * called during executor startup. It should perform any initialization
@@ -893,6 +2227,11 @@ static void BeginForeignModify(ModifyTableState* modifyTableState,
     Oid foreignTableId = RelationGetRelid(relation);
     table_open(foreignTableId, RowExclusiveLock);
 
+    KVFdwOptions* fdwOptions = KVGetOptions(foreignTableId);
+    writeState->orderedKey = fdwOptions->orderedKey;
+    writeState->codec = BuildTupleCodec(RelationGetDescr(relation),
+                                        writeState->orderedKey);
+
     #ifdef VIDARDB
     TablePlanState* planState = (TablePlanState*) linitial(fdwPrivate);
     writeState->useColumn = planState->fdwOptions->useColumn;
@@ -902,13 +2241,25 @@ static void BeginForeignModify(ModifyTableState* modifyTableState,
     if (operation == CMD_INSERT) {
         OpenArgs args;
         SetRelationComparatorOpts(relation, &args.opts);
-        KVFdwOptions* fdwOptions = KVGetOptions(foreignTableId);
         args.path = fdwOptions->filename;
+        args.engine = fdwOptions->engine;
+        args.write = fdwOptions->write;
         #ifdef VIDARDB
         args.useColumn = planState->fdwOptions->useColumn;
         args.attrCount = planState->attrCount;
         #endif
         KVOpenRequest(foreignTableId, &args);
+
+        writeState->batch = makeStringInfo();
+    }
+
+    /* forget the failed writes of a modify which did not end */
+    writeState->pipelined = KVPipelinedWrites;
+    if (writeState->pipelined) {
+        KVSyncRequest(foreignTableId, false);
+        if (writeState->batch == NULL) {
+            writeState->batch = makeStringInfo();
+        }
     }
 
     resultRelInfo->ri_FdwState = (void*) writeState;
@@ -919,24 +2270,72 @@ static void BeginForeignModify(ModifyTableState* modifyTableState,
     #endif
 }
 
-static void SerializeTuple(StringInfo key, StringInfo val,
-                           TupleTableSlot* tupleSlot) {
-    TupleDesc tupleDescriptor = tupleSlot->tts_tupleDescriptor;
-    int count = tupleDescriptor->natts;
+/*
+ * Send the buffered rows, or the keys of a delete, to kv worker, which writes
+ * them in one batch.
+ */
+static void FlushBatch(Oid foreignTableId, TableWriteState* writeState) {
+    StringInfo batch = writeState->batch;
+    if (batch->len == 0) {
+        return;
+    }
 
-    for (int index = 0; index < count; index++) {
+    bool success = false;
+    if (writeState->operation == CMD_DELETE) {
+        DeleteBatchArgs args;
+        args.bufLen = batch->len;
+        args.buf = batch->data;
+        args.pipelined = writeState->pipelined;
+        success = KVDeleteBatchRequest(foreignTableId, &args);
+    } else {
+        PutBatchArgs args;
+        args.bufLen = batch->len;
+        args.buf = batch->data;
+        args.pipelined = writeState->pipelined;
+        success = KVPutBatchRequest(foreignTableId, &args);
+    }
+    if (!success) {
+        ereport(ERROR, errmsg("could not write batch into foreign table %u",
+                              foreignTableId));
+    }
 
-        Datum datum = tupleSlot->tts_values[index];
-        if (tupleSlot->tts_isnull[index]) {
-            if (index == 0) {
-                ereport(ERROR, errmsg("first column cannot be null!"));
-            }
+    resetStringInfo(batch);
+}
 
-            SerializeNullAttribute(tupleDescriptor, index, val);
-        } else {
-            SerializeAttribute(tupleDescriptor, index, datum,
-                               index == 0 ? key : val);
-        }
+/*
+ * Add a row to the batch, or only its key without a value, flushing first if
+ * it does not fit into the current batch.
+ */
+static void AppendBatch(Oid foreignTableId, TableWriteState* writeState,
+                        StringInfo key, StringInfo val) {
+    StringInfo batch = writeState->batch;
+    uint64 keyLen = key->len;
+    uint64 size = keyLen + sizeof(keyLen);
+    if (val) {
+        size += val->len + sizeof(uint64);
+    }
+    if (batch->len + size > PUTBATCHSIZE) {
+        FlushBatch(foreignTableId, writeState);
+    }
+
+    appendBinaryStringInfo(batch, (char*) &keyLen, sizeof(keyLen));
+    appendBinaryStringInfo(batch, key->data, key->len);
+    if (val) {
+        uint64 valLen = val->len;
+        appendBinaryStringInfo(batch, (char*) &valLen, sizeof(valLen));
+        appendBinaryStringInfo(batch, val->data, val->len);
+    }
+}
+
+/*
+ * Wait for the pipelined batches, which kv worker has all written when it
+ * answers, and fail if any of them failed.
+ */
+static void SyncWrites(Oid foreignTableId) {
+    uint64 errors = KVSyncRequest(foreignTableId, true);
+    if (errors > 0) {
+        ereport(ERROR, errmsg("could not write " UINT64_FORMAT " batches into "
+                              "foreign table %u", errors, foreignTableId));
     }
 }
 
@@ -944,7 +2343,7 @@ static TupleTableSlot* ExecForeignInsert(EState* executorState,
                                          ResultRelInfo* resultRelInfo,
                                          TupleTableSlot* slot,
                                          TupleTableSlot* planSlot) {
-    printf("\n-----------------%s----------------------\n", __func__);
+    KV_TRACE("\n-----------------%s----------------------\n", __func__);
     /*
      * Insert one tuple into the foreign table. executorState is global
      * execution state for the query. resultRelInfo is the ResultRelInfo struct
@@ -992,14 +2391,15 @@ static TupleTableSlot* ExecForeignInsert(EState* executorState,
     Relation relation = resultRelInfo->ri_RelationDesc;
     Oid foreignTableId = RelationGetRelid(relation);
 
-    SerializeTuple(key, val, slot);
+    TableWriteState* writeState = (TableWriteState*) resultRelInfo->ri_FdwState;
+    EncodeTuple(writeState->codec, slot->tts_values, slot->tts_isnull, key,
+                val);
+
+    /* rows are buffered and sent in batches to save the round trips */
+    AppendBatch(foreignTableId, writeState, key, val);
 
-    PutArgs args;
-    args.keyLen = key->len;
-    args.valLen = val->len;
-    args.key = key->data;
-    args.val = val->data;
-    KVPutRequest(foreignTableId, &args);
+    pfree(key->data);
+    pfree(val->data);
 
     if (shouldFree) {
         pfree(heapTuple);
@@ -1012,7 +2412,7 @@ static TupleTableSlot* ExecForeignUpdate(EState* executorState,
                                          ResultRelInfo* resultRelInfo,
                                          TupleTableSlot* slot,
                                          TupleTableSlot* planSlot) {
-    printf("\n-----------------%s----------------------\n", __func__);
+    KV_TRACE("\n-----------------%s----------------------\n", __func__);
     /*
      * Update one tuple in the foreign table. executorState is global execution
      * state for the query. resultRelInfo is the ResultRelInfo struct describing
@@ -1060,14 +2460,20 @@ static TupleTableSlot* ExecForeignUpdate(EState* executorState,
     Relation relation = resultRelInfo->ri_RelationDesc;
     Oid foreignTableId = RelationGetRelid(relation);
 
-    SerializeTuple(key, val, slot);
+    TableWriteState* writeState = (TableWriteState*) resultRelInfo->ri_FdwState;
+    EncodeTuple(writeState->codec, slot->tts_values, slot->tts_isnull, key,
+                val);
 
-    PutArgs args;
-    args.keyLen = key->len;
-    args.valLen = val->len;
-    args.key = key->data;
-    args.val = val->data;
-    KVPutRequest(foreignTableId, &args);
+    if (writeState->pipelined) {
+        AppendBatch(foreignTableId, writeState, key, val);
+    } else {
+        PutArgs args;
+        args.keyLen = key->len;
+        args.valLen = val->len;
+        args.key = key->data;
+        args.val = val->data;
+        KVPutRequest(foreignTableId, &args);
+    }
 
     if (shouldFree) {
         pfree(heapTuple);
@@ -1080,7 +2486,7 @@ static TupleTableSlot* ExecForeignDelete(EState* executorState,
                                          ResultRelInfo* resultRelInfo,
                                          TupleTableSlot* slot,
                                          TupleTableSlot* planSlot) {
-    printf("\n-----------------%s----------------------\n", __func__);
+    KV_TRACE("\n-----------------%s----------------------\n", __func__);
     /*
      * Delete one tuple from the foreign table. executorState is global
      * execution state for the query. resultRelInfo is the ResultRelInfo struct
@@ -1115,7 +2521,9 @@ static TupleTableSlot* ExecForeignDelete(EState* executorState,
     Relation relation = resultRelInfo->ri_RelationDesc;
     Oid foreignTableId = RelationGetRelid(relation);
 
-    SerializeTuple(key, val, planSlot);
+    TableWriteState* writeState = (TableWriteState*) resultRelInfo->ri_FdwState;
+    EncodeTuple(writeState->codec, planSlot->tts_values, planSlot->tts_isnull,
+                key, val);
 
     /* Get the previous value */
     char* v;
@@ -1129,10 +2537,14 @@ static TupleTableSlot* ExecForeignDelete(EState* executorState,
     KVGetRequest(foreignTableId, &getArgs);
 
     /* Delete the specified key */
-    DeleteArgs delArgs;
-    delArgs.key = key->data;
-    delArgs.keyLen = key->len;
-    KVDeleteRequest(foreignTableId, &delArgs);
+    if (writeState->pipelined) {
+        AppendBatch(foreignTableId, writeState, key, NULL);
+    } else {
+        DeleteArgs delArgs;
+        delArgs.key = key->data;
+        delArgs.keyLen = key->len;
+        KVDeleteRequest(foreignTableId, &delArgs);
+    }
 
     /* Key not exists */
     if (vLen == 0) {
@@ -1141,15 +2553,17 @@ static TupleTableSlot* ExecForeignDelete(EState* executorState,
 
     /* Save the previous value into slot */
     #ifdef VIDARDB
-    TableWriteState* writeState = (TableWriteState*) resultRelInfo->ri_FdwState;
     if (writeState->useColumn) {
         DeserializeColumnTuple(key->data, key->len, v, vLen, slot,
-                               writeState->targetAttrs, true);
+                               writeState->targetAttrs, true,
+                               writeState->orderedKey);
     } else {
-        DeserializeTuple(key->data, key->len, v, vLen, slot);
+        DecodeTuple(writeState->codec, key->data, key->len, v, vLen,
+                    slot->tts_values, slot->tts_isnull);
     }
     #else
-    DeserializeTuple(key->data, key->len, v, vLen, slot);
+    DecodeTuple(writeState->codec, key->data, key->len, v, vLen,
+                slot->tts_values, slot->tts_isnull);
     #endif
 
     ExecStoreVirtualTuple(slot);
@@ -1157,7 +2571,7 @@ static TupleTableSlot* ExecForeignDelete(EState* executorState,
 }
 
 static void EndForeignModify(EState* executorState, ResultRelInfo* resultRelInfo) {
-    printf("\n-----------------%s----------------------\n", __func__);
+    KV_TRACE("\n-----------------%s----------------------\n", __func__);
     /*
      * End the table update and release resources. It is normally not important
      * to release palloc'd memory, but for example open files and connections
@@ -1176,6 +2590,12 @@ static void EndForeignModify(EState* executorState, ResultRelInfo* resultRelInfo
         Oid foreignTableId = RelationGetRelid(relation);
 
         CmdType operation = writeState->operation;
+        if (writeState->batch) {
+            FlushBatch(foreignTableId, writeState);
+        }
+        if (writeState->pipelined) {
+            SyncWrites(foreignTableId);
+        }
         if (operation == CMD_INSERT) {
             KVCloseRequest(foreignTableId);
         }
@@ -1187,9 +2607,208 @@ static void EndForeignModify(EState* executorState, ResultRelInfo* resultRelInfo
     }
 }
 
+/*
+ * Whether the qual is exactly a key bound of the storage: key = value,
+ * key >= value, key <= value or key < value with a value known at the
+ * beginning, as GetKeyRangeQual takes it. The lower bound of the storage is
+ * inclusive, so key > value is left to the executor.
+ */
+static bool IsDirectDeleteQual(Node* node, Index relid, Oid keyType,
+                               Oid keyCollation) {
+    if (!node || !IsA(node, OpExpr) || list_length(((OpExpr*) node)->args) != 2) {
+        return false;
+    }
+
+    /* make it key op value */
+    OpExpr* op = (OpExpr*) node;
+    Node* left = list_nth(op->args, 0);
+    Node* right = list_nth(op->args, 1);
+    Oid opno = op->opno;
+    if (!IsA(left, Var)) {
+        Node* temp = left;
+        left = right;
+        right = temp;
+        opno = get_commutator(opno);
+    }
+
+    if (!IsA(left, Var) || ((Var*) left)->varno != relid ||
+        ((Var*) left)->varattno != 1 || ((Var*) left)->varlevelsup != 0 ||
+        !OidIsValid(opno) || !IsScanConstant(right) ||
+        op->inputcollid != keyCollation) {
+        return false;
+    }
+
+    TypeCacheEntry* typeEntry = lookup_type_cache(keyType,
+        TYPECACHE_BTREE_OPFAMILY | TYPECACHE_CMP_PROC);
+    if (!OidIsValid(typeEntry->btree_opf) || !OidIsValid(typeEntry->cmp_proc)) {
+        return false;
+    }
+
+    int strategy = get_op_opfamily_strategy(opno, typeEntry->btree_opf);
+    if (strategy != BTEqualStrategyNumber && strategy != BTLessStrategyNumber &&
+        strategy != BTLessEqualStrategyNumber &&
+        strategy != BTGreaterEqualStrategyNumber) {
+        return false;
+    }
+
+    Oid valueType = exprType(right);
+    return valueType == keyType ||
+           can_coerce_type(1, &valueType, &keyType, COERCION_IMPLICIT);
+}
+
+static bool PlanDirectModify(PlannerInfo* root, ModifyTable* plan,
+                             Index resultRelation, int subplanIndex) {
+    KV_TRACE("\n-----------------%s----------------------\n", __func__);
+    /*
+     * Decide whether it is safe to execute a direct modification on the
+     * remote server. If so, return true after performing planning actions
+     * needed for that. Otherwise, return false. This optional function is
+     * called during query planning. If this function succeeds,
+     * BeginDirectModify, IterateDirectModify and EndDirectModify will be
+     * called at the execution stage, instead. Otherwise, the table
+     * modification will be executed using the table-updating functions
+     * described above.
+     *
+     * Only a delete whose quals are all key bounds is pushed down, the keys
+     * within the bounds are deleted by the kv worker without a round trip per
+     * row. An update still reads the rows, since the new values are computed
+     * and encoded by the backend.
+     */
+
+    ereport(DEBUG1, errmsg("entering function %s", __func__));
+
+    if (plan->operation != CMD_DELETE || plan->returningLists != NIL) {
+        return false;
+    }
+
+    Plan* subplan = (Plan*) list_nth(plan->plans, subplanIndex);
+    if (!IsA(subplan, ForeignScan) ||
+        ((ForeignScan*) subplan)->scan.scanrelid != resultRelation) {
+        return false;
+    }
+
+    RangeTblEntry* rangeTable = planner_rt_fetch(resultRelation, root);
+    Relation relation = table_open(rangeTable->relid, NoLock);
+    Form_pg_attribute attr = TupleDescAttr(RelationGetDescr(relation), 0);
+    Oid keyType = attr->atttypid;
+    Oid keyCollation = attr->attcollation;
+    table_close(relation, NoLock);
+
+    ListCell* lc;
+    foreach (lc, subplan->qual) {
+        if (!IsDirectDeleteQual((Node*) lfirst(lc), resultRelation, keyType,
+                                keyCollation)) {
+            return false;
+        }
+    }
+
+    ((ForeignScan*) subplan)->operation = CMD_DELETE;
+    return true;
+}
+
+static void BeginDirectModify(ForeignScanState* scanState, int executorFlags) {
+    KV_TRACE("\n-----------------%s----------------------\n", __func__);
+    /*
+     * Prepare to execute a direct modification on the remote server. This is
+     * called during executor startup. It should perform any initialization
+     * needed prior to the direct modification (that should be done upon the
+     * first call to IterateDirectModify). The ForeignScanState node has
+     * already been created, but its fdw_state field is still NULL.
+     *
+     * Note that when (executorFlags & EXEC_FLAG_EXPLAIN_ONLY) is true, this
+     * function should not perform any externally-visible actions; it should
+     * only do the minimum required to make the node state valid for
+     * ExplainDirectModify and EndDirectModify.
+     */
+
+    ereport(DEBUG1, errmsg("entering function %s", __func__));
+
+    TableDirectModifyState* modifyState =
+        palloc0(sizeof(TableDirectModifyState));
+    modifyState->done = false;
+    modifyState->execExplainOnly = false;
+    scanState->fdw_state = (void*) modifyState;
+
+    if (executorFlags & EXEC_FLAG_EXPLAIN_ONLY) {
+        modifyState->execExplainOnly = true;
+        return;
+    }
+
+    /* the params are known already, see IsDirectDeleteQual */
+    KeyRangeQual range;
+    memset(&range, 0, sizeof(range));
+
+    ListCell* lc;
+    foreach (lc, scanState->ss.ps.plan->qual) {
+        GetKeyRangeQual((Node*) lfirst(lc), scanState, &range);
+    }
+
+    Relation relation = scanState->ss.ss_currentRelation;
+    KVFdwOptions* fdwOptions = KVGetOptions(RelationGetRelid(relation));
+    modifyState->empty = range.empty;
+    modifyState->bounds = SerializeScanBounds(RelationGetDescr(relation),
+                                              &range, fdwOptions->orderedKey);
+}
+
+static TupleTableSlot* IterateDirectModify(ForeignScanState* scanState) {
+    KV_TRACE("\n-----------------%s----------------------\n", __func__);
+    /*
+     * When the query doesn't have a RETURNING clause, just return NULL after
+     * a direct modification on the remote server. The number of the deleted
+     * rows is added to the processed rows of the executor instead.
+     */
+
+    ereport(DEBUG1, errmsg("entering function %s", __func__));
+
+    TableDirectModifyState* modifyState =
+        (TableDirectModifyState*) scanState->fdw_state;
+    TupleTableSlot* slot = scanState->ss.ss_ScanTupleSlot;
+    if (modifyState->done || modifyState->empty) {
+        return ExecClearTuple(slot);
+    }
+    modifyState->done = true;
+
+    Oid relationId = RelationGetRelid(scanState->ss.ss_currentRelation);
+    uint64 count = 0;
+
+    DeleteRangeArgs args;
+    args.bounds = modifyState->bounds;
+    args.count = &count;
+    if (!KVDeleteRangeRequest(relationId, &args)) {
+        ereport(ERROR, errmsg("could not delete rows from foreign table %u",
+                              relationId));
+    }
+
+    scanState->ss.ps.state->es_processed += count;
+    if (scanState->ss.ps.instrument) {
+        scanState->ss.ps.instrument->tuplecount += count;
+    }
+    return ExecClearTuple(slot);
+}
+
+static void EndDirectModify(ForeignScanState* scanState) {
+    KV_TRACE("\n-----------------%s----------------------\n", __func__);
+    /*
+     * Clean up after a direct modification. It is normally not important to
+     * release palloc'd memory, but for example open files and connections to
+     * remote servers should be cleaned up.
+     */
+
+    ereport(DEBUG1, errmsg("entering function %s", __func__));
+
+    TableDirectModifyState* modifyState =
+        (TableDirectModifyState*) scanState->fdw_state;
+
+    /* the table is opened by GetForeignPlan as for a scan */
+    if (!modifyState->execExplainOnly) {
+        KVCloseRequest(RelationGetRelid(scanState->ss.ss_currentRelation));
+    }
+    pfree(modifyState);
+}
+
 static void ExplainForeignScan(ForeignScanState* scanState,
                                struct ExplainState*  explainState) {
-    printf("\n-----------------%s----------------------\n", __func__);
+    KV_TRACE("\n-----------------%s----------------------\n", __func__);
     /*
      * Print additional EXPLAIN output for a foreign table scan. This function
      * can call ExplainPropertyText and related functions to add fields to the
@@ -1202,13 +2821,26 @@ static void ExplainForeignScan(ForeignScanState* scanState,
      */
 
     ereport(DEBUG1, errmsg("entering function %s", __func__));
+
+    if (IsAggregateScan(scanState)) {
+        TableAggregateState* aggState =
+            (TableAggregateState*) scanState->fdw_state;
+        ExplainPropertyInteger("Pushed Aggregates", NULL, aggState->aggCount,
+                               explainState);
+        return;
+    }
+
+    TableReadState* readState = (TableReadState*) scanState->fdw_state;
+    if (readState->reverse) {
+        ExplainPropertyText("Key Order", "Descending", explainState);
+    }
 }
 
 static void ExplainForeignModify(ModifyTableState* modifyTableState,
                                  ResultRelInfo* relationInfo, List* fdwPrivate,
                                 int subplanIndex,
                                 struct ExplainState* explainState) {
-    printf("\n-----------------%s----------------------\n", __func__);
+    KV_TRACE("\n-----------------%s----------------------\n", __func__);
     /*
      * Print additional EXPLAIN output for a foreign table update. This
      * function can call ExplainPropertyText and related functions to add
@@ -1224,10 +2856,116 @@ static void ExplainForeignModify(ModifyTableState* modifyTableState,
     ereport(DEBUG1, errmsg("entering function %s", __func__));
 }
 
+static void ExplainDirectModify(ForeignScanState* scanState,
+                                struct ExplainState* explainState) {
+    KV_TRACE("\n-----------------%s----------------------\n", __func__);
+    /*
+     * Print additional EXPLAIN output for a direct modification on the remote
+     * server. This function can call ExplainPropertyText and related
+     * functions to add fields to the EXPLAIN output.
+     */
+
+    ereport(DEBUG1, errmsg("entering function %s", __func__));
+
+    ExplainPropertyText("Pushed Delete", "Key Range", explainState);
+}
+
+/*
+ * The worker draws the sample while scanning the whole table, then hands it
+ * out as a cursor with the number of rows it scanned.
+ */
+static int AcquireSampleRows(Relation relation, int elevel, HeapTuple* rows,
+                             int targrows, double* totalrows,
+                             double* totaldeadrows) {
+    KV_TRACE("\n-----------------%s----------------------\n", __func__);
+    ereport(DEBUG1, errmsg("entering function %s", __func__));
+
+    Oid relationId = RelationGetRelid(relation);
+    TupleDesc tupleDescriptor = RelationGetDescr(relation);
+    KVFdwOptions* fdwOptions = KVGetOptions(relationId);
+    bool orderedKey = fdwOptions->orderedKey;
+    KVTupleCodec* codec = BuildTupleCodec(tupleDescriptor, orderedKey);
+    #ifdef VIDARDB
+    bool useColumn = fdwOptions->useColumn;
+    #endif
+    TupleTableSlot* slot = MakeSingleTupleTableSlot(tupleDescriptor,
+                                                    &TTSOpsVirtual);
+
+    char* buf = NULL;
+    uint64 bufLen = 0;
+    SampleArgs args;
+    args.opid = ++operationId;
+    args.buf = &buf;
+    args.bufLen = &bufLen;
+    args.sampleSize = targrows;
+    args.rowCount = 0;
+    bool hasNext = KVSampleRequest(relationId, &args);
+
+    int count = 0;
+    while (true) {
+        for (char* next = buf; next < buf + bufLen && count < targrows;) {
+            size_t keyLen, valLen;
+            memcpy(&keyLen, next, sizeof(keyLen));
+            next += sizeof(keyLen);
+            char* key = next;
+            next += keyLen;
+            memcpy(&valLen, next, sizeof(valLen));
+            next += sizeof(valLen);
+            char* val = next;
+            next += valLen;
+
+            #ifdef VIDARDB
+            if (useColumn) {
+                DeserializeColumnTuple(key, keyLen, val, valLen, slot, NIL,
+                                       true, orderedKey);
+            } else {
+                DecodeTuple(codec, key, keyLen, val, valLen, slot->tts_values,
+                            slot->tts_isnull);
+            }
+            #else
+            DecodeTuple(codec, key, keyLen, val, valLen, slot->tts_values,
+                        slot->tts_isnull);
+            #endif
+            rows[count++] = heap_form_tuple(tupleDescriptor, slot->tts_values,
+                                            slot->tts_isnull);
+        }
+
+        if (!hasNext) {
+            break;
+        }
+
+        ReadBatchArgs batchArgs;
+        batchArgs.opid = args.opid;
+        batchArgs.buf = &buf;
+        batchArgs.bufLen = &bufLen;
+        batchArgs.bounds = NULL;
+        hasNext = KVReadBatchRequest(relationId, &batchArgs);
+        if (bufLen == 0 && hasNext) {
+            ereport(ERROR, errmsg("kv worker returned an empty batch of foreign "
+                                  "table %u before its end", relationId));
+        }
+    }
+
+    CloseCursorArgs closeArgs;
+    closeArgs.opid = args.opid;
+    KVCloseCursorRequest(relationId, &closeArgs);
+
+    *totalrows = args.rowCount;
+    *totaldeadrows = 0;
+    KVCloseRequest(relationId);
+
+    ExecDropSingleTupleTableSlot(slot);
+
+    ereport(elevel, errmsg("\"%s\": table contains %.0f rows, %d rows in sample",
+                           RelationGetRelationName(relation), *totalrows,
+                           count));
+    return count;
+}
+
 static bool AnalyzeForeignTable(Relation relation,
                                 AcquireSampleRowsFunc* acquireSampleRowsFunc,
                                 BlockNumber* totalPageCount) {
-    printf("\n-----------------%s----------------------\n", __func__);
+    KV_TRACE("\n-----------------%s----------------------\n", __func__);
     /* ----
      * This function is called when ANALYZE is executed on a foreign table. If
      * the FDW can collect statistics for this foreign table, it should return
@@ -1257,11 +2995,135 @@ static bool AnalyzeForeignTable(Relation relation,
 
     ereport(DEBUG1, errmsg("entering function %s", __func__));
 
+    Oid relationId = RelationGetRelid(relation);
+    OpenArgs args;
+    SetRelationComparatorOpts(relation, &args.opts);
+
+    KVFdwOptions* fdwOptions = KVGetOptions(relationId);
+    args.path = fdwOptions->filename;
+    args.engine = fdwOptions->engine;
+    args.write = fdwOptions->write;
+    #ifdef VIDARDB
+    args.useColumn = fdwOptions->useColumn;
+    args.attrCount = RelationGetNumberOfAttributes(relation);
+    #endif
+
+    /* kept open for AcquireSampleRows, which closes it */
+    KVOpenRequest(relationId, &args);
+    double rows = KVCountRequest(relationId);
+    int32 width = get_relation_data_width(relationId, NULL);
+
+    *totalPageCount = (BlockNumber) ceil(rows * width / BLCKSZ);
+    *acquireSampleRowsFunc = AcquireSampleRows;
+    return true;
+}
+
+static bool IsForeignScanParallelSafe(PlannerInfo* root, RelOptInfo* rel,
+                                      RangeTblEntry* rte) {
+    KV_TRACE("\n-----------------%s----------------------\n", __func__);
+    /*
+     * Test whether a scan can be performed within a parallel worker. This
+     * function will only be called when the planner believes that a parallel
+     * plan might be possible, and should return true if it is safe for that
+     * scan to run within a parallel worker.
+     */
+
+    ereport(DEBUG1, errmsg("entering function %s", __func__));
+
+    #ifdef VIDARDB
+    /* the plan state in fdw_private cannot be passed to parallel workers */
     return false;
+    #else
+    return true;
+    #endif
+}
+
+static Size EstimateDSMForeignScan(ForeignScanState* scanState,
+                                   ParallelContext* pcxt) {
+    KV_TRACE("\n-----------------%s----------------------\n", __func__);
+    /*
+     * Estimate the amount of dynamic shared memory that will be required for
+     * parallel operation. This is called in the leader, after
+     * BeginForeignScan, so the split keys are fetched here.
+     */
+
+    ereport(DEBUG1, errmsg("entering function %s", __func__));
+
+    TableReadState* readState = (TableReadState*) scanState->fdw_state;
+    Oid relationId = RelationGetRelid(scanState->ss.ss_currentRelation);
+
+    /* several chunks per participant to even out their sizes */
+    SplitArgs args;
+    args.maxSplits = (pcxt->nworkers + 1) * PARALLELCHUNKS - 1;
+    args.bounds = readState->qualBounds;
+    args.buf = &readState->splits;
+    args.bufLen = &readState->splitsLen;
+    KVSplitRequest(relationId, &args);
+
+    return offsetof(ParallelScanState, splits) + readState->splitsLen;
+}
+
+static void InitializeDSMForeignScan(ForeignScanState* scanState,
+                                     ParallelContext* pcxt, void* coordinate) {
+    KV_TRACE("\n-----------------%s----------------------\n", __func__);
+    /*
+     * Initialize the dynamic shared memory that will be required for parallel
+     * operation. coordinate points to a shared memory area of size equal to
+     * the return value of EstimateDSMForeignScan.
+     */
+
+    ereport(DEBUG1, errmsg("entering function %s", __func__));
+
+    TableReadState* readState = (TableReadState*) scanState->fdw_state;
+    ParallelScanState* parallelState = (ParallelScanState*) coordinate;
+
+    pg_atomic_init_u32(&parallelState->next, 0);
+    parallelState->chunks = 1;
+    parallelState->splitsLen = readState->splitsLen;
+    memcpy(parallelState->splits, readState->splits, readState->splitsLen);
+
+    for (char* current = readState->splits;
+         current < readState->splits + readState->splitsLen;) {
+        uint64 keyLen;
+        memcpy(&keyLen, current, sizeof(keyLen));
+        current += sizeof(keyLen) + keyLen;
+        parallelState->chunks++;
+    }
+
+    readState->parallelState = parallelState;
+}
+
+static void ReInitializeDSMForeignScan(ForeignScanState* scanState,
+                                       ParallelContext* pcxt,
+                                       void* coordinate) {
+    KV_TRACE("\n-----------------%s----------------------\n", __func__);
+    /*
+     * Re-initialize the dynamic shared memory required for parallel operation
+     * when the foreign-scan plan node is about to be re-scanned.
+     */
+
+    ereport(DEBUG1, errmsg("entering function %s", __func__));
+
+    ParallelScanState* parallelState = (ParallelScanState*) coordinate;
+    pg_atomic_write_u32(&parallelState->next, 0);
+}
+
+static void InitializeWorkerForeignScan(ForeignScanState* scanState,
+                                        shm_toc* toc, void* coordinate) {
+    KV_TRACE("\n-----------------%s----------------------\n", __func__);
+    /*
+     * Initialize a parallel worker's local state based on the shared state
+     * set up by the leader during InitializeDSMForeignScan.
+     */
+
+    ereport(DEBUG1, errmsg("entering function %s", __func__));
+
+    TableReadState* readState = (TableReadState*) scanState->fdw_state;
+    readState->parallelState = (ParallelScanState*) coordinate;
 }
 
 Datum kv_fdw_handler(PG_FUNCTION_ARGS) {
-    printf("\n-----------------%s----------------------\n", __func__);
+    KV_TRACE("\n-----------------%s----------------------\n", __func__);
     FdwRoutine* routine = makeNode(FdwRoutine);
 
     ereport(DEBUG1, errmsg("entering function %s", __func__));
@@ -1285,6 +3147,9 @@ Datum kv_fdw_handler(PG_FUNCTION_ARGS) {
     routine->EndForeignScan = EndForeignScan;
 
     /* remainder are optional - use NULL if not required */
+    /* support for aggregate pushdown */
+    routine->GetForeignUpperPaths = GetForeignUpperPaths;
+
     /* support for insert / update / delete */
     routine->AddForeignUpdateTargets = AddForeignUpdateTargets;
     routine->PlanForeignModify = PlanForeignModify;
@@ -1294,31 +3159,50 @@ Datum kv_fdw_handler(PG_FUNCTION_ARGS) {
     routine->ExecForeignDelete = ExecForeignDelete;
     routine->EndForeignModify = EndForeignModify;
 
+    /* support for direct delete */
+    routine->PlanDirectModify = PlanDirectModify;
+    routine->BeginDirectModify = BeginDirectModify;
+    routine->IterateDirectModify = IterateDirectModify;
+    routine->EndDirectModify = EndDirectModify;
+
     /* support for EXPLAIN */
     routine->ExplainForeignScan = ExplainForeignScan;
     routine->ExplainForeignModify = ExplainForeignModify;
+    routine->ExplainDirectModify = ExplainDirectModify;
 
     /* support for ANALYSE */
     routine->AnalyzeForeignTable = AnalyzeForeignTable;
 
+    /* support for parallel scan */
+    routine->IsForeignScanParallelSafe = IsForeignScanParallelSafe;
+    routine->EstimateDSMForeignScan = EstimateDSMForeignScan;
+    routine->InitializeDSMForeignScan = InitializeDSMForeignScan;
+    routine->ReInitializeDSMForeignScan = ReInitializeDSMForeignScan;
+    routine->InitializeWorkerForeignScan = InitializeWorkerForeignScan;
+
     PG_RETURN_POINTER(routine);
 }
 
 Datum kv_fdw_validator(PG_FUNCTION_ARGS) {
-    printf("\n-----------------%s----------------------\n", __func__);
-    //List *options_list = untransformRelOptions(PG_GETARG_DATUM(0));
+    KV_TRACE("\n-----------------%s----------------------\n", __func__);
+    List* optionList = untransformRelOptions(PG_GETARG_DATUM(0));
+    Oid catalog = PG_GETARG_OID(1);
 
     ereport(DEBUG1, errmsg("entering function %s", __func__));
 
-    /* make sure the options are valid */
-
-    /* no options are supported */
-
-    /*if (list_length(options_list) > 0) {
-        ereport(ERROR, errcode(ERRCODE_FDW_INVALID_OPTION_NAME),
-                       errmsg("invalid options"),
-                       errhint("FDW does not support any options"));
-    }*/
+    /* make sure the options tuning the storage engine are valid */
+    KVFdwOptions options;
+    memset(&options, 0, sizeof(options));
+    ListCell* optionCell = NULL;
+    foreach(optionCell, optionList) {
+        DefElem* optionDef = (DefElem*) lfirst(optionCell);
+        char* value = defGetString(optionDef);
+        if (!KVParseEngineOption(optionDef->defname, value, &options.engine) &&
+            !KVParseWriteOption(optionDef->defname, value, &options.write)) {
+            KVParseTableOption(optionDef->defname, value, catalog, &options);
+        }
+    }
+    KVCheckWriteOptions(&options.write);
 
     PG_RETURN_VOID();
 }
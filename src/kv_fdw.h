@@ -36,22 +36,65 @@
  */
 typedef struct KVFdwOptions {
     char* filename;
+    bool  orderedKey;  /* order-preserving key encoding */
+    bool  estimateCount;  /* count(*) pushed down is the engine's estimate */
+    EngineOpts engine;    /* tuning of the storage engine */
+    WriteOpts  write;     /* durability of the writes */
     #ifdef VIDARDB
     bool  useColumn;
     int32 batchCapacity;
+    #else
+    bool  bulkLoad;    /* COPY FROM builds and ingests sorted string tables */
+    bool  sortedLoad;  /* COPY FROM input is already in key order */
     #endif
 } KVFdwOptions;
 
 
+/*
+ * What the row format needs of an attribute, see BuildTupleCodec.
+ */
+typedef struct KVAttrCodec {
+    int16 length;
+    bool  byValue;
+    char  storage;
+    bool  needed;   /* decoded by a scan, see TrimTupleCodec */
+} KVAttrCodec;
+
+typedef struct KVTupleCodec {
+    TupleDesc   tupleDescriptor;
+    int         count;
+    bool        orderedKey;
+    int         fixedSize;  /* max size of the value, -1 with varlena */
+    int         lastNeeded; /* attributes after it are not decoded */
+    KVAttrCodec attrs[FLEXIBLE_ARRAY_MEMBER];
+} KVTupleCodec;
+
+
 /* Functions used across files in kv_fdw */
 extern KVFdwOptions* KVGetOptions(Oid foreignTableId);
-extern void SerializeNullAttribute(TupleDesc tupleDescriptor, Index index,
-                                   StringInfo buffer);
+extern bool KVParseTableOption(const char* name, const char* value,
+                               Oid catalog, KVFdwOptions* options);
+extern bool KVParseEngineOption(const char* name, const char* value,
+                                EngineOpts* engine);
+extern void KVCheckWriteOptions(WriteOpts* write);
+extern bool KVParseWriteOption(const char* name, const char* value,
+                               WriteOpts* write);
 extern void SerializeAttribute(TupleDesc tupleDescriptor, Index index,
                                Datum datum, StringInfo buffer);
 extern int  DeserializeAttribute(TupleDesc tupleDescriptor, Index index,
                                  int offset, char* key, char* val, char* limit,
                                  Datum* values, bool* nulls);
+extern void SerializeOrderedKey(TupleDesc tupleDescriptor, Datum datum,
+                                StringInfo buffer);
+extern Datum DeserializeOrderedKey(TupleDesc tupleDescriptor, char* key,
+                                   size_t keyLen);
+extern KVTupleCodec* BuildTupleCodec(TupleDesc tupleDescriptor,
+                                     bool orderedKey);
+extern void TrimTupleCodec(KVTupleCodec* codec, List* attrs);
+extern void DecodeTuple(KVTupleCodec* codec, char* key, size_t keyLen,
+                        char* val, size_t valLen, Datum* values, bool* nulls);
+extern void EncodeTuple(KVTupleCodec* codec, Datum* values, bool* nulls,
+                        StringInfo key, StringInfo val);
 extern void SetRelationComparatorOpts(Relation relation, ComparatorOpts* opts);
 
 #endif  /* KV_FDW_H_ */
@@ -15,6 +15,7 @@
 
 
 #include <sys/stat.h>
+#include <unistd.h>
 
 #include "kv_fdw.h"
 #include "server/kv_storage.h"
@@ -36,12 +37,40 @@
 #include "utils/typcache.h"
 #include "commands/dbcommands.h"
 #include "access/table.h"
+#include "utils/guc.h"
+#include "utils/varlena.h"
+#include "utils/pg_locale.h"
+#include "utils/float.h"
+#include "utils/uuid.h"
+#include "catalog/pg_collation.h"
+#include "catalog/pg_type.h"
+#include "catalog/pg_foreign_table.h"
+#include "catalog/objectaddress.h"
+#include "utils/acl.h"
+#include "funcapi.h"
+#include "utils/array.h"
+#include "utils/memutils.h"
+#include "utils/tuplestore.h"
 
 
 /* Defines */
 #define KVFDWNAME             "kv_fdw"
+#define KVSHAREDNAME          "shared"
 #define HEADERBUFFSIZE        10
 #define OPTION_FILENAME       "filename"
+#define OPTION_KEY_ENCODING   "keyencoding"
+#define ORDEREDKEYENCODING    "ordered"
+#define NATIVEKEYENCODING     "native"
+#define OPTION_ESTIMATE_COUNT "estimatecount"
+#define OPTION_BLOOM_BITS     "bloombits"
+#define OPTION_BLOCK_SIZE     "blocksize"
+#define OPTION_COMPRESSION    "compression"
+#define OPTION_WRITE_BUFFER   "writebuffersize"
+#define OPTION_BACKGROUND_JOBS "backgroundjobs"
+#define OPTION_SYNC           "sync"
+#define OPTION_DISABLE_WAL    "disablewal"
+#define OPTION_BULK_LOAD      "bulkload"
+#define OPTION_SORTED_LOAD    "sorted"
 #ifdef VIDARDB
 #define COLUMNSTORE           "column"
 #define BATCHCAPACITY         8*1024*1024
@@ -75,10 +104,23 @@ typedef struct DroppedObject {
  * SQL functions
  */
 PG_FUNCTION_INFO_V1(kv_ddl_event_end_trigger);
+PG_FUNCTION_INFO_V1(kv_fdw_stats);
+PG_FUNCTION_INFO_V1(kv_fdw_engine_stats);
 
 /* saved hook value in case of unload */
 static ProcessUtility_hook_type PreviousProcessUtilityHook = NULL;
 
+/* GUC variables */
+int  KVWorkerThreads = 0;
+int  KVResponseChannels = 8;
+bool KVUseLockFreeChannel = false;
+int  KVIdleWorkers = 0;
+bool KVSharedStorage = false;
+int  KVBlockCacheSize = 64;
+bool KVDebugTrace = false;
+bool KVPipelinedWrites = false;
+int  KVPointCacheSize = 0;
+
 /* local functions forward declarations */
 static void KVProcessUtility(PlannedStmt* plannedStmt, const char* queryString,
                              ProcessUtilityContext context,
@@ -87,11 +129,135 @@ static void KVProcessUtility(PlannedStmt* plannedStmt, const char* queryString,
                              DestReceiver* destReceiver, char* completionTag);
 
 /*
- * _PG_init is called when the module is loaded. In this function we save the
- * previous utility hook, and then install our hook to pre-intercept calls to
- * the copy command.
+ * _PG_init is called when the module is loaded. In this function we define
+ * the GUC variables, save the previous utility hook, and then install our hook
+ * to pre-intercept calls to the copy command.
  */
 void _PG_init(void) {
+    DefineCustomIntVariable("kv_fdw.worker_threads",
+                            "Number of threads in each kv worker to process "
+                            "requests, 0 means processing in the main loop.",
+                            "Takes effect for kv workers launched afterwards.",
+                            &KVWorkerThreads,
+                            0,
+                            0,
+                            64,
+                            PGC_SIGHUP,
+                            0,
+                            NULL,
+                            NULL,
+                            NULL);
+
+    DefineCustomIntVariable("kv_fdw.response_channels",
+                            "Number of response channels of kv manager and "
+                            "each kv worker.",
+                            "Backends block when all of them are leased.",
+                            &KVResponseChannels,
+                            8,
+                            1,
+                            1024,
+                            PGC_POSTMASTER,
+                            0,
+                            NULL,
+                            NULL,
+                            NULL);
+
+    DefineCustomBoolVariable("kv_fdw.lockfree_channel",
+                             "Use the lock-free ring as the request channel "
+                             "of kv manager and kv workers.",
+                             NULL,
+                             &KVUseLockFreeChannel,
+                             false,
+                             PGC_POSTMASTER,
+                             0,
+                             NULL,
+                             NULL,
+                             NULL);
+
+    DefineCustomIntVariable("kv_fdw.idle_workers",
+                            "Number of idle kv workers started in advance, "
+                            "which are bound to tables on demand.",
+                            "Each of them takes a background worker slot.",
+                            &KVIdleWorkers,
+                            0,
+                            0,
+                            64,
+                            PGC_POSTMASTER,
+                            0,
+                            NULL,
+                            NULL,
+                            NULL);
+
+    DefineCustomIntVariable("kv_fdw.block_cache_size",
+                            "Size of the block cache shared by the tables "
+                            "of each kv worker.",
+                            "Not used by VidarDB.",
+                            &KVBlockCacheSize,
+                            64,
+                            1,
+                            INT_MAX / 2,
+                            PGC_POSTMASTER,
+                            GUC_UNIT_MB,
+                            NULL,
+                            NULL,
+                            NULL);
+
+    #ifndef VIDARDB
+    DefineCustomBoolVariable("kv_fdw.shared_storage",
+                             "Store the tables of a database as column "
+                             "families of one storage engine instance.",
+                             "The instance is hosted by one kv worker per "
+                             "database. Tables stored otherwise are not "
+                             "visible after it is changed.",
+                             &KVSharedStorage,
+                             false,
+                             PGC_POSTMASTER,
+                             0,
+                             NULL,
+                             NULL,
+                             NULL);
+    #endif
+
+    DefineCustomBoolVariable("kv_fdw.debug_trace",
+                             "Print the entered callbacks and the chosen "
+                             "scans to the standard output.",
+                             NULL,
+                             &KVDebugTrace,
+                             false,
+                             PGC_USERSET,
+                             0,
+                             NULL,
+                             NULL,
+                             NULL);
+
+    DefineCustomBoolVariable("kv_fdw.pipelined_writes",
+                             "Send the batches of INSERT, UPDATE and DELETE "
+                             "without waiting for the kv worker.",
+                             "Failed writes are reported at the end of the "
+                             "statement.",
+                             &KVPipelinedWrites,
+                             false,
+                             PGC_USERSET,
+                             0,
+                             NULL,
+                             NULL,
+                             NULL);
+
+    DefineCustomIntVariable("kv_fdw.point_cache_size",
+                            "Size of the cache of the point lookups of each "
+                            "backend.",
+                            "A cached value is used until its table is "
+                            "written. 0 disables the cache.",
+                            &KVPointCacheSize,
+                            0,
+                            0,
+                            INT_MAX / 2,
+                            PGC_USERSET,
+                            GUC_UNIT_KB,
+                            NULL,
+                            NULL,
+                            NULL);
+
     PreviousProcessUtilityHook = ProcessUtility_hook;
     ProcessUtility_hook = KVProcessUtility;
 
@@ -203,6 +369,29 @@ static char* KVDefaultFilePath(Oid foreignTableId) {
     return filePath->data;
 }
 
+/* the instance of the shared storage, the tables are its column families */
+static char* KVSharedFilePath(void) {
+    StringInfo filePath = makeStringInfo();
+    appendStringInfo(filePath, "%s/%s/%u/%s", DataDir, KVFDWNAME, MyDatabaseId,
+                     KVSHAREDNAME);
+
+    return filePath->data;
+}
+
+static char* KVFindOptionValue(List* optionList, const char* optionName) {
+    ListCell* optionCell = NULL;
+    foreach(optionCell, optionList) {
+        DefElem* optionDef = (DefElem*) lfirst(optionCell);
+        char* optionDefName = optionDef->defname;
+
+        if (strncmp(optionDefName, optionName, NAMEDATALEN) == 0) {
+            return defGetString(optionDef);
+        }
+    }
+
+    return NULL;
+}
+
 /*
  * Walks over foreign table and foreign server options, and
  * looks for the option with the given name. If found, the function returns the
@@ -216,17 +405,162 @@ static char* KVGetOptionValue(Oid foreignTableId, const char* optionName) {
     optionList = list_concat(optionList, foreignTable->options);
     optionList = list_concat(optionList, foreignServer->options);
 
-    ListCell* optionCell = NULL;
-    foreach(optionCell, optionList) {
-        DefElem* optionDef = (DefElem*) lfirst(optionCell);
-        char* optionDefName = optionDef->defname;
+    return KVFindOptionValue(optionList, optionName);
+}
 
-        if (strncmp(optionDefName, optionName, NAMEDATALEN) == 0) {
-            return defGetString(optionDef);
+/* an option which describes the stored data of one table, not of the server */
+static char* KVGetTableOptionValue(Oid foreignTableId, const char* optionName) {
+    return KVFindOptionValue(GetForeignTable(foreignTableId)->options,
+                             optionName);
+}
+
+/* indexed by KVCompression */
+static const char* const KVCompressionNames[] = {
+    "default", "none", "snappy", "lz4", "zstd", "zlib"
+};
+
+static int32 KVParseIntOption(const char* name, const char* value, int flags,
+                              int32 min, int32 max) {
+    int result = 0;
+    const char* hint = NULL;
+    if (!parse_int(value, &result, flags, &hint) || result < min ||
+        result > max) {
+        ereport(ERROR, (errmsg("invalid value for option \"%s\": \"%s\"",
+                               name, value),
+                        hint ? errhint("%s", _(hint)) :
+                               errhint("Valid values are between %d and %d.",
+                                       min, max)));
+    }
+    return result;
+}
+
+/* a comma separated list of the compressions of the levels from level 0 */
+static void KVParseCompression(const char* value, EngineOpts* engine) {
+    List* names = NIL;
+    if (!SplitIdentifierString(pstrdup(value), ',', &names) || names == NIL ||
+        list_length(names) > KVMAXLEVELS) {
+        ereport(ERROR, errmsg("%s requires a list of up to %d compressions",
+                              OPTION_COMPRESSION, KVMAXLEVELS));
+    }
+
+    engine->compressionLevels = 0;
+    ListCell* nameCell = NULL;
+    foreach(nameCell, names) {
+        char* name = lfirst(nameCell);
+        int kind = -1;
+        for (int i = 0; i < lengthof(KVCompressionNames); i++) {
+            if (strcmp(name, KVCompressionNames[i]) == 0) {
+                kind = i;
+            }
+        }
+        if (kind < 0) {
+            ereport(ERROR, (errmsg("invalid %s \"%s\"", OPTION_COMPRESSION,
+                                   name),
+                            errhint("Valid values are \"default\", \"none\", "
+                                    "\"snappy\", \"lz4\", \"zstd\" and "
+                                    "\"zlib\".")));
         }
+        engine->compression[engine->compressionLevels++] = kind;
     }
+}
 
-    return NULL;
+/*
+ * Parses an option of the durability of the writes, and returns false if the
+ * option is not one of them. It is also used by the validator.
+ */
+bool KVParseWriteOption(const char* name, const char* value, WriteOpts* write) {
+    bool* result = NULL;
+    if (strcmp(name, OPTION_SYNC) == 0) {
+        result = &write->sync;
+    } else if (strcmp(name, OPTION_DISABLE_WAL) == 0) {
+        result = &write->disableWAL;
+    } else {
+        return false;
+    }
+
+    if (!parse_bool(value, result)) {
+        ereport(ERROR, errmsg("%s requires a Boolean value", name));
+    }
+    return true;
+}
+
+/* sync write is pointless without the WAL */
+void KVCheckWriteOptions(WriteOpts* write) {
+    if (write->sync && write->disableWAL) {
+        ereport(ERROR, errmsg("%s and %s cannot be both enabled", OPTION_SYNC,
+                              OPTION_DISABLE_WAL));
+    }
+}
+
+/*
+ * Parses an option tuning the storage engine, and returns false if the option
+ * is not one of them. The sizes take memory units. It is also used by the
+ * validator, so that invalid values are rejected by CREATE and ALTER.
+ */
+bool KVParseEngineOption(const char* name, const char* value,
+                         EngineOpts* engine) {
+    if (strcmp(name, OPTION_BLOOM_BITS) == 0) {
+        engine->bloomBits = KVParseIntOption(name, value, 0, 0, 64);
+    } else if (strcmp(name, OPTION_BLOCK_SIZE) == 0) {
+        engine->blockSize = KVParseIntOption(name, value, GUC_UNIT_BYTE, 1024,
+                                             64 * 1024 * 1024);
+    } else if (strcmp(name, OPTION_WRITE_BUFFER) == 0) {
+        engine->writeBufferSize = KVParseIntOption(name, value, GUC_UNIT_BYTE,
+                                                   64 * 1024, INT_MAX);
+    } else if (strcmp(name, OPTION_BACKGROUND_JOBS) == 0) {
+        engine->backgroundJobs = KVParseIntOption(name, value, 0, 1, 256);
+    } else if (strcmp(name, OPTION_COMPRESSION) == 0) {
+        KVParseCompression(value, engine);
+    } else {
+        return false;
+    }
+    return true;
+}
+
+/*
+ * Parses an option of the table itself, and returns false if the option is not
+ * one of them. It is also used by the validator, with the catalog the options
+ * belong to.
+ */
+bool KVParseTableOption(const char* name, const char* value, Oid catalog,
+                        KVFdwOptions* options) {
+    bool* result = NULL;
+    if (strcmp(name, OPTION_KEY_ENCODING) == 0) {
+        /* the keys of every table of a server would be read differently */
+        if (catalog != ForeignTableRelationId) {
+            ereport(ERROR, (errcode(ERRCODE_FDW_INVALID_OPTION_NAME),
+                            errmsg("%s can only be set on a foreign table",
+                                   OPTION_KEY_ENCODING)));
+        }
+        if (strcmp(value, NATIVEKEYENCODING) == 0) {
+            options->orderedKey = false;
+        } else if (strcmp(value, ORDEREDKEYENCODING) == 0) {
+            options->orderedKey = true;
+        } else {
+            ereport(ERROR, errmsg("invalid %s \"%s\", expected \"%s\" or "
+                                  "\"%s\"", OPTION_KEY_ENCODING, value,
+                                  NATIVEKEYENCODING, ORDEREDKEYENCODING));
+        }
+        return true;
+    } else if (strcmp(name, OPTION_ESTIMATE_COUNT) == 0) {
+        result = &options->estimateCount;
+    } else if (strcmp(name, OPTION_BULK_LOAD) == 0 ||
+        strcmp(name, OPTION_SORTED_LOAD) == 0) {
+        #ifdef VIDARDB
+        ereport(ERROR, (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+                        errmsg("%s is not supported by VidarDB", name)));
+        #else
+        result = strcmp(name, OPTION_BULK_LOAD) == 0 ?
+            &options->bulkLoad : &options->sortedLoad;
+        #endif
+    } else {
+        return false;
+    }
+
+    if (!parse_bool(value, result)) {
+        ereport(ERROR, errmsg("%s requires a Boolean value", name));
+    }
+    return true;
 }
 
 /*
@@ -241,6 +575,33 @@ KVFdwOptions* KVGetOptions(Oid foreignTableId) {
     char* filename = KVGetOptionValue(foreignTableId, OPTION_FILENAME);
     /* set default filename if it is not provided */
     options->filename = filename ? filename : KVDefaultFilePath(foreignTableId);
+    /* all the tables are in the same instance with the shared storage */
+    if (KVSharedStorage) {
+        options->filename = KVSharedFilePath();
+    }
+
+    /* those of the table take precedence over those of the server */
+    static const char* const engineOptions[] = {
+        OPTION_BLOOM_BITS, OPTION_BLOCK_SIZE, OPTION_COMPRESSION,
+        OPTION_WRITE_BUFFER, OPTION_BACKGROUND_JOBS
+    };
+    for (int i = 0; i < lengthof(engineOptions); i++) {
+        char* value = KVGetOptionValue(foreignTableId, engineOptions[i]);
+        if (value) {
+            KVParseEngineOption(engineOptions[i], value, &options->engine);
+        }
+    }
+
+    static const char* const writeOptions[] = {
+        OPTION_SYNC, OPTION_DISABLE_WAL
+    };
+    for (int i = 0; i < lengthof(writeOptions); i++) {
+        char* value = KVGetOptionValue(foreignTableId, writeOptions[i]);
+        if (value) {
+            KVParseWriteOption(writeOptions[i], value, &options->write);
+        }
+    }
+    KVCheckWriteOptions(&options->write);
 
     #ifdef VIDARDB
     char* storage = KVGetOptionValue(foreignTableId, OPTION_STORAGE_FORMAT);
@@ -252,6 +613,23 @@ KVFdwOptions* KVGetOptions(Oid foreignTableId) {
         pg_atoi(capacity, sizeof(int32), 0) : BATCHCAPACITY;
     #endif
 
+    char* encoding = KVGetTableOptionValue(foreignTableId, OPTION_KEY_ENCODING);
+    if (encoding) {
+        KVParseTableOption(OPTION_KEY_ENCODING, encoding,
+                           ForeignTableRelationId, options);
+    }
+
+    static const char* const tableOptions[] = {
+        OPTION_ESTIMATE_COUNT, OPTION_BULK_LOAD, OPTION_SORTED_LOAD
+    };
+    for (int i = 0; i < lengthof(tableOptions); i++) {
+        char* value = KVGetOptionValue(foreignTableId, tableOptions[i]);
+        if (value) {
+            KVParseTableOption(tableOptions[i], value, ForeignTableRelationId,
+                               options);
+        }
+    }
+
     return options;
 }
 
@@ -292,12 +670,19 @@ Datum kv_ddl_event_end_trigger(PG_FUNCTION_ARGS) {
              */
             KVCreateDatabaseDirectory(MyDatabaseId);
 
+            /* the worker creates the column family of the shared storage */
+            if (KVSharedStorage) {
+                table_close(relation, AccessExclusiveLock);
+                PG_RETURN_NULL();
+            }
+
             StringInfo kvPath = makeStringInfo();
             appendStringInfo(kvPath, "%s/%s/%u/%u", DataDir, KVFDWNAME,
                              MyDatabaseId, relationId);
 
             ComparatorOpts opts;
             SetRelationComparatorOpts(relation, &opts);
+            KVFdwOptions* fdwOptions = KVGetOptions(relationId);
 
             /* Initialize the database */
             #ifdef VIDARDB
@@ -306,9 +691,10 @@ Datum kv_ddl_event_end_trigger(PG_FUNCTION_ARGS) {
                 (0 == strncmp(option, COLUMNSTORE, sizeof(COLUMNSTORE))): false;
             TupleDesc tupleDescriptor = RelationGetDescr(relation);
             void* kvDB = OpenConn(kvPath->data, useColumn,
-                                  tupleDescriptor->natts, &opts);
+                                  tupleDescriptor->natts, &opts,
+                                  &fdwOptions->engine);
             #else
-            void* kvDB = OpenConn(kvPath->data, &opts);
+            void* kvDB = OpenConn(kvPath->data, &opts, &fdwOptions->engine);
             #endif
             CloseConn(kvDB);
 
@@ -319,6 +705,116 @@ Datum kv_ddl_event_end_trigger(PG_FUNCTION_ARGS) {
     PG_RETURN_NULL();
 }
 
+/* Sets up the tuplestore returned by the statistics functions. */
+static Tuplestorestate* KVBeginStatsResult(FunctionCallInfo fcinfo,
+                                           TupleDesc* tupleDescriptor) {
+    ReturnSetInfo* resultInfo = (ReturnSetInfo*) fcinfo->resultinfo;
+    if (resultInfo == NULL || !IsA(resultInfo, ReturnSetInfo)) {
+        ereport(ERROR, errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+                errmsg("set-valued function called in context that cannot "
+                       "accept a set"));
+    }
+    if (!(resultInfo->allowedModes & SFRM_Materialize)) {
+        ereport(ERROR, errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+                errmsg("materialize mode required, but it is not allowed in "
+                       "this context"));
+    }
+    if (get_call_result_type(fcinfo, NULL, tupleDescriptor) !=
+        TYPEFUNC_COMPOSITE) {
+        ereport(ERROR, errmsg("return type must be a row type"));
+    }
+
+    MemoryContext oldContext =
+        MemoryContextSwitchTo(resultInfo->econtext->ecxt_per_query_memory);
+    Tuplestorestate* tupleStore = tuplestore_begin_heap(true, false, work_mem);
+    *tupleDescriptor = CreateTupleDescCopy(*tupleDescriptor);
+    MemoryContextSwitchTo(oldContext);
+
+    resultInfo->returnMode = SFRM_Materialize;
+    resultInfo->setResult = tupleStore;
+    resultInfo->setDesc = *tupleDescriptor;
+    return tupleStore;
+}
+
+/* nanoseconds of the counters to milliseconds */
+#define KVMILLISECONDS(nanos) Float8GetDatum((double) (nanos) / 1000000.0)
+
+/*
+ * kv_fdw_stats returns a row per kv worker and operation it served, with the
+ * times in milliseconds. The latency histogram counts the service times by the
+ * power of two of their microseconds, element i for those below 2^i.
+ */
+Datum kv_fdw_stats(PG_FUNCTION_ARGS) {
+    TupleDesc tupleDescriptor = NULL;
+    Tuplestorestate* tupleStore = KVBeginStatsResult(fcinfo, &tupleDescriptor);
+
+    KVOpStatsEntry* entries = NULL;
+    uint32 count = KVReadOpStats(&entries);
+    for (uint32 i = 0; i < count; i++) {
+        KVOpStatsEntry* entry = &entries[i];
+
+        Datum latency[KVSTATSBUCKETS];
+        for (int j = 0; j < KVSTATSBUCKETS; j++) {
+            latency[j] = Int64GetDatum(entry->latency[j]);
+        }
+
+        Datum values[11];
+        bool nulls[11];
+        memset(nulls, false, sizeof(nulls));
+        values[0] = ObjectIdGetDatum(entry->workerId);
+        values[1] = ObjectIdGetDatum(entry->dbId);
+        values[2] = CStringGetTextDatum(entry->operation);
+        values[3] = Int64GetDatum(entry->calls);
+        values[4] = KVMILLISECONDS(entry->queueWait);
+        values[5] = KVMILLISECONDS(entry->serviceTime);
+        values[6] = KVMILLISECONDS(entry->leaseWait);
+        values[7] = KVMILLISECONDS(entry->inputWait);
+        values[8] = Int64GetDatum(entry->bytesIn);
+        values[9] = Int64GetDatum(entry->bytesOut);
+        values[10] = PointerGetDatum(construct_array(latency, KVSTATSBUCKETS,
+                                                     INT8OID, sizeof(int64),
+                                                     FLOAT8PASSBYVAL, 'd'));
+        tuplestore_putvalues(tupleStore, tupleDescriptor, values, nulls);
+    }
+
+    PG_RETURN_VOID();
+}
+
+/*
+ * kv_fdw_engine_stats returns a row per kv worker with the statistics of its
+ * storage engine, copied by the worker at most once a second while it serves.
+ */
+Datum kv_fdw_engine_stats(PG_FUNCTION_ARGS) {
+    TupleDesc tupleDescriptor = NULL;
+    Tuplestorestate* tupleStore = KVBeginStatsResult(fcinfo, &tupleDescriptor);
+
+    KVEngineStatsEntry* entries = NULL;
+    uint32 count = KVReadEngineStats(&entries);
+    for (uint32 i = 0; i < count; i++) {
+        KVEngineStatsEntry* entry = &entries[i];
+        uint64* tickers = entry->tickers;
+        uint64 lookups = tickers[KVEngineCacheHits] +
+                         tickers[KVEngineCacheMisses];
+
+        Datum values[8];
+        bool nulls[8];
+        memset(nulls, false, sizeof(nulls));
+        values[0] = ObjectIdGetDatum(entry->workerId);
+        values[1] = ObjectIdGetDatum(entry->dbId);
+        values[2] = Int64GetDatum(tickers[KVEngineCacheHits]);
+        values[3] = Int64GetDatum(tickers[KVEngineCacheMisses]);
+        values[4] = Float8GetDatum(lookups > 0 ?
+            (double) tickers[KVEngineCacheHits] / lookups : 0);
+        nulls[4] = lookups == 0;
+        values[5] = Float8GetDatum(tickers[KVEngineStallMicros] / 1000.0);
+        values[6] = Int64GetDatum(tickers[KVEngineCompactReadBytes]);
+        values[7] = Int64GetDatum(tickers[KVEngineCompactWriteBytes]);
+        tuplestore_putvalues(tupleStore, tupleDescriptor, values, nulls);
+    }
+
+    PG_RETURN_VOID();
+}
+
 /*
  * Removes directory previously created for this database.
  * However it does not remove 'kv_fdw' directory even if there
@@ -458,15 +954,6 @@ static uint8 DecodeVarintLength(char* start, char* limit, uint64* len) {
     return ret ? (ret - start) : 0;
 }
 
-void SerializeNullAttribute(TupleDesc tupleDescriptor, Index index,
-                            StringInfo buffer) {
-    enlargeStringInfo(buffer, buffer->len + HEADERBUFFSIZE);
-    char* current = buffer->data + buffer->len;
-    memset(current, 0, HEADERBUFFSIZE);
-    uint8 headerLen = EncodeVarintLength(0, current);
-    buffer->len += headerLen;
-}
-
 void SerializeAttribute(TupleDesc tupleDescriptor, Index index, Datum datum,
                         StringInfo buffer) {
     Form_pg_attribute attributeForm = TupleDescAttr(tupleDescriptor, index);
@@ -544,26 +1031,516 @@ int DeserializeAttribute(TupleDesc tupleDescriptor, Index index, int offset,
     return offset;
 }
 
+/*
+ * A tuple codec keeps what the row format needs of each attribute, so that a
+ * row is encoded and decoded in one pass without looking into the tuple
+ * descriptor again. The size header of a value attribute is exactly the size
+ * of the data, which saves the length computation of att_addlength_datum
+ * when decoding, and most headers are a single byte.
+ */
+KVTupleCodec* BuildTupleCodec(TupleDesc tupleDescriptor, bool orderedKey) {
+    int count = tupleDescriptor->natts;
+    KVTupleCodec* codec = palloc0(offsetof(KVTupleCodec, attrs) +
+                                  count * sizeof(KVAttrCodec));
+    codec->tupleDescriptor = tupleDescriptor;
+    codec->count = count;
+    codec->orderedKey = orderedKey;
+    codec->fixedSize = 0;
+    codec->lastNeeded = count - 1;
+
+    for (int index = 0; index < count; index++) {
+        Form_pg_attribute attributeForm = TupleDescAttr(tupleDescriptor, index);
+        KVAttrCodec* attr = &codec->attrs[index];
+        attr->length = attributeForm->attlen;
+        attr->byValue = attributeForm->attbyval;
+        attr->storage = attributeForm->attstorage;
+        attr->needed = true;
+
+        if (index > 0) {
+            if (attr->length > 0 && codec->fixedSize >= 0) {
+                codec->fixedSize += HEADERBUFFSIZE + attr->length;
+            } else {
+                codec->fixedSize = -1;
+            }
+        }
+    }
+
+    return codec;
+}
+
+/*
+ * Let a scan decode only the attributes it refers to. The size headers of the
+ * others are still read to skip their data, and the decoding stops after the
+ * last needed attribute. The key is always decoded.
+ */
+void TrimTupleCodec(KVTupleCodec* codec, List* attrs) {
+    for (int index = 1; index < codec->count; index++) {
+        codec->attrs[index].needed = false;
+    }
+    codec->lastNeeded = 0;
+
+    ListCell* lc = NULL;
+    foreach (lc, attrs) {
+        int index = lfirst_int(lc) - 1;
+        if (index < 0 || index >= codec->count) {
+            continue;
+        }
+        codec->attrs[index].needed = true;
+        codec->lastNeeded = Max(codec->lastNeeded, index);
+    }
+}
+
+static inline Datum FetchAttribute(KVAttrCodec* attr, char* current) {
+    if (!attr->byValue) {
+        return PointerGetDatum(current);
+    }
+
+    /* the data is not aligned in the row */
+    switch (attr->length) {
+        case sizeof(char):
+            return CharGetDatum(*current);
+        case sizeof(int16): {
+            int16 value;
+            memcpy(&value, current, sizeof(value));
+            return Int16GetDatum(value);
+        }
+        case sizeof(int32): {
+            int32 value;
+            memcpy(&value, current, sizeof(value));
+            return Int32GetDatum(value);
+        }
+        default: {
+            Datum value;
+            memcpy(&value, current, sizeof(value));
+            return value;
+        }
+    }
+}
+
+void DecodeTuple(KVTupleCodec* codec, char* key, size_t keyLen, char* val,
+                 size_t valLen, Datum* values, bool* nulls) {
+    if (codec->orderedKey) {
+        values[0] = DeserializeOrderedKey(codec->tupleDescriptor, key, keyLen);
+    } else {
+        values[0] = FetchAttribute(&codec->attrs[0], key);
+    }
+    nulls[0] = false;
+
+    char* current = val;
+    char* limit = val + valLen;
+    for (int index = 1; index < codec->count; index++) {
+        if (index > codec->lastNeeded) {
+            values[index] = (Datum) 0;
+            nulls[index] = true;
+            continue;
+        }
+
+        /* a row shorter than the table has nulls at the end */
+        uint64 dataLen = 0;
+        if (current < limit) {
+            unsigned char byte = *(unsigned char*) current;
+            if (byte < 128) {
+                dataLen = byte;
+                current++;
+            } else {
+                current += DecodeVarintLength(current, limit, &dataLen);
+            }
+        }
+
+        if (dataLen == 0) {
+            values[index] = (Datum) 0;
+            nulls[index] = true;
+            continue;
+        }
+
+        KVAttrCodec* attr = &codec->attrs[index];
+        if (attr->needed) {
+            values[index] = FetchAttribute(attr, current);
+            nulls[index] = false;
+        } else {
+            values[index] = (Datum) 0;
+            nulls[index] = true;
+        }
+        current += dataLen;
+    }
+}
+
+static inline char* StoreAttribute(KVAttrCodec* attr, Datum datum,
+                                   char* current, uint64 dataLen) {
+    if (attr->byValue) {
+        store_att_byval(current, datum, attr->length);
+    } else {
+        memcpy(current, DatumGetPointer(datum), dataLen);
+    }
+    return current + dataLen;
+}
+
+/*
+ * The buffers are enlarged once per row. An all fixed-length row knows its
+ * size from the codec, otherwise the varlena sizes are taken first.
+ */
+void EncodeTuple(KVTupleCodec* codec, Datum* values, bool* nulls,
+                 StringInfo key, StringInfo val) {
+    if (nulls[0]) {
+        ereport(ERROR, errmsg("first column cannot be null!"));
+    }
+
+    KVAttrCodec* keyAttr = &codec->attrs[0];
+    Datum keyDatum = values[0];
+    if (codec->orderedKey) {
+        SerializeOrderedKey(codec->tupleDescriptor, keyDatum, key);
+    } else {
+        keyDatum = ShortVarlena(keyDatum, keyAttr->length, keyAttr->storage);
+        uint64 keyLen = att_addlength_datum(0, keyAttr->length, keyDatum);
+        enlargeStringInfo(key, keyLen);
+        StoreAttribute(keyAttr, keyDatum, key->data + key->len, keyLen);
+        key->len += keyLen;
+    }
+
+    int count = codec->count;
+    Datum* datums = values;
+    int size = codec->fixedSize;
+    if (size < 0) {
+        datums = palloc(count * sizeof(Datum));
+        size = 0;
+        for (int index = 1; index < count; index++) {
+            KVAttrCodec* attr = &codec->attrs[index];
+            size += HEADERBUFFSIZE;
+            if (!nulls[index]) {
+                datums[index] = ShortVarlena(values[index], attr->length,
+                                             attr->storage);
+                size += att_addlength_datum(0, attr->length, datums[index]);
+            }
+        }
+    }
+
+    enlargeStringInfo(val, size);
+    char* current = val->data + val->len;
+    for (int index = 1; index < count; index++) {
+        if (nulls[index]) {
+            *(current++) = 0;
+            continue;
+        }
+
+        KVAttrCodec* attr = &codec->attrs[index];
+        uint64 dataLen = attr->length > 0 ? attr->length :
+            att_addlength_datum(0, attr->length, datums[index]);
+        current = EncodeVarint64(current, dataLen);
+        current = StoreAttribute(attr, datums[index], current, dataLen);
+    }
+    val->len = current - val->data;
+
+    if (datums != values) {
+        pfree(datums);
+    }
+}
+
+/*
+ * Order-preserving key encoding, the encoded keys sort under memcmp the same
+ * as the values under the btree operator class, so the storage engine can use
+ * its bytewise comparator. Integers are big-endian with the sign bit flipped,
+ * floats flip the sign bit of positives and all the bits of negatives, and
+ * strings escape 0x00 as 0x00 0xFF and end with 0x00 0x01, which keeps the
+ * encoding self-delimiting for composite keys.
+ */
+#define ORDEREDKEYESCAPE     0x00
+#define ORDEREDKEYESCAPED    0xFF
+#define ORDEREDKEYTERMINATOR 0x01
+#define ORDEREDKEYSIGNBIT(size) (UINT64CONST(1) << ((size) * BITS_PER_BYTE - 1))
+
+static bool OrderedKeySupported(Form_pg_attribute attr) {
+    switch (attr->atttypid) {
+        case BOOLOID:
+        case INT2OID:
+        case INT4OID:
+        case INT8OID:
+        case OIDOID:
+        case DATEOID:
+        case TIMESTAMPOID:
+        case TIMESTAMPTZOID:
+        case FLOAT4OID:
+        case FLOAT8OID:
+        case UUIDOID:
+        case BYTEAOID:
+            return true;
+        case TEXTOID:
+        case VARCHAROID:
+            /* only the C collation compares strings bytewise */
+            return lc_collate_is_c(attr->attcollation);
+        default:
+            return false;
+    }
+}
+
+static void AppendOrderedInteger(StringInfo buffer, uint64 value, int size) {
+    enlargeStringInfo(buffer, size);
+    for (int i = size - 1; i >= 0; i--) {
+        buffer->data[buffer->len++] = (char) (value >> (i * BITS_PER_BYTE));
+    }
+    buffer->data[buffer->len] = '\0';
+}
+
+static uint64 ReadOrderedInteger(char* key, int size) {
+    uint64 value = 0;
+    for (int i = 0; i < size; i++) {
+        value = (value << BITS_PER_BYTE) | (uint8) key[i];
+    }
+    return value;
+}
+
+static void AppendOrderedBytes(StringInfo buffer, char* data, int len) {
+    enlargeStringInfo(buffer, len * 2 + 2);
+    for (int i = 0; i < len; i++) {
+        buffer->data[buffer->len++] = data[i];
+        if (data[i] == ORDEREDKEYESCAPE) {
+            buffer->data[buffer->len++] = (char) ORDEREDKEYESCAPED;
+        }
+    }
+    buffer->data[buffer->len++] = ORDEREDKEYESCAPE;
+    buffer->data[buffer->len++] = ORDEREDKEYTERMINATOR;
+    buffer->data[buffer->len] = '\0';
+}
+
+/* NaNs are equal and larger than the others, -0 equals 0 */
+static uint64 OrderedFloat8(float8 value) {
+    if (isnan(value)) {
+        value = get_float8_nan();
+    } else if (value == 0) {
+        value = 0;
+    }
+
+    uint64 bits;
+    memcpy(&bits, &value, sizeof(bits));
+    return (bits & ORDEREDKEYSIGNBIT(8)) ? ~bits : bits | ORDEREDKEYSIGNBIT(8);
+}
+
+static float8 UnorderedFloat8(uint64 bits) {
+    bits = (bits & ORDEREDKEYSIGNBIT(8)) ? bits ^ ORDEREDKEYSIGNBIT(8) : ~bits;
+
+    float8 value;
+    memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+static uint32 OrderedFloat4(float4 value) {
+    if (isnan(value)) {
+        value = get_float4_nan();
+    } else if (value == 0) {
+        value = 0;
+    }
+
+    uint32 bits;
+    memcpy(&bits, &value, sizeof(bits));
+    return (bits & ORDEREDKEYSIGNBIT(4)) ? ~bits : bits | ORDEREDKEYSIGNBIT(4);
+}
+
+static float4 UnorderedFloat4(uint32 bits) {
+    bits = (bits & ORDEREDKEYSIGNBIT(4)) ? bits ^ ORDEREDKEYSIGNBIT(4) : ~bits;
+
+    float4 value;
+    memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+void SerializeOrderedKey(TupleDesc tupleDescriptor, Datum datum,
+                         StringInfo buffer) {
+    Form_pg_attribute attr = TupleDescAttr(tupleDescriptor, 0);
+
+    switch (attr->atttypid) {
+        case BOOLOID:
+            AppendOrderedInteger(buffer, DatumGetBool(datum), 1);
+            break;
+        case INT2OID:
+            AppendOrderedInteger(buffer, DatumGetInt16(datum) ^
+                                 ORDEREDKEYSIGNBIT(2), 2);
+            break;
+        case INT4OID:
+        case DATEOID:
+            AppendOrderedInteger(buffer, DatumGetInt32(datum) ^
+                                 ORDEREDKEYSIGNBIT(4), 4);
+            break;
+        case INT8OID:
+        case TIMESTAMPOID:
+        case TIMESTAMPTZOID:
+            AppendOrderedInteger(buffer, DatumGetInt64(datum) ^
+                                 ORDEREDKEYSIGNBIT(8), 8);
+            break;
+        case OIDOID:
+            AppendOrderedInteger(buffer, DatumGetObjectId(datum), 4);
+            break;
+        case FLOAT4OID:
+            AppendOrderedInteger(buffer, OrderedFloat4(DatumGetFloat4(datum)), 4);
+            break;
+        case FLOAT8OID:
+            AppendOrderedInteger(buffer, OrderedFloat8(DatumGetFloat8(datum)), 8);
+            break;
+        case UUIDOID:
+            appendBinaryStringInfo(buffer, (char*) DatumGetUUIDP(datum)->data,
+                                   UUID_LEN);
+            break;
+        case TEXTOID:
+        case VARCHAROID:
+        case BYTEAOID: {
+            struct varlena* value = PG_DETOAST_DATUM_PACKED(datum);
+            AppendOrderedBytes(buffer, VARDATA_ANY(value),
+                               VARSIZE_ANY_EXHDR(value));
+            break;
+        }
+        default:
+            ereport(ERROR, errmsg("type %s does not support %s key encoding",
+                                  format_type_be(attr->atttypid),
+                                  ORDEREDKEYENCODING));
+    }
+}
+
+Datum DeserializeOrderedKey(TupleDesc tupleDescriptor, char* key,
+                            size_t keyLen) {
+    Form_pg_attribute attr = TupleDescAttr(tupleDescriptor, 0);
+
+    switch (attr->atttypid) {
+        case BOOLOID:
+            return BoolGetDatum(ReadOrderedInteger(key, 1) != 0);
+        case INT2OID:
+            return Int16GetDatum((int16) (ReadOrderedInteger(key, 2) ^
+                                          ORDEREDKEYSIGNBIT(2)));
+        case INT4OID:
+        case DATEOID:
+            return Int32GetDatum((int32) (ReadOrderedInteger(key, 4) ^
+                                          ORDEREDKEYSIGNBIT(4)));
+        case INT8OID:
+        case TIMESTAMPOID:
+        case TIMESTAMPTZOID:
+            return Int64GetDatum((int64) (ReadOrderedInteger(key, 8) ^
+                                          ORDEREDKEYSIGNBIT(8)));
+        case OIDOID:
+            return ObjectIdGetDatum((Oid) ReadOrderedInteger(key, 4));
+        case FLOAT4OID:
+            return Float4GetDatum(UnorderedFloat4(ReadOrderedInteger(key, 4)));
+        case FLOAT8OID:
+            return Float8GetDatum(UnorderedFloat8(ReadOrderedInteger(key, 8)));
+        case UUIDOID: {
+            pg_uuid_t* uuid = palloc(sizeof(pg_uuid_t));
+            memcpy(uuid->data, key, UUID_LEN);
+            return UUIDPGetDatum(uuid);
+        }
+        case TEXTOID:
+        case VARCHAROID:
+        case BYTEAOID: {
+            /* the decoded string is never longer than the encoded one */
+            struct varlena* value = palloc(VARHDRSZ + keyLen);
+            char* data = VARDATA(value);
+            size_t len = 0;
+
+            for (size_t i = 0; i < keyLen; i++) {
+                char c = key[i];
+                if (c == ORDEREDKEYESCAPE &&
+                    (uint8) key[++i] == ORDEREDKEYTERMINATOR) {
+                    break;
+                }
+                data[len++] = c;
+            }
+
+            SET_VARSIZE(value, VARHDRSZ + len);
+            return PointerGetDatum(value);
+        }
+        default:
+            ereport(ERROR, errmsg("type %s does not support %s key encoding",
+                                  format_type_be(attr->atttypid),
+                                  ORDEREDKEYENCODING));
+    }
+
+    return (Datum) 0;
+}
+
 void SetRelationComparatorOpts(Relation relation, ComparatorOpts* opts) {
     TupleDesc tupleDescriptor = RelationGetDescr(relation);
 
     /* TODO: we assume the 1st column is primary key */
     FormData_pg_attribute* key = TupleDescAttr(tupleDescriptor, 0);
+
+    KVFdwOptions* fdwOptions = KVGetOptions(RelationGetRelid(relation));
+    opts->orderedKey = fdwOptions->orderedKey;
+    if (opts->orderedKey && !OrderedKeySupported(key)) {
+        ereport(ERROR, errmsg("type %s of the first column does not support %s "
+                              "key encoding", format_type_be(key->atttypid),
+                              ORDEREDKEYENCODING));
+    }
     opts->attrByVal = key->attbyval;
     opts->attrLength = key->attlen;
+    opts->attrTypeOid = key->atttypid;
     opts->attrCollOid = key->attcollation;
 
+    /*
+     * resolve the collation here, so the storage can pick a native comparator
+     * for C collation without catalog access
+     */
+    if (OidIsValid(opts->attrCollOid) && lc_collate_is_c(opts->attrCollOid)) {
+        opts->attrCollOid = C_COLLATION_OID;
+    }
+
     TypeCacheEntry* typeEntry = lookup_type_cache(key->atttypid,
                                                   TYPECACHE_CMP_PROC_FINFO);
     opts->cmpFuncOid = typeEntry->cmp_proc; /* maybe not exist */
 }
 
+#ifndef VIDARDB
+/*
+ * Asks the worker to move a finished sorted string table of the bulk loader
+ * into the db. The file is removed if the ingestion fails.
+ */
+static void KVIngestBulkLoadFile(Oid relationId, void* bulkLoader) {
+    IngestArgs args;
+    args.path = BulkLoadFile(bulkLoader);
+
+    if (!KVIngestRequest(relationId, &args)) {
+        unlink(args.path);
+        ereport(ERROR, errmsg("failed to ingest \"%s\": %s", args.path,
+                              args.error));
+    }
+}
+
+/* raises the failure of a step of the bulk loader, or ingests its file */
+static void KVCheckBulkLoad(Oid relationId, void* bulkLoader,
+                            BulkLoadStatus status, bool sorted) {
+    if (status == BulkLoadFailure) {
+        ereport(ERROR, (errmsg("could not bulk load foreign table %u: %s",
+                               relationId, BulkLoadError(bulkLoader)),
+                        sorted ? errhint("Rows must be in strictly ascending "
+                                         "key order when the table is loaded "
+                                         "as sorted.") : 0));
+    }
+    if (status == BulkLoadFileReady) {
+        KVIngestBulkLoadFile(relationId, bulkLoader);
+    }
+}
+
+/*
+ * The bulk loader lives outside of the memory contexts, so it is freed with
+ * its files by the reset of the transaction context if the copy fails.
+ */
+typedef struct BulkLoadCleanup {
+    MemoryContextCallback callback;
+    void*                 bulkLoader;  /* null once it is freed */
+} BulkLoadCleanup;
+
+static void KVCleanupBulkLoad(void* arg) {
+    BulkLoadCleanup* cleanup = (BulkLoadCleanup*) arg;
+    if (cleanup->bulkLoader != NULL) {
+        DelBulkLoad(cleanup->bulkLoader);
+        cleanup->bulkLoader = NULL;
+    }
+}
+#endif
+
 /*
  * Handles a "COPY kv_table FROM" statement. This function uses the COPY
  * command's functions to read and parse rows from the data source specified
  * in the COPY statement. The function then writes each row to the file
  * specified in the foreign table options. Finally, the function returns the
  * number of copied rows.
+ *
+ * With the bulkload option, rows are written into sorted string tables in the
+ * backend instead, which bypass the WAL and memtable when they are ingested.
  */
 static uint64 KVCopyIntoTable(const CopyStmt* copyStmt, const char* queryString) {
     /* Only superuser can copy from or to local file */
@@ -592,6 +1569,8 @@ static uint64 KVCopyIntoTable(const CopyStmt* copyStmt, const char* queryString)
     SetRelationComparatorOpts(relation, &args.opts);
     KVFdwOptions* fdwOptions = KVGetOptions(relationId);
     args.path = fdwOptions->filename;
+    args.engine = fdwOptions->engine;
+    args.write = fdwOptions->write;
 
     #ifdef VIDARDB
     char* option = KVGetOptionValue(relationId, OPTION_STORAGE_FORMAT);
@@ -602,8 +1581,30 @@ static uint64 KVCopyIntoTable(const CopyStmt* copyStmt, const char* queryString)
     #endif
     KVOpenRequest(relationId, &args);
 
+    /* the loads are not waited for, forget the failures of an earlier copy */
+    KVSyncRequest(relationId, false);
+
+    /* the bulkload option is rejected for VidarDB, see KVParseTableOption */
+    void* bulkLoader = NULL;
+    #ifndef VIDARDB
+    BulkLoadCleanup* cleanup = NULL;
+    if (fdwOptions->bulkLoad) {
+        bulkLoader = BeginBulkLoad(args.path, &args.opts,
+                                   fdwOptions->sortedLoad);
+        cleanup = MemoryContextAllocZero(CurTransactionContext,
+                                         sizeof(BulkLoadCleanup));
+        cleanup->bulkLoader = bulkLoader;
+        cleanup->callback.func = KVCleanupBulkLoad;
+        cleanup->callback.arg = cleanup;
+        MemoryContextRegisterResetCallback(CurTransactionContext,
+                                           &cleanup->callback);
+    }
+    #endif
+
     Datum* values = palloc0(attrCount * sizeof(Datum));
     bool* nulls = palloc0(attrCount * sizeof(bool));
+    KVTupleCodec* codec = BuildTupleCodec(tupleDescriptor,
+                                          fdwOptions->orderedKey);
 
     EState* estate = CreateExecutorState();
     ExprContext* econtext = GetPerTupleExprContext(estate);
@@ -627,25 +1628,23 @@ static uint64 KVCopyIntoTable(const CopyStmt* copyStmt, const char* queryString)
             StringInfo key = makeStringInfo();
             StringInfo val = makeStringInfo();
 
-            for (int index = 0; index < attrCount; index++) {
-                Datum datum = values[index];
-                if (nulls[index]) {
-                    if (index == 0) {
-                        ereport(ERROR, errmsg("first column cannot be null!"));
-                    }
-                    SerializeNullAttribute(tupleDescriptor, index, val);
-                } else {
-                    SerializeAttribute(tupleDescriptor, index, datum,
-                                       index == 0 ? key : val);
-                }
-            }
+            EncodeTuple(codec, values, nulls, key, val);
 
-            PutArgs args;
-            args.keyLen = key->len;
-            args.valLen = val->len;
-            args.key = key->data;
-            args.val = val->data;
-            KVLoadRequest(relationId, &args);
+            if (bulkLoader != NULL) {
+                #ifndef VIDARDB
+                KVCheckBulkLoad(relationId, bulkLoader,
+                                BulkLoadPut(bulkLoader, key->data, key->len,
+                                            val->data, val->len),
+                                fdwOptions->sortedLoad);
+                #endif
+            } else {
+                PutArgs args;
+                args.keyLen = key->len;
+                args.valLen = val->len;
+                args.key = key->data;
+                args.val = val->data;
+                KVLoadRequest(relationId, &args);
+            }
 
             rowCount++;
         }
@@ -659,6 +1658,20 @@ static uint64 KVCopyIntoTable(const CopyStmt* copyStmt, const char* queryString)
         CHECK_FOR_INTERRUPTS();
     }
 
+    #ifndef VIDARDB
+    if (bulkLoader != NULL) {
+        KVCheckBulkLoad(relationId, bulkLoader, BulkLoadFinish(bulkLoader),
+                        fdwOptions->sortedLoad);
+        KVCleanupBulkLoad(cleanup);
+    }
+    #endif
+
+    uint64 errors = KVSyncRequest(relationId, true);
+    if (errors > 0) {
+        ereport(ERROR, errmsg("could not load " UINT64_FORMAT " rows into "
+                              "foreign table %u", errors, relationId));
+    }
+
     /* end read/write sessions and close the relation */
     EndCopyFrom(copyState);
     KVCloseRequest(relationId);
@@ -767,14 +1780,127 @@ static void KVCheckAlterTable(AlterTableStmt* alterStmt) {
             ereport(ERROR, errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
                            errmsg("No support for adding column currently"));
         }
+
+        /* the stored keys are not re-encoded, so the encoding is fixed */
+        if (alterCmd->subtype == AT_GenericOptions) {
+            ListCell* optionCell = NULL;
+            foreach (optionCell, (List*) alterCmd->def) {
+                DefElem* optionDef = (DefElem*) lfirst(optionCell);
+                if (strcmp(optionDef->defname, OPTION_KEY_ENCODING) != 0) {
+                    continue;
+                }
+
+                KVFdwOptions options;
+                options.orderedKey = false;
+                if (optionDef->defaction != DEFELEM_DROP) {
+                    KVParseTableOption(optionDef->defname,
+                                       defGetString(optionDef),
+                                       ForeignTableRelationId, &options);
+                }
+                if (options.orderedKey !=
+                    KVGetOptions(relationId)->orderedKey) {
+                    ereport(ERROR, (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+                                    errmsg("cannot change %s of foreign table "
+                                           "\"%s\"", OPTION_KEY_ENCODING,
+                                           rangeVar->relname),
+                                    errhint("Create a new table with the "
+                                            "encoding and copy the rows "
+                                            "into it.")));
+                }
+            }
+        }
+    }
+}
+
+/*
+ * Truncates a kv table by its kv worker, which drops the whole key range at
+ * once instead of deleting the rows one by one. As the other writes of a kv
+ * table, it is not undone if the transaction aborts.
+ */
+static void KVTruncateTable(Relation relation) {
+    Oid relationId = RelationGetRelid(relation);
+
+    OpenArgs args;
+    SetRelationComparatorOpts(relation, &args.opts);
+    KVFdwOptions* fdwOptions = KVGetOptions(relationId);
+    args.path = fdwOptions->filename;
+    args.engine = fdwOptions->engine;
+    args.write = fdwOptions->write;
+    #ifdef VIDARDB
+    args.useColumn = fdwOptions->useColumn;
+    args.attrCount = RelationGetNumberOfAttributes(relation);
+    #endif
+    KVOpenRequest(relationId, &args);
+
+    bool success = KVTruncateRequest(relationId);
+    KVCloseRequest(relationId);
+    if (!success) {
+        ereport(ERROR, errmsg("could not truncate foreign table %u",
+                              relationId));
+    }
+}
+
+/*
+ * Handles a "TRUNCATE" statement, which PostgreSQL refuses for foreign tables.
+ * The kv tables are locked and checked as PostgreSQL does, the other tables of
+ * the statement are truncated as usual, and then the kv tables by their kv
+ * workers, since they cannot be restored if the others fail.
+ */
+static void KVTruncateTables(PlannedStmt* plannedStmt, const char* queryString,
+                             ProcessUtilityContext context,
+                             ParamListInfo paramListInfo,
+                             QueryEnvironment* queryEnvironment,
+                             DestReceiver* destReceiver, char* completionTag) {
+    TruncateStmt* truncateStmt = (TruncateStmt*) plannedStmt->utilityStmt;
+    List* kvTables = NIL;
+    List* otherRelations = NIL;
+
+    ListCell* relationCell = NULL;
+    foreach (relationCell, truncateStmt->relations) {
+        RangeVar* rangeVar = (RangeVar*) lfirst(relationCell);
+        Oid relationId = RangeVarGetRelid(rangeVar, NoLock, true);
+        if (!KVTable(relationId)) {
+            otherRelations = lappend(otherRelations, rangeVar);
+            continue;
+        }
+
+        Relation relation = table_open(relationId, AccessExclusiveLock);
+        AclResult aclResult = pg_class_aclcheck(relationId, GetUserId(),
+                                                ACL_TRUNCATE);
+        if (aclResult != ACLCHECK_OK) {
+            aclcheck_error(aclResult,
+                           get_relkind_objtype(relation->rd_rel->relkind),
+                           RelationGetRelationName(relation));
+        }
+        kvTables = lappend(kvTables, relation);
+    }
+
+    if (kvTables == NIL) {
+        CALL_PREVIOUS_UTILITY(parseTree, queryString, context, paramListInfo,
+                              destReceiver, completionTag);
+        return;
+    }
+
+    /* the statement might be cached, so the others go in a copy */
+    if (otherRelations != NIL) {
+        PlannedStmt* otherStmt = copyObject(plannedStmt);
+        ((TruncateStmt*) otherStmt->utilityStmt)->relations = otherRelations;
+        PREVIOUS_UTILITY(otherStmt, queryString, context, paramListInfo,
+                         queryEnvironment, destReceiver, completionTag);
+    }
+
+    foreach (relationCell, kvTables) {
+        Relation relation = (Relation) lfirst(relationCell);
+        KVTruncateTable(relation);
+        table_close(relation, NoLock);
     }
 }
 
 /*
  * Hook for handling utility commands. This function customizes the behavior of
- * "COPY kv_table" and "DROP FOREIGN TABLE " commands. For all other utility
- * statements, the function calls the previous utility hook or the standard
- * utility command via macro CALL_PREVIOUS_UTILITY.
+ * "COPY kv_table", "TRUNCATE kv_table" and "DROP FOREIGN TABLE " commands. For
+ * all other utility statements, the function calls the previous utility hook
+ * or the standard utility command via macro CALL_PREVIOUS_UTILITY.
  */
 static void KVProcessUtility(PlannedStmt* plannedStmt, const char* queryString,
                              ProcessUtilityContext context,
@@ -839,6 +1965,19 @@ static void KVProcessUtility(PlannedStmt* plannedStmt, const char* queryString,
             ListCell* fileCell = NULL;
             foreach(fileCell, droppedTables) {
                 DroppedObject* obj = lfirst(fileCell);
+                #ifndef VIDARDB
+                if (KVSharedStorage) {
+                    DropArgs args;
+                    args.path = KVSharedFilePath();
+                    if (!KVDropRequest(obj->objectId, &args)) {
+                        ereport(WARNING,
+                                errmsg("could not drop the data of table %u",
+                                       obj->objectId));
+                    }
+                    continue;
+                }
+                #endif
+
                 StringInfo tablePath = makeStringInfo();
                 appendStringInfo(tablePath, "%s", obj->path);
                 if (KVDirectoryExists(tablePath)) {
@@ -848,6 +1987,9 @@ static void KVProcessUtility(PlannedStmt* plannedStmt, const char* queryString,
                 KVTerminateRequest(obj->objectId, MyDatabaseId);
             }
         }
+    } else if (nodeTag(parseTree) == T_TruncateStmt) {
+        KVTruncateTables(plannedStmt, queryString, context, paramListInfo,
+                         queryEnvironment, destReceiver, completionTag);
     } else if (nodeTag(parseTree) == T_AlterTableStmt) {
         AlterTableStmt* alterStmt = (AlterTableStmt*) parseTree;
         KVCheckAlterTable(alterStmt);
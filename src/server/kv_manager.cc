@@ -14,10 +14,12 @@
  */
 
 #include "kv_manager.h"
+#include "ipc/kv_stats.h"
 
 extern "C" {
 #include "postgres.h"
 #include "miscadmin.h"
+#include "access/transam.h"
 #include "postmaster/bgworker.h"
 }
 
@@ -35,18 +37,26 @@ static KVManager* manager = nullptr;
 
 KVManager::KVManager() {
     running_ = false;
+    nextSlot_ = InvalidOid;
     queue_ = new KVMessageQueue(InvalidOid, MANAGER, true);
 }
 
 KVManager::~KVManager() {
     for (auto& it : workers_) {
-        delete it.second; /* new in Launch() */
+        delete it.second; /* new in Ready() */
+    }
+    for (auto& it : idle_) {
+        delete it.second; /* new in LaunchIdleKVWorker() */
     }
     delete queue_;
 }
 
 void KVManager::Start() {
     running_ = true;
+
+    for (int i = 0; i < KVIdleWorkers; i++) {
+        LaunchIdleKVWorker();
+    }
 }
 
 bool KVManager::CheckKVWorkerAlive(BackgroundWorkerHandle* handle) {
@@ -55,6 +65,42 @@ bool KVManager::CheckKVWorkerAlive(BackgroundWorkerHandle* handle) {
     return BGWH_STARTED == status;
 }
 
+/* a launched worker may not be started by the postmaster yet */
+bool KVManager::CheckKVWorkerStarting(BackgroundWorkerHandle* handle) {
+    pid_t pid;
+    BgwHandleStatus status = GetBackgroundWorkerPid(handle, &pid);
+    return BGWH_STARTED == status || BGWH_NOT_YET_STARTED == status;
+}
+
+/* slot ids of the idle workers are below those of the relations */
+void KVManager::LaunchIdleKVWorker() {
+    nextSlot_ = nextSlot_ % (FirstNormalObjectId - 1) + 1;
+
+    BackgroundWorkerHandle* handle =
+        (BackgroundWorkerHandle*) LaunchKVWorker(nextSlot_, InvalidOid);
+    if (handle) {
+        idle_.insert({nextSlot_, new KVIdleWorkerHandle(nextSlot_, handle)});
+    }
+}
+
+void KVManager::FailPendingKVWorker(KVWorkerId workerId) {
+    auto it = pending_.find(workerId);
+    if (it == pending_.end()) {
+        return;
+    }
+
+    for (uint32 waiter : it->second.waiters) {
+        queue_->Send(FailureMessage(waiter));
+    }
+    TerminateKVWorker(it->second.handle);
+    pending_.erase(it);
+}
+
+/*
+ * Answer at once if the worker is running, otherwise wait for it among the
+ * other backends. A new worker is bound from the idle ones if any is ready,
+ * and the pool is refilled in the background.
+ */
 void KVManager::Launch(KVWorkerId workerId, const KVMessage& msg) {
     auto it = workers_.find(workerId);
     if (it != workers_.end()) {
@@ -67,21 +113,69 @@ void KVManager::Launch(KVWorkerId workerId, const KVMessage& msg) {
         }
     }
 
+    auto pending = pending_.find(workerId);
+    if (pending != pending_.end()) {
+        if (CheckKVWorkerStarting(pending->second.handle)) {
+            pending->second.waiters.push_back(msg.hdr.rpsId);
+            return;
+        }
+        /* it exited before it was ready */
+        FailPendingKVWorker(workerId);
+    }
+
+    KVDatabaseId dbId = msg.hdr.dbId;
+    for (auto idle = idle_.begin(); idle != idle_.end(); idle++) {
+        KVIdleWorkerHandle* worker = idle->second;
+        if (worker->client == nullptr ||
+            !CheckKVWorkerAlive(worker->handle)) {
+            continue;
+        }
+
+        worker->client->Bind(workerId, dbId);
+        pending_.insert({workerId, {dbId, worker->handle, {msg.hdr.rpsId}}});
+        idle_.erase(idle);
+        delete worker;
+
+        LaunchIdleKVWorker();
+        return;
+    }
+
     BackgroundWorkerHandle* handle =
-        (BackgroundWorkerHandle*) LaunchKVWorker(workerId, msg.hdr.dbId);
+        (BackgroundWorkerHandle*) LaunchKVWorker(workerId, dbId);
     if (!handle) {
         queue_->Send(FailureMessage(msg.hdr.rpsId));
         return;
     }
 
-    /* wait kv worker be ready */
-    queue_->Wait(WorkerReady);
+    pending_.insert({workerId, {dbId, handle, {msg.hdr.rpsId}}});
+}
 
-    KVDatabaseId dbId = msg.hdr.dbId;
+/* a worker has created its message queue, so that clients can attach to it */
+void KVManager::Ready(KVWorkerId workerId, const KVMessage& msg) {
+    /* an idle worker has no database yet */
+    if (msg.hdr.dbId == InvalidOid) {
+        auto idle = idle_.find(workerId);
+        if (idle != idle_.end()) {
+            idle->second->client = new KVIdleWorkerClient(workerId);
+        }
+        return;
+    }
+
+    auto it = pending_.find(workerId);
+    if (it == pending_.end()) {
+        return;
+    }
+
+    KVPendingWorker& pending = it->second;
     KVWorkerClient* client = new KVWorkerClient(workerId);
-    KVWorkerHandle* worker = new KVWorkerHandle(workerId, dbId, client, handle);
+    KVWorkerHandle* worker = new KVWorkerHandle(workerId, pending.dbId, client,
+                                                pending.handle);
     workers_.insert({workerId, worker});
-    queue_->Send(SuccessMessage(msg.hdr.rpsId));
+
+    for (uint32 waiter : pending.waiters) {
+        queue_->Send(SuccessMessage(waiter));
+    }
+    pending_.erase(it);
 }
 
 void KVManager::TerminateKVWorker(BackgroundWorkerHandle* handle) {
@@ -92,6 +186,14 @@ void KVManager::TerminateKVWorker(BackgroundWorkerHandle* handle) {
 
 void KVManager::Terminate(KVWorkerId workerId, const KVMessage& msg) {
     if (workerId == KVAllRelationId) { /* for dropping database */
+        for (auto it = pending_.begin(); it != pending_.end();) {
+            KVWorkerId pendingId = it->first;
+            it++;
+            if (pending_[pendingId].dbId == msg.hdr.dbId) {
+                FailPendingKVWorker(pendingId);
+            }
+        }
+
         for (auto it = workers_.begin(); it != workers_.end();) {
             if (it->second->dbId != msg.hdr.dbId) {
                 it++;
@@ -114,6 +216,8 @@ void KVManager::Terminate(KVWorkerId workerId, const KVMessage& msg) {
         return;
     }
 
+    FailPendingKVWorker(workerId);
+
     auto it = workers_.find(workerId);
     if (it == workers_.end()) {
         queue_->Send(SuccessMessage(msg.hdr.rpsId));
@@ -145,6 +249,9 @@ void KVManager::Run() {
             case KVOpLaunch:
                 Launch(msg.hdr.relId, msg);
                 break;
+            case KVOpReady:
+                Ready(msg.hdr.relId, msg);
+                break;
             case KVOpTerminate:
                 Terminate(msg.hdr.relId, msg);
                 break;
@@ -163,6 +270,17 @@ void KVManager::Stop() {
         }
         TerminateKVWorker(it.second->handle);
     }
+    for (auto& it : pending_) {
+        TerminateKVWorker(it.second.handle);
+    }
+    for (auto& it : idle_) {
+        if (it.second->client && CheckKVWorkerAlive(it.second->handle)) {
+            it.second->client->Terminate();
+            /* wait destroyed event */
+            queue_->Wait(WorkerDesty);
+        }
+        TerminateKVWorker(it.second->handle);
+    }
 
     running_ = false;
     queue_->Stop();
@@ -188,6 +306,11 @@ bool KVManagerClient::Launch(KVWorkerId workerId) {
     return recvmsg.hdr.status == KVStatusSuccess;
 }
 
+/* no response, the manager answers the backends waiting for the worker */
+void KVManagerClient::Ready(KVWorkerId workerId, KVDatabaseId dbId) {
+    queue_->Send(SimpleMessage(KVOpReady, workerId, dbId));
+}
+
 bool KVManagerClient::Terminate(KVWorkerId workerId, KVDatabaseId dbId) {
     KVMessage recvmsg;
     KVMessage sendmsg = SimpleMessage(KVOpTerminate, workerId, dbId);
@@ -243,12 +366,15 @@ extern "C" void KVManagerMain(Datum arg) {
  * Launch kv manager process
  */
 void LaunchKVManager() {
-    printf("\n~~~~~~~~~~~~~~~%s~~~~~~~~~~~~~~~\n", __func__);
+    KV_TRACE("\n~~~~~~~~~~~~~~~%s~~~~~~~~~~~~~~~\n", __func__);
 
     if (!process_shared_preload_libraries_in_progress) {
         return;
     }
 
+    /* in the postmaster, so that the processes forked later inherit it */
+    InitKVStats();
+
     BackgroundWorker bgw;
     memset(&bgw, 0, sizeof(bgw));
     snprintf(bgw.bgw_name, BGW_MAXLEN, "KV Manager");
@@ -18,6 +18,7 @@
 
 
 #include <unordered_map>
+#include <vector>
 using namespace std;
 
 #include "ipc/kv_mq.h"
@@ -29,6 +30,11 @@ extern void LaunchKVManager();
 /*
  * A kv manager is responsible for managing all the kv workers' lifecycle from
  * multiple databases, so will only be terminated when PostgreSQL is stop.
+ *
+ * Launches do not block the manager. A launched worker reports itself ready
+ * with a message, and only then the backends waiting for it are answered. It
+ * also keeps a pool of idle workers started in advance, which are bound to a
+ * relation on demand, so a launch does not wait for a new process either.
  */
 
 class KVManager {
@@ -41,12 +47,26 @@ class KVManager {
     void Stop();
 
   private:
+    /* a launched worker not ready yet, and the backends waiting for it */
+    struct KVPendingWorker {
+        KVDatabaseId            dbId;
+        BackgroundWorkerHandle* handle;
+        vector<uint32>          waiters;  /* response channels */
+    };
+
     void Launch(KVWorkerId workerId, const KVMessage& msg);
+    void Ready(KVWorkerId workerId, const KVMessage& msg);
     void Terminate(KVWorkerId workerId, const KVMessage& msg);
+    void LaunchIdleKVWorker();
+    void FailPendingKVWorker(KVWorkerId workerId);
     bool CheckKVWorkerAlive(BackgroundWorkerHandle* handle);
+    bool CheckKVWorkerStarting(BackgroundWorkerHandle* handle);
     void TerminateKVWorker(BackgroundWorkerHandle* worker);
 
     unordered_map<KVWorkerId, KVWorkerHandle*> workers_;
+    unordered_map<KVWorkerId, KVPendingWorker> pending_;
+    unordered_map<KVWorkerId, KVIdleWorkerHandle*> idle_;  /* by slot id */
+    KVWorkerId nextSlot_;
     KVMessageQueue* queue_;
     bool running_;
 };
@@ -62,6 +82,7 @@ class KVManagerClient {
     ~KVManagerClient();
 
     bool Launch(KVWorkerId workerId);
+    void Ready(KVWorkerId workerId, KVDatabaseId dbId);
     bool Terminate(KVWorkerId workerId, KVDatabaseId dbId);
     void Notify(KVCtrlType type);
 
@@ -21,15 +21,31 @@
 #include "vidardb/table.h"
 #include "vidardb/splitter.h"
 #include "vidardb/comparator.h"
+#include "vidardb/write_batch.h"
 using namespace vidardb;
 #else
 #include "rocksdb/db.h"
+#include "rocksdb/cache.h"
+#include "rocksdb/table.h"
+#include "rocksdb/filter_policy.h"
 #include "rocksdb/options.h"
 #include "rocksdb/comparator.h"
+#include "rocksdb/write_batch.h"
+#include "rocksdb/write_buffer_manager.h"
+#include "rocksdb/convenience.h"
+#include "rocksdb/sst_file_writer.h"
+#include "rocksdb/statistics.h"
 using namespace rocksdb;
 #endif
 
+#include <unistd.h>
+#include <cmath>
 #include <mutex>
+#include <random>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <unordered_map>
 using namespace std;
 
 #include "kv_storage.h"
@@ -40,22 +56,140 @@ extern "C" {
 #include "access/tupmacs.h"
 #include "miscadmin.h"
 #include "utils/resowner.h"
+#include "catalog/pg_type.h"
+#include "utils/uuid.h"
+#include "catalog/pg_collation.h"
 }
 
+/* all the comparators share the name, the ordering of the keys is the same */
+#define COMPARATORNAME "kv.PGDataTypeComparator"
+
 /*
  * Forward Declaration
  * Create a datatype comparator wrapper for storage engine
  */
 void* NewDataTypeComparator(ComparatorOpts* options);
+void  DelDataTypeComparator(const Comparator* comparator);
+
+
+#ifndef VIDARDB
+/* the block cache of all the tables in this process, see KVBlockCacheSize */
+static shared_ptr<Cache> blockCache;
+
+static shared_ptr<Cache> GetBlockCache() {
+    if (!blockCache) {
+        size_t capacity = static_cast<size_t>(KVBlockCacheSize) * 1024 * 1024;
+        blockCache = NewLRUCache(capacity);
+    }
+    return blockCache;
+}
+
+/* the statistics of all the tables in this process, see GetEngineTickers */
+static shared_ptr<Statistics> engineStats;
+
+static shared_ptr<Statistics> GetStatistics() {
+    if (!engineStats) {
+        engineStats = CreateDBStatistics();
+        /* tickers only, the timers of the histograms cost the most */
+        engineStats->set_stats_level(kExceptDetailedTimers);
+    }
+    return engineStats;
+}
+#endif
+
+/*
+ * Copy the tickers of the engine into KVEngineTickers counters, all zeros for
+ * VidarDB whose statistics are not collected.
+ */
+void GetEngineTickers(uint64* tickers) {
+    memset(tickers, 0, sizeof(uint64) * KVEngineTickers);
+    #ifndef VIDARDB
+    if (!engineStats) {
+        return;
+    }
+
+    tickers[KVEngineCacheHits] = engineStats->getTickerCount(BLOCK_CACHE_HIT);
+    tickers[KVEngineCacheMisses] = engineStats->getTickerCount(BLOCK_CACHE_MISS);
+    tickers[KVEngineStallMicros] = engineStats->getTickerCount(STALL_MICROS);
+    tickers[KVEngineCompactReadBytes] =
+        engineStats->getTickerCount(COMPACT_READ_BYTES);
+    tickers[KVEngineCompactWriteBytes] =
+        engineStats->getTickerCount(COMPACT_WRITE_BYTES);
+    #endif
+}
+
+static CompressionType GetCompressionType(int8 compression) {
+    switch (compression) {
+        case KVCompressionNone:
+            return kNoCompression;
+        case KVCompressionSnappy:
+            return kSnappyCompression;
+        case KVCompressionLZ4:
+            return kLZ4Compression;
+        case KVCompressionZSTD:
+            return kZSTD;
+        case KVCompressionZlib:
+            return kZlibCompression;
+        default:
+            return ColumnFamilyOptions().compression;
+    }
+}
+
+/*
+ * Apply the tuning of a table to its column family, zeros keep the defaults.
+ * The table factory of VidarDB is built by OpenConn, so the block based table
+ * options are only set for RocksDB.
+ */
+static void SetEngineOptions(EngineOpts* engine, ColumnFamilyOptions* options) {
+    if (engine->writeBufferSize > 0) {
+        options->write_buffer_size = engine->writeBufferSize;
+    }
+    if (engine->compressionLevels > 0) {
+        options->compression_per_level.clear();
+        for (int32 i = 0; i < engine->compressionLevels; i++) {
+            options->compression_per_level.push_back(
+                GetCompressionType(engine->compression[i]));
+        }
+    }
+
+    #ifndef VIDARDB
+    BlockBasedTableOptions tableOptions;
+    tableOptions.block_cache = GetBlockCache();
+    if (engine->blockSize > 0) {
+        tableOptions.block_size = engine->blockSize;
+    }
+    if (engine->bloomBits > 0) {
+        tableOptions.filter_policy.reset(
+            NewBloomFilterPolicy(engine->bloomBits, false));
+    }
+    options->table_factory.reset(NewBlockBasedTableFactory(tableOptions));
+    #endif
+}
+
+struct SharedInstance;
 
+/*
+ * A connection is a table, namely a column family of the storage engine. The
+ * instance opened by OpenConn belongs to the table, whose rows are in the
+ * default column family. The tables of OpenSharedConn are column families of
+ * the same instance.
+ */
+struct KVConn {
+    DB*                 db = nullptr;
+    ColumnFamilyHandle* cf = nullptr;
+    SharedInstance*     shared = nullptr;  /* null if db belongs to the table */
+    WriteOptions        writeOpts;         /* of the writes into the table */
+};
 
 #ifdef VIDARDB
-void* OpenConn(char* path, bool useColumn, int attrCount, ComparatorOpts* opts) {
-    DB* conn = nullptr;
+void* OpenConn(char* path, bool useColumn, int attrCount, ComparatorOpts* opts,
+               EngineOpts* engine) {
+    DB* db = nullptr;
     Options options;
     options.OptimizeAdaptiveLevelStyleCompaction();
     options.create_if_missing = true;
     options.comparator = static_cast<Comparator*>(NewDataTypeComparator(opts));
+    SetEngineOptions(engine, &options);
 
     shared_ptr<TableFactory> block_based_table(NewBlockBasedTableFactory());
     shared_ptr<TableFactory> column_table(NewColumnTableFactory());
@@ -68,78 +202,628 @@ void* OpenConn(char* path, bool useColumn, int attrCount, ComparatorOpts* opts)
     options.table_factory.reset(NewAdaptiveTableFactory(block_based_table,
         block_based_table, column_table, useColumn? 0: -1));
 
-    Status s = DB::Open(options, string(path), &conn);
+    Status s = DB::Open(options, string(path), &db);
     if (!s.ok()) {
         ereport(ERROR, errmsg("DB open status: %s", s.ToString().c_str()));
     }
+
+    KVConn* conn = new KVConn;
+    conn->db = db;
+    conn->cf = db->DefaultColumnFamily();
     return conn;
 }
 #else
-void* OpenConn(char* path, ComparatorOpts* opts) {
-    DB* conn = nullptr;
+void* OpenConn(char* path, ComparatorOpts* opts, EngineOpts* engine) {
+    DB* db = nullptr;
     Options options;
     options.create_if_missing = true;
     options.comparator = static_cast<Comparator*>(NewDataTypeComparator(opts));
+    SetEngineOptions(engine, &options);
+    if (engine->backgroundJobs > 0) {
+        options.max_background_jobs = engine->backgroundJobs;
+    }
+    options.statistics = GetStatistics();
 
-    Status s = DB::Open(options, string(path), &conn);
+    Status s = DB::Open(options, string(path), &db);
     if (!s.ok()) {
         ereport(ERROR, errmsg("DB open status: %s", s.ToString().c_str()));
     }
+
+    KVConn* conn = new KVConn;
+    conn->db = db;
+    conn->cf = db->DefaultColumnFamily();
     return conn;
 }
+
+/*
+ * The instance of a database shares the block cache and one write buffer
+ * budget among its tables. A table is a column family named by its relation
+ * id, with the comparator of its key. The options of the tables are kept in
+ * the default column family, so that all the column families can be opened
+ * again. They are written before a column family is created and deleted after
+ * it is dropped, hence a column family on disk has always its options.
+ */
+#define SHAREDWRITEBUFFERSIZE 256UL*1024*1024
+
+struct SharedTableOpts {
+    ComparatorOpts cmp;
+    EngineOpts     engine;
+};
+
+struct SharedFamily {
+    ColumnFamilyHandle* handle;
+    const Comparator*   cmp;
+    SharedTableOpts     opts;
+};
+
+struct SharedInstance {
+    DB*                                 db = nullptr;
+    string                              path;
+    unordered_map<string, SharedFamily> families;
+    vector<const Comparator*>           dropped;  /* of dropped tables */
+    uint64                              ref = 0;  /* open connections */
+};
+
+/* a kv worker hosts the instance of its database only */
+static unordered_map<string, SharedInstance*> instances;
+static shared_ptr<WriteBufferManager> sharedWriteBuffer;
+
+static ColumnFamilyOptions SharedFamilyOptions(const Comparator* cmp,
+                                               SharedTableOpts* opts) {
+    ColumnFamilyOptions options;
+    options.comparator = cmp;
+    SetEngineOptions(&opts->engine, &options);
+    return options;
+}
+
+static Status PutSharedTableOpts(DB* db, const string& name,
+                                 SharedTableOpts* opts) {
+    return db->Put(WriteOptions(), db->DefaultColumnFamily(), name,
+                   Slice(reinterpret_cast<char*>(opts), sizeof(*opts)));
+}
+
+/* read the options of the tables, empty if the instance is new */
+static vector<pair<string, SharedTableOpts>> ReadSharedFamilies(const string& path) {
+    vector<pair<string, SharedTableOpts>> families;
+    vector<string> names;
+    if (!DB::ListColumnFamilies(DBOptions(), path, &names).ok()) {
+        return families;
+    }
+
+    /* the default column family alone can be opened in read only mode */
+    DB* db = nullptr;
+    vector<ColumnFamilyHandle*> handles;
+    vector<ColumnFamilyDescriptor> descriptors;
+    descriptors.emplace_back(kDefaultColumnFamilyName, ColumnFamilyOptions());
+    Status s = DB::OpenForReadOnly(DBOptions(), path, descriptors, &handles, &db);
+    if (!s.ok()) {
+        ereport(ERROR, errmsg("DB open status: %s", s.ToString().c_str()));
+    }
+
+    Iterator* it = db->NewIterator(ReadOptions(), handles[0]);
+    for (it->SeekToFirst(); it->Valid(); it->Next()) {
+        SharedTableOpts opts;
+        if (it->value().size() != sizeof(opts)) {
+            continue;
+        }
+        memcpy(&opts, it->value().data(), sizeof(opts));
+        families.push_back({it->key().ToString(), opts});
+    }
+    delete it;
+
+    db->DestroyColumnFamilyHandle(handles[0]);
+    delete db;
+    return families;
+}
+
+/*
+ * The background jobs are of the instance, the most any table asks for, the
+ * one being opened included.
+ */
+static SharedInstance* OpenSharedInstance(const string& path,
+                                          EngineOpts* engine) {
+    auto it = instances.find(path);
+    if (it != instances.end()) {
+        return it->second;
+    }
+
+    vector<pair<string, SharedTableOpts>> families = ReadSharedFamilies(path);
+    int32 backgroundJobs = engine ? engine->backgroundJobs : 0;
+    for (auto& family : families) {
+        backgroundJobs = max(backgroundJobs, family.second.engine.backgroundJobs);
+    }
+
+    DBOptions options;
+    options.create_if_missing = true;
+    options.create_missing_column_families = true;
+    if (backgroundJobs > 0) {
+        options.max_background_jobs = backgroundJobs;
+    }
+    options.statistics = GetStatistics();
+
+    vector<ColumnFamilyDescriptor> descriptors;
+    vector<const Comparator*> cmps;
+    descriptors.emplace_back(kDefaultColumnFamilyName, ColumnFamilyOptions());
+    cmps.push_back(nullptr);
+    for (auto& family : families) {
+        const Comparator* cmp =
+            static_cast<Comparator*>(NewDataTypeComparator(&family.second.cmp));
+        descriptors.emplace_back(family.first,
+                                 SharedFamilyOptions(cmp, &family.second));
+        cmps.push_back(cmp);
+    }
+
+    /* memtables are charged to the block cache as well */
+    if (!sharedWriteBuffer) {
+        sharedWriteBuffer = make_shared<WriteBufferManager>(SHAREDWRITEBUFFERSIZE,
+                                                            GetBlockCache());
+    }
+    options.write_buffer_manager = sharedWriteBuffer;
+
+    SharedInstance* instance = new SharedInstance;
+    vector<ColumnFamilyHandle*> handles;
+    Status s = DB::Open(options, path, descriptors, &handles, &instance->db);
+    if (!s.ok()) {
+        for (auto cmp : cmps) {
+            if (cmp) {
+                DelDataTypeComparator(cmp);
+            }
+        }
+        delete instance;
+        ereport(ERROR, errmsg("DB open status: %s", s.ToString().c_str()));
+    }
+
+    instance->path = path;
+    SharedTableOpts none;
+    memset(&none, 0, sizeof(none));
+    instance->families.insert({kDefaultColumnFamilyName,
+                               {handles[0], nullptr, none}});
+    for (size_t i = 1; i < handles.size(); i++) {
+        instance->families.insert({descriptors[i].name,
+                                   {handles[i], cmps[i], families[i - 1].second}});
+    }
+    instances.insert({path, instance});
+    return instance;
+}
+
+/* the comparators are used until the storage engine is closed */
+static void CloseSharedInstance(SharedInstance* instance) {
+    for (auto& it : instance->families) {
+        instance->db->DestroyColumnFamilyHandle(it.second.handle);
+    }
+    delete instance->db;
+
+    for (auto& it : instance->families) {
+        if (it.second.cmp) {
+            DelDataTypeComparator(it.second.cmp);
+        }
+    }
+    for (auto cmp : instance->dropped) {
+        DelDataTypeComparator(cmp);
+    }
+    instances.erase(instance->path);
+    delete instance;
+}
+
+/*
+ * Changed options of an existing table are kept for the next time the
+ * instance is opened, the column family open now goes on with the old ones.
+ */
+void* OpenSharedConn(char* path, KVRelationId relId, ComparatorOpts* opts,
+                     EngineOpts* engine) {
+    SharedInstance* instance = OpenSharedInstance(string(path), engine);
+    DB* db = instance->db;
+    string name = to_string(relId);
+
+    SharedTableOpts tableOpts;
+    memset(&tableOpts, 0, sizeof(tableOpts));
+    tableOpts.cmp = *opts;
+    tableOpts.engine = *engine;
+
+    Status s;
+    auto it = instance->families.find(name);
+    if (it == instance->families.end()) {
+        const Comparator* cmp =
+            static_cast<Comparator*>(NewDataTypeComparator(opts));
+        ColumnFamilyHandle* handle = nullptr;
+        s = PutSharedTableOpts(db, name, &tableOpts);
+        if (s.ok()) {
+            s = db->CreateColumnFamily(SharedFamilyOptions(cmp, &tableOpts),
+                                       name, &handle);
+        }
+        if (!s.ok()) {
+            DelDataTypeComparator(cmp);
+        } else {
+            it = instance->families.insert({name, {handle, cmp, tableOpts}}).first;
+        }
+    } else if (memcmp(&it->second.opts.engine, engine, sizeof(*engine)) != 0) {
+        s = PutSharedTableOpts(db, name, &tableOpts);
+        if (s.ok()) {
+            it->second.opts = tableOpts;
+        }
+    }
+
+    if (!s.ok()) {
+        if (instance->ref == 0) {
+            CloseSharedInstance(instance);
+        }
+        ereport(ERROR, errmsg("column family open status: %s",
+                              s.ToString().c_str()));
+    }
+    instance->ref++;
+
+    KVConn* conn = new KVConn;
+    conn->db = db;
+    conn->cf = it->second.handle;
+    conn->shared = instance;
+    return conn;
+}
+
+/*
+ * Drop the column family of a table, before its connection is closed if any.
+ * The comparator is kept since background jobs may still refer to it.
+ */
+bool DropSharedTable(char* path, KVRelationId relId) {
+    SharedInstance* instance = OpenSharedInstance(string(path), nullptr);
+    DB* db = instance->db;
+    string name = to_string(relId);
+    Status s;
+
+    auto it = instance->families.find(name);
+    if (it != instance->families.end()) {
+        s = db->DropColumnFamily(it->second.handle);
+        if (s.ok()) {
+            db->DestroyColumnFamilyHandle(it->second.handle);
+            instance->dropped.push_back(it->second.cmp);
+            instance->families.erase(it);
+        }
+    }
+    if (s.ok()) {
+        s = db->Delete(WriteOptions(), db->DefaultColumnFamily(), name);
+    }
+
+    if (instance->ref == 0) {
+        CloseSharedInstance(instance);
+    }
+    return s.ok();
+}
 #endif
 
 void CloseConn(void* conn) {
-    DB* db_ptr = static_cast<DB*>(conn);
-    const Comparator* wrap_cmp = db_ptr->GetOptions().comparator;
+    KVConn* table = static_cast<KVConn*>(conn);
+    #ifndef VIDARDB
+    if (table->shared) {
+        if (--table->shared->ref == 0) {
+            CloseSharedInstance(table->shared);
+        }
+        delete table;
+        return;
+    }
+    #endif
+
+    const Comparator* wrap_cmp = table->db->GetOptions().comparator;
     const Comparator* root_cmp = wrap_cmp->GetRootComparator();
-    delete root_cmp;
-    delete db_ptr;
+    delete table->db;
+    DelDataTypeComparator(root_cmp);
+    delete table;
 }
 
 uint64 GetCount(void* conn) {
+    KVConn* table = static_cast<KVConn*>(conn);
     string count;
     #ifdef VIDARDB
-    static_cast<DB*>(conn)->GetProperty("vidardb.estimate-num-keys", &count);
+    table->db->GetProperty(table->cf, "vidardb.estimate-num-keys", &count);
     #else
-    static_cast<DB*>(conn)->GetProperty("rocksdb.estimate-num-keys", &count);
+    table->db->GetProperty(table->cf, "rocksdb.estimate-num-keys", &count);
     #endif
     return stoull(count);
 }
 
-void* GetIter(void* conn) {
-    Iterator* it = static_cast<DB*>(conn)->NewIterator(ReadOptions());
-    it->SeekToFirst();
-    return it;
+/*
+ * Iterator of a scan with its bounds, which must outlive the iterator. An
+ * exclusive limit becomes the upper bound of the storage engine, an inclusive
+ * one is checked on each key.
+ */
+struct ScanIterator {
+    Iterator*         it = nullptr;
+    string            limit;
+    Slice             upperBound;
+    const Comparator* cmp = nullptr;  /* set if BatchRead checks the bound */
+    bool              done = false;
+    bool              reverse = false;
+    string            start;          /* checked by a reverse scan */
+    vector<string>    keys;           /* keys of a multi get, without it */
+    vector<string>    values;         /* values of the keys if read already */
+    size_t            nextKey = 0;
+    vector<string>    fetched;        /* values of the last MultiGet chunk */
+    vector<bool>      found;          /* whether each of them exists */
+    size_t            fetchedKey = 0; /* the key of the first of them */
+    string            large;          /* a record above READBATCHSIZE */
+};
+
+/* number of keys looked up by one MultiGet call */
+#define MULTIGETKEYS 256
+
+/*
+ * A reverse scan only relies on Seek and Prev, it positions at the limit and
+ * BatchRead stops at the start.
+ */
+static void* GetReverseIter(KVConn* table, ScanBounds* bounds) {
+    ScanIterator* iter = new ScanIterator;
+    iter->reverse = true;
+    iter->cmp = table->cf->GetComparator();
+    if (bounds->startLen > 0) {
+        iter->start.assign(bounds->start, bounds->startLen);
+    }
+    iter->it = table->db->NewIterator(ReadOptions(), table->cf);
+
+    Iterator* it = iter->it;
+    if (bounds->limitLen == 0) {
+        it->SeekToLast();
+        return iter;
+    }
+
+    Slice limit(bounds->limit, bounds->limitLen);
+    it->Seek(limit);
+    if (!it->Valid()) {
+        it->SeekToLast();
+    } else if (!bounds->limitInclusive ||
+               iter->cmp->Compare(it->key(), limit) != 0) {
+        it->Prev();
+    }
+    return iter;
+}
+
+void* GetIter(void* conn, ScanBounds* bounds) {
+    KVConn* table = static_cast<KVConn*>(conn);
+    if (bounds != NULL && bounds->reverse) {
+        return GetReverseIter(table, bounds);
+    }
+
+    ScanIterator* iter = new ScanIterator;
+    ReadOptions options;
+
+    if (bounds != NULL && bounds->limitLen > 0) {
+        iter->limit.assign(bounds->limit, bounds->limitLen);
+        if (bounds->limitInclusive) {
+            iter->cmp = table->cf->GetComparator();
+        } else {
+            iter->upperBound = Slice(iter->limit);
+            options.iterate_upper_bound = &iter->upperBound;
+        }
+    }
+
+    iter->it = table->db->NewIterator(options, table->cf);
+    if (bounds != NULL && bounds->startLen > 0) {
+        iter->it->Seek(Slice(bounds->start, bounds->startLen));
+    } else {
+        iter->it->SeekToFirst();
+    }
+    return iter;
+}
+
+/* keys are packed as [uint64 keyLen][key] */
+void* GetKeysIter(void* conn, char* keys, size_t keysLen) {
+    ScanIterator* iter = new ScanIterator;
+    char* end = keys + keysLen;
+
+    while (keys < end) {
+        uint64 keyLen;
+        memcpy(&keyLen, keys, sizeof(keyLen));
+        keys += sizeof(keyLen);
+        iter->keys.emplace_back(keys, keyLen);
+        keys += keyLen;
+    }
+    return iter;
+}
+
+/*
+ * Draw a reservoir sample of the whole table, the sampled records are kept in
+ * the key order, so ANALYZE sees the correlation of the key. The rows scanned
+ * are the exact count of the table.
+ */
+void* GetSampleIter(void* conn, uint64 sampleSize, uint64* rowCount) {
+    struct SampleRecord {
+        uint64 pos;
+        string key;
+        string val;
+    };
+    vector<SampleRecord> sample;
+    sample.reserve(sampleSize);
+
+    mt19937_64 generator(random_device{}());
+    KVConn* table = static_cast<KVConn*>(conn);
+    Iterator* it = table->db->NewIterator(ReadOptions(), table->cf);
+    uint64 pos = 0;
+    for (it->SeekToFirst(); it->Valid(); it->Next(), pos++) {
+        if (pos < sampleSize) {
+            sample.push_back({pos, it->key().ToString(), it->value().ToString()});
+            continue;
+        }
+
+        uint64 slot = uniform_int_distribution<uint64>(0, pos)(generator);
+        if (slot < sampleSize) {
+            sample[slot] = {pos, it->key().ToString(), it->value().ToString()};
+        }
+    }
+    delete it;
+    *rowCount = pos;
+
+    sort(sample.begin(), sample.end(),
+         [](const SampleRecord& a, const SampleRecord& b) {
+             return a.pos < b.pos;
+         });
+
+    ScanIterator* iter = new ScanIterator;
+    iter->keys.reserve(sample.size());
+    iter->values.reserve(sample.size());
+    for (auto& record : sample) {
+        iter->keys.push_back(move(record.key));
+        iter->values.push_back(move(record.val));
+    }
+    return iter;
+}
+
+void DelIter(void* iter) {
+    ScanIterator* scanIter = static_cast<ScanIterator*>(iter);
+    delete scanIter->it;
+    delete scanIter;
+}
+
+/* whether the key is beyond the bound BatchRead checks itself */
+static inline bool PastBound(ScanIterator* iter, const Slice& key) {
+    if (iter->reverse) {
+        return !iter->start.empty() && iter->cmp->Compare(key, iter->start) < 0;
+    }
+    return iter->cmp != nullptr && iter->cmp->Compare(key, iter->limit) > 0;
+}
+
+static inline char* PackRecord(char* buf, const Slice& key, const Slice& val) {
+    size_t keyLen = key.size(), valLen = val.size();
+
+    memcpy(buf, &keyLen, sizeof(keyLen));
+    buf += sizeof(keyLen);
+    memcpy(buf, key.data(), keyLen);
+    buf += keyLen;
+    memcpy(buf, &valLen, sizeof(valLen));
+    buf += sizeof(valLen);
+    memcpy(buf, val.data(), valLen);
+    return buf + valLen;
+}
+
+/*
+ * A record which does not fit a batch even alone is packed out of line, and
+ * handed out as a batch of its own by the worker, see BatchLargeRecord.
+ */
+static void PackLargeRecord(ScanIterator* iter, const Slice& key,
+                            const Slice& val) {
+    iter->large.resize(key.size() + val.size() + sizeof(size_t) * 2);
+    PackRecord(&iter->large[0], key, val);
+}
+
+/*
+ * Look up the keys of a multi get in chunks, the found records follow the
+ * order of the keys. The values of a chunk which do not fit are kept for the
+ * next batch, so no key is looked up twice.
+ */
+static void MultiGetChunk(KVConn* table, ScanIterator* iter) {
+    size_t count = min(iter->keys.size() - iter->nextKey,
+                       static_cast<size_t>(MULTIGETKEYS));
+    vector<Slice> keys;
+    keys.reserve(count);
+    for (size_t i = 0; i < count; i++) {
+        keys.emplace_back(iter->keys[iter->nextKey + i]);
+    }
+
+    vector<ColumnFamilyHandle*> cfs(count, table->cf);
+    vector<Status> status = table->db->MultiGet(ReadOptions(), cfs, keys,
+                                                &iter->fetched);
+    iter->found.assign(count, false);
+    for (size_t i = 0; i < count; i++) {
+        iter->found[i] = status[i].ok();
+    }
+    iter->fetchedKey = iter->nextKey;
+}
+
+static bool BatchMultiGet(KVConn* table, ScanIterator* iter, char* buf,
+                          size_t* bufLen) {
+    while (iter->nextKey < iter->keys.size()) {
+        if (iter->nextKey >= iter->fetchedKey + iter->fetched.size()) {
+            MultiGetChunk(table, iter);
+        }
+
+        size_t i = iter->nextKey - iter->fetchedKey;
+        if (iter->found[i]) {
+            const string& key = iter->keys[iter->nextKey];
+            const string& val = iter->fetched[i];
+            size_t size = key.size() + val.size() + sizeof(size_t) * 2;
+            if (*bufLen + size > READBATCHSIZE && *bufLen > 0) {
+                return true;
+            }
+            if (size > READBATCHSIZE) {
+                PackLargeRecord(iter, key, val);
+                iter->nextKey++;
+                return iter->nextKey < iter->keys.size();
+            }
+            buf = PackRecord(buf, key, val);
+            *bufLen += size;
+        }
+        iter->nextKey++;
+    }
+
+    iter->fetched.clear();
+    iter->found.clear();
+    return false;
 }
 
-void DelIter(void* it) {
-    delete static_cast<Iterator*>(it);
+/* hand out the records read already, e.g. a sample */
+static bool BatchRecords(ScanIterator* iter, char* buf, size_t* bufLen) {
+    while (iter->nextKey < iter->keys.size()) {
+        const string& key = iter->keys[iter->nextKey];
+        const string& val = iter->values[iter->nextKey];
+        size_t size = key.size() + val.size() + sizeof(size_t) * 2;
+        if (*bufLen + size > READBATCHSIZE && *bufLen > 0) {
+            return true;
+        }
+        if (size > READBATCHSIZE) {
+            PackLargeRecord(iter, key, val);
+            iter->nextKey++;
+            return iter->nextKey < iter->keys.size();
+        }
+
+        buf = PackRecord(buf, key, val);
+        *bufLen += size;
+        iter->nextKey++;
+    }
+
+    return false;
 }
 
+/*
+ * Fill a batch of at most READBATCHSIZE, or take a single larger record out of
+ * line and leave the batch empty. The record of the previous call is dropped.
+ */
 bool BatchRead(void* conn, void* iter, char* buf, size_t* bufLen) {
     *bufLen = 0;
 
-    Iterator* it = static_cast<Iterator*>(iter);
-    while (it != nullptr && it->Valid()) {
-        size_t keyLen = it->key().size(), valLen = it->value().size();
-        *bufLen += keyLen + valLen + sizeof(keyLen) + sizeof(valLen);
+    ScanIterator* scanIter = static_cast<ScanIterator*>(iter);
+    string().swap(scanIter->large);
+    if (scanIter->it == nullptr) {
+        if (!scanIter->values.empty()) {
+            return BatchRecords(scanIter, buf, bufLen);
+        }
+        return BatchMultiGet(static_cast<KVConn*>(conn), scanIter, buf, bufLen);
+    }
 
-        if (*bufLen > READBATCHSIZE) {
-            *bufLen -= keyLen + valLen + sizeof(keyLen) + sizeof(valLen);
+    Iterator* it = scanIter->done ? nullptr : scanIter->it;
+    while (it != nullptr && it->Valid()) {
+        if (PastBound(scanIter, it->key())) {
+            scanIter->done = true;
+            it = nullptr;
             break;
         }
 
-        memcpy(buf, &keyLen, sizeof(keyLen));
-        buf += sizeof(keyLen);
-        memcpy(buf, it->key().data(), keyLen);
-        buf += keyLen;
-        memcpy(buf, &valLen, sizeof(valLen));
-        buf += sizeof(valLen);
-        memcpy(buf, it->value().data(), valLen);
-        buf += valLen;
+        size_t keyLen = it->key().size(), valLen = it->value().size();
+        size_t size = keyLen + valLen + sizeof(keyLen) + sizeof(valLen);
+        if (*bufLen + size > READBATCHSIZE && *bufLen > 0) {
+            break;
+        }
 
-        it->Next();
+        bool large = size > READBATCHSIZE;
+        if (large) {
+            PackLargeRecord(scanIter, it->key(), it->value());
+        } else {
+            buf = PackRecord(buf, it->key(), it->value());
+            *bufLen += size;
+        }
+        if (scanIter->reverse) {
+            it->Prev();
+        } else {
+            it->Next();
+        }
+        if (large) {
+            break;
+        }
     }
 
     /* does not have next */
@@ -150,28 +834,602 @@ bool BatchRead(void* conn, void* iter, char* buf, size_t* bufLen) {
     return true;
 }
 
+char* BatchLargeRecord(void* iter, size_t* size) {
+    ScanIterator* scanIter = static_cast<ScanIterator*>(iter);
+    *size = scanIter->large.size();
+    return scanIter->large.empty() ? nullptr : &scanIter->large[0];
+}
+
+/*
+ * Split the key range at the smallest keys of the live files, which are
+ * strictly inside the bounds, so that the pieces are of similar size on disk.
+ * The split keys are packed as [uint64 keyLen][key] into at most
+ * SPLITKEYSSIZE bytes.
+ */
+size_t SplitKeys(void* conn, ScanBounds* bounds, uint32 maxSplits, char* buf) {
+    KVConn* table = static_cast<KVConn*>(conn);
+    const Comparator* cmp = table->cf->GetComparator();
+    Slice start(bounds->start, bounds->startLen);
+    Slice limit(bounds->limit, bounds->limitLen);
+
+    vector<LiveFileMetaData> files;
+    table->db->GetLiveFilesMetaData(&files);
+
+    vector<string> keys;
+    for (auto& file : files) {
+        if (file.column_family_name != table->cf->GetName()) {
+            continue;
+        }
+
+        Slice key(file.smallestkey);
+        if ((start.empty() || cmp->Compare(key, start) > 0) &&
+            (limit.empty() || cmp->Compare(key, limit) < 0)) {
+            keys.push_back(file.smallestkey);
+        }
+    }
+
+    sort(keys.begin(), keys.end(), [cmp](const string& a, const string& b) {
+        return cmp->Compare(a, b) < 0;
+    });
+    keys.erase(unique(keys.begin(), keys.end(),
+                      [cmp](const string& a, const string& b) {
+                          return cmp->Compare(a, b) == 0;
+                      }),
+               keys.end());
+
+    size_t splits = min(keys.size(), static_cast<size_t>(maxSplits));
+    size_t size = 0;
+    for (size_t i = 0; i < splits; i++) {
+        const string& key = keys[(i + 1) * keys.size() / (splits + 1)];
+        uint64 keyLen = key.size();
+        if (size + sizeof(keyLen) + keyLen > SPLITKEYSSIZE) {
+            break;
+        }
+
+        memcpy(buf + size, &keyLen, sizeof(keyLen));
+        size += sizeof(keyLen);
+        memcpy(buf + size, key.data(), keyLen);
+        size += keyLen;
+    }
+    return size;
+}
+
+/* copied from the storage engine */
+static inline const char* GetVarint64(const char* p, const char* limit,
+                                      uint64* value) {
+    uint64 result = 0;
+    for (uint32 shift = 0; shift <= 63 && p < limit; shift += 7) {
+        uint64 byte = *(reinterpret_cast<const unsigned char*>(p));
+        p++;
+        if (byte & 128) {
+            result |= ((byte & 127) << shift);
+        } else {
+            result |= (byte << shift);
+            *value = result;
+            return p;
+        }
+    }
+    return nullptr;
+}
+
+/*
+ * Find an attribute in a value, which is a sequence of [varint size][data]
+ * with size 0 for null. A value shorter than the table has nulls at the end.
+ */
+static const char* FindAttribute(const Slice& val, int32 index) {
+    const char* p = val.data();
+    const char* limit = p + val.size();
+    for (int32 i = 0; p != nullptr && p < limit; i++) {
+        uint64 size = 0;
+        p = GetVarint64(p, limit, &size);
+        if (p == nullptr || size == 0) {
+            if (i == index) {
+                return nullptr;
+            }
+            continue;
+        }
+
+        if (i == index) {
+            return p;
+        }
+        p += size;
+    }
+    return nullptr;
+}
+
+static void AggregateRecord(KVAggregate* agg, KVAggregateResult* result,
+                            const Slice& val) {
+    if (agg->kind == KVAggCount) {
+        result->count++;
+        return;
+    }
+
+    const char* data = FindAttribute(val, agg->index);
+    if (data == nullptr) {
+        return;
+    }
+    result->count++;
+
+    switch (agg->kind) {
+        case KVAggSumInt16: {
+            int16 value;
+            memcpy(&value, data, sizeof(value));
+            result->intSum += value;
+            break;
+        }
+        case KVAggSumInt32: {
+            int32 value;
+            memcpy(&value, data, sizeof(value));
+            result->intSum += value;
+            break;
+        }
+        case KVAggSumFloat64: {
+            double value;
+            memcpy(&value, data, sizeof(value));
+            result->floatSum += value;
+            break;
+        }
+        default:
+            break;
+    }
+}
+
+/*
+ * Compute the aggregates in one pass over the table, which does not copy the
+ * records out. The min and max keys are the first and the last keys, and
+ * count(*) alone can be the estimate of the engine, neither needs a pass. It
+ * fails if the keys do not fit into AGGREGATESIZE bytes.
+ */
+bool AggregateRecords(void* conn, bool estimate, uint32 aggCount,
+                      KVAggregate* aggs, char* buf, size_t* bufLen) {
+    KVConn* table = static_cast<KVConn*>(conn);
+    KVAggregateResult* results = reinterpret_cast<KVAggregateResult*>(buf);
+    size_t size = aggCount * sizeof(KVAggregateResult);
+    memset(buf, 0, size);
+
+    vector<KVAggregate*> scanAggs;
+    vector<KVAggregateResult*> scanResults;
+    for (uint32 i = 0; i < aggCount; i++) {
+        int32 kind = aggs[i].kind;
+        if (kind == KVAggMinKey || kind == KVAggMaxKey ||
+            (kind == KVAggCount && estimate)) {
+            continue;
+        }
+        scanAggs.push_back(&aggs[i]);
+        scanResults.push_back(&results[i]);
+    }
+
+    uint64 rows = 0;
+    if (!scanAggs.empty()) {
+        Iterator* it = table->db->NewIterator(ReadOptions(), table->cf);
+        for (it->SeekToFirst(); it->Valid(); it->Next(), rows++) {
+            Slice val = it->value();
+            for (size_t i = 0; i < scanAggs.size(); i++) {
+                AggregateRecord(scanAggs[i], scanResults[i], val);
+            }
+        }
+        delete it;
+    }
+
+    for (uint32 i = 0; i < aggCount; i++) {
+        if (aggs[i].kind == KVAggCount) {
+            results[i].count = scanAggs.empty() ? GetCount(conn) : rows;
+            continue;
+        }
+        if (aggs[i].kind != KVAggMinKey && aggs[i].kind != KVAggMaxKey) {
+            continue;
+        }
+
+        Iterator* it = table->db->NewIterator(ReadOptions(), table->cf);
+        if (aggs[i].kind == KVAggMinKey) {
+            it->SeekToFirst();
+        } else {
+            it->SeekToLast();
+        }
+
+        uint64 keyLen = it->Valid() ? it->key().size() : 0;
+        if (size + sizeof(keyLen) + keyLen > AGGREGATESIZE) {
+            delete it;
+            return false;
+        }
+        memcpy(buf + size, &keyLen, sizeof(keyLen));
+        size += sizeof(keyLen);
+        if (keyLen > 0) {
+            memcpy(buf + size, it->key().data(), keyLen);
+            size += keyLen;
+            results[i].count = 1;
+        }
+        delete it;
+    }
+
+    *bufLen = size;
+    return true;
+}
+
+/*
+ * The value of the last GetRecord of a thread, valid until ReleaseRecord. The
+ * value of RocksDB is pinned in the block cache or the memtable rather than
+ * copied, the string of VidarDB keeps its capacity for the next one.
+ */
+#ifdef VIDARDB
+static thread_local string recordValue;
+#else
+static thread_local PinnableSlice recordValue;
+#endif
+
 bool GetRecord(void* conn, char* key, size_t keyLen, char** val, size_t* valLen) {
-    string sval;
     ReadOptions ro;
-    Status s = static_cast<DB*>(conn)->Get(ro, Slice(key, keyLen), &sval);
+    KVConn* table = static_cast<KVConn*>(conn);
+    Status s = table->db->Get(ro, table->cf, Slice(key, keyLen), &recordValue);
     if (!s.ok()) return false;
-    *valLen = sval.length();
-    *val = static_cast<char*>(palloc(*valLen));
-    memcpy(*val, sval.c_str(), *valLen);
+    *valLen = recordValue.size();
+    *val = const_cast<char*>(recordValue.data());
     return true;
 }
 
+void ReleaseRecord() {
+    #ifdef VIDARDB
+    recordValue.clear();
+    #else
+    recordValue.Reset();
+    #endif
+}
+
+/* set when the table is opened, before it is written */
+void SetWriteOpts(void* conn, WriteOpts* write) {
+    KVConn* table = static_cast<KVConn*>(conn);
+    table->writeOpts.sync = write->sync;
+    table->writeOpts.disableWAL = write->disableWAL;
+}
+
 bool PutRecord(void* conn, char* key, size_t keyLen, char* val, size_t valLen) {
-    Status s = static_cast<DB*>(conn)->Put(WriteOptions(), Slice(key, keyLen),
-                                           Slice(val, valLen));
+    KVConn* table = static_cast<KVConn*>(conn);
+    Status s = table->db->Put(table->writeOpts, table->cf, Slice(key, keyLen),
+                              Slice(val, valLen));
+    return s.ok();
+}
+
+/* apply the rows packed in the same layout as BatchRead in one write batch */
+bool PutRecords(void* conn, char* buf, size_t bufLen) {
+    KVConn* table = static_cast<KVConn*>(conn);
+    WriteBatch batch;
+    char* end = buf + bufLen;
+
+    while (buf < end) {
+        size_t keyLen, valLen;
+        memcpy(&keyLen, buf, sizeof(keyLen));
+        buf += sizeof(keyLen);
+        char* key = buf;
+        buf += keyLen;
+
+        memcpy(&valLen, buf, sizeof(valLen));
+        buf += sizeof(valLen);
+        batch.Put(table->cf, Slice(key, keyLen), Slice(buf, valLen));
+        buf += valLen;
+    }
+
+    Status s = table->db->Write(table->writeOpts, &batch);
     return s.ok();
 }
 
 bool DelRecord(void* conn, char* key, size_t keyLen) {
-    Status s = static_cast<DB*>(conn)->Delete(WriteOptions(), Slice(key, keyLen));
+    KVConn* table = static_cast<KVConn*>(conn);
+    Status s = table->db->Delete(table->writeOpts, table->cf,
+                                 Slice(key, keyLen));
+    return s.ok();
+}
+
+/* apply the keys packed as [keyLen][key] in one write batch */
+bool DelRecords(void* conn, char* buf, size_t bufLen) {
+    KVConn* table = static_cast<KVConn*>(conn);
+    WriteBatch batch;
+    char* end = buf + bufLen;
+
+    while (buf < end) {
+        size_t keyLen;
+        memcpy(&keyLen, buf, sizeof(keyLen));
+        buf += sizeof(keyLen);
+        batch.Delete(table->cf, Slice(buf, keyLen));
+        buf += keyLen;
+    }
+
+    Status s = table->db->Write(table->writeOpts, &batch);
+    return s.ok();
+}
+
+/* flush threshold of the write batch of a range delete per key */
+#define DELRANGEBATCHSIZE 4096*256
+
+/*
+ * Delete the keys within the bounds and count them. The keys are still read
+ * to count them, but with RocksDB the keys from the first to the last one
+ * found are removed by one range tombstone instead of one tombstone each.
+ */
+bool DelRange(void* conn, ScanBounds* bounds, uint64* count) {
+    KVConn* table = static_cast<KVConn*>(conn);
+    ScanIterator* iter = static_cast<ScanIterator*>(GetIter(conn, bounds));
+    WriteBatch batch;
+    Status s;
+    *count = 0;
+
+    #ifndef VIDARDB
+    string first, last;
+    #endif
+    Iterator* it = iter->it;
+    for (; it->Valid() && !PastBound(iter, it->key()); it->Next()) {
+        #ifdef VIDARDB
+        batch.Delete(table->cf, it->key());
+        if (batch.GetDataSize() > DELRANGEBATCHSIZE) {
+            s = table->db->Write(table->writeOpts, &batch);
+            if (!s.ok()) {
+                break;
+            }
+            batch.Clear();
+        }
+        #else
+        if (*count == 0) {
+            first.assign(it->key().data(), it->key().size());
+        }
+        last.assign(it->key().data(), it->key().size());
+        #endif
+        (*count)++;
+    }
+    if (s.ok()) {
+        s = it->status();
+    }
+    DelIter(iter);
+
+    #ifndef VIDARDB
+    /* the end of a range tombstone is exclusive */
+    if (s.ok() && *count > 0) {
+        batch.DeleteRange(table->cf, first, last);
+        batch.Delete(table->cf, last);
+    }
+    #endif
+    if (s.ok() && batch.Count() > 0) {
+        s = table->db->Write(table->writeOpts, &batch);
+    }
+    return s.ok();
+}
+
+/*
+ * Delete all the keys of a table, which is locked exclusively by the backend.
+ * RocksDB covers them by one range tombstone from the first key to the last,
+ * found without a scan, then drops the files below level 0 as a whole and
+ * compacts the rest together with the tombstone, so nothing of the table is
+ * left to skip by later scans. VidarDB deletes them one by one as DelRange.
+ */
+bool TruncateTable(void* conn) {
+    #ifdef VIDARDB
+    ScanBounds bounds = {};
+    uint64 count = 0;
+    return DelRange(conn, &bounds, &count);
+    #else
+    KVConn* table = static_cast<KVConn*>(conn);
+    Iterator* it = table->db->NewIterator(ReadOptions(), table->cf);
+    bool empty = true;
+    string first, last;
+    it->SeekToFirst();
+    if (it->Valid()) {
+        empty = false;
+        first.assign(it->key().data(), it->key().size());
+        it->SeekToLast();
+        if (it->Valid()) {
+            last.assign(it->key().data(), it->key().size());
+        }
+    }
+    Status s = it->status();
+    delete it;
+    if (!s.ok() || empty) {
+        return s.ok();
+    }
+
+    /* the end of a range tombstone is exclusive */
+    WriteBatch batch;
+    batch.DeleteRange(table->cf, first, last);
+    batch.Delete(table->cf, last);
+    s = table->db->Write(table->writeOpts, &batch);
+    if (s.ok()) {
+        s = DeleteFilesInRange(table->db, table->cf, nullptr, nullptr);
+    }
+    if (s.ok()) {
+        s = table->db->CompactRange(CompactRangeOptions(), table->cf, nullptr,
+                                    nullptr);
+    }
+    return s.ok();
+    #endif
+}
+
+#ifndef VIDARDB
+bool IngestFile(void* conn, char* path, char* error) {
+    IngestExternalFileOptions options;
+    options.move_files = true;
+
+    KVConn* table = static_cast<KVConn*>(conn);
+    Status s = table->db->IngestExternalFile(table->cf, {string(path)}, options);
+    if (!s.ok()) {
+        snprintf(error, KVERRORSIZE, "%s", s.ToString().c_str());
+    }
     return s.ok();
 }
 
+/*
+ * Bulk loader of COPY, it runs in the backend and writes the rows into sorted
+ * string tables which are moved into the db by the worker afterwards. Unsorted
+ * rows are buffered and sorted in chunks, so one output file per chunk. Rows
+ * assumed sorted are streamed into the current file directly. A failure is
+ * kept for BulkLoadError rather than raised here, since an error would jump
+ * over the destructors of the loader.
+ */
+#define BULKLOADCHUNKSIZE 64*1024*1024
+#define BULKLOADFILESIZE  256*1024*1024
+
+struct BulkLoadRow {
+    size_t offset;
+    size_t keyLen;
+    size_t valLen;
+};
+
+struct BulkLoader {
+    Options             options;
+    bool                sorted;
+    string              prefix;    /* path prefix of the output files */
+    uint32              seq = 0;   /* sequence number of the output files */
+    string              file;      /* the last finished file */
+    vector<string>      files;     /* all the files, removed by DelBulkLoad */
+    SstFileWriter*      writer = nullptr;
+    string              chunk;     /* unsorted rows */
+    vector<BulkLoadRow> rows;
+    string              error;
+};
+
+static bool BulkLoadFailed(BulkLoader* loader, const char* action,
+                           const Status& s) {
+    loader->error = string("SST file ") + action + " status: " + s.ToString();
+    return false;
+}
+
+static bool OpenBulkLoadFile(BulkLoader* loader) {
+    loader->file = loader->prefix + "." + to_string(loader->seq++) + ".sst";
+    loader->files.push_back(loader->file);
+    loader->writer = new SstFileWriter(EnvOptions(), loader->options);
+
+    Status s = loader->writer->Open(loader->file);
+    return s.ok() || BulkLoadFailed(loader, "open", s);
+}
+
+static bool FinishBulkLoadFile(BulkLoader* loader) {
+    Status s = loader->writer->Finish();
+    delete loader->writer;
+    loader->writer = nullptr;
+
+    return s.ok() || BulkLoadFailed(loader, "finish", s);
+}
+
+static BulkLoadStatus FlushBulkLoadChunk(BulkLoader* loader) {
+    if (loader->rows.empty()) {
+        return BulkLoadBuffered;
+    }
+
+    const char* base = loader->chunk.data();
+    const Comparator* cmp = loader->options.comparator;
+    auto key = [base](const BulkLoadRow& row) {
+        return Slice(base + row.offset, row.keyLen);
+    };
+
+    /* stable, so that rows of the same key stay in the input order */
+    stable_sort(loader->rows.begin(), loader->rows.end(),
+        [&](const BulkLoadRow& a, const BulkLoadRow& b) {
+            return cmp->Compare(key(a), key(b)) < 0;
+        });
+
+    if (!OpenBulkLoadFile(loader)) {
+        return BulkLoadFailure;
+    }
+    size_t count = loader->rows.size();
+    for (size_t i = 0; i < count; i++) {
+        const BulkLoadRow& row = loader->rows[i];
+        /* the last row of the same key wins, as it does with put */
+        if (i + 1 < count && cmp->Equal(key(row), key(loader->rows[i + 1]))) {
+            continue;
+        }
+
+        Status s = loader->writer->Put(key(row),
+            Slice(base + row.offset + row.keyLen, row.valLen));
+        if (!s.ok()) {
+            BulkLoadFailed(loader, "put", s);
+            return BulkLoadFailure;
+        }
+    }
+    if (!FinishBulkLoadFile(loader)) {
+        return BulkLoadFailure;
+    }
+
+    loader->chunk.clear();
+    loader->rows.clear();
+    return BulkLoadFileReady;
+}
+
+void* BeginBulkLoad(char* path, ComparatorOpts* opts, bool sorted) {
+    BulkLoader* loader = new BulkLoader;
+    loader->options.comparator =
+        static_cast<Comparator*>(NewDataTypeComparator(opts));
+    loader->sorted = sorted;
+    loader->prefix = string(path) + "." + to_string(MyProcPid);
+    return loader;
+}
+
+BulkLoadStatus BulkLoadPut(void* bulkLoader, char* key, size_t keyLen,
+                           char* val, size_t valLen) {
+    BulkLoader* loader = static_cast<BulkLoader*>(bulkLoader);
+
+    if (loader->sorted) {
+        if (loader->writer == nullptr && !OpenBulkLoadFile(loader)) {
+            return BulkLoadFailure;
+        }
+
+        Status s = loader->writer->Put(Slice(key, keyLen), Slice(val, valLen));
+        if (!s.ok()) {
+            BulkLoadFailed(loader, "put", s);
+            return BulkLoadFailure;
+        }
+
+        if (loader->writer->FileSize() < BULKLOADFILESIZE) {
+            return BulkLoadBuffered;
+        }
+        return FinishBulkLoadFile(loader) ? BulkLoadFileReady : BulkLoadFailure;
+    }
+
+    BulkLoadRow row;
+    row.offset = loader->chunk.size();
+    row.keyLen = keyLen;
+    row.valLen = valLen;
+    loader->chunk.append(key, keyLen);
+    loader->chunk.append(val, valLen);
+    loader->rows.push_back(row);
+
+    if (loader->chunk.size() < BULKLOADCHUNKSIZE) {
+        return BulkLoadBuffered;
+    }
+    return FlushBulkLoadChunk(loader);
+}
+
+BulkLoadStatus BulkLoadFinish(void* bulkLoader) {
+    BulkLoader* loader = static_cast<BulkLoader*>(bulkLoader);
+
+    if (!loader->sorted) {
+        return FlushBulkLoadChunk(loader);
+    }
+    if (loader->writer == nullptr) {
+        return BulkLoadBuffered;
+    }
+    return FinishBulkLoadFile(loader) ? BulkLoadFileReady : BulkLoadFailure;
+}
+
+char* BulkLoadFile(void* bulkLoader) {
+    return const_cast<char*>(static_cast<BulkLoader*>(bulkLoader)->file.c_str());
+}
+
+const char* BulkLoadError(void* bulkLoader) {
+    return static_cast<BulkLoader*>(bulkLoader)->error.c_str();
+}
+
+/*
+ * Also called when the copy fails, so the files which are not ingested, e.g.
+ * a chunk half written, are removed. The ingested ones were moved into the db
+ * and only have their links here, if any.
+ */
+void DelBulkLoad(void* bulkLoader) {
+    BulkLoader* loader = static_cast<BulkLoader*>(bulkLoader);
+    delete loader->writer;
+    for (const string& file : loader->files) {
+        unlink(file.c_str());
+    }
+    DelDataTypeComparator(loader->options.comparator);
+    delete loader;
+}
+#endif
+
 #ifdef VIDARDB
 void ParseRangeQueryOptions(RangeQueryOpts* queryOptions, void** range,
                             void** readOptions) {
@@ -180,7 +1438,7 @@ void ParseRangeQueryOptions(RangeQueryOpts* queryOptions, void** range,
     /* Parse Range */
     Range* r = static_cast<Range*>(*range);
     if (*range == NULL) {
-        r = static_cast<Range*>(palloc0(sizeof(Range)));
+        r = new Range();
     }
     r->start = queryOptions->startLen > 0 ?
                Slice(queryOptions->start, queryOptions->startLen) : kRangeQueryMin;
@@ -201,14 +1459,38 @@ void ParseRangeQueryOptions(RangeQueryOpts* queryOptions, void** range,
     }
 
     sort(options->columns.begin(), options->columns.end());
-    printf("\nattrs in %s: ", __func__);
-    for (auto i : options->columns) printf(" %d ", i);
-    printf("\n");
+    KV_TRACE("\nattrs in %s: ", __func__);
+    for (auto i : options->columns) KV_TRACE(" %d ", i);
+    KV_TRACE("\n");
     options->batch_capacity = queryOptions->batchCapacity;
 
     *readOptions = options;
 }
 
+/* the queried columns but the key, which is column 0 */
+static uint64 ValueColumns(ReadOptions* options) {
+    return count_if(options->columns.begin(), options->columns.end(),
+                    [](uint32_t column) { return column > 0; });
+}
+
+/* copied from the storage engine */
+static inline const char* GetVarint64Ptr(const char* p, const char* limit,
+                                         uint64* value) {
+    uint64 result = 0;
+    for (uint32 shift = 0; shift <= 63 && p < limit; shift += 7) {
+        uint64 byte = *(reinterpret_cast<const unsigned char*>(p));
+        p++;
+        if (byte & 128) {
+            result |= ((byte & 127) << shift);
+        } else {
+            result |= (byte << shift);
+            *value = result;
+            return p;
+        }
+    }
+    return nullptr;
+}
+
 bool RangeQueryRead(void* conn, void* range, void** readOptions, size_t* bufLen,
                     void** result) {
     ReadOptions* ro = static_cast<ReadOptions*>(*readOptions);
@@ -218,7 +1500,7 @@ bool RangeQueryRead(void* conn, void* range, void** readOptions, size_t* bufLen,
         res = new list<RangeQueryKeyVal>;
     }
     Status s;
-    bool ret = static_cast<DB*>(conn)->RangeQuery(*ro, *r, *res, &s);
+    bool ret = static_cast<KVConn*>(conn)->db->RangeQuery(*ro, *r, *res, &s);
 
     if (!s.ok()) {
         *result = res;
@@ -232,31 +1514,80 @@ bool RangeQueryRead(void* conn, void* range, void** readOptions, size_t* bufLen,
          */
         *bufLen = 0;
     } else {
-        *bufLen = ro->result_key_size + ro->result_val_size +
-                  sizeof(size_t) * 2 * res->size();
+        /* the values lose their size headers but each column is aligned */
+        uint64 rows = res->size();
+        uint64 columns = ValueColumns(ro);
+        *bufLen = sizeof(uint64) * 2 +
+                  (columns + 1) * (rows + 1) * sizeof(uint64) +
+                  columns * (COLUMNBITMAPSIZE(rows) + 7) +
+                  COLUMNBATCHALIGN(ro->result_key_size) + ro->result_val_size;
     }
 
     *result = res;
     return ret;
 }
 
-void ParseRangeQueryResult(void* result, char* buf) {
+/*
+ * Write the batch in the columnar layout of kv_api.h. A value is parsed once,
+ * the rows resume from where the previous column ended, and a row shorter
+ * than the query has nulls at the end.
+ */
+void ParseRangeQueryResult(void* result, void* readOptions, char* buf) {
     Assert(result != NULL);
     list<RangeQueryKeyVal>* res = static_cast<list<RangeQueryKeyVal>*>(result);
 
     if (buf != NULL) {
+        uint64 rows = res->size();
+        uint64 columns = ValueColumns(static_cast<ReadOptions*>(readOptions));
+        memcpy(buf, &rows, sizeof(rows));
+        memcpy(buf + sizeof(rows), &columns, sizeof(columns));
+        char* current = buf + sizeof(rows) + sizeof(columns);
+
+        uint64* offsets = reinterpret_cast<uint64*>(current);
+        char* data = current + (rows + 1) * sizeof(uint64);
+        uint64 offset = 0, row = 0;
+        vector<const char*> positions;
+        positions.reserve(rows);
         for (auto it = res->begin(); it != res->end(); ++it) {
-            size_t keyLen = it->user_key.size();
-            memcpy(buf, &keyLen, sizeof(keyLen));
-            buf += sizeof(keyLen);
-            memcpy(buf, it->user_key.c_str(), keyLen);
-            buf += keyLen;
+            offsets[row++] = offset;
+            memcpy(data + offset, it->user_key.data(), it->user_key.size());
+            offset += it->user_key.size();
+            positions.push_back(it->user_val.data());
+        }
+        offsets[rows] = offset;
+        current = data + COLUMNBATCHALIGN(offset);
+
+        for (uint64 column = 0; column < columns; column++) {
+            uint8* nulls = reinterpret_cast<uint8*>(current);
+            memset(nulls, 0, COLUMNBITMAPSIZE(rows));
+            offsets = reinterpret_cast<uint64*>(current + COLUMNBITMAPSIZE(rows));
+            data = reinterpret_cast<char*>(offsets + rows + 1);
 
-            size_t valLen = it->user_val.size();
-            memcpy(buf, &valLen, sizeof(valLen));
-            buf += sizeof(valLen);
-            memcpy(buf, it->user_val.c_str(), valLen);
-            buf += valLen;
+            offset = 0, row = 0;
+            for (auto it = res->begin(); it != res->end(); ++it, row++) {
+                const char* end = it->user_val.data() + it->user_val.size();
+                const char* p = positions[row];
+                uint64 dataLen = 0;
+                if (p < end) {
+                    p = GetVarint64Ptr(p, end, &dataLen);
+                    if (p == nullptr || dataLen > static_cast<uint64>(end - p)) {
+                        p = end;
+                        dataLen = 0;
+                    }
+                }
+
+                offsets[row] = offset;
+                if (dataLen == 0) {
+                    nulls[row / 8] |= 1 << (row % 8);
+                } else {
+                    memcpy(data + offset, p, dataLen);
+                    offset += dataLen;
+                    p += dataLen;
+                }
+                positions[row] = p;
+            }
+            offsets[rows] = offset;
+            current = data + COLUMNBATCHALIGN(offset);
         }
     }
 
@@ -266,12 +1597,12 @@ void ParseRangeQueryResult(void* result, char* buf) {
 void ClearRangeQueryMeta(void* range, void* readOptions) {
     Range* r = static_cast<Range*>(range);
     if (r->start != kRangeQueryMin) {
-        pfree(const_cast<void*>(static_cast<const void*>(r->start.data())));
+        free(const_cast<void*>(static_cast<const void*>(r->start.data())));
     }
     if (r->limit != kRangeQueryMax) {
-        pfree(const_cast<void*>(static_cast<const void*>(r->limit.data())));
+        free(const_cast<void*>(static_cast<const void*>(r->limit.data())));
     }
-    pfree(range);
+    delete r;
 
     ReadOptions* options = static_cast<ReadOptions*>(readOptions);
     delete options;
@@ -318,7 +1649,7 @@ class PGDataTypeComparator : public Comparator {
      * the relative ordering of any two keys to change.
      */
     virtual const char* Name() const override {
-        return "kv.PGDataTypeComparator";
+        return COMPARATORNAME;
     }
 
     /*
@@ -348,13 +1679,19 @@ class PGDataTypeComparator : public Comparator {
             /*
              * must start a transaction to build the type cache, and pass
              * through system cache check, but it is fine, just for one time.
+             * A backend (bulk load) is already inside a transaction.
              * TODO: We have to be careful about cache invalidation problem.
              * currently, we assume tbl schema never get changed after creation.
              */
-            StartTransactionCommand();  /* necessary transaction */
+            bool inTransaction = IsTransactionState();
+            if (!inTransaction) {
+                StartTransactionCommand();  /* necessary transaction */
+            }
             /* generally, the return type is int4 (pg_proc.dat) */
             ret = DatumGetInt32(FunctionCallInvoke(funcCallInfo_));
-            CommitTransactionCommand();  /* necessary transaction */
+            if (!inTransaction) {
+                CommitTransactionCommand();  /* necessary transaction */
+            }
             *firstCall_ = false;
         } else {
             /*
@@ -417,6 +1754,122 @@ class PGDataTypeComparator : public Comparator {
     FunctionCallInfoBaseData* funcCallInfo_;
 };
 
+/*
+ * Native comparison of the common key types, they give the same result as the
+ * btree support functions but need neither fmgr nor the mutex. Keys are not
+ * aligned in the slice, so the values are copied out.
+ */
+template <typename T>
+static inline int CompareInteger(const Slice& a, const Slice& b) {
+    T x, y;
+    memcpy(&x, a.data(), sizeof(T));
+    memcpy(&y, b.data(), sizeof(T));
+    return (x > y) - (x < y);
+}
+
+/* same as float8_cmp_internal, NaNs are equal and larger than non-NaNs */
+static inline int CompareFloat8(const Slice& a, const Slice& b) {
+    float8 x, y;
+    memcpy(&x, a.data(), sizeof(float8));
+    memcpy(&y, b.data(), sizeof(float8));
+
+    if (isnan(x)) {
+        return isnan(y) ? 0 : 1;
+    }
+    if (isnan(y)) {
+        return -1;
+    }
+    return (x > y) - (x < y);
+}
+
+static inline int CompareUUID(const Slice& a, const Slice& b) {
+    return memcmp(a.data(), b.data(), UUID_LEN);
+}
+
+/* same as varstr_cmp under C collation, the key is a short or 4B varlena */
+static inline int CompareCText(const Slice& a, const Slice& b) {
+    const char* x = a.data();
+    const char* y = b.data();
+    int xLen = VARSIZE_ANY_EXHDR(x);
+    int yLen = VARSIZE_ANY_EXHDR(y);
+
+    int ret = memcmp(VARDATA_ANY(x), VARDATA_ANY(y), Min(xLen, yLen));
+    if (ret == 0 && xLen != yLen) {
+        ret = xLen < yLen ? -1 : 1;
+    }
+    return ret;
+}
+
+typedef int (*KeyCompareFunc) (const Slice& a, const Slice& b);
+
+template <KeyCompareFunc compare>
+class NativeDataTypeComparator : public Comparator {
+  public:
+    virtual const char* Name() const override {
+        return COMPARATORNAME;
+    }
+
+    virtual int Compare(const Slice& a, const Slice& b) const override {
+        return compare(a, b);
+    }
+
+    virtual bool Equal(const Slice& a, const Slice& b) const override {
+        return compare(a, b) == 0;
+    }
+
+    virtual void FindShortestSeparator(string* start,
+                                       const Slice& limit) const override {
+        /* do nothing */
+    }
+
+    virtual void FindShortSuccessor(string* key) const override {
+        /* do nothing */
+    }
+};
+
 void* NewDataTypeComparator(ComparatorOpts* options) {
+    /* the keys are encoded to sort bytewise */
+    if (options->orderedKey) {
+        return const_cast<Comparator*>(BytewiseComparator());
+    }
+
+    /*
+     * By the type rather than the comparison function, since fmgroids.h names
+     * the functions after their source, e.g. F_TIMESTAMP_CMP is the one of
+     * timestamptz. The comparison function is the default one of the type.
+     */
+    switch (options->attrTypeOid) {
+        case INT2OID:
+            return new NativeDataTypeComparator<CompareInteger<int16>>();
+        case INT4OID:
+        case DATEOID:
+            return new NativeDataTypeComparator<CompareInteger<int32>>();
+        case INT8OID:
+        case TIMESTAMPOID:
+        case TIMESTAMPTZOID:
+            return new NativeDataTypeComparator<CompareInteger<int64>>();
+        case FLOAT8OID:
+            return new NativeDataTypeComparator<CompareFloat8>();
+        case UUIDOID:
+            return new NativeDataTypeComparator<CompareUUID>();
+        case TEXTOID:
+        case VARCHAROID:
+            /* the backend resolves any C equivalent collation to C */
+            if (options->attrCollOid == C_COLLATION_OID ||
+                options->attrCollOid == POSIX_COLLATION_OID) {
+                return new NativeDataTypeComparator<CompareCText>();
+            }
+            break;
+        default:
+            break;
+    }
+
     return new PGDataTypeComparator(options);
 }
+
+/* the bytewise comparator is a singleton of the storage engine */
+void DelDataTypeComparator(const Comparator* comparator) {
+    if (comparator != BytewiseComparator()) {
+        delete comparator;
+    }
+}
@@ -24,31 +24,71 @@ extern "C" {
 
 
 #define READBATCHSIZE 4096*20
+#define SPLITKEYSSIZE 4096*8  /* fits into a response channel */
+#define AGGREGATESIZE 4096*8  /* fits into a response channel */
+
+#ifndef VIDARDB
+/* the outcome of a step of the bulk loader, see BulkLoadError */
+typedef enum BulkLoadStatus {
+    BulkLoadBuffered = 0,  /* nothing to ingest yet */
+    BulkLoadFileReady,     /* a file is finished, see BulkLoadFile */
+    BulkLoadFailure,
+} BulkLoadStatus;
+#endif
 
 
 /**
- * C wrapper of storage engine API, might be directly used in C part (utility)
+ * C wrapper of storage engine API, might be directly used in C part (utility).
+ * It can be called by the threads of kv worker, so returned memory is from
+ * malloc instead of palloc.
  */
 
 #ifdef VIDARDB
-void*  OpenConn(char* path, bool useColumn, int attrCount, ComparatorOpts* opts);
+void*  OpenConn(char* path, bool useColumn, int attrCount, ComparatorOpts* opts,
+                EngineOpts* engine);
 #else
-void*  OpenConn(char* path, ComparatorOpts* opts);
+void*  OpenConn(char* path, ComparatorOpts* opts, EngineOpts* engine);
+void*  OpenSharedConn(char* path, KVRelationId relId, ComparatorOpts* opts,
+                      EngineOpts* engine);
+bool   DropSharedTable(char* path, KVRelationId relId);
 #endif
 void   CloseConn(void* conn);
+void   SetWriteOpts(void* conn, WriteOpts* write);
 uint64 GetCount(void* conn);
-void*  GetIter(void* conn);
-void   DelIter(void* it);
+void*  GetIter(void* conn, ScanBounds* bounds);
+void*  GetKeysIter(void* conn, char* keys, size_t keysLen);
+void*  GetSampleIter(void* conn, uint64 sampleSize, uint64* rowCount);
+void   DelIter(void* iter);
 bool   BatchRead(void* conn, void* iter, char* buf, size_t* bufLen);
+char*  BatchLargeRecord(void* iter, size_t* size);
+size_t SplitKeys(void* conn, ScanBounds* bounds, uint32 maxSplits, char* buf);
+bool   AggregateRecords(void* conn, bool estimate, uint32 aggCount,
+                        KVAggregate* aggs, char* buf, size_t* bufLen);
 bool   GetRecord(void* conn, char* key, size_t keyLen, char** val, size_t* valLen);
+void   ReleaseRecord();
 bool   PutRecord(void* conn, char* key, size_t keyLen, char* val, size_t valLen);
+bool   PutRecords(void* conn, char* buf, size_t bufLen);
 bool   DelRecord(void* conn, char* key, size_t keyLen);
+bool   DelRecords(void* conn, char* buf, size_t bufLen);
+bool   DelRange(void* conn, ScanBounds* bounds, uint64* count);
+bool   TruncateTable(void* conn);
+void   GetEngineTickers(uint64* tickers);
+#ifndef VIDARDB
+bool   IngestFile(void* conn, char* path, char* error);
+void*  BeginBulkLoad(char* path, ComparatorOpts* opts, bool sorted);
+BulkLoadStatus BulkLoadPut(void* bulkLoader, char* key, size_t keyLen,
+                           char* val, size_t valLen);
+BulkLoadStatus BulkLoadFinish(void* bulkLoader);
+char*  BulkLoadFile(void* bulkLoader);
+const char* BulkLoadError(void* bulkLoader);
+void   DelBulkLoad(void* bulkLoader);
+#endif
 #ifdef VIDARDB
 void   ParseRangeQueryOptions(RangeQueryOpts* queryOptions, void** range,
                               void** readOptions);
 bool   RangeQueryRead(void* conn, void* range, void** readOptions,
                       size_t* bufLen, void** result);
-void   ParseRangeQueryResult(void* result, char* buf);
+void   ParseRangeQueryResult(void* result, void* readOptions, char* buf);
 void   ClearRangeQueryMeta(void* range, void* readOptions);
 #endif
 
@@ -18,6 +18,8 @@
 #include "ipc/kv_posix.h"
 #include "kv_storage.h"
 #include "fcntl.h"
+#include <signal.h>
+#include <cerrno>
 
 extern "C" {
 #include "postgres.h"
@@ -27,11 +29,119 @@ extern "C" {
 
 
 #define READBATCHPATH     "/KVReadBatch"
+#define MULTIGETPATH      "/KVMultiGet"
+#define ENGINESTATSPERIOD 1000000000  /* nanoseconds between copies */
 #ifdef VIDARDB
 #define RANGEQUERYPATH    "/KVRangeQuery"
 #endif
 
 static const char* WORKER = "Worker";
+static const char* IDLEWORKER = "IdleWorker";
+
+
+/*
+ * Map the shared memory of a cursor, which is created (or enlarged) by the
+ * worker and only attached by the backend. The worker maps it on a thread of
+ * the pool, where ereport(ERROR) cannot unwind, so a failure returns nullptr
+ * and leaves its cause in error of KVERRORSIZE bytes.
+ */
+static char* TryMapCursorShm(const char* name, uint64 size, bool create,
+                             char* error) {
+    int fd = shm_open(name, create ? O_CREAT | O_RDWR : O_RDWR, 0777);
+    if (fd == -1) {
+        snprintf(error, KVERRORSIZE, "could not open \"%s\": %m", name);
+        return nullptr;
+    }
+    if (create && ftruncate(fd, size) == -1) {
+        snprintf(error, KVERRORSIZE, "could not resize \"%s\" to %lu bytes: %m",
+                 name, size);
+        close(fd);
+        return nullptr;
+    }
+    void* shm = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (shm == MAP_FAILED) {
+        snprintf(error, KVERRORSIZE, "could not map \"%s\" of %lu bytes: %m",
+                 name, size);
+        close(fd);
+        return nullptr;
+    }
+    close(fd);
+    return static_cast<char*>(shm);
+}
+
+/* the backend maps the cursors it reads in its main thread */
+static char* MapCursorShm(const char* name, uint64 size, bool create) {
+    char error[KVERRORSIZE];
+    char* shm = TryMapCursorShm(name, size, create, error);
+    if (shm == nullptr) {
+        ereport(ERROR, errmsg("%s failed: %s", __func__, error));
+    }
+    return shm;
+}
+
+/*
+ * Nobody waits for the release of a cursor on the pool, so its failure is
+ * only logged to stderr where the worker cannot ereport. The segment is not
+ * created yet if its mapping failed on open.
+ */
+static void ReleaseCursorShm(const char* name, char* shm, uint64 size) {
+    if (name != nullptr && shm_unlink(name) == -1 && errno != ENOENT) {
+        fprintf(stderr, "could not unlink \"%s\": %m\n", name);
+    }
+    if (shm != nullptr && munmap(shm, size) == -1) {
+        fprintf(stderr, "could not unmap \"%s\": %m\n",
+                name != nullptr ? name : "cursor");
+    }
+}
+
+
+/*
+ * Scan bounds are passed as [uint64 startLen][start][uint64 limitLen][limit]
+ * [bool limitInclusive][bool reverse], the keys point to the entity.
+ */
+static char* ReadScanBounds(char* current, ScanBounds* bounds) {
+    bounds->startLen = *reinterpret_cast<uint64*>(current);
+    current += sizeof(bounds->startLen);
+    bounds->start = current;
+    current += bounds->startLen;
+
+    bounds->limitLen = *reinterpret_cast<uint64*>(current);
+    current += sizeof(bounds->limitLen);
+    bounds->limit = current;
+    current += bounds->limitLen;
+
+    bounds->limitInclusive = *reinterpret_cast<bool*>(current);
+    current += sizeof(bounds->limitInclusive);
+    bounds->reverse = *reinterpret_cast<bool*>(current);
+    current += sizeof(bounds->reverse);
+    return current;
+}
+
+static void WriteScanBounds(KVChannel* channel, uint64* offset,
+                            ScanBounds* bounds) {
+    channel->Push(offset, reinterpret_cast<char*>(&bounds->startLen),
+                  sizeof(bounds->startLen));
+    if (bounds->startLen > 0) {
+        channel->Push(offset, bounds->start, bounds->startLen);
+    }
+
+    channel->Push(offset, reinterpret_cast<char*>(&bounds->limitLen),
+                  sizeof(bounds->limitLen));
+    if (bounds->limitLen > 0) {
+        channel->Push(offset, bounds->limit, bounds->limitLen);
+    }
+
+    channel->Push(offset, reinterpret_cast<char*>(&bounds->limitInclusive),
+                  sizeof(bounds->limitInclusive));
+    channel->Push(offset, reinterpret_cast<char*>(&bounds->reverse),
+                  sizeof(bounds->reverse));
+}
+
+static uint64 ScanBoundsSize(ScanBounds* bounds) {
+    return sizeof(bounds->startLen) + bounds->startLen +
+           sizeof(bounds->limitLen) + bounds->limitLen +
+           sizeof(bounds->limitInclusive) + sizeof(bounds->reverse);
+}
 
 
 /*
@@ -40,27 +150,49 @@ static const char* WORKER = "Worker";
 
 KVWorker::KVWorker(KVWorkerId workerId, KVDatabaseId dbId) {
     running_ = false;
-    conn_ = nullptr;
-    ref_ = 0;
     queue_ = new KVMessageQueue(workerId, WORKER, true);
+    stats_ = AttachKVStats(workerId, dbId);
+    queue_->SetStats(stats_);
 }
 
 KVWorker::~KVWorker() {
-    if (conn_) {
-        CloseConn(conn_);
+    for (auto& it : conns_) {
+        CloseConn(it.second.conn);
     }
     delete queue_;
+    DetachKVStats(stats_);
 }
 
 void KVWorker::Start() {
     running_ = true;
+
+    for (int i = 0; i < KVWorkerThreads; i++) {
+        tasks_.push_back(new KVTaskQueue());
+    }
+    for (int i = 0; i < KVWorkerThreads; i++) {
+        threads_.push_back(thread(&KVWorker::RunThread, this, tasks_[i]));
+    }
 }
 
+/*
+ * The main loop only dispatches. Messages touching the connection itself are
+ * processed inline, the others are processed by the threads if any. Messages
+ * of a backend always go to the same thread to keep their order, e.g. a load
+ * without response must be done before the following get of that backend.
+ * The statistics of the engine are copied in between, at most once a period.
+ */
 void KVWorker::Run() {
     while (running_) {
         KVMessage msg;
         queue_->Recv(msg, MSGHEADER);
 
+        uint64 start = KVNow();
+        KVStatsServing(msg.hdr.op);
+        if (stats_ != nullptr && start - engineTime_ > ENGINESTATSPERIOD) {
+            CopyEngineStats();
+            engineTime_ = start;
+        }
+
         switch (msg.hdr.op) {
             case KVOpDummy:
                 break;
@@ -70,41 +202,201 @@ void KVWorker::Run() {
             case KVOpClose:
                 Close(msg);
                 break;
+            #ifndef VIDARDB
+            case KVOpDrop:
+                Drop(msg);
+                break;
+            #endif
             case KVOpCount:
                 Count(msg);
                 break;
             case KVOpPut:
-                Put(msg);
-                break;
+            case KVOpPutBatch:
             case KVOpGet:
-                Get(msg);
-                break;
             case KVOpDel:
-                Delete(msg);
-                break;
+            case KVOpDelBatch:
+            case KVOpDelRange:
+            case KVOpTruncate:
             case KVOpLoad:
-                Load(msg);
-                break;
+            case KVOpSync:
             case KVOpReadBatch:
-                ReadBatch(msg);
-                break;
+            case KVOpMultiGet:
+            case KVOpSample:
+            case KVOpSplit:
+            case KVOpAggregate:
             case KVOpDelCursor:
-                CloseCursor(msg);
-                break;
             #ifdef VIDARDB
             case KVOpRangeQuery:
-                RangeQuery(msg);
-                break;
             case KVOpClearRangeQuery:
-                ClearRangeQuery(msg);
-                break;
+            #else
+            case KVOpIngest:
             #endif
+                /* fetch the entity to free the request channel as soon as possible */
+                if (msg.hdr.largeSize > 0) {
+                    /* read in place, the backend waits for the response */
+                    msg.ety = queue_->LargeEntity(msg);
+                    queue_->Recv(msg, MSGDISCARD);
+                } else if (msg.hdr.etySize == 0) {
+                    /* the channel would wait for an entity of the next one */
+                    msg.ety = nullptr;
+                    queue_->Recv(msg, MSGDISCARD);
+                } else {
+                    if (threads_.empty()) {
+                        if (entity_.size() < msg.hdr.etySize) {
+                            entity_.resize(msg.hdr.etySize);
+                        }
+                        msg.ety = entity_.data();
+                    } else {
+                        msg.ety = malloc(msg.hdr.etySize);
+                    }
+                    msg.readFunc = CommonReadEntity;
+                    queue_->Recv(msg, MSGENTITY);
+                }
+
+                /* counted by Process instead */
+                if (threads_.empty()) {
+                    Process(msg);
+                } else {
+                    Submit(msg);
+                }
+                continue;
             case KVOpTerminate:
                 Terminate(msg);
                 break;
             default:
+                /* release the record, or it is read again by the next Recv */
+                queue_->Recv(msg, MSGDISCARD);
                 ereport(WARNING, errmsg("invalid operation: %d", msg.hdr.op));
         }
+
+        KVStatsServed(stats_, msg.hdr, start);
+    }
+
+    /* answer all the accepted requests before the connection is closed */
+    for (auto queue : tasks_) {
+        unique_lock<mutex> lock(queue->mtx);
+        queue->stop = true;
+        queue->cond.notify_one();
+    }
+    for (auto& thr : threads_) {
+        thr.join();
+    }
+    for (auto queue : tasks_) {
+        delete queue;
+    }
+    threads_.clear();
+    tasks_.clear();
+}
+
+/*
+ * Process a message whose entity has been fetched. It might run in a thread of
+ * the pool, so neither palloc nor ereport(ERROR) is allowed. A failure there
+ * is answered by a FailureMessage, whose entity is the cause if any.
+ */
+void KVWorker::Process(KVMessage& msg) {
+    uint64 start = KVNow();
+    KVStatsServing(msg.hdr.op);
+
+    switch (msg.hdr.op) {
+        case KVOpPut:
+            Put(msg);
+            break;
+        case KVOpPutBatch:
+            PutBatch(msg);
+            break;
+        case KVOpGet:
+            Get(msg);
+            break;
+        case KVOpDel:
+            Delete(msg);
+            break;
+        case KVOpDelBatch:
+            DeleteBatch(msg);
+            break;
+        case KVOpDelRange:
+            DeleteRange(msg);
+            break;
+        case KVOpTruncate:
+            Truncate(msg);
+            break;
+        case KVOpLoad:
+            Load(msg);
+            break;
+        case KVOpSync:
+            Sync(msg);
+            break;
+        case KVOpReadBatch:
+            ReadBatch(msg);
+            break;
+        case KVOpMultiGet:
+            MultiGet(msg);
+            break;
+        case KVOpSample:
+            Sample(msg);
+            break;
+        case KVOpSplit:
+            Split(msg);
+            break;
+        case KVOpAggregate:
+            Aggregate(msg);
+            break;
+        case KVOpDelCursor:
+            CloseCursor(msg);
+            break;
+        #ifdef VIDARDB
+        case KVOpRangeQuery:
+            RangeQuery(msg);
+            break;
+        case KVOpClearRangeQuery:
+            ClearRangeQuery(msg);
+            break;
+        #else
+        case KVOpIngest:
+            Ingest(msg);
+            break;
+        #endif
+        default:
+            break;
+    }
+
+    KVStatsServed(stats_, msg.hdr, start);
+    if (msg.hdr.largeSize == 0 && msg.ety != entity_.data()) {
+        free(msg.ety);
+    }
+}
+
+void KVWorker::CopyEngineStats() {
+    uint64 tickers[KVEngineTickers];
+    GetEngineTickers(tickers);
+
+    for (int i = 0; i < KVEngineTickers; i++) {
+        stats_->engine[i].store(tickers[i], memory_order_relaxed);
+    }
+}
+
+void KVWorker::Submit(KVMessage& msg) {
+    KVTaskQueue* queue = tasks_[msg.hdr.pid % tasks_.size()];
+
+    unique_lock<mutex> lock(queue->mtx);
+    queue->tasks.push_back(msg);
+    queue->cond.notify_one();
+}
+
+void KVWorker::RunThread(KVTaskQueue* queue) {
+    while (true) {
+        unique_lock<mutex> lock(queue->mtx);
+        queue->cond.wait(lock, [queue] {
+            return queue->stop || !queue->tasks.empty();
+        });
+        if (queue->tasks.empty()) {
+            return; /* stopped and drained */
+        }
+
+        KVMessage msg = queue->tasks.front();
+        queue->tasks.pop_front();
+        lock.unlock();
+
+        Process(msg);
     }
 }
 
@@ -119,8 +411,14 @@ void KVWorker::ReadOpenArgs(KVChannel* channel, uint64* offset, void* entity,
     uint64 delta = sizeof(args->opts);
 
     channel->Pop(offset, reinterpret_cast<char*>(&args->opts), delta);
+    uint64 len = sizeof(args->engine);
+    channel->Pop(offset, reinterpret_cast<char*>(&args->engine), len);
+    delta += len;
+    len = sizeof(args->write);
+    channel->Pop(offset, reinterpret_cast<char*>(&args->write), len);
+    delta += len;
     #ifdef VIDARDB
-    uint64 len = sizeof(args->useColumn);
+    len = sizeof(args->useColumn);
     channel->Pop(offset, reinterpret_cast<char*>(&args->useColumn), len);
     delta += len;
     len = sizeof(args->attrCount);
@@ -130,6 +428,13 @@ void KVWorker::ReadOpenArgs(KVChannel* channel, uint64* offset, void* entity,
     channel->Pop(offset, args->path, size - delta);
 }
 
+/* connections are only opened and closed by the main loop */
+void* KVWorker::GetConn(KVRelationId relId) {
+    lock_guard<mutex> lock(connMutex_);
+    auto it = conns_.find(relId);
+    return it == conns_.end() ? nullptr : it->second.conn;
+}
+
 void KVWorker::Open(KVMessage& msg) {
     OpenArgs args;
     args.path = static_cast<char*>(palloc0(msg.hdr.etySize));
@@ -138,30 +443,44 @@ void KVWorker::Open(KVMessage& msg) {
     msg.readFunc = ReadOpenArgs;
     queue_->Recv(msg, MSGENTITY);
 
-    if (!conn_) {
+    KVRelationId relId = msg.hdr.relId;
+    if (!GetConn(relId)) {
         #ifdef VIDARDB
-        conn_ = OpenConn(args.path, args.useColumn, args.attrCount, &args.opts);
+        void* conn = OpenConn(args.path, args.useColumn, args.attrCount,
+                              &args.opts, &args.engine);
         #else
-        conn_ = OpenConn(args.path, &args.opts);
+        void* conn = KVSharedStorage ?
+                     OpenSharedConn(args.path, relId, &args.opts, &args.engine) :
+                     OpenConn(args.path, &args.opts, &args.engine);
         #endif
+        SetWriteOpts(conn, &args.write);
+        lock_guard<mutex> lock(connMutex_);
+        conns_[relId].conn = conn;
+    }
+
+    {
+        lock_guard<mutex> lock(connMutex_);
+        conns_[relId].ref++;
     }
-    ref_++;
 
     pfree(args.path);
+    ClearWriteErrors();
 }
 
 void KVWorker::Close(KVMessage& msg) {
     queue_->Recv(msg, MSGDISCARD);
 
-    if (conn_) {
-        ref_--;
+    lock_guard<mutex> lock(connMutex_);
+    auto it = conns_.find(msg.hdr.relId);
+    if (it != conns_.end() && it->second.ref > 0) {
+        it->second.ref--;
     }
 }
 
 void KVWorker::Count(KVMessage& msg) {
     queue_->Recv(msg, MSGDISCARD);
 
-    uint64 count = GetCount(conn_);
+    uint64 count = GetCount(GetConn(msg.hdr.relId));
 
     KVMessage sendmsg;
     sendmsg.ety = &count;
@@ -173,31 +492,38 @@ void KVWorker::Count(KVMessage& msg) {
 }
 
 void KVWorker::Put(KVMessage& msg) {
-    msg.ety = palloc0(msg.hdr.etySize);
-    msg.readFunc = CommonReadEntity;
-    queue_->Recv(msg, MSGENTITY);
-
     PutArgs args;
     args.keyLen = *static_cast<uint64*>(msg.ety);
     args.valLen = msg.hdr.etySize - args.keyLen - sizeof(args.keyLen);
     args.key = static_cast<char*>(msg.ety) + sizeof(args.keyLen);
     args.val = static_cast<char*>(msg.ety) + sizeof(args.keyLen) + args.keyLen;
 
-    bool success = PutRecord(conn_, args.key, args.keyLen, args.val, args.valLen);
+    bool success = PutRecord(GetConn(msg.hdr.relId), args.key, args.keyLen, args.val, args.valLen);
+    KVStatsWritten(stats_, msg.hdr.relId);
     queue_->Send(success ? SuccessMessage(msg.hdr.rpsId) :
                            FailureMessage(msg.hdr.rpsId));
+}
 
-    pfree(msg.ety);
+void KVWorker::PutBatch(KVMessage& msg) {
+    bool success = PutRecords(GetConn(msg.hdr.relId),
+                              static_cast<char*>(msg.ety), msg.hdr.etySize);
+    KVStatsWritten(stats_, msg.hdr.relId);
+    if (msg.hdr.rpsId == 0) { /* pipelined */
+        if (!success) {
+            AddWriteError(msg.hdr);
+        }
+        return;
+    }
+
+    queue_->Send(success ? SuccessMessage(msg.hdr.rpsId) :
+                           FailureMessage(msg.hdr.rpsId));
 }
 
 void KVWorker::Get(KVMessage& msg) {
-    msg.ety = palloc0(msg.hdr.etySize);
-    msg.readFunc = CommonReadEntity;
-    queue_->Recv(msg, MSGENTITY);
-
     char*  val = nullptr;
     uint64 valLen;
-    bool success = GetRecord(conn_, static_cast<char*>(msg.ety), msg.hdr.etySize,
+    bool success = GetRecord(GetConn(msg.hdr.relId), static_cast<char*>(msg.ety),
+                             msg.hdr.etySize,
                              &val, &valLen);
     if (success) {
         KVMessage sendmsg = SuccessMessage(msg.hdr.rpsId);
@@ -205,40 +531,131 @@ void KVWorker::Get(KVMessage& msg) {
         sendmsg.ety = val;
         sendmsg.writeFunc = CommonWriteEntity;
         queue_->Send(sendmsg);
-        pfree(val);
     } else {
         queue_->Send(FailureMessage(msg.hdr.rpsId));
     }
-
-    pfree(msg.ety);
+    ReleaseRecord();
 }
 
 void KVWorker::Delete(KVMessage& msg) {
-    msg.ety = palloc0(msg.hdr.etySize);
-    msg.readFunc = CommonReadEntity;
-    queue_->Recv(msg, MSGENTITY);
+    bool success = DelRecord(GetConn(msg.hdr.relId), static_cast<char*>(msg.ety),
+                             msg.hdr.etySize);
+    KVStatsWritten(stats_, msg.hdr.relId);
+    queue_->Send(success ? SuccessMessage(msg.hdr.rpsId) :
+                           FailureMessage(msg.hdr.rpsId));
+}
+
+void KVWorker::DeleteBatch(KVMessage& msg) {
+    bool success = DelRecords(GetConn(msg.hdr.relId),
+                              static_cast<char*>(msg.ety), msg.hdr.etySize);
+    KVStatsWritten(stats_, msg.hdr.relId);
+    if (msg.hdr.rpsId == 0) { /* pipelined */
+        if (!success) {
+            AddWriteError(msg.hdr);
+        }
+        return;
+    }
 
-    bool success = DelRecord(conn_, static_cast<char*>(msg.ety), msg.hdr.etySize);
     queue_->Send(success ? SuccessMessage(msg.hdr.rpsId) :
                            FailureMessage(msg.hdr.rpsId));
+}
+
+void KVWorker::DeleteRange(KVMessage& msg) {
+    ScanBounds bounds;
+    ReadScanBounds(static_cast<char*>(msg.ety), &bounds);
+
+    uint64 count = 0;
+    bool success = DelRange(GetConn(msg.hdr.relId), &bounds, &count);
+    KVStatsWritten(stats_, msg.hdr.relId);
+    if (!success) {
+        queue_->Send(FailureMessage(msg.hdr.rpsId));
+        return;
+    }
 
-    pfree(msg.ety);
+    KVMessage sendmsg = SuccessMessage(msg.hdr.rpsId);
+    sendmsg.ety = &count;
+    sendmsg.hdr.etySize = sizeof(count);
+    sendmsg.writeFunc = CommonWriteEntity;
+    queue_->Send(sendmsg);
 }
 
-void KVWorker::Load(KVMessage& msg) {
-    msg.ety = palloc0(msg.hdr.etySize);
-    msg.readFunc = CommonReadEntity;
-    queue_->Recv(msg, MSGENTITY);
+void KVWorker::Truncate(KVMessage& msg) {
+    bool success = TruncateTable(GetConn(msg.hdr.relId));
+    KVStatsWritten(stats_, msg.hdr.relId);
+    queue_->Send(success ? SuccessMessage(msg.hdr.rpsId) :
+                           FailureMessage(msg.hdr.rpsId));
+}
 
+void KVWorker::Load(KVMessage& msg) {
     PutArgs args;
     args.keyLen = *static_cast<uint64*>(msg.ety);
     args.valLen = msg.hdr.etySize - args.keyLen - sizeof(args.keyLen);
     args.key = static_cast<char*>(msg.ety) + sizeof(args.keyLen);
     args.val = static_cast<char*>(msg.ety) + sizeof(args.keyLen) + args.keyLen;
 
-    PutRecord(conn_, args.key, args.keyLen, args.val, args.valLen);
+    if (!PutRecord(GetConn(msg.hdr.relId), args.key, args.keyLen, args.val,
+                   args.valLen)) {
+        AddWriteError(msg.hdr);
+    }
+    KVStatsWritten(stats_, msg.hdr.relId);
+
+    /* a large load holds a response channel, see KVWorkerClient::Load */
+    if (msg.hdr.rpsId > 0) {
+        queue_->Send(SuccessMessage(msg.hdr.rpsId));
+    }
+}
+
+static uint64 WriteErrorKey(const KVMessageHeader& hdr) {
+    return (static_cast<uint64>(hdr.pid) << 32) | hdr.relId;
+}
+
+void KVWorker::AddWriteError(const KVMessageHeader& hdr) {
+    lock_guard<mutex> lock(errorMutex_);
+    writeErrors_[WriteErrorKey(hdr)]++;
+}
+
+/*
+ * Forget the failed writes of the backends which exited and never sync, e.g.
+ * after a failed statement. A pid is only reused once its backend is gone, so
+ * the entries of a live backend are kept for its next sync.
+ */
+void KVWorker::ClearWriteErrors() {
+    lock_guard<mutex> lock(errorMutex_);
+    for (auto it = writeErrors_.begin(); it != writeErrors_.end();) {
+        pid_t pid = static_cast<pid_t>(it->first >> 32);
+        if (kill(pid, 0) != 0 && errno == ESRCH) {
+            it = writeErrors_.erase(it);
+        } else {
+            it++;
+        }
+    }
+}
+
+/*
+ * Answer and forget the failed writes of the backend, which are all served
+ * before since the requests of a backend are served in order. A sync without
+ * a response channel only forgets them, as a modify begins.
+ */
+void KVWorker::Sync(KVMessage& msg) {
+    uint64 errors = 0;
+    {
+        lock_guard<mutex> lock(errorMutex_);
+        auto it = writeErrors_.find(WriteErrorKey(msg.hdr));
+        if (it != writeErrors_.end()) {
+            errors = it->second;
+            writeErrors_.erase(it);
+        }
+    }
+
+    if (msg.hdr.rpsId == 0) {
+        return;
+    }
 
-    pfree(msg.ety);
+    KVMessage sendmsg = SuccessMessage(msg.hdr.rpsId);
+    sendmsg.ety = &errors;
+    sendmsg.hdr.etySize = sizeof(errors);
+    sendmsg.writeFunc = CommonWriteEntity;
+    queue_->Send(sendmsg);
 }
 
 void KVWorker::WriteReadBatchState(KVChannel* channel, uint64* offset,
@@ -249,81 +666,288 @@ void KVWorker::WriteReadBatchState(KVChannel* channel, uint64* offset,
                   sizeof(state->next));
     channel->Push(offset, reinterpret_cast<char*>(&state->size),
                   sizeof(state->size));
-    /* why this does not work? */
-//    channel->Push(offset, reinterpret_cast<char*>(state), sizeof(*state));
+    channel->Push(offset, reinterpret_cast<char*>(&state->capacity),
+                  sizeof(state->capacity));
+    channel->Push(offset, reinterpret_cast<char*>(&state->offset),
+                  sizeof(state->offset));
+    channel->Push(offset, reinterpret_cast<char*>(&state->rows),
+                  sizeof(state->rows));
+    if (state->record != nullptr) {
+        channel->Push(offset, state->record, state->size);
+    }
 }
 
 void KVWorker::ReadBatch(KVMessage& msg) {
-    msg.ety = palloc0(msg.hdr.etySize);
-    msg.readFunc = CommonReadEntity;
-    queue_->Recv(msg, MSGENTITY);
-
     KVCursorKey key;
-    key.pid = *static_cast<pid_t*>(msg.ety);
-    key.opid =
-        *reinterpret_cast<KVOpId*>(static_cast<char*>(msg.ety) + sizeof(key.pid));
+    char* current = static_cast<char*>(msg.ety);
+    key.pid = *reinterpret_cast<pid_t*>(current);
+    current += sizeof(key.pid);
+    key.opid = *reinterpret_cast<KVOpId*>(current);
+    current += sizeof(key.opid);
 
-    void* cursor = nullptr;
-    auto it = cursors_.find(key);
-    if (it == cursors_.end()) {
-        cursor = GetIter(conn_);
-        cursors_.insert({key, cursor});
-    } else {
-        cursor = it->second;
+    /*
+     * Only the map itself is shared by threads, a cursor is always used by the
+     * thread its backend is bound to, and references survive rehashing.
+     */
+    KVCursorEntry* entry = nullptr;
+    {
+        lock_guard<mutex> lock(cursorMutex_);
+        auto it = cursors_.find(key);
+        if (it != cursors_.end()) {
+            entry = &it->second;
+        }
+    }
+
+    if (entry == nullptr) {
+        /* the bounds come with the first batch, and are copied by GetIter */
+        ScanBounds bounds;
+        ScanBounds* scanBounds = nullptr;
+        if (current < static_cast<char*>(msg.ety) + msg.hdr.etySize) {
+            ReadScanBounds(current, &bounds);
+            scanBounds = &bounds;
+        }
+
+        void* iter = GetIter(GetConn(msg.hdr.relId), scanBounds);
+        char error[KVERRORSIZE];
+        entry = AddCursor(msg, key, iter, error);
+        if (entry == nullptr) {
+            DelIter(iter);
+            SendFailure(msg, error);
+            return;
+        }
     }
 
+    SendBatch(msg, entry);
+}
+
+/* returns nullptr if the shared memory cannot be mapped, iter is not taken */
+KVWorker::KVCursorEntry* KVWorker::AddCursor(KVMessage& msg,
+                                             const KVCursorKey& key,
+                                             void* iter, char* error) {
     char name[MAXPATHLENGTH];
     snprintf(name, MAXPATHLENGTH, "%s%d%d%lu", READBATCHPATH, key.pid,
              msg.hdr.relId, key.opid);
-    ShmUnlink(name, __func__);
-    int fd = ShmOpen(name, O_CREAT | O_RDWR, 0777, __func__);
-    Ftruncate(fd, READBATCHSIZE, __func__);
-    char* shm = (char*) Mmap(nullptr, READBATCHSIZE, PROT_READ | PROT_WRITE,
-                             MAP_SHARED, fd, 0, __func__);
-    Fclose(fd, __func__);
 
-    ReadBatchState state;
-    state.next = BatchRead(conn_, cursor, shm, &state.size);
+    KVCursorEntry cursor;
+    cursor.conn = GetConn(msg.hdr.relId);
+    cursor.iter = iter;
+    cursor.shm = TryMapCursorShm(name, READBATCHSIZE * READBATCHSLOTS, true,
+                                 error);
+    if (cursor.shm == nullptr) {
+        ReleaseCursorShm(name, nullptr, 0);
+        return nullptr;
+    }
+
+    lock_guard<mutex> lock(cursorMutex_);
+    return &cursors_.insert({key, cursor}).first->second;
+}
+
+/*
+ * Answer a request which failed on a thread of the pool with the cause, and
+ * the backend raises it, since the thread cannot.
+ */
+void KVWorker::SendFailure(KVMessage& msg, const char* error) {
+    KVMessage sendmsg = FailureMessage(msg.hdr.rpsId);
+    sendmsg.ety = const_cast<char*>(error);
+    sendmsg.hdr.etySize = strlen(error) + 1;
+    sendmsg.writeFunc = CommonWriteEntity;
+    queue_->Send(sendmsg);
+}
+
+/*
+ * A multi get is a cursor whose iterator looks up the given keys instead of
+ * scanning, so the rest batches are read by ReadBatch and it is closed by
+ * CloseCursor. The keys are passed in a shared memory created by the backend
+ * since they might not fit into the request channel.
+ */
+void KVWorker::MultiGet(KVMessage& msg) {
+    KVCursorKey key;
+    char* current = static_cast<char*>(msg.ety);
+    key.pid = *reinterpret_cast<pid_t*>(current);
+    current += sizeof(key.pid);
+    key.opid = *reinterpret_cast<KVOpId*>(current);
+    current += sizeof(key.opid);
+    uint64 keysLen = *reinterpret_cast<uint64*>(current);
 
-    Munmap(shm, READBATCHSIZE, __func__); /* Is it safe to unmap here? */
+    char name[MAXPATHLENGTH];
+    snprintf(name, MAXPATHLENGTH, "%s%d%d%lu", MULTIGETPATH, key.pid,
+             msg.hdr.relId, key.opid);
+    char error[KVERRORSIZE];
+    char* keys = TryMapCursorShm(name, keysLen, false, error);
+    if (keys == nullptr) {
+        SendFailure(msg, error);
+        return;
+    }
+
+    void* iter = GetKeysIter(GetConn(msg.hdr.relId), keys, keysLen);
+    ReleaseCursorShm(nullptr, keys, keysLen);
+
+    KVCursorEntry* entry = AddCursor(msg, key, iter, error);
+    if (entry == nullptr) {
+        DelIter(iter);
+        SendFailure(msg, error);
+        return;
+    }
+    SendBatch(msg, entry);
+}
+
+void KVWorker::Split(KVMessage& msg) {
+    char* current = static_cast<char*>(msg.ety);
+    uint32 maxSplits = *reinterpret_cast<uint32*>(current);
+    current += sizeof(maxSplits);
+    ScanBounds bounds;
+    ReadScanBounds(current, &bounds);
+
+    char buf[SPLITKEYSSIZE];
+    KVMessage sendmsg = SuccessMessage(msg.hdr.rpsId);
+    sendmsg.hdr.etySize = SplitKeys(GetConn(msg.hdr.relId), &bounds, maxSplits,
+                                    buf);
+    sendmsg.ety = buf;
+    sendmsg.writeFunc = CommonWriteEntity;
+    queue_->Send(sendmsg);
+}
+
+void KVWorker::Aggregate(KVMessage& msg) {
+    char* current = static_cast<char*>(msg.ety);
+    uint32 aggCount = *reinterpret_cast<uint32*>(current);
+    current += sizeof(aggCount);
+    KVAggregate* aggs = reinterpret_cast<KVAggregate*>(current);
+    current += aggCount * sizeof(KVAggregate);
+    bool estimate = *reinterpret_cast<bool*>(current);
+
+    char buf[AGGREGATESIZE];
+    size_t bufLen = 0;
+    if (!AggregateRecords(GetConn(msg.hdr.relId), estimate, aggCount, aggs, buf,
+                          &bufLen)) {
+        queue_->Send(FailureMessage(msg.hdr.rpsId));
+        return;
+    }
+
+    KVMessage sendmsg = SuccessMessage(msg.hdr.rpsId);
+    sendmsg.hdr.etySize = bufLen;
+    sendmsg.ety = buf;
+    sendmsg.writeFunc = CommonWriteEntity;
+    queue_->Send(sendmsg);
+}
+
+/* a sample is a cursor too, whose records are drawn before the first batch */
+void KVWorker::Sample(KVMessage& msg) {
+    KVCursorKey key;
+    char* current = static_cast<char*>(msg.ety);
+    key.pid = *reinterpret_cast<pid_t*>(current);
+    current += sizeof(key.pid);
+    key.opid = *reinterpret_cast<KVOpId*>(current);
+    current += sizeof(key.opid);
+    uint64 sampleSize = *reinterpret_cast<uint64*>(current);
+
+    uint64 rowCount = 0;
+    void* iter = GetSampleIter(GetConn(msg.hdr.relId), sampleSize, &rowCount);
+    char error[KVERRORSIZE];
+    KVCursorEntry* entry = AddCursor(msg, key, iter, error);
+    if (entry == nullptr) {
+        DelIter(iter);
+        SendFailure(msg, error);
+        return;
+    }
+    entry->rows = rowCount;
+    SendBatch(msg, entry);
+}
+
+void KVWorker::SendBatch(KVMessage& msg, KVCursorEntry* entry) {
+    /* nothing read ahead, e.g. the first batch, so read it synchronously */
+    if (entry->filled == 0) {
+        FillBatch(entry);
+    }
+
+    ReadBatchState state;
+    state.record = nullptr;
+    if (entry->filled > 0) {
+        state.offset = entry->head * READBATCHSIZE;
+        state.size = entry->sizes[entry->head];
+        /* the large record is always the last filled slot */
+        if (entry->large && entry->filled == 1) {
+            size_t size = 0;
+            state.record = BatchLargeRecord(entry->iter, &size);
+            entry->large = false;
+        }
+        entry->head = (entry->head + 1) % READBATCHSLOTS;
+        entry->filled--;
+    } else {
+        state.offset = 0;
+        state.size = 0;
+    }
+    state.next = entry->more || entry->filled > 0;
+    state.capacity = READBATCHSIZE * READBATCHSLOTS;
+    state.rows = entry->rows;
 
     KVMessage sendmsg = SuccessMessage(msg.hdr.rpsId);
-    sendmsg.hdr.etySize = sizeof(state);
+    sendmsg.hdr.etySize = sizeof(state.next) + sizeof(state.size) +
+                          sizeof(state.capacity) + sizeof(state.offset) +
+                          sizeof(state.rows);
+    if (state.record != nullptr) {
+        sendmsg.hdr.etySize += state.size;
+    }
     sendmsg.ety = &state;
     sendmsg.writeFunc = WriteReadBatchState;
 
     queue_->Send(sendmsg);
+    KVStatsResponded(stats_, state.size);
+
+    /*
+     * The backend is decoding the slot just handed out, fill the free slots
+     * meanwhile. The slot it decoded before is released by this request.
+     */
+    while (entry->more && entry->filled < READBATCHSLOTS - 1) {
+        FillBatch(entry);
+    }
+}
+
+/* BatchRead drops the large record, so it waits until the record is sent */
+void KVWorker::FillBatch(KVCursorEntry* entry) {
+    if (!entry->more || entry->large) {
+        return;
+    }
 
-    pfree(msg.ety);
+    uint32 slot = (entry->head + entry->filled) % READBATCHSLOTS;
+    size_t size = 0;
+    entry->more = BatchRead(entry->conn, entry->iter,
+                            entry->shm + slot * READBATCHSIZE, &size);
+    if (size == 0 && BatchLargeRecord(entry->iter, &size) != nullptr) {
+        entry->large = true;
+    }
+    if (size > 0) {
+        entry->sizes[slot] = size;
+        entry->filled++;
+    }
 }
 
 void KVWorker::CloseCursor(KVMessage& msg) {
-    msg.ety = palloc0(msg.hdr.etySize);
-    msg.readFunc = CommonReadEntity;
-    queue_->Recv(msg, MSGENTITY);
-
     KVCursorKey key;
     key.pid = *static_cast<pid_t*>(msg.ety);
     key.opid =
         *reinterpret_cast<KVOpId*>(static_cast<char*>(msg.ety) + sizeof(key.pid));
 
-    auto it = cursors_.find(key);
-    if (it == cursors_.end()) {
-        pfree(msg.ety);
-        return;
+    KVCursorEntry entry;
+    {
+        lock_guard<mutex> lock(cursorMutex_);
+        auto it = cursors_.find(key);
+        if (it == cursors_.end()) {
+            return;
+        }
+        entry = it->second;
+        cursors_.erase(it);
     }
 
-    DelIter(it->second);
-    cursors_.erase(it);
-    pfree(msg.ety);
+    char name[MAXPATHLENGTH];
+    snprintf(name, MAXPATHLENGTH, "%s%d%d%lu", READBATCHPATH, key.pid,
+             msg.hdr.relId, key.opid);
+    ReleaseCursorShm(name, entry.shm, READBATCHSIZE * READBATCHSLOTS);
+
+    DelIter(entry.iter);
 }
 
 #ifdef VIDARDB
 void KVWorker::RangeQuery(KVMessage& msg) {
-    msg.ety = palloc0(msg.hdr.etySize);
-    msg.readFunc = CommonReadEntity;
-    queue_->Recv(msg, MSGENTITY);
-
     KVCursorKey key;
     char* current = static_cast<char*>(msg.ety);
     key.pid = *reinterpret_cast<pid_t*>(current);
@@ -331,16 +955,27 @@ void KVWorker::RangeQuery(KVMessage& msg) {
     key.opid = *reinterpret_cast<KVOpId*>(current);
     current += sizeof(key.opid);
 
-    KVRangeQueryEntry entry;
-    auto it = ranges_.find(key);
-    if (it == ranges_.end()) {
+    char name[MAXPATHLENGTH];
+    snprintf(name, MAXPATHLENGTH, "%s%d%d%lu", RANGEQUERYPATH, key.pid,
+             msg.hdr.relId, key.opid);
+
+    KVRangeQueryEntry* range = nullptr;
+    {
+        lock_guard<mutex> lock(cursorMutex_);
+        auto it = ranges_.find(key);
+        if (it != ranges_.end()) {
+            range = &it->second;
+        }
+    }
+
+    if (range == nullptr) {
         RangeQueryOpts opts;
 
         opts.startLen = *reinterpret_cast<uint64*>(current);
         current += sizeof(opts.startLen);
 
         if (opts.startLen > 0) {
-            opts.start = static_cast<char*>(palloc0(opts.startLen));
+            opts.start = static_cast<char*>(malloc(opts.startLen));
             memcpy(opts.start, current, opts.startLen);
             current += opts.startLen;
         }
@@ -349,7 +984,7 @@ void KVWorker::RangeQuery(KVMessage& msg) {
         current += sizeof(opts.limitLen);
 
         if (opts.limitLen > 0) {
-            opts.limit = static_cast<char*>(palloc0(opts.limitLen));
+            opts.limit = static_cast<char*>(malloc(opts.limitLen));
             memcpy(opts.limit, current, opts.limitLen);
             current += opts.limitLen;
         }
@@ -364,73 +999,165 @@ void KVWorker::RangeQuery(KVMessage& msg) {
             opts.attrs = reinterpret_cast<AttrNumber*>(current);
         }
 
+        KVRangeQueryEntry entry;
+        entry.conn = GetConn(msg.hdr.relId);
         ParseRangeQueryOptions(&opts, &entry.range, &entry.readOpts);
-        ranges_.insert({key, entry});
-    } else {
-        entry = it->second;
-    }
+        entry.capacity = READBATCHSIZE;
+
+        char error[KVERRORSIZE];
+        entry.shm = TryMapCursorShm(name, entry.capacity, true, error);
+        if (entry.shm == nullptr) {
+            ReleaseCursorShm(name, nullptr, 0);
+            ClearRangeQueryMeta(entry.range, entry.readOpts);
+            SendFailure(msg, error);
+            return;
+        }
 
-    void* result = nullptr;
-    ReadBatchState state;
+        lock_guard<mutex> lock(cursorMutex_);
+        range = &ranges_.insert({key, entry}).first->second;
+    }
 
-    do {
-        state.next = RangeQueryRead(conn_, entry.range, &entry.readOpts,
-                                    &state.size, &result);
-    } while (state.next && state.size == 0);
+    /* nothing read ahead, e.g. the first batch, so read it synchronously */
+    if (!range->ready) {
+        FillRangeQuery(range);
+    }
 
-    char name[MAXPATHLENGTH];
-    snprintf(name, MAXPATHLENGTH, "%s%d%d%lu", RANGEQUERYPATH, key.pid,
-             msg.hdr.relId, key.opid);
-    ShmUnlink(name, __func__);
+    ReadBatchState state;
+    state.next = range->next;
+    state.size = range->size;
+    state.offset = 0;
+    state.rows = 0;
+    state.record = nullptr;
+
+    /*
+     * Batch sizes vary with the data, so enlarge the segment by doubling when
+     * a batch does not fit. The backend remaps it when the capacity changes.
+     * If it cannot be enlarged, the batch is dropped and the old segment kept
+     * until the query is cleared.
+     */
+    if (state.size > range->capacity) {
+        uint64 capacity = range->capacity;
+        while (capacity < state.size) {
+            capacity <<= 1;
+        }
 
-    char* shm = nullptr;
-    if (state.size > 0) {
-        int fd = ShmOpen(name, O_CREAT | O_RDWR, 0777, __func__);
-        Ftruncate(fd, state.size, __func__);
-        shm = (char*) Mmap(nullptr, state.size, PROT_READ | PROT_WRITE, MAP_SHARED,
-                           fd, 0, __func__);
-        Fclose(fd, __func__);
+        char error[KVERRORSIZE];
+        char* shm = TryMapCursorShm(name, capacity, true, error);
+        if (shm == nullptr) {
+            ParseRangeQueryResult(range->result, range->readOpts, nullptr);
+            range->result = nullptr;
+            range->ready = false;
+            SendFailure(msg, error);
+            return;
+        }
+        ReleaseCursorShm(nullptr, range->shm, range->capacity);
+        range->shm = shm;
+        range->capacity = capacity;
     }
 
-    ParseRangeQueryResult(result, shm);
-    if (state.size > 0) {
-        Munmap(shm, state.size, __func__);
-    }
+    ParseRangeQueryResult(range->result, range->readOpts, range->shm);
+    range->result = nullptr;
+    range->ready = false;
+    state.capacity = range->capacity;
 
     KVMessage sendmsg = SuccessMessage(msg.hdr.rpsId);
-    sendmsg.hdr.etySize = sizeof(state);
+    sendmsg.hdr.etySize = sizeof(state.next) + sizeof(state.size) +
+                          sizeof(state.capacity) + sizeof(state.offset) +
+                          sizeof(state.rows);
     sendmsg.ety = &state;
     sendmsg.writeFunc = WriteReadBatchState;
 
     queue_->Send(sendmsg);
+    KVStatsResponded(stats_, state.size);
+
+    /*
+     * Query the next batch while the backend decodes this one. It is copied
+     * into the shared memory on the next request, when the backend is done
+     * with the current content.
+     */
+    if (state.next) {
+        FillRangeQuery(range);
+    }
+}
 
-    pfree(msg.ety);
+void KVWorker::FillRangeQuery(KVRangeQueryEntry* entry) {
+    entry->result = nullptr;
+    do {
+        entry->next = RangeQueryRead(entry->conn, entry->range, &entry->readOpts,
+                                     &entry->size, &entry->result);
+    } while (entry->next && entry->size == 0);
+    entry->ready = true;
 }
 
 void KVWorker::ClearRangeQuery(KVMessage& msg) {
-    msg.ety = palloc0(msg.hdr.etySize);
-    msg.readFunc = CommonReadEntity;
-    queue_->Recv(msg, MSGENTITY);
-
     KVCursorKey key;
     key.pid = *static_cast<pid_t*>(msg.ety);
     key.opid =
         *reinterpret_cast<KVOpId*>(static_cast<char*>(msg.ety) + sizeof(key.pid));
 
-    auto it = ranges_.find(key);
-    if (it == ranges_.end()) {
-        pfree(msg.ety);
-        return;
+    KVRangeQueryEntry entry;
+    {
+        lock_guard<mutex> lock(cursorMutex_);
+        auto it = ranges_.find(key);
+        if (it == ranges_.end()) {
+            return;
+        }
+        entry = it->second;
+        ranges_.erase(it);
     }
 
-    ClearRangeQueryMeta(it->second.range, it->second.readOpts);
-    ranges_.erase(it);
-
     char name[MAXPATHLENGTH];
     snprintf(name, MAXPATHLENGTH, "%s%d%d%lu", RANGEQUERYPATH, key.pid,
              msg.hdr.relId, key.opid);
-    ShmUnlink(name, __func__);
-    pfree(msg.ety);
+    ReleaseCursorShm(name, entry.shm, entry.capacity);
+
+    /* drop the batch read ahead but never asked for */
+    if (entry.result) {
+        ParseRangeQueryResult(entry.result, entry.readOpts, nullptr);
+    }
+    ClearRangeQueryMeta(entry.range, entry.readOpts);
+}
+#else
+/* the status of a failure goes back to be raised by the backend */
+void KVWorker::Ingest(KVMessage& msg) {
+    char error[KVERRORSIZE];
+    bool success = IngestFile(GetConn(msg.hdr.relId), static_cast<char*>(msg.ety),
+                              error);
+    KVStatsWritten(stats_, msg.hdr.relId);
+    if (success) {
+        queue_->Send(SuccessMessage(msg.hdr.rpsId));
+        return;
+    }
+
+    SendFailure(msg, error);
+}
+
+/*
+ * Drop the column family of a table from the shared instance. The instance is
+ * still open by the connection of the table if any, which is closed after.
+ */
+void KVWorker::Drop(KVMessage& msg) {
+    char* path = static_cast<char*>(palloc0(msg.hdr.etySize));
+    msg.ety = path;
+    msg.readFunc = CommonReadEntity;
+    queue_->Recv(msg, MSGENTITY);
+
+    KVRelationId relId = msg.hdr.relId;
+    bool success = DropSharedTable(path, relId);
+    KVStatsWritten(stats_, relId);
+
+    void* conn = GetConn(relId);
+    if (conn) {
+        {
+            lock_guard<mutex> lock(connMutex_);
+            conns_.erase(relId);
+        }
+        CloseConn(conn);
+    }
+    pfree(path);
+
+    queue_->Send(success ? SuccessMessage(msg.hdr.rpsId) :
+                           FailureMessage(msg.hdr.rpsId));
 }
 #endif
 
@@ -447,9 +1174,16 @@ void KVWorker::Terminate(KVMessage& msg) {
 
 KVWorkerClient::KVWorkerClient(KVWorkerId workerId) {
     queue_ = new KVMessageQueue(workerId, WORKER, false);
+    workerId_ = workerId;
+    /* the worker has taken its slot before it is ready */
+    stats_ = FindKVStats(workerId);
+    queue_->SetStats(stats_);
 }
 
 KVWorkerClient::~KVWorkerClient() {
+    for (auto it = buffers_.begin(); it != buffers_.end(); ++it) {
+        Munmap(it->second.shm, it->second.capacity, __func__);
+    }
     delete queue_;
 }
 
@@ -459,6 +1193,10 @@ void KVWorkerClient::WriteOpenArgs(KVChannel* channel, uint64* offset,
 
     channel->Push(offset, reinterpret_cast<char*>(&args->opts),
                   sizeof(args->opts));
+    channel->Push(offset, reinterpret_cast<char*>(&args->engine),
+                  sizeof(args->engine));
+    channel->Push(offset, reinterpret_cast<char*>(&args->write),
+                  sizeof(args->write));
     #ifdef VIDARDB
     channel->Push(offset, reinterpret_cast<char*>(&args->useColumn),
                   sizeof(args->useColumn));
@@ -469,7 +1207,8 @@ void KVWorkerClient::WriteOpenArgs(KVChannel* channel, uint64* offset,
 }
 
 void KVWorkerClient::Open(KVWorkerId workerId, OpenArgs* args) {
-    uint64 size = sizeof(args->opts) + strlen(args->path);
+    uint64 size = sizeof(args->opts) + sizeof(args->engine) +
+                  sizeof(args->write) + strlen(args->path);
     #ifdef VIDARDB
     size += sizeof(args->useColumn) + sizeof(args->attrCount);
     #endif
@@ -524,6 +1263,33 @@ bool KVWorkerClient::Put(KVWorkerId workerId, PutArgs* args) {
     return recvmsg.hdr.status == KVStatusSuccess;
 }
 
+/*
+ * A pipelined batch is sent without waiting if it fits into the request
+ * channel, its failure is answered by a sync.
+ */
+bool KVWorkerClient::WriteBatch(KVOperation op, KVWorkerId workerId, char* buf,
+                                uint64 bufLen, bool pipelined) {
+    KVMessage sendmsg = SimpleMessage(op, workerId, MyDatabaseId);
+    sendmsg.ety = buf;
+    sendmsg.hdr.etySize = bufLen;
+    sendmsg.writeFunc = CommonWriteEntity;
+
+    if (pipelined && bufLen <= MSGMAXENTITY) {
+        queue_->Send(sendmsg);
+        return true;
+    }
+
+    KVMessage recvmsg;
+    queue_->SendWithResponse(sendmsg, recvmsg);
+
+    return recvmsg.hdr.status == KVStatusSuccess;
+}
+
+bool KVWorkerClient::PutBatch(KVWorkerId workerId, PutBatchArgs* args) {
+    return WriteBatch(KVOpPutBatch, workerId, args->buf, args->bufLen,
+                      args->pipelined);
+}
+
 bool KVWorkerClient::Get(KVWorkerId workerId, GetArgs* args) {
     KVMessage sendmsg = SimpleMessage(KVOpGet, workerId, MyDatabaseId);
     sendmsg.ety = args->key;
@@ -544,6 +1310,11 @@ bool KVWorkerClient::Get(KVWorkerId workerId, GetArgs* args) {
     queue_->Recv(recvmsg, MSGENTITY);
     queue_->UnleaseResponseChannel(channel);
 
+    /* a missing key fails alone, a value which could not be sent has a cause */
+    if (recvmsg.hdr.status != KVStatusSuccess && recvmsg.hdr.etySize > 0) {
+        ereport(ERROR, errmsg("kv worker failed to get a record: %s",
+                              *(args->val)));
+    }
     return recvmsg.hdr.status == KVStatusSuccess;
 }
 
@@ -559,6 +1330,39 @@ bool KVWorkerClient::Delete(KVWorkerId workerId, DeleteArgs* args) {
     return recvmsg.hdr.status == KVStatusSuccess;
 }
 
+bool KVWorkerClient::DeleteBatch(KVWorkerId workerId, DeleteBatchArgs* args) {
+    return WriteBatch(KVOpDelBatch, workerId, args->buf, args->bufLen,
+                      args->pipelined);
+}
+
+void KVWorkerClient::WriteDeleteRangeArgs(KVChannel* channel, uint64* offset,
+                                          void* entity, uint64 size) {
+    WriteScanBounds(channel, offset, static_cast<ScanBounds*>(entity));
+}
+
+bool KVWorkerClient::DeleteRange(KVWorkerId workerId, DeleteRangeArgs* args) {
+    KVMessage sendmsg = SimpleMessage(KVOpDelRange, workerId, MyDatabaseId);
+    sendmsg.ety = args->bounds;
+    sendmsg.hdr.etySize = ScanBoundsSize(args->bounds);
+    sendmsg.writeFunc = WriteDeleteRangeArgs;
+
+    *(args->count) = 0;
+    KVMessage recvmsg;
+    recvmsg.ety = args->count;
+    recvmsg.readFunc = CommonReadEntity;
+    queue_->SendWithResponse(sendmsg, recvmsg);
+
+    return recvmsg.hdr.status == KVStatusSuccess;
+}
+
+bool KVWorkerClient::Truncate(KVWorkerId workerId) {
+    KVMessage sendmsg = SimpleMessage(KVOpTruncate, workerId, MyDatabaseId);
+    KVMessage recvmsg;
+    queue_->SendWithResponse(sendmsg, recvmsg);
+
+    return recvmsg.hdr.status == KVStatusSuccess;
+}
+
 void KVWorkerClient::Load(KVWorkerId workerId, PutArgs* args) {
     uint64 size = args->keyLen + args->valLen + sizeof(args->keyLen);
 
@@ -567,9 +1371,32 @@ void KVWorkerClient::Load(KVWorkerId workerId, PutArgs* args) {
     sendmsg.hdr.etySize = size;
     sendmsg.writeFunc = WritePutArgs;
 
+    /* a large entity needs a response channel, failed or not, see Sync */
+    if (size > LARGEENTITYSIZE) {
+        KVMessage recvmsg;
+        queue_->SendWithResponse(sendmsg, recvmsg);
+        return;
+    }
+
     queue_->Send(sendmsg);
 }
 
+uint64 KVWorkerClient::Sync(KVWorkerId workerId, bool wait) {
+    KVMessage sendmsg = SimpleMessage(KVOpSync, workerId, MyDatabaseId);
+    if (!wait) {
+        queue_->Send(sendmsg);
+        return 0;
+    }
+
+    uint64 errors = 0;
+    KVMessage recvmsg;
+    recvmsg.ety = &errors;
+    recvmsg.readFunc = CommonReadEntity;
+    queue_->SendWithResponse(sendmsg, recvmsg);
+
+    return errors;
+}
+
 void KVWorkerClient::WriteReadBatchArgs(KVChannel* channel, uint64* offset,
                                         void* entity, uint64 size) {
     ReadBatchArgs* args = static_cast<ReadBatchArgs*>(entity);
@@ -577,47 +1404,220 @@ void KVWorkerClient::WriteReadBatchArgs(KVChannel* channel, uint64* offset,
     pid_t pid = getpid();
     channel->Push(offset, reinterpret_cast<char*>(&pid), sizeof(pid_t));
     channel->Push(offset, reinterpret_cast<char*>(&args->opid), sizeof(args->opid));
-}
 
-bool KVWorkerClient::ReadBatch(KVWorkerId workerId, ReadBatchArgs* args) {
-    if (*(args->buf) != nullptr) {
-        Munmap(*(args->buf), READBATCHSIZE, __func__);
+    if (args->bounds) {
+        WriteScanBounds(channel, offset, args->bounds);
     }
+}
 
-    KVMessage sendmsg = SimpleMessage(KVOpReadBatch, workerId, MyDatabaseId);
-    sendmsg.ety = args;
-    sendmsg.hdr.etySize = sizeof(pid_t) + sizeof(args->opid);
-    sendmsg.writeFunc = WriteReadBatchArgs;
+/*
+ * Receive the state of a batch and locate it in the cursor shared memory,
+ * which is created by the worker in the first batch and kept. A batch of one
+ * record larger than a slot follows the state in the response instead, and is
+ * kept until the next batch of the cursor.
+ */
+bool KVWorkerClient::RecvBatch(KVWorkerId workerId, KVOpId opid,
+                               KVMessage& sendmsg, char** batch,
+                               uint64* batchLen, uint64* rows) {
+    const uint64 stateSize = sizeof(bool) + sizeof(uint64) * 4;
+    char state[stateSize];
+    string large;
 
-    char buf[sizeof(bool) + sizeof(uint64)];
+    uint32 channel = queue_->LeaseResponseChannel();
+    sendmsg.hdr.rpsId = channel;
     KVMessage recvmsg;
+    recvmsg.hdr.rpsId = channel;
+    queue_->Send(sendmsg);
+    queue_->Recv(recvmsg, MSGHEADER);
+
+    char* buf = state;
+    if (recvmsg.hdr.etySize > stateSize) {
+        large.resize(recvmsg.hdr.etySize);
+        buf = &large[0];
+    }
     recvmsg.ety = buf;
     recvmsg.readFunc = CommonReadEntity;
-    queue_->SendWithResponse(sendmsg, recvmsg);
+    queue_->Recv(recvmsg, MSGENTITY);
+    queue_->UnleaseResponseChannel(channel);
 
+    /* the cause is raised here, since the thread of the worker cannot */
     if (recvmsg.hdr.status != KVStatusSuccess) {
-        return false;
+        char cause[KVERRORSIZE];
+        snprintf(cause, KVERRORSIZE, "%s",
+                 recvmsg.hdr.etySize > 0 ? buf : "unknown");
+        string().swap(large);  /* not destroyed by the longjmp */
+        ereport(ERROR, errmsg("kv worker failed to read a batch: %s", cause));
     }
 
     bool next = *reinterpret_cast<bool*>(buf);
-    *(args->bufLen) = *reinterpret_cast<uint64*>(buf + sizeof(next));
-    if (*(args->bufLen) == 0) {
-        *(args->buf) = nullptr;
-    } else {
+    char* current = buf + sizeof(next);
+    *batchLen = *reinterpret_cast<uint64*>(current);
+    current += sizeof(uint64);
+    uint64 capacity = *reinterpret_cast<uint64*>(current);
+    current += sizeof(uint64);
+    uint64 batchOffset = *reinterpret_cast<uint64*>(current);
+    current += sizeof(uint64);
+    if (rows != nullptr) {
+        *rows = *reinterpret_cast<uint64*>(current);
+    }
+
+    auto it = buffers_.find(opid);
+    if (it == buffers_.end()) {
         char  name[MAXPATHLENGTH];
         pid_t pid = getpid();
 
         snprintf(name, MAXPATHLENGTH, "%s%d%d%lu", READBATCHPATH, pid, workerId,
-                 args->opid);
-        int fd = ShmOpen(name, O_RDWR, 0777, __func__);
-        *(args->buf) = (char*) Mmap(nullptr, READBATCHSIZE, PROT_READ | PROT_WRITE,
-                                    MAP_SHARED, fd, 0, __func__);
-        Fclose(fd, __func__);
+                 opid);
+        KVCursorBuffer buffer;
+        buffer.capacity = capacity;
+        buffer.shm = MapCursorShm(name, buffer.capacity, false);
+        it = buffers_.insert({opid, buffer}).first;
+    }
+    if (large.empty()) {
+        *batch = it->second.shm + batchOffset;
+    } else {
+        it->second.large.swap(large);
+        *batch = &it->second.large[stateSize];
+    }
+
+    return next;
+}
+
+bool KVWorkerClient::ReadBatch(KVWorkerId workerId, ReadBatchArgs* args) {
+    KVMessage sendmsg = SimpleMessage(KVOpReadBatch, workerId, MyDatabaseId);
+    sendmsg.ety = args;
+    sendmsg.hdr.etySize = sizeof(pid_t) + sizeof(args->opid);
+    if (args->bounds) {
+        sendmsg.hdr.etySize += ScanBoundsSize(args->bounds);
     }
+    sendmsg.writeFunc = WriteReadBatchArgs;
+
+    return RecvBatch(workerId, args->opid, sendmsg, args->buf, args->bufLen);
+}
+
+void KVWorkerClient::WriteMultiGetArgs(KVChannel* channel, uint64* offset,
+                                       void* entity, uint64 size) {
+    MultiGetArgs* args = static_cast<MultiGetArgs*>(entity);
+
+    pid_t pid = getpid();
+    channel->Push(offset, reinterpret_cast<char*>(&pid), sizeof(pid_t));
+    channel->Push(offset, reinterpret_cast<char*>(&args->opid), sizeof(args->opid));
+    channel->Push(offset, reinterpret_cast<char*>(&args->keysLen),
+                  sizeof(args->keysLen));
+}
+
+bool KVWorkerClient::MultiGet(KVWorkerId workerId, MultiGetArgs* args) {
+    char  name[MAXPATHLENGTH];
+    pid_t pid = getpid();
+
+    /* the keys are only read by the worker before it responds */
+    snprintf(name, MAXPATHLENGTH, "%s%d%d%lu", MULTIGETPATH, pid, workerId,
+             args->opid);
+    char* keys = MapCursorShm(name, args->keysLen, true);
+    memcpy(keys, args->keys, args->keysLen);
+    Munmap(keys, args->keysLen, __func__);
+
+    KVMessage sendmsg = SimpleMessage(KVOpMultiGet, workerId, MyDatabaseId);
+    sendmsg.ety = args;
+    sendmsg.hdr.etySize = sizeof(pid_t) + sizeof(args->opid) +
+                          sizeof(args->keysLen);
+    sendmsg.writeFunc = WriteMultiGetArgs;
+
+    bool next = RecvBatch(workerId, args->opid, sendmsg, args->buf, args->bufLen);
+    ShmUnlink(name, __func__);
 
     return next;
 }
 
+void KVWorkerClient::WriteSampleArgs(KVChannel* channel, uint64* offset,
+                                     void* entity, uint64 size) {
+    SampleArgs* args = static_cast<SampleArgs*>(entity);
+
+    pid_t pid = getpid();
+    channel->Push(offset, reinterpret_cast<char*>(&pid), sizeof(pid_t));
+    channel->Push(offset, reinterpret_cast<char*>(&args->opid), sizeof(args->opid));
+    channel->Push(offset, reinterpret_cast<char*>(&args->sampleSize),
+                  sizeof(args->sampleSize));
+}
+
+bool KVWorkerClient::Sample(KVWorkerId workerId, SampleArgs* args) {
+    KVMessage sendmsg = SimpleMessage(KVOpSample, workerId, MyDatabaseId);
+    sendmsg.ety = args;
+    sendmsg.hdr.etySize = sizeof(pid_t) + sizeof(args->opid) +
+                          sizeof(args->sampleSize);
+    sendmsg.writeFunc = WriteSampleArgs;
+
+    return RecvBatch(workerId, args->opid, sendmsg, args->buf, args->bufLen,
+                     &args->rowCount);
+}
+
+void KVWorkerClient::WriteSplitArgs(KVChannel* channel, uint64* offset,
+                                    void* entity, uint64 size) {
+    SplitArgs* args = static_cast<SplitArgs*>(entity);
+
+    channel->Push(offset, reinterpret_cast<char*>(&args->maxSplits),
+                  sizeof(args->maxSplits));
+    WriteScanBounds(channel, offset, args->bounds);
+}
+
+void KVWorkerClient::Split(KVWorkerId workerId, SplitArgs* args) {
+    KVMessage sendmsg = SimpleMessage(KVOpSplit, workerId, MyDatabaseId);
+    sendmsg.ety = args;
+    sendmsg.hdr.etySize = sizeof(args->maxSplits) + ScanBoundsSize(args->bounds);
+    sendmsg.writeFunc = WriteSplitArgs;
+
+    KVMessage recvmsg;
+    uint32 channel = queue_->LeaseResponseChannel();
+    sendmsg.hdr.rpsId = channel;
+    recvmsg.hdr.rpsId = channel;
+    queue_->Send(sendmsg);
+    queue_->Recv(recvmsg, MSGHEADER);
+
+    *(args->bufLen) = recvmsg.hdr.etySize;
+    *(args->buf) = static_cast<char*>(palloc0(*(args->bufLen) + 1));
+    recvmsg.ety = *(args->buf);
+    recvmsg.readFunc = CommonReadEntity;
+    queue_->Recv(recvmsg, MSGENTITY);
+    queue_->UnleaseResponseChannel(channel);
+}
+
+void KVWorkerClient::WriteAggregateArgs(KVChannel* channel, uint64* offset,
+                                        void* entity, uint64 size) {
+    AggregateArgs* args = static_cast<AggregateArgs*>(entity);
+
+    /* the aggregates stay aligned after the count */
+    channel->Push(offset, reinterpret_cast<char*>(&args->aggCount),
+                  sizeof(args->aggCount));
+    channel->Push(offset, reinterpret_cast<char*>(args->aggs),
+                  args->aggCount * sizeof(KVAggregate));
+    channel->Push(offset, reinterpret_cast<char*>(&args->estimate),
+                  sizeof(args->estimate));
+}
+
+bool KVWorkerClient::Aggregate(KVWorkerId workerId, AggregateArgs* args) {
+    KVMessage sendmsg = SimpleMessage(KVOpAggregate, workerId, MyDatabaseId);
+    sendmsg.ety = args;
+    sendmsg.hdr.etySize = sizeof(args->aggCount) +
+        args->aggCount * sizeof(KVAggregate) + sizeof(args->estimate);
+    sendmsg.writeFunc = WriteAggregateArgs;
+
+    KVMessage recvmsg;
+    uint32 channel = queue_->LeaseResponseChannel();
+    sendmsg.hdr.rpsId = channel;
+    recvmsg.hdr.rpsId = channel;
+    queue_->Send(sendmsg);
+    queue_->Recv(recvmsg, MSGHEADER);
+
+    *(args->bufLen) = recvmsg.hdr.etySize;
+    *(args->buf) = static_cast<char*>(palloc0(*(args->bufLen) + 1));
+    recvmsg.ety = *(args->buf);
+    recvmsg.readFunc = CommonReadEntity;
+    queue_->Recv(recvmsg, MSGENTITY);
+    queue_->UnleaseResponseChannel(channel);
+
+    return recvmsg.hdr.status == KVStatusSuccess;
+}
+
 void KVWorkerClient::WriteDelCursorArgs(KVChannel* channel, uint64* offset,
                                         void* entity, uint64 size) {
     CloseCursorArgs* args = static_cast<CloseCursorArgs*>(entity);
@@ -629,17 +1629,13 @@ void KVWorkerClient::WriteDelCursorArgs(KVChannel* channel, uint64* offset,
 }
 
 void KVWorkerClient::CloseCursor(KVWorkerId workerId, CloseCursorArgs* args) {
-    if (args->buf) {
-        Munmap(args->buf, READBATCHSIZE, __func__);
+    /* the worker owns the shared memory and unlinks it with the cursor */
+    auto it = buffers_.find(args->opid);
+    if (it != buffers_.end()) {
+        Munmap(it->second.shm, it->second.capacity, __func__);
+        buffers_.erase(it);
     }
 
-    char  name[MAXPATHLENGTH];
-    pid_t pid = getpid();
-
-    snprintf(name, MAXPATHLENGTH, "%s%d%d%lu", READBATCHPATH, pid, workerId,
-             args->opid);
-    ShmUnlink(name, __func__);
-
     KVMessage sendmsg = SimpleMessage(KVOpDelCursor, workerId, MyDatabaseId);
     sendmsg.ety = args;
     sendmsg.hdr.etySize = sizeof(pid_t) + sizeof(args->opid);
@@ -683,10 +1679,6 @@ void KVWorkerClient::WriteRangeQueryArgs(KVChannel* channel, uint64* offset,
 }
 
 bool KVWorkerClient::RangeQuery(KVWorkerId workerId, RangeQueryArgs* args) {
-    if (*(args->buf) && *(args->bufLen) > 0) {
-        Munmap(*(args->buf), *(args->bufLen), __func__);
-    }
-
     KVMessage sendmsg = SimpleMessage(KVOpRangeQuery, workerId, MyDatabaseId);
     sendmsg.ety = args;
     sendmsg.hdr.etySize = sizeof(pid_t) + sizeof(args->opid);
@@ -701,38 +1693,53 @@ bool KVWorkerClient::RangeQuery(KVWorkerId workerId, RangeQueryArgs* args) {
     }
     sendmsg.writeFunc = WriteRangeQueryArgs;
 
-    char buf[sizeof(bool) + sizeof(uint64)];
+    char buf[KVERRORSIZE];  /* the state, or the cause of a failure */
     KVMessage recvmsg;
     recvmsg.ety = buf;
     recvmsg.readFunc = CommonReadEntity;
     queue_->SendWithResponse(sendmsg, recvmsg);
 
     if (recvmsg.hdr.status != KVStatusSuccess) {
-        return false;
+        ereport(ERROR, errmsg("kv worker failed to query a range: %s",
+                              recvmsg.hdr.etySize > 0 ? buf : "unknown"));
     }
 
     bool next = *reinterpret_cast<bool*>(buf);
-    *(args->bufLen) = *reinterpret_cast<uint64*>(buf + sizeof(next));
-    if (*(args->bufLen) == 0) {
-        *(args->buf) = nullptr;
-    } else {
+    char* current = buf + sizeof(next);
+    *(args->bufLen) = *reinterpret_cast<uint64*>(current);
+    current += sizeof(uint64);
+    uint64 capacity = *reinterpret_cast<uint64*>(current);
+    current += sizeof(uint64);
+    uint64 batchOffset = *reinterpret_cast<uint64*>(current);
+
+    /* remap only when the worker has enlarged the segment */
+    auto it = buffers_.find(args->opid);
+    if (it == buffers_.end() || it->second.capacity != capacity) {
         char  name[MAXPATHLENGTH];
         pid_t pid = getpid();
 
+        if (it != buffers_.end()) {
+            Munmap(it->second.shm, it->second.capacity, __func__);
+            buffers_.erase(it);
+        }
+
         snprintf(name, MAXPATHLENGTH, "%s%d%d%lu", RANGEQUERYPATH, pid,
                  workerId, args->opid);
-        int fd = ShmOpen(name, O_RDWR, 0777, __func__);
-        *(args->buf) = static_cast<char*>(Mmap(nullptr, *(args->bufLen),
-            PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0, __func__));
-        Fclose(fd, __func__);
+        KVCursorBuffer buffer;
+        buffer.capacity = capacity;
+        buffer.shm = MapCursorShm(name, buffer.capacity, false);
+        it = buffers_.insert({args->opid, buffer}).first;
     }
+    *(args->buf) = it->second.shm + batchOffset;
 
     return next;
 }
 
 void KVWorkerClient::ClearRangeQuery(KVWorkerId workerId, RangeQueryArgs* args) {
-    if (*(args->buf) && *(args->bufLen) > 0) {
-        Munmap(*(args->buf), *(args->bufLen), __func__);
+    auto it = buffers_.find(args->opid);
+    if (it != buffers_.end()) {
+        Munmap(it->second.shm, it->second.capacity, __func__);
+        buffers_.erase(it);
     }
 
     KVMessage sendmsg = SimpleMessage(KVOpClearRangeQuery, workerId, MyDatabaseId);
@@ -743,12 +1750,65 @@ void KVWorkerClient::ClearRangeQuery(KVWorkerId workerId, RangeQueryArgs* args)
 
     queue_->Send(sendmsg);
 }
+#else
+bool KVWorkerClient::Ingest(KVWorkerId workerId, IngestArgs* args) {
+    KVMessage sendmsg = SimpleMessage(KVOpIngest, workerId, MyDatabaseId);
+    sendmsg.ety = args->path;
+    sendmsg.hdr.etySize = strlen(args->path) + 1;
+    sendmsg.writeFunc = CommonWriteEntity;
+
+    args->error[0] = '\0';
+    KVMessage recvmsg;
+    recvmsg.ety = args->error;
+    recvmsg.readFunc = CommonReadEntity;
+    queue_->SendWithResponse(sendmsg, recvmsg);
+
+    return recvmsg.hdr.status == KVStatusSuccess;
+}
+
+bool KVWorkerClient::Drop(KVWorkerId workerId, DropArgs* args) {
+    KVMessage sendmsg = SimpleMessage(KVOpDrop, workerId, MyDatabaseId);
+    sendmsg.ety = args->path;
+    sendmsg.hdr.etySize = strlen(args->path) + 1;
+    sendmsg.writeFunc = CommonWriteEntity;
+
+    KVMessage recvmsg;
+    queue_->SendWithResponse(sendmsg, recvmsg);
+
+    return recvmsg.hdr.status == KVStatusSuccess;
+}
 #endif
 
 void KVWorkerClient::Terminate(KVWorkerId workerId) {
     queue_->Send(SimpleMessage(KVOpTerminate, workerId, MyDatabaseId));
 }
 
+/* the write sequence of the relation published by the worker, see KVWriteSeq */
+bool KVWorkerClient::WriteSeq(KVRelationId relId, uint64* seq) {
+    return KVWriteSeq(stats_, workerId_, relId, seq);
+}
+
+
+/*
+ * Implementation for idle kv worker client
+ */
+
+KVIdleWorkerClient::KVIdleWorkerClient(KVWorkerId slotId) {
+    queue_ = new KVMessageQueue(slotId, IDLEWORKER, false);
+}
+
+KVIdleWorkerClient::~KVIdleWorkerClient() {
+    delete queue_;
+}
+
+void KVIdleWorkerClient::Bind(KVWorkerId workerId, KVDatabaseId dbId) {
+    queue_->Send(SimpleMessage(KVOpLaunch, workerId, dbId));
+}
+
+void KVIdleWorkerClient::Terminate() {
+    queue_->Send(SimpleMessage(KVOpTerminate, InvalidOid, InvalidOid));
+}
+
 
 /*
  * Start kv worker and begin to accept and handle requets.
@@ -760,8 +1820,8 @@ static void KVWorkerDo(KVWorkerId workerId, KVDatabaseId dbId) {
     KVManagerClient* manager = new KVManagerClient();
 
     worker->Start();
-    /* notify ready event */
-    manager->Notify(WorkerReady);
+    /* tell kv manager to answer the backends waiting for the launch */
+    manager->Ready(workerId, dbId);
 
     worker->Run();
 
@@ -772,6 +1832,34 @@ static void KVWorkerDo(KVWorkerId workerId, KVDatabaseId dbId) {
     delete manager;
 }
 
+/*
+ * Wait until kv manager binds the idle kv worker to a relation, which happens
+ * before its database is known, so the connection is made only afterwards.
+ * Return false if it is terminated instead.
+ */
+static bool KVIdleWorkerDo(KVWorkerId slotId, KVWorkerId* workerId,
+                           KVDatabaseId* dbId) {
+    KVMessageQueue* queue = new KVMessageQueue(slotId, IDLEWORKER, true);
+    KVManagerClient* manager = new KVManagerClient();
+    manager->Ready(slotId, InvalidOid);
+
+    KVMessage msg;
+    queue->Recv(msg);
+    delete queue;
+
+    bool bound = msg.hdr.op == KVOpLaunch;
+    if (bound) {
+        *workerId = msg.hdr.relId;
+        *dbId = msg.hdr.dbId;
+    } else {
+        /* notify destroyed event */
+        manager->Notify(WorkerDesty);
+    }
+
+    delete manager;
+    return bound;
+}
+
 /*
  * Entrypoint for kv worker
  */
@@ -779,6 +1867,10 @@ extern "C" void KVWorkerMain(Datum arg) {
     KVDatabaseId dbId = (KVDatabaseId) DatumGetObjectId(arg);
     KVWorkerId workerId = *reinterpret_cast<KVWorkerId*>(MyBgworkerEntry->bgw_extra);
 
+    if (dbId == InvalidOid && !KVIdleWorkerDo(workerId, &workerId, &dbId)) {
+        return;
+    }
+
     /* Connect to our database */
     BackgroundWorkerInitializeConnectionByOid(dbId, InvalidOid, 0);
 
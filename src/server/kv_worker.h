@@ -17,12 +17,21 @@
 #define KV_WORKER_H_
 
 
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
 #include <unordered_map>
+#include <vector>
 using namespace std;
 
 #include "ipc/kv_mq.h"
 
 
+#define READBATCHSLOTS 2  /* batches of a cursor in flight */
+
+
+/* with an invalid database, the worker is an idle one of the given slot */
 extern void* LaunchKVWorker(KVWorkerId workerId, KVDatabaseId dbId);
 
 
@@ -41,18 +50,42 @@ class KVWorker {
     void Stop();
 
   private:
+    struct KVTaskQueue {
+        mutex              mtx;
+        condition_variable cond;
+        deque<KVMessage>   tasks;
+        bool               stop = false;
+    };
+
+    void Process(KVMessage& msg);
+    void Submit(KVMessage& msg);
+    void RunThread(KVTaskQueue* queue);
+    void CopyEngineStats();
+
     void Open(KVMessage& msg);
     void Close(KVMessage& msg);
     void Count(KVMessage& msg);
     void Put(KVMessage& msg);
+    void PutBatch(KVMessage& msg);
     void Get(KVMessage& msg);
     void Delete(KVMessage& msg);
+    void DeleteBatch(KVMessage& msg);
+    void DeleteRange(KVMessage& msg);
+    void Truncate(KVMessage& msg);
     void Load(KVMessage& msg);
+    void Sync(KVMessage& msg);
     void ReadBatch(KVMessage& msg);
+    void MultiGet(KVMessage& msg);
+    void Sample(KVMessage& msg);
+    void Split(KVMessage& msg);
+    void Aggregate(KVMessage& msg);
     void CloseCursor(KVMessage& msg);
     #ifdef VIDARDB
     void RangeQuery(KVMessage& msg);
     void ClearRangeQuery(KVMessage& msg);
+    #else
+    void Ingest(KVMessage& msg);
+    void Drop(KVMessage& msg);
     #endif
     void Terminate(KVMessage& msg);
 
@@ -64,6 +97,10 @@ class KVWorker {
     struct ReadBatchState {
         bool   next;        /* have next batch? */
         uint64 size;        /* current batch size */
+        uint64 capacity;    /* capacity of the cursor's shared memory */
+        uint64 offset;      /* where current batch starts in shared memory */
+        uint64 rows;        /* rows of the table scanned by a sample */
+        char*  record;      /* a batch sent in the response, not in a slot */
     };
 
     struct KVCursorKey {
@@ -81,20 +118,88 @@ class KVWorker {
         }
     };
 
-    unordered_map<KVCursorKey, void*, KVCursorKeyHashFunc> cursors_;
+    /*
+     * The shared memory of a cursor lives as long as the cursor itself and is
+     * refilled by every batch, hence it is mapped only once by both sides.
+     * It is split into READBATCHSLOTS slots: the backend decodes one slot
+     * while the worker reads ahead into the others. A record larger than a
+     * slot takes a slot of no data and is sent in the response instead, and
+     * nothing is read ahead until it is sent.
+     */
+    struct KVCursorEntry {
+        void*  conn     = nullptr;
+        void*  iter     = nullptr;
+        char*  shm      = nullptr;
+        uint32 head     = 0;       /* next filled slot to hand out */
+        uint32 filled   = 0;       /* slots filled but not handed out yet */
+        bool   more     = true;    /* iterator not exhausted yet */
+        uint64 rows     = 0;       /* rows scanned by a sample */
+        bool   large    = false;   /* the last filled slot is BatchLargeRecord */
+        uint64 sizes[READBATCHSLOTS];
+    };
+    unordered_map<KVCursorKey, KVCursorEntry, KVCursorKeyHashFunc> cursors_;
 
     #ifdef VIDARDB
     struct KVRangeQueryEntry {
-        void* readOpts = nullptr;
-        void* range    = nullptr;
+        void*  conn     = nullptr;
+        void*  readOpts = nullptr;
+        void*  range    = nullptr;
+        char*  shm      = nullptr;
+        uint64 capacity = 0;    /* only grows, see RangeQuery */
+        void*  result   = nullptr; /* batch read ahead, not copied yet */
+        uint64 size     = 0;
+        bool   next     = true;
+        bool   ready    = false;   /* is result read ahead? */
     };
     unordered_map<KVCursorKey, KVRangeQueryEntry, KVCursorKeyHashFunc> ranges_;
     #endif
 
+    void FillBatch(KVCursorEntry* entry);
+    void SendBatch(KVMessage& msg, KVCursorEntry* entry);
+    KVCursorEntry* AddCursor(KVMessage& msg, const KVCursorKey& key,
+                             void* iter, char* error);
+    void SendFailure(KVMessage& msg, const char* error);
+    #ifdef VIDARDB
+    void FillRangeQuery(KVRangeQueryEntry* entry);
+    #endif
+
+    /*
+     * Connections of the tables, keyed by relation. A worker hosts one table,
+     * or all the tables of its database with the shared storage.
+     */
+    struct KVConnEntry {
+        void*  conn = nullptr;
+        uint64 ref  = 0;
+    };
+    unordered_map<KVRelationId, KVConnEntry> conns_;
+    void* GetConn(KVRelationId relId);
+
+    /*
+     * Failed writes which the backend did not wait for, keyed by backend and
+     * relation, until the backend asks for them by a sync or exits.
+     */
+    unordered_map<uint64, uint64> writeErrors_;
+    void AddWriteError(const KVMessageHeader& hdr);
+    void ClearWriteErrors();
+
+    mutex connMutex_;    /* protects conns_ */
+    mutex cursorMutex_;  /* protects cursors_ and ranges_ */
+    mutex errorMutex_;   /* protects writeErrors_ */
+    vector<KVTaskQueue*> tasks_;  /* one task queue per thread */
+    vector<thread> threads_;
+
     KVMessageQueue* queue_;
     bool running_;
-    void* conn_;
-    uint64 ref_;
+
+    /*
+     * The entities processed inline reuse one buffer, which only grows, since
+     * each is done before the next request is received. Those submitted to
+     * the threads are allocated until they are processed.
+     */
+    vector<char> entity_;
+
+    KVWorkerStats* stats_;  /* nullptr if there is no free slot */
+    uint64 engineTime_ = 0; /* when the engine statistics were copied */
 };
 
 
@@ -112,24 +217,50 @@ class KVWorkerClient {
     void   Close(KVWorkerId workerId);
     uint64 Count(KVWorkerId workerId);
     bool   Put(KVWorkerId workerId, PutArgs* args);
+    bool   PutBatch(KVWorkerId workerId, PutBatchArgs* args);
     bool   Get(KVWorkerId workerId, GetArgs* args);
     bool   Delete(KVWorkerId workerId, DeleteArgs* args);
+    bool   DeleteBatch(KVWorkerId workerId, DeleteBatchArgs* args);
+    bool   DeleteRange(KVWorkerId workerId, DeleteRangeArgs* args);
+    bool   Truncate(KVWorkerId workerId);
     void   Load(KVWorkerId workerId, PutArgs* args);
+    uint64 Sync(KVWorkerId workerId, bool wait);
     bool   ReadBatch(KVWorkerId workerId, ReadBatchArgs* args);
+    bool   MultiGet(KVWorkerId workerId, MultiGetArgs* args);
+    bool   Sample(KVWorkerId workerId, SampleArgs* args);
+    void   Split(KVWorkerId workerId, SplitArgs* args);
+    bool   Aggregate(KVWorkerId workerId, AggregateArgs* args);
     void   CloseCursor(KVWorkerId workerId, CloseCursorArgs* args);
     #ifdef VIDARDB
     bool   RangeQuery(KVWorkerId workerId, RangeQueryArgs* args);
     void   ClearRangeQuery(KVWorkerId workerId, RangeQueryArgs* args);
+    #else
+    bool   Ingest(KVWorkerId workerId, IngestArgs* args);
+    bool   Drop(KVWorkerId workerId, DropArgs* args);
     #endif
     void   Terminate(KVWorkerId workerId);
+    bool   WriteSeq(KVRelationId relId, uint64* seq);
 
   private:
+    bool WriteBatch(KVOperation op, KVWorkerId workerId, char* buf,
+                    uint64 bufLen, bool pipelined);
+
     static void WriteOpenArgs(KVChannel* channel, uint64* offset, void* entity,
                               uint64 size);
     static void WritePutArgs(KVChannel* channel, uint64* offset, void* entity,
                              uint64 size);
+    static void WriteDeleteRangeArgs(KVChannel* channel, uint64* offset,
+                                     void* entity, uint64 size);
     static void WriteReadBatchArgs(KVChannel* channel, uint64* offset,
                                    void* entity, uint64 size);
+    static void WriteMultiGetArgs(KVChannel* channel, uint64* offset,
+                                  void* entity, uint64 size);
+    static void WriteSampleArgs(KVChannel* channel, uint64* offset,
+                                void* entity, uint64 size);
+    static void WriteSplitArgs(KVChannel* channel, uint64* offset,
+                               void* entity, uint64 size);
+    static void WriteAggregateArgs(KVChannel* channel, uint64* offset,
+                                   void* entity, uint64 size);
     static void WriteDelCursorArgs(KVChannel* channel, uint64* offset,
                                    void* entity, uint64 size);
     #ifdef VIDARDB
@@ -137,7 +268,20 @@ class KVWorkerClient {
                                     void* entity, uint64 size);
     #endif
 
+    /* mapped cursor shared memory of this backend, keyed by operation id */
+    struct KVCursorBuffer {
+        char*  shm;
+        uint64 capacity;
+        string large;  /* the last batch if it came in the response */
+    };
+    unordered_map<KVOpId, KVCursorBuffer> buffers_;
+
+    bool RecvBatch(KVWorkerId workerId, KVOpId opid, KVMessage& sendmsg,
+                   char** batch, uint64* batchLen, uint64* rows = nullptr);
+
     KVMessageQueue* queue_;
+    KVWorkerId workerId_;
+    KVWorkerStats* stats_;  /* nullptr if the worker has no slot */
 };
 
 struct BackgroundWorkerHandle;
@@ -154,4 +298,34 @@ struct KVWorkerHandle {
     ~KVWorkerHandle() { delete client; }
 };
 
+/*
+ * A stub of an idle kv worker, through which kv manager binds it to a relation
+ * or terminates it. Slot ids are below FirstNormalObjectId, so they never clash
+ * with the relations of the kv workers. A kv worker of the shared storage is
+ * the one of its database, whose oid might be below it, but idle workers are
+ * kept apart from the others by their invalid database.
+ */
+
+class KVIdleWorkerClient {
+  public:
+    KVIdleWorkerClient(KVWorkerId slotId);
+    ~KVIdleWorkerClient();
+
+    void Bind(KVWorkerId workerId, KVDatabaseId dbId);
+    void Terminate();
+
+  private:
+    KVMessageQueue* queue_;
+};
+
+struct KVIdleWorkerHandle {
+    KVWorkerId              slotId;
+    KVIdleWorkerClient*     client;  /* set once the idle worker is ready */
+    BackgroundWorkerHandle* handle;
+
+    KVIdleWorkerHandle(KVWorkerId slotId, BackgroundWorkerHandle* handle) :
+        slotId(slotId), client(nullptr), handle(handle) {}
+    ~KVIdleWorkerHandle() { delete client; }
+};
+
 #endif  /* KV_WORKER_H_ */